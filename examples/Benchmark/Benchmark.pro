@@ -0,0 +1,25 @@
+#-------------------------------------------------
+#
+# Micro benchmarks for the QsrMail hot paths
+#
+#-------------------------------------------------
+
+QT       += core network
+QT       -= gui
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET = Benchmark
+TEMPLATE = app
+
+# uncomment the following line for static linking
+#CONFIG += qsrmail_static
+include(../../qsrmail.pri)
+
+SOURCES += main.cpp \
+    benchmark.cpp \
+    smtpsink.cpp
+
+HEADERS  += benchmark.h \
+    smtpsink.h
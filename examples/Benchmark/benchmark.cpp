@@ -0,0 +1,319 @@
+#include "benchmark.h"
+
+#include <QsrMailAddress>
+#include <QsrMailBase64Encoder>
+#include <QsrMailBodyPart>
+#include <QsrMailMimeMultipart>
+#include <QsrMailMimePart>
+#include <QsrMailQpEncoder>
+#include <QsrMailTransaction>
+
+#include <QBuffer>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QHostAddress>
+#include <QSslConfiguration>
+#include <QStringList>
+#include <QTextStream>
+
+/* size of the reads from the encoders */
+#define READ_SIZE (64*1024)
+
+Benchmark::Benchmark(QObject *parent) :
+    QObject(parent),
+    mMinimumTime(500),
+    mMessageCount(1000)
+{
+    mSink.listen(QHostAddress::LocalHost);
+}
+
+void Benchmark::setMinimumTime(int msecs)
+{
+    mMinimumTime = qMax(1, msecs);
+}
+
+int Benchmark::minimumTime() const
+{
+    return mMinimumTime;
+}
+
+void Benchmark::setMessageCount(int count)
+{
+    mMessageCount = qMax(1, count);
+}
+
+int Benchmark::messageCount() const
+{
+    return mMessageCount;
+}
+
+bool Benchmark::setCertificate(const QString &certFile,
+                               const QString &keyFile)
+{
+    return mSink.setCertificate(certFile, keyFile);
+}
+
+/* -------------------------------------------------------------------------- */
+
+void Benchmark::runEncoders()
+{
+    static const int sizes[] = { 1024, 64*1024, 1024*1024, 16*1024*1024 };
+    static const int widths[] = { 76, 998 };
+
+    for (unsigned i=0; i<sizeof(sizes)/sizeof(sizes[0]); ++i) {
+        const QByteArray binary(randomData(sizes[i]));
+        const QByteArray text(textData(sizes[i]));
+
+        for (unsigned j=0; j<sizeof(widths)/sizeof(widths[0]); ++j) {
+            encoderCase<QsrMailBase64Encoder>("base64", binary, widths[j]);
+            encoderCase<QsrMailQpEncoder>("qp/text", text, widths[j]);
+            encoderCase<QsrMailQpEncoder>("qp/binary", binary, widths[j]);
+        }
+    }
+}
+
+template <class Encoder>
+void Benchmark::encoderCase(const char *name, const QByteArray &input,
+                            int lineWidth)
+{
+    QByteArray buffer(READ_SIZE, Qt::Uninitialized);
+    qint64 bytes = 0;
+    qint64 encoded = 0;
+    QElapsedTimer timer;
+
+    timer.start();
+    do {
+        QBuffer source;
+        source.setData(input);
+
+        Encoder encoder(&source);
+        encoder.setLineWidth(lineWidth);
+        if (!encoder.open(QIODevice::ReadOnly))
+            return;
+
+        qint64 read;
+        while ((read = encoder.read(buffer.data(), buffer.size())) > 0)
+            encoded += read;
+
+        bytes += input.size();
+    } while (timer.elapsed() < mMinimumTime);
+
+    const double secs = timer.nsecsElapsed() / 1e9;
+    report(QString("%1 %2 width=%3").arg(name).arg(sizeName(input.size()))
+           .arg(lineWidth),
+           QString("%1 MB/s in, %2 MB/s out")
+           .arg(bytes / secs / 1e6, 0, 'f', 1)
+           .arg(encoded / secs / 1e6, 0, 'f', 1));
+}
+
+/* -------------------------------------------------------------------------- */
+
+void Benchmark::runHeaders()
+{
+    static const int counts[] = { 8, 32, 128 };
+
+    for (unsigned i=0; i<sizeof(counts)/sizeof(counts[0]); ++i) {
+        QList<QByteArray> names;
+        for (int j=0; j<counts[i]; ++j)
+            names.append("X-Benchmark-" + QByteArray::number(j));
+        const QByteArray value("a header value which is long enough to "
+                               "be realistic but does not need folding");
+
+        qint64 ops = 0;
+        QElapsedTimer timer;
+        timer.start();
+        do {
+            QsrMailMessage message;
+            foreach (const QByteArray &name, names)
+                message.appendRawHeader(name, value);
+            foreach (const QByteArray &name, names)
+                message.setRawHeader(name, value);
+            foreach (const QByteArray &name, names)
+                message.rawHeader(name);
+            ops += names.size() * 3;
+        } while (timer.elapsed() < mMinimumTime);
+
+        const double secs = timer.nsecsElapsed() / 1e9;
+        report(QString("headers append/set/get n=%1").arg(counts[i]),
+               QString("%1 Mops/s").arg(ops / secs / 1e6, 0, 'f', 2));
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+void Benchmark::runAddresses()
+{
+    QStringList items;
+    for (int i=0; i<10000; ++i) {
+        if (i % 2)
+            items.append(QString("user%1@example.com").arg(i));
+        else
+            items.append(QString("\"User, %1\" <user%1@Example.COM>").arg(i));
+    }
+    const QString list(items.join(", "));
+
+    qint64 addresses = 0;
+    QElapsedTimer timer;
+    timer.start();
+    do {
+        const QList<QsrMailAddress> parsed(QsrMailAddress::parseList(list));
+        foreach (const QsrMailAddress &address, parsed)
+            address.toByteArray();
+        addresses += parsed.size();
+    } while (timer.elapsed() < mMinimumTime);
+
+    const double secs = timer.nsecsElapsed() / 1e9;
+    report("addresses parse/encode n=10000",
+           QString("%1 k addresses/s").arg(addresses / secs / 1e3, 0, 'f', 1));
+}
+
+/* -------------------------------------------------------------------------- */
+
+void Benchmark::runTransport()
+{
+    const QsrMailAddress from("sender@example.com");
+    const QsrMailAddress to("recipient@example.com", "Recipient");
+
+    /* plain text message */
+    QsrMailMessage text;
+    text.setFrom(from);
+    text.setTo(to);
+    text.setSubject("Benchmark text message");
+    text.setBody(QsrMailBodyPart::fromRawData(textData(2*1024)));
+
+    /* text and html alternatives */
+    QsrMailMessage alternative(text);
+    alternative.setSubject("Benchmark alternative message");
+    QsrMailMimeMultipart parts(QsrMailMimeMultipart::AlternativeType);
+    parts.append(QsrMailMimePart::fromRawData("body.txt", textData(4*1024)));
+    parts.append(QsrMailMimePart::fromRawData("body.html",
+                                              "<html><body><p>"
+                                              + textData(8*1024)
+                                              + "</p></body></html>"));
+    alternative.setBody(parts);
+
+    /* text with a binary attachment */
+    QsrMailMessage attachment(text);
+    attachment.setSubject("Benchmark attachment message");
+    QsrMailMimeMultipart mixed(QsrMailMimeMultipart::MixedType);
+    mixed.append(QsrMailMimePart::fromRawData("body.txt", textData(2*1024)));
+    mixed.append(QsrMailMimePart::fromRawData("data.bin",
+                                              randomData(1024*1024)));
+    attachment.setBody(mixed);
+
+    QList<QsrMailTransport::TlsLevel> levels;
+    levels << QsrMailTransport::TlsDisabled;
+    if (mSink.hasCertificate())
+        levels << QsrMailTransport::TlsRequired;
+    else
+        report("transport tls", "skipped, no --cert/--key given");
+
+    foreach (QsrMailTransport::TlsLevel level, levels) {
+        const QString tls(level == QsrMailTransport::TlsDisabled
+                          ? "plain" : "tls");
+        for (int threaded=0; threaded<2; ++threaded) {
+            const QString mode(tls + (threaded ? "/threaded" : ""));
+            transportCase("transport " + mode + " text", text,
+                          mMessageCount, level, threaded);
+            transportCase("transport " + mode + " alternative", alternative,
+                          mMessageCount, level, threaded);
+            transportCase("transport " + mode + " attachment", attachment,
+                          qMax(1, mMessageCount / 10), level, threaded);
+        }
+    }
+}
+
+void Benchmark::transportCase(const QString &name,
+                              const QsrMailMessage &message, int count,
+                              QsrMailTransport::TlsLevel level, bool threaded)
+{
+    QsrMailTransport transport;
+    transport.setAuthMech(QsrMailTransport::DisabledMech);
+    transport.setTlsLevel(level);
+    transport.setThreadedRendering(threaded);
+    if (level != QsrMailTransport::TlsDisabled) {
+        QSslConfiguration config(QSslConfiguration::defaultConfiguration());
+        config.setPeerVerifyMode(QSslSocket::VerifyNone);
+        transport.setSslConfiguration(config);
+    }
+
+    QList<QsrMailTransaction *> transactions;
+    for (int i=0; i<count; ++i)
+        transactions.append(transport.queueMessage(message));
+
+    const qint64 messages = mSink.messages();
+    const qint64 bytes = mSink.bytes();
+
+    QEventLoop loop;
+    connect(&transport, SIGNAL(finished()), &loop, SLOT(quit()));
+
+    QElapsedTimer timer;
+    timer.start();
+    transport.sendMessages(QHostAddress(QHostAddress::LocalHost),
+                           mSink.serverPort());
+    loop.exec();
+    const double secs = timer.nsecsElapsed() / 1e9;
+
+    int failed = 0;
+    foreach (QsrMailTransaction *transaction, transactions) {
+        if (transaction->error() != QsrMailTransaction::NoError)
+            failed++;
+    }
+    qDeleteAll(transactions);
+
+    QString result(QString("%1 msgs/s, %2 MB/s")
+                   .arg((mSink.messages() - messages) / secs, 0, 'f', 0)
+                   .arg((mSink.bytes() - bytes) / secs / 1e6, 0, 'f', 1));
+    if (failed > 0)
+        result += QString(" (%1 failed)").arg(failed);
+    report(name, result);
+}
+
+/* -------------------------------------------------------------------------- */
+
+QByteArray Benchmark::randomData(int size)
+{
+    QByteArray data(size, Qt::Uninitialized);
+    quint32 seed = 0x9e3779b9u;
+    for (int i=0; i<size; ++i) {
+        /* xorshift, reproducible between runs */
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        data[i] = static_cast<char>(seed);
+    }
+
+    return data;
+}
+
+QByteArray Benchmark::textData(int size)
+{
+    static const char words[] =
+            "Lorem ipsum dolor sit amet, consetetur sadipscing elitr, sed "
+            "diam nonumy eirmod tempor invidunt ut labore et dolore magna "
+            "aliquyam erat. Grüße aus Köln, naïve café.\r\n";
+    const int length = sizeof(words) - 1;
+
+    QByteArray data;
+    data.reserve(size + length);
+    while (data.size() < size)
+        data.append(words, length);
+    data.truncate(size);
+
+    return data;
+}
+
+QString Benchmark::sizeName(int size)
+{
+    if (size >= 1024*1024)
+        return QString("%1M").arg(size / (1024*1024));
+    if (size >= 1024)
+        return QString("%1k").arg(size / 1024);
+    return QString::number(size);
+}
+
+void Benchmark::report(const QString &name, const QString &result)
+{
+    QTextStream out(stdout);
+    out << name.leftJustified(44) << result << "\n";
+}
@@ -0,0 +1,51 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QObject>
+#include <QsrMailMessage>
+#include <QsrMailTransport>
+
+#include "smtpsink.h"
+
+/* Runs the benchmark suites and prints one result line per case. Every
+ * case is repeated until it ran for at least minimumTime() milliseconds.
+ */
+class Benchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Benchmark(QObject *parent = 0);
+
+    void setMinimumTime(int msecs);
+    int minimumTime() const;
+
+    void setMessageCount(int count);
+    int messageCount() const;
+
+    bool setCertificate(const QString &certFile, const QString &keyFile);
+
+    void runEncoders();
+    void runHeaders();
+    void runAddresses();
+    void runTransport();
+
+private:
+    template <class Encoder>
+    void encoderCase(const char *name, const QByteArray &input,
+                     int lineWidth);
+    void transportCase(const QString &name, const QsrMailMessage &message,
+                       int count, QsrMailTransport::TlsLevel level,
+                       bool threaded);
+
+    static QByteArray randomData(int size);
+    static QByteArray textData(int size);
+    static QString sizeName(int size);
+    static void report(const QString &name, const QString &result);
+
+    SmtpSink mSink;
+    int mMinimumTime;
+    int mMessageCount;
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,66 @@
+#include "benchmark.h"
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QTextStream>
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setApplicationName("Benchmark");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Micro benchmarks for QsrMail");
+    parser.addHelpOption();
+    parser.addPositionalArgument("suites", "Suites to run: encoders, "
+                                 "headers, addresses, transport "
+                                 "(default: all)");
+
+    QCommandLineOption timeOption("time", "Minimum run time of every case "
+                                  "in milliseconds.", "msecs", "500");
+    QCommandLineOption countOption("messages", "Messages per transport "
+                                   "case.", "count", "1000");
+    QCommandLineOption certOption("cert", "PEM certificate for the TLS "
+                                  "transport cases.", "file");
+    QCommandLineOption keyOption("key", "PEM private key for the TLS "
+                                 "transport cases.", "file");
+    parser.addOption(timeOption);
+    parser.addOption(countOption);
+    parser.addOption(certOption);
+    parser.addOption(keyOption);
+    parser.process(app);
+
+    Benchmark benchmark;
+    benchmark.setMinimumTime(parser.value(timeOption).toInt());
+    benchmark.setMessageCount(parser.value(countOption).toInt());
+
+    if (parser.isSet(certOption) || parser.isSet(keyOption)) {
+        if (!benchmark.setCertificate(parser.value(certOption),
+                                      parser.value(keyOption))) {
+            QTextStream(stderr) << "unable to load certificate or key\n";
+            return 1;
+        }
+    }
+
+    QStringList suites(parser.positionalArguments());
+    if (suites.isEmpty()) {
+        suites << "encoders" << "headers" << "addresses" << "transport";
+    }
+
+    foreach (const QString &suite, suites) {
+        if (suite == "encoders") {
+            benchmark.runEncoders();
+        } else if (suite == "headers") {
+            benchmark.runHeaders();
+        } else if (suite == "addresses") {
+            benchmark.runAddresses();
+        } else if (suite == "transport") {
+            benchmark.runTransport();
+        } else {
+            QTextStream(stderr) << "unknown suite: " << suite << "\n";
+            return 1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,193 @@
+#include "smtpsink.h"
+
+#include <QSslSocket>
+#include <QFile>
+
+SmtpSink::SmtpSink(QObject *parent) :
+    QTcpServer(parent),
+    mMessages(0),
+    mBytes(0)
+{
+}
+
+bool SmtpSink::setCertificate(const QString &certFile, const QString &keyFile)
+{
+    QFile cert(certFile);
+    QFile key(keyFile);
+    if (!cert.open(QIODevice::ReadOnly) || !key.open(QIODevice::ReadOnly))
+        return false;
+
+    mCertificate = QSslCertificate(&cert, QSsl::Pem);
+    mKey = QSslKey(&key, QSsl::Rsa, QSsl::Pem);
+    if (mKey.isNull()) {
+        key.seek(0);
+        mKey = QSslKey(&key, QSsl::Ec, QSsl::Pem);
+    }
+
+    return hasCertificate();
+}
+
+bool SmtpSink::hasCertificate() const
+{
+    return !mCertificate.isNull() && !mKey.isNull();
+}
+
+qint64 SmtpSink::messages() const
+{
+    return mMessages;
+}
+
+qint64 SmtpSink::bytes() const
+{
+    return mBytes;
+}
+
+void SmtpSink::incomingConnection(qintptr handle)
+{
+    new SmtpSinkSession(this, handle);
+}
+
+/* -------------------------------------------------------------------------- */
+
+SmtpSinkSession::SmtpSinkSession(SmtpSink *sink, qintptr handle) :
+    QObject(sink),
+    mSink(sink),
+    mSocket(new QSslSocket(this)),
+    mState(CommandState),
+    mScanPos(0),
+    mChunkLeft(0),
+    mChunkLast(false),
+    mMessageSize(0)
+{
+    connect(mSocket, SIGNAL(readyRead()), this, SLOT(readyRead()));
+    connect(mSocket, SIGNAL(disconnected()), this, SLOT(deleteLater()));
+
+    if (sink->hasCertificate()) {
+        mSocket->setLocalCertificate(sink->mCertificate);
+        mSocket->setPrivateKey(sink->mKey);
+    }
+
+    mSocket->setSocketDescriptor(handle);
+    mSocket->write("220 localhost ESMTP sink\r\n");
+}
+
+void SmtpSinkSession::readyRead()
+{
+    mBuffer += mSocket->readAll();
+
+    int pos = 0;
+    while (pos < mBuffer.size()) {
+        if (mState == DataState) {
+            /* the terminating CRLF.CRLF may span several reads */
+            int end = mBuffer.indexOf("\r\n.\r\n", qMax(pos, mScanPos - 4));
+            if (end < 0) {
+                /* keep the tail which may start the terminator */
+                const int keep = qMax(pos, mBuffer.size() - 4);
+                mMessageSize += keep - pos;
+                pos = keep;
+                mScanPos = mBuffer.size();
+                break;
+            }
+
+            mMessageSize += end + 2 - pos;
+            pos = end + 5;
+            mState = CommandState;
+            endOfMessage(mMessageSize);
+        } else if (mState == ChunkState) {
+            const int bytes = static_cast<int>(
+                        qMin<qint64>(mChunkLeft, mBuffer.size() - pos));
+            mMessageSize += bytes;
+            mChunkLeft -= bytes;
+            pos += bytes;
+
+            if (mChunkLeft == 0) {
+                mState = CommandState;
+                if (mChunkLast)
+                    endOfMessage(mMessageSize);
+                else
+                    mReplies += "250 OK\r\n";
+            }
+        } else {
+            const int end = mBuffer.indexOf("\r\n", pos);
+            if (end < 0)
+                break;
+
+            const QByteArray line(mBuffer.mid(pos, end - pos));
+            pos = end + 2;
+            if (!processCommand(line)) {
+                /* STARTTLS, everything after it is a protocol violation */
+                pos = mBuffer.size();
+                break;
+            }
+        }
+    }
+
+    /* keep only the unprocessed data */
+    mBuffer.remove(0, pos);
+    mScanPos = qMax(0, mScanPos - pos);
+
+    if (!mReplies.isEmpty()) {
+        mSocket->write(mReplies);
+        mReplies.clear();
+    }
+}
+
+bool SmtpSinkSession::processCommand(const QByteArray &line)
+{
+    const QByteArray verb(line.left(4).toUpper());
+
+    if (verb == "EHLO" || verb == "HELO") {
+        mReplies += "250-localhost\r\n"
+                    "250-PIPELINING\r\n"
+                    "250-8BITMIME\r\n"
+                    "250-CHUNKING\r\n"
+                    "250-BINARYMIME\r\n";
+        if (mSink->hasCertificate() && !mSocket->isEncrypted())
+            mReplies += "250-STARTTLS\r\n";
+        mReplies += "250 SIZE 0\r\n";
+    } else if (verb == "MAIL" || verb == "RCPT" || verb == "RSET"
+               || verb == "NOOP") {
+        mReplies += "250 OK\r\n";
+    } else if (verb == "DATA") {
+        mReplies += "354 Go ahead\r\n";
+        mState = DataState;
+        mScanPos = 0;
+        mMessageSize = 0;
+    } else if (verb == "BDAT") {
+        const QList<QByteArray> args(line.split(' '));
+        if (mMessageSize < 0)
+            mMessageSize = 0;
+        mChunkLeft = args.value(1).toLongLong();
+        mChunkLast = args.size() > 2 && args.at(2).toUpper() == "LAST";
+        mState = ChunkState;
+        if (mChunkLeft == 0) {
+            mState = CommandState;
+            if (mChunkLast)
+                endOfMessage(mMessageSize);
+            else
+                mReplies += "250 OK\r\n";
+        }
+    } else if (verb == "STAR" && mSink->hasCertificate()) {
+        mSocket->write(mReplies + "220 Ready to start TLS\r\n");
+        mReplies.clear();
+        mSocket->startServerEncryption();
+        return false;
+    } else if (verb == "QUIT") {
+        mReplies += "221 Bye\r\n";
+        mSocket->write(mReplies);
+        mReplies.clear();
+        mSocket->disconnectFromHost();
+    } else {
+        mReplies += "500 Unknown command\r\n";
+    }
+
+    return true;
+}
+
+void SmtpSinkSession::endOfMessage(qint64 size)
+{
+    mSink->mMessages++;
+    mSink->mBytes += size;
+    mMessageSize = -1;
+    mReplies += "250 OK queued\r\n";
+}
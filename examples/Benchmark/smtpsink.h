@@ -0,0 +1,70 @@
+#ifndef SMTPSINK_H
+#define SMTPSINK_H
+
+#include <QTcpServer>
+#include <QSslCertificate>
+#include <QSslKey>
+
+class QSslSocket;
+
+/* Loopback SMTP server which accepts and discards every message. It
+ * advertises PIPELINING, CHUNKING and BINARYMIME and, once a certificate
+ * has been set, STARTTLS.
+ */
+class SmtpSink : public QTcpServer
+{
+    Q_OBJECT
+
+public:
+    explicit SmtpSink(QObject *parent = 0);
+
+    bool setCertificate(const QString &certFile, const QString &keyFile);
+    bool hasCertificate() const;
+
+    qint64 messages() const;
+    qint64 bytes() const;
+
+protected:
+    void incomingConnection(qintptr handle);
+
+private:
+    friend class SmtpSinkSession;
+
+    QSslCertificate mCertificate;
+    QSslKey mKey;
+    qint64 mMessages;
+    qint64 mBytes;
+};
+
+class SmtpSinkSession : public QObject
+{
+    Q_OBJECT
+
+public:
+    SmtpSinkSession(SmtpSink *sink, qintptr handle);
+
+private Q_SLOTS:
+    void readyRead();
+
+private:
+    bool processCommand(const QByteArray &line);
+    void endOfMessage(qint64 size);
+
+    enum State {
+        CommandState,
+        DataState,
+        ChunkState
+    };
+
+    SmtpSink *mSink;
+    QSslSocket *mSocket;
+    QByteArray mBuffer;
+    QByteArray mReplies;
+    State mState;
+    int mScanPos;
+    qint64 mChunkLeft;
+    bool mChunkLast;
+    qint64 mMessageSize;
+};
+
+#endif // SMTPSINK_H
@@ -59,12 +59,22 @@ HEADERS += \
     include/QsrMailAddress \
     include/QsrMailBase64Encoder \
     include/QsrMailBodyPart \
+    include/QsrMailBodySource \
+    include/QsrMailEncoderCache \
+    include/QsrMailEngine \
+    include/QsrMailEnvelope \
     include/QsrMailMessage \
     include/QsrMailMimeMultipart \
     include/QsrMailMimePart \
     include/QsrMailQpEncoder \
+    include/QsrMailRenderedMessage \
+    include/QsrMailRouter \
+    include/QsrMailSpool \
+    include/QsrMailStatistics \
     include/QsrMailTransaction \
+    include/QsrMailTransactionTiming \
     include/QsrMailTransport \
+    include/QsrMailTransportPool \
     src/qsrmailabstractencoder.h \
     src/qsrmailabstractencoder_p.h \
     src/qsrmailabstractmimepart.h \
@@ -75,20 +85,47 @@ HEADERS += \
     src/qsrmailbase64encoder.h \
     src/qsrmailbase64encoder_p.h \
     src/qsrmailbodypart.h \
+    src/qsrmailbodysource.h \
+    src/qsrmailbodysource_p.h \
+    src/qsrmailbufferpool_p.h \
+    src/qsrmaildotstuffer_p.h \
+    src/qsrmailencodercache.h \
+    src/qsrmailencodercache_p.h \
+    src/qsrmailengine.h \
+    src/qsrmailengine_p.h \
+    src/qsrmailenvelope.h \
+    src/qsrmailenvelope_p.h \
+    src/qsrmailfilemap_p.h \
     src/qsrmailglobal.h \
     src/qsrmailheaders_p.h \
     src/qsrmailmessage.h \
     src/qsrmailmessage_p.h \
+    src/qsrmailmimedetector_p.h \
     src/qsrmailmimemultipart.h \
     src/qsrmailmimepart.h \
     src/qsrmailqpencoder.h \
     src/qsrmailqpencoder_p.h \
+    src/qsrmailrecipientset_p.h \
+    src/qsrmailrenderedmessage.h \
+    src/qsrmailrenderedmessage_p.h \
     src/qsrmailrenderer_p.h \
+    src/qsrmailrenderpipe_p.h \
+    src/qsrmailresolver_p.h \
+    src/qsrmailrouter.h \
+    src/qsrmailrouter_p.h \
     src/qsrmailrfctools_p.h \
+    src/qsrmailspool.h \
+    src/qsrmailspool_p.h \
+    src/qsrmailstatistics.h \
+    src/qsrmailstatistics_p.h \
+    src/qsrmailtimerwheel_p.h \
+    src/qsrmailtrace_p.h \
     src/qsrmailtransaction.h \
     src/qsrmailtransaction_p.h \
     src/qsrmailtransport.h \
-    src/qsrmailtransport_p.h
+    src/qsrmailtransport_p.h \
+    src/qsrmailtransportpool.h \
+    src/qsrmailtransportpool_p.h
 
 SOURCES += \
     src/qsrmailabstractencoder.cpp \
@@ -97,12 +134,30 @@ SOURCES += \
     src/qsrmailaddress.cpp \
     src/qsrmailbase64encoder.cpp \
     src/qsrmailbodypart.cpp \
+    src/qsrmailbodysource.cpp \
+    src/qsrmailbufferpool.cpp \
+    src/qsrmaildotstuffer.cpp \
+    src/qsrmailencodercache.cpp \
+    src/qsrmailengine.cpp \
+    src/qsrmailenvelope.cpp \
+    src/qsrmailfilemap.cpp \
     src/qsrmailheaders.cpp \
     src/qsrmailmessage.cpp \
+    src/qsrmailmimedetector.cpp \
     src/qsrmailmimemultipart.cpp \
     src/qsrmailmimepart.cpp \
     src/qsrmailqpencoder.cpp \
+    src/qsrmailrecipientset.cpp \
+    src/qsrmailrenderedmessage.cpp \
     src/qsrmailrenderer.cpp \
+    src/qsrmailrenderpipe.cpp \
+    src/qsrmailresolver.cpp \
+    src/qsrmailrouter.cpp \
     src/qsrmailrfctools.cpp \
+    src/qsrmailspool.cpp \
+    src/qsrmailstatistics.cpp \
+    src/qsrmailtimerwheel.cpp \
+    src/qsrmailtrace.cpp \
     src/qsrmailtransaction.cpp \
-    src/qsrmailtransport.cpp
+    src/qsrmailtransport.cpp \
+    src/qsrmailtransportpool.cpp
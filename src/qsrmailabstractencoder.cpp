@@ -50,6 +50,8 @@
 #include "qsrmailabstractencoder.h"
 #include "qsrmailabstractencoder_p.h"
 
+#include <QBuffer>
+
 QT_BEGIN_NAMESPACE
 
 /*!
@@ -62,7 +64,8 @@ QsrMailAbstractEncoderPrivate::QsrMailAbstractEncoderPrivate(
         QsrMailAbstractEncoder *qq) :
     q_ptr(qq),
     device(0),
-    gotReadChannelFinished(false)
+    gotReadChannelFinished(false),
+    directInput(true)
 {
 }
 
@@ -104,6 +107,55 @@ void QsrMailAbstractEncoderPrivate::_q_flushBuffers()
     /* intentionally left blank */
 }
 
+/*!
+ * \internal
+ *
+ * Returns a pointer to the input at the current position of the device
+ * without reading it. *size* is set to the number of bytes which can be
+ * accessed; the bytes consumed by the encoder are skipped using
+ * skipInput(). This works for QBuffer devices and for files, which are
+ * mapped into memory window by window. For all other devices 0 is
+ * returned and the input must be read().
+ */
+const char *QsrMailAbstractEncoderPrivate::peekInput(qint64 *size)
+{
+    if (!directInput)
+        return 0;
+
+    QBuffer *buffer = qobject_cast<QBuffer *>(device);
+    if (buffer != 0) {
+        const QByteArray &data = buffer->data();
+        *size = data.size() - buffer->pos();
+        return data.constData() + buffer->pos();
+    }
+
+    qint64 pos = device->pos();
+    if (!inputMap.contains(pos)) {
+        /* the tail of a file is read */
+        QFileDevice *file = qobject_cast<QFileDevice *>(device);
+        if (file != 0 && !QsrMailFileMap::isMappable(file))
+            return 0;
+
+        if (file == 0 || !inputMap.map(file, pos)) {
+            directInput = false;
+            return 0;
+        }
+    }
+
+    *size = inputMap.offset() + inputMap.size() - pos;
+    return inputMap.data() + (pos - inputMap.offset());
+}
+
+/*!
+ * \internal
+ *
+ * Skip *size* bytes of the input returned by peekInput().
+ */
+void QsrMailAbstractEncoderPrivate::skipInput(qint64 size)
+{
+    device->seek(device->pos() + size);
+}
+
 /* -------------------------------------------------------------------------- */
 
 /*!
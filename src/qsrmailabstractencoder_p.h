@@ -23,6 +23,7 @@
 #define QSRMAILABSTRACTENCODER_P_H
 
 #include "qsrmailabstractencoder.h"
+#include "qsrmailfilemap_p.h"
 
 QT_BEGIN_NAMESPACE
 
@@ -35,6 +36,9 @@ public:
     void _q_readChannelFinished();
     virtual void _q_flushBuffers();
 
+    const char *peekInput(qint64 *size);
+    void skipInput(qint64 size);
+
     inline bool deviceAtEnd() const
     {
         if (device->isSequential()) {
@@ -50,6 +54,8 @@ public:
     QsrMailAbstractEncoder *q_ptr;
     QIODevice *device;
     bool gotReadChannelFinished;
+    bool directInput;
+    QsrMailFileMap inputMap;
 };
 
 QT_END_NAMESPACE
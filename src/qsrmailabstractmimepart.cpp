@@ -136,7 +136,9 @@ QsrMailAbstractMimePart::rawHeaders(const QByteArray &name) const
 /*!
  * Sets the content type of the part to *type*. The default behaviour is
  * to autodetect the content type using the QMimeDatabase while sending the
- * message to the server, so setting this property is optional.
+ * message to the server, so setting this property is optional. Detection
+ * prefers the extension of the filename and otherwise examines the start
+ * of the body. The detected type is remembered by the part.
  *
  * However, if the developer decides to override the default behaviour it
  * must be ensured that the supplied content type data confirms to RFC
@@ -256,6 +258,7 @@ QsrMailAbstractMimePart::contentDisposition() const
 void QsrMailAbstractMimePart::setFilename(const QString &name)
 {
     d->filename = name;
+    d->detectedContentType.clear();
 }
 
 /*!
@@ -108,7 +108,7 @@ QsrMailAbstractPartPrivate::QsrMailAbstractPartPrivate(
  */
 QsrMailHeaders QsrMailAbstractPartPrivate::cookHeaders() const
 {
-    QsrMailHeaders result(headers);
+    QsrMailHeaders result(headers.overlay());
 
     QByteArray ctype(contentType);
     if (isMimeMultipart()) {
@@ -156,30 +156,30 @@ QsrMailHeaders QsrMailAbstractPartPrivate::cookHeaders() const
     }
 
     if (!createDate.isNull()) {
-        disposition += ";\n\tcreation-date=\""
+        disposition += "; creation-date=\""
                 % QsrMailRfcTools::rfc2822Date(createDate)
                 % "\"";
     }
 
     if (!modificationDate.isNull()) {
-        disposition += ";\n\tmodification-date=\""
+        disposition += "; modification-date=\""
                 % QsrMailRfcTools::rfc2822Date(modificationDate)
                 % "\"";
     }
 
     if (!readDate.isNull()) {
-        disposition += ";\n\tread-date=\""
+        disposition += "; read-date=\""
                 % QsrMailRfcTools::rfc2822Date(readDate)
                 % "\"";
     }
 
     if (size > 0) {
-        disposition += ";\n\tsize="
+        disposition += "; size="
                 % QByteArray::number(size);
     }
 
     if (!filename.isEmpty()) {
-        disposition += ";\n\tfilename*=\"utf-8''"
+        disposition += "; filename*=\"utf-8''"
                 % filename.toUtf8().toPercentEncoding()
                 % "\"";
     }
@@ -204,10 +204,10 @@ bool QsrMailAbstractPartPrivate::isEmptyImpl() const
     case QsrMailAbstractPart::MimePartType:
         return body.isEmpty()
                 && bodyDevice == 0
-                && headers.headers.isEmpty();
+                && headers.isEmpty();
 
     case QsrMailAbstractPart::MimeMultipartType:
-        return headers.headers.isEmpty()
+        return headers.isEmpty()
                 && parts.isEmpty();
 
     case QsrMailAbstractPart::NullType:
@@ -60,6 +60,9 @@ public:
     QIODevice *bodyDevice;
     bool autoDelete;
 
+    /* QsrMailMimePart - memoized by QsrMailEncoderCachePrivate */
+    mutable QByteArray bodyHash;
+
     /* QsrMailMimePart / QsrMailMimeMultipart */
     QsrMailHeaders headers;
     QByteArray contentType;
@@ -74,6 +77,9 @@ public:
     QDateTime readDate;
     qint64 size;
 
+    /* QsrMailMimePart - memoized by QsrMailMimeDetector */
+    mutable QByteArray detectedContentType;
+
     /* QsrMailMimePart */
     QsrMailMimePart::Encoder encoder;
 
@@ -83,10 +83,39 @@ Q_GLOBAL_STATIC_WITH_ARGS(QSharedDataPointer<QsrMailAddressPrivate>,
  *
  * Default constructor.
  */
-QsrMailAddressPrivate::QsrMailAddressPrivate()
+QsrMailAddressPrivate::QsrMailAddressPrivate() :
+    valid(false)
 {
 }
 
+/*!
+ * \internal
+ *
+ * Validate the address and build the wire form. This is called on every
+ * modification so isValid() and toByteArray() never have to walk the
+ * RFC grammar or convert the strings again; since the private data is
+ * shared the result is shared by all copies (e.g. all messages sent to
+ * the same recipient list). Doing the work on write rather than lazily
+ * keeps the const accessors free of writes to shared data, which may be
+ * used from several threads at once.
+ */
+void QsrMailAddressPrivate::update()
+{
+    const QByteArray addrSpec(address.toUtf8());
+
+    valid = QsrMailRfcTools::validateAddrSpec(addrSpec);
+    if (!valid) {
+        encoded.clear();
+    } else if (displayName.isEmpty()) {
+        encoded = addrSpec;
+    } else {
+        QByteArray name(displayName.toUtf8());
+        if (!QsrMailRfcTools::validateDisplayName(name))
+            name = QsrMailRfcTools::toEncodedWords(displayName);
+        encoded = name % " <" % addrSpec % ">";
+    }
+}
+
 /* -------------------------------------------------------------------------- */
 
 /*!
@@ -113,6 +142,7 @@ QsrMailAddress::QsrMailAddress(const QString &address) :
     d(new QsrMailAddressPrivate)
 {
     d->address = address;
+    d->update();
 }
 
 /*!
@@ -170,6 +200,7 @@ QsrMailAddress::QsrMailAddress(const QString &address,
 {
     d->address = address;
     d->displayName = displayName;
+    d->update();
 }
 
 /*!
@@ -207,7 +238,7 @@ bool QsrMailAddress::isNull() const
  */
 bool QsrMailAddress::isValid() const
 {
-    return QsrMailRfcTools::validateAddrSpec(d->address.toUtf8());
+    return d->valid;
 }
 
 /*!
@@ -222,6 +253,7 @@ bool QsrMailAddress::isValid() const
 void QsrMailAddress::setAddress(const QString &address)
 {
     d->address = address;
+    d->update();
 }
 
 /*!
@@ -242,6 +274,7 @@ QString QsrMailAddress::address() const
 void QsrMailAddress::setDisplayName(const QString &name)
 {
     d->displayName = name;
+    d->update();
 }
 
 /*!
@@ -270,17 +303,8 @@ QString QsrMailAddress::displayName() const
  */
 QByteArray QsrMailAddress::toByteArray() const
 {
-    if (!isValid())
-        return QByteArray();
-
-    if (d->displayName.isEmpty())
-        return d->address.toUtf8();
-
-    if (QsrMailRfcTools::validateDisplayName(d->displayName.toUtf8()))
-        return d->displayName.toUtf8() % " <" % d->address.toUtf8() % ">";
-
-    return QsrMailRfcTools::toEncodedWords(d->displayName)
-            % " <" % d->address.toUtf8() % ">";
+    /* built once on modification, this is a reference count increment */
+    return d->encoded;
 }
 
 /*!
@@ -307,4 +331,40 @@ QString QsrMailAddress::toString() const
     return d->displayName % " <" % d->address % ">";
 }
 
+/*!
+ * Parses the comma separated address list *addresses* - for example the
+ * contents of a To: field as typed by a user - and returns one instance
+ * per item. Items may be plain internet mail addresses or display names
+ * followed by an address in angle brackets; quoted display names are
+ * unquoted. Commas within quoted strings, comments and angle brackets do
+ * not separate items.
+ *
+ * The list is split in a single pass and every address is validated once
+ * while parsing. Invalid items are still returned; use isValid() to check
+ * them.
+ *
+ * Example:
+ * \code{.cpp}
+ * QList<QsrMailAddress> list = QsrMailAddress::parseList(
+ *     "h.mueller@foo.com, \"Mueller, Henry\" <henry@bar.com>");
+ * // list.at(1).displayName(): 'Mueller, Henry'
+ * \endcode
+ */
+QList<QsrMailAddress> QsrMailAddress::parseList(const QString &addresses)
+{
+    QList<QByteArray> addrSpecs;
+    QList<QByteArray> displayNames;
+    QsrMailRfcTools::splitAddressList(addresses.toUtf8(), addrSpecs,
+                                      displayNames);
+
+    QList<QsrMailAddress> result;
+    result.reserve(addrSpecs.size());
+    for (int i=0, size=addrSpecs.size(); i<size; ++i) {
+        result.append(QsrMailAddress(QString::fromUtf8(addrSpecs.at(i)),
+                                     QString::fromUtf8(displayNames.at(i))));
+    }
+
+    return result;
+}
+
 QT_END_NAMESPACE
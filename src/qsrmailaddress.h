@@ -25,6 +25,7 @@
 #include "qsrmailglobal.h"
 #include <QSharedDataPointer>
 #include <QHash>
+#include <QList>
 #include <QString>
 
 QT_BEGIN_NAMESPACE
@@ -56,6 +57,8 @@ public:
     QByteArray toByteArray() const;
     QString toString() const;
 
+    static QList<QsrMailAddress> parseList(const QString &addresses);
+
 private:
     QSharedDataPointer<QsrMailAddressPrivate> d;
 };
@@ -22,6 +22,7 @@
 #ifndef QSRMAILMAILADDRESS_P_H
 #define QSRMAILMAILADDRESS_P_H
 
+#include <QByteArray>
 #include <QSharedData>
 #include <QString>
 
@@ -32,9 +33,15 @@ class QsrMailAddressPrivate : public QSharedData
 public:
     QsrMailAddressPrivate();
 
+    void update();
+
 public:
     QString address;
     QString displayName;
+
+    /* wire form cache, kept up to date by update() */
+    QByteArray encoded;
+    bool valid;
 };
 
 QT_END_NAMESPACE
@@ -61,12 +61,135 @@
 #include "qsrmailbase64encoder.h"
 #include "qsrmailbase64encoder_p.h"
 
+/* vector kernels are available for x86 (SSSE3, dispatched at runtime) and
+ * for AArch64 (NEON, always present)
+ */
+#if defined(Q_CC_GNU) && (defined(Q_PROCESSOR_X86) || defined(__i386__) \
+        || defined(__x86_64__))
+#  define QSRMAIL_BASE64_SSSE3
+#  include <tmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  define QSRMAIL_BASE64_NEON
+#  include <arm_neon.h>
+#endif
+
+/* size of the input block - a multiple of the 57 bytes of a 76 char line */
+#define BASE64_BLOCK_SIZE (1024*57)
+
+/* the vector kernels may read a few bytes beyond the input */
+#define BASE64_BLOCK_PADDING 16
+
 QT_BEGIN_NAMESPACE
 
 /* dictionary for base64 encoder */
 const char base64dict[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdef"
                           "ghijklmnopqrstuvwxyz0123456789+/";
 
+/* encodes *triples* three byte groups of *in* to *out* */
+typedef void (*Base64Kernel)(const uchar *in, int triples, char *out);
+
+static void base64EncodeScalar(const uchar *in, int triples, char *out)
+{
+    for (; triples > 0; --triples, in += 3, out += 4) {
+        const quint32 q = in[0] << 16 | in[1] << 8 | in[2];
+        out[0] = base64dict[q >> 18];
+        out[1] = base64dict[q >> 12 & 0x3f];
+        out[2] = base64dict[q >> 6 & 0x3f];
+        out[3] = base64dict[q & 0x3f];
+    }
+}
+
+#if defined(QSRMAIL_BASE64_SSSE3)
+/* 12 input bytes are spread to 16 sextets using pshufb and the multiply
+ * shift trick; the sextets are then translated to ASCII by adding an
+ * offset looked up by range.
+ */
+__attribute__((target("ssse3")))
+static void base64EncodeSsse3(const uchar *in, int triples, char *out)
+{
+    const __m128i shuffle = _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7,
+                                         4, 5, 3, 4, 1, 2, 0, 1);
+    const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '0' - 52,
+                                          '0' - 52, '0' - 52, '+' - 62,
+                                          '/' - 63, 'A', 0, 0);
+
+    for (; triples >= 4; triples -= 4, in += 12, out += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(in));
+        v = _mm_shuffle_epi8(v, shuffle);
+
+        const __m128i t0 = _mm_and_si128(v, _mm_set1_epi32(0x0fc0fc00));
+        const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+        const __m128i t2 = _mm_and_si128(v, _mm_set1_epi32(0x003f03f0));
+        const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+        const __m128i idx = _mm_or_si128(t1, t3);
+
+        __m128i r = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+        const __m128i lt = _mm_cmpgt_epi8(_mm_set1_epi8(26), idx);
+        r = _mm_or_si128(r, _mm_and_si128(lt, _mm_set1_epi8(13)));
+        r = _mm_add_epi8(_mm_shuffle_epi8(offsets, r), idx);
+
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(out), r);
+    }
+
+    base64EncodeScalar(in, triples, out);
+}
+#endif
+
+#if defined(QSRMAIL_BASE64_NEON)
+/* 48 input bytes are deinterleaved into three vectors, split into four
+ * sextet vectors and translated using a 64 byte table lookup.
+ */
+static void base64EncodeNeon(const uchar *in, int triples, char *out)
+{
+    const uint8_t *d = reinterpret_cast<const uint8_t *>(base64dict);
+    uint8x16x4_t dict;
+    dict.val[0] = vld1q_u8(d);
+    dict.val[1] = vld1q_u8(d + 16);
+    dict.val[2] = vld1q_u8(d + 32);
+    dict.val[3] = vld1q_u8(d + 48);
+    const uint8x16_t mask = vdupq_n_u8(0x3f);
+
+    for (; triples >= 16; triples -= 16, in += 48, out += 64) {
+        const uint8x16x3_t v = vld3q_u8(in);
+        uint8x16x4_t r;
+
+        r.val[0] = vshrq_n_u8(v.val[0], 2);
+        r.val[1] = vandq_u8(vorrq_u8(vshlq_n_u8(v.val[0], 4),
+                                     vshrq_n_u8(v.val[1], 4)), mask);
+        r.val[2] = vandq_u8(vorrq_u8(vshlq_n_u8(v.val[1], 2),
+                                     vshrq_n_u8(v.val[2], 6)), mask);
+        r.val[3] = vandq_u8(v.val[2], mask);
+
+        r.val[0] = vqtbl4q_u8(dict, r.val[0]);
+        r.val[1] = vqtbl4q_u8(dict, r.val[1]);
+        r.val[2] = vqtbl4q_u8(dict, r.val[2]);
+        r.val[3] = vqtbl4q_u8(dict, r.val[3]);
+
+        vst4q_u8(reinterpret_cast<uint8_t *>(out), r);
+    }
+
+    base64EncodeScalar(in, triples, out);
+}
+#endif
+
+/* select the best kernel for the cpu we are running on */
+static Base64Kernel base64SelectKernel()
+{
+#if defined(QSRMAIL_BASE64_SSSE3)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("ssse3"))
+        return base64EncodeSsse3;
+#elif defined(QSRMAIL_BASE64_NEON)
+    return base64EncodeNeon;
+#endif
+
+    return base64EncodeScalar;
+}
+
+static const Base64Kernel base64Kernel = base64SelectKernel();
+
 /*!
  * \internal
  *
@@ -132,8 +255,50 @@ qint64 QsrMailBase64EncoderPrivate::readDataImpl(char *data, qint64 maxlen)
     quint8 c = 0;
     qint64 remain = maxlen;
 
+    if (block.isEmpty())
+        block.resize(BASE64_BLOCK_SIZE + BASE64_BLOCK_PADDING);
+
     /* we need at least 6 bytes (4*BASE64, opt. CR,LF) to be happy */
     while (device->bytesAvailable() > 0 && remain > 6) {
+        /* encode as many complete triples as fit into the output in
+         * one block
+         */
+        qint64 size = 0;
+        if (qSize == 0) {
+            size = qMin(device->bytesAvailable(), maxTriples(remain) * 3);
+            size = qMin(size, static_cast<qint64>(BASE64_BLOCK_SIZE)) / 3 * 3;
+        }
+
+        /* encode directly from the memory of the device if possible;
+         * the kernel may read beyond the triples it encodes
+         */
+        qint64 direct = 0;
+        const char *input = size > 0 ? peekInput(&direct) : 0;
+        direct = qMin(size, direct - BASE64_BLOCK_PADDING) / 3 * 3;
+
+        if (direct > 0) {
+            remain -= encodeBlock(reinterpret_cast<const uchar *>(input),
+                                  static_cast<int>(direct / 3), &data);
+            skipInput(direct);
+            continue;
+        }
+
+        if (size > 0) {
+            uchar *in = reinterpret_cast<uchar *>(block.data());
+            qint64 got = device->read(block.data(), size);
+            if (got <= 0)
+                break;
+
+            int triples = static_cast<int>(got / 3);
+            remain -= encodeBlock(in, triples, &data);
+
+            /* a short read leaves a partial quantum */
+            for (int i=triples*3; i<got; i++)
+                qBuffer |= static_cast<quint32>(in[i]) << (16 - 8 * qSize++);
+
+            continue;
+        }
+
         /* fill quantum */
         while (qSize < 3) {
             if (!device->getChar(reinterpret_cast<char *>(&c)))
@@ -162,6 +327,8 @@ qint64 QsrMailBase64EncoderPrivate::readDataImpl(char *data, qint64 maxlen)
 
     /* handle end of input device */
     if (deviceAtEnd()) {
+        inputMap.unmap();
+
         /* flush qBuffer.. */
         if (qSize > 0)
             remain -= putQ(&data);
@@ -173,6 +340,85 @@ qint64 QsrMailBase64EncoderPrivate::readDataImpl(char *data, qint64 maxlen)
     return maxlen - remain;
 }
 
+/*!
+ * \internal
+ *
+ * Returns the number of complete triples which can be encoded into an
+ * output buffer of *remain* bytes including the line breaks.
+ */
+qint64 QsrMailBase64EncoderPrivate::maxTriples(qint64 remain) const
+{
+    /* no line breaks at all */
+    if (lineWidth <= 0)
+        return remain / 4;
+
+    /* lines not aligned to quantums are encoded quantum by quantum
+     * which needs at most one line break per quantum
+     */
+    if (lineWidth % 4 != 0 || lineChars % 4 != 0)
+        return remain / 6;
+
+    /* fill the current line, then full lines, then the rest */
+    const qint64 first = lineWidth - lineChars;
+    if (remain < first + 2)
+        return qMax(Q_INT64_C(0), (remain - 2) / 4);
+
+    remain -= first + 2;
+    qint64 result = first / 4;
+
+    const qint64 lines = remain / (lineWidth + 2);
+    result += lines * (lineWidth / 4);
+    remain -= lines * (lineWidth + 2);
+
+    return result + qMax(Q_INT64_C(0), (remain - 2) / 4);
+}
+
+/*!
+ * \internal
+ *
+ * Encode *triples* three byte groups from *in* to the memory pointed to by
+ * *p* and insert the line breaks. The output is the same as putQ() would
+ * produce for each triple, but complete lines are encoded in one go by the
+ * vector kernel. After execution *p* is shifted to the next available byte.
+ *
+ * The function returns the number of bytes written.
+ */
+int QsrMailBase64EncoderPrivate::encodeBlock(const uchar *in, int triples,
+                                             char **p)
+{
+    char *start = *p;
+
+    /* line breaks within quantums - fall back to putQ() */
+    if (lineWidth > 0 && (lineWidth % 4 != 0 || lineChars % 4 != 0)) {
+        for (; triples > 0; --triples, in += 3) {
+            qBuffer = in[0] << 16 | in[1] << 8 | in[2];
+            qSize = 3;
+            putQ(p);
+        }
+        return static_cast<int>(*p - start);
+    }
+
+    while (triples > 0) {
+        /* encode up to the end of the current line */
+        int n = triples;
+        if (lineWidth > 0)
+            n = qMin(n, (lineWidth - lineChars) / 4);
+
+        base64Kernel(in, n, *p);
+        in += n * 3;
+        *p += n * 4;
+        triples -= n;
+
+        if (lineWidth > 0 && (lineChars += n * 4) >= lineWidth) {
+            *(*p)++ = '\r';
+            *(*p)++ = '\n';
+            lineChars = 0;
+        }
+    }
+
+    return static_cast<int>(*p - start);
+}
+
 /*!
  * \internal
  *
@@ -340,6 +586,24 @@ int QsrMailBase64Encoder::lineWidth() const
     return d->lineWidth;
 }
 
+/*!
+ * Returns the number of bytes the encoder produces for *size* bytes of
+ * input when the output is wrapped at *lineWidth* characters. Every
+ * complete line is terminated by CRLF, an incomplete last line is not.
+ * This allows to determine the encoded size without encoding the data.
+ */
+qint64 QsrMailBase64Encoder::encodedSize(qint64 size, int lineWidth)
+{
+    if (size <= 0)
+        return 0;
+
+    qint64 chars = (size + 2) / 3 * 4;
+    if (lineWidth > 0)
+        chars += chars / lineWidth * 2;
+
+    return chars;
+}
+
 /*!
  * Reimplemented for subclassing QIODevice.
  */
@@ -43,6 +43,8 @@ public:
     void setLineWidth(int width);
     int lineWidth() const;
 
+    static qint64 encodedSize(qint64 size, int lineWidth = 76);
+
 private:
     qint64 readData(char *data, qint64 maxlen);
     qint64 writeData(const char *data, qint64 len);
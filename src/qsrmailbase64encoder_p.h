@@ -38,6 +38,8 @@ public:
 
     void _q_flushBuffers();
     qint64 readDataImpl(char *data, qint64 maxlen);
+    qint64 maxTriples(qint64 remain) const;
+    int encodeBlock(const uchar *in, int triples, char **p);
 
     inline int put(char **p, char c) {
         *(*p)++ = c;
@@ -73,6 +75,7 @@ public:
     int lineChars;
     quint32 qBuffer;
     int qSize;
+    QByteArray block;
 };
 
 QT_END_NAMESPACE
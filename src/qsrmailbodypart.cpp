@@ -74,6 +74,29 @@ QsrMailBodyPart &QsrMailBodyPart::operator=(const QsrMailBodyPart &other)
     return *this;
 }
 
+#ifdef Q_COMPILER_RVALUE_REFS
+/*!
+ * Move-constructs an instance from *other*, which is left empty. Unlike a
+ * copy the instance takes over the reference of *other*, so data nobody
+ * else refers to can be modified without a detach.
+ */
+QsrMailBodyPart::QsrMailBodyPart(QsrMailBodyPart &&other) :
+    QsrMailAbstractPart(*sharedNull)
+{
+    swap(other);
+}
+
+/*!
+ * Move-assigns *other* to this instance and returns a reference to it.
+ * *other* takes over the previous data of this instance.
+ */
+QsrMailBodyPart &QsrMailBodyPart::operator=(QsrMailBodyPart &&other)
+{
+    swap(other);
+    return *this;
+}
+#endif
+
 /*!
  * Swap this instance with *other*. This function is very fast and
  * never fails.
@@ -129,6 +152,19 @@ void QsrMailBodyPart::setBody(const QByteArray &content)
     d->body = content;
 }
 
+#ifdef Q_COMPILER_RVALUE_REFS
+/*!
+ * \overload
+ *
+ * Moves *content* into the part without touching its reference count.
+ * Afterwards *content* holds the previous body of the part.
+ */
+void QsrMailBodyPart::setBody(QByteArray &&content)
+{
+    d->body.swap(content);
+}
+#endif
+
 /*!
  * Returns the body for this part. If the body is not set or the body is
  * a device a default constructed QByteArray is returned.
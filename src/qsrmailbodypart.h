@@ -34,6 +34,10 @@ public:
     QsrMailBodyPart();
     QsrMailBodyPart(const QsrMailBodyPart &other);
     QsrMailBodyPart &operator=(const QsrMailBodyPart &other);
+#ifdef Q_COMPILER_RVALUE_REFS
+    QsrMailBodyPart(QsrMailBodyPart &&other);
+    QsrMailBodyPart &operator=(QsrMailBodyPart &&other);
+#endif
     void swap(QsrMailBodyPart &other);
     ~QsrMailBodyPart();
 
@@ -43,6 +47,9 @@ public:
     bool autoDelete() const;
 
     void setBody(const QByteArray &content);
+#ifdef Q_COMPILER_RVALUE_REFS
+    void setBody(QByteArray &&content);
+#endif
     QByteArray body() const;
 
     void setBodyDevice(QIODevice *device);
@@ -0,0 +1,243 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \class QsrMailBodySource
+ * \brief Produces the body of a MIME part on demand.
+ *
+ * Generated content like exports or reports does not have to be built in
+ * memory or wrapped into a QIODevice subclass. Subclass QsrMailBodySource,
+ * implement read() and pass an instance to QsrMailMimePart::fromSource()
+ * or QsrMailMimePart::setBodySource().
+ *
+ * The renderer pulls the body only when its buffer has space, so the body
+ * is produced just in time while the message is sent and memory usage does
+ * not depend on its size. read() is called on the thread of the
+ * transport. Since the body cannot be produced twice, a message with a
+ * body source is not retried once its transfer started.
+ *
+ * Example:
+ * \code
+ * class CsvExport : public QsrMailBodySource
+ * {
+ * public:
+ *     qint64 read(char *data, qint64 maxSize)
+ *     {
+ *         if (mLine.isEmpty() && !nextRow(&mLine))
+ *             return 0;
+ *
+ *         qint64 size = qMin(maxSize, qint64(mLine.size()));
+ *         memcpy(data, mLine.constData(), size);
+ *         mLine.remove(0, size);
+ *         return size;
+ *     }
+ *     ...
+ * };
+ *
+ * QsrMailMimeMultipart multipart;
+ * multipart.append(QsrMailMimePart::fromSource("export.csv", new CsvExport));
+ * \endcode
+ *
+ * \sa QsrMailMimePart::setBodySource()
+ */
+
+/*!
+ * \fn QsrMailBodySource::read(char *data, qint64 maxSize)
+ *
+ * Produce up to *maxSize* bytes of the body into *data*. Returns the
+ * number of bytes produced, 0 at the end of the body or -1 on error, in
+ * which case errorString() describes the error and the message fails.
+ * Unlike QIODevice::read() a return value of 0 always ends the body.
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailBodySourceDevice "qsrmailbodysource_p.h"
+ * \brief Sequential QIODevice reading from a QsrMailBodySource.
+ *
+ * The device is the body device of parts with a body source, so the
+ * renderer, the encoders and the MIME detector handle them like any other
+ * device. It is opened right away; an unbuffered device would lose the
+ * data peeked by the MIME detector. The device emits readChannelFinished()
+ * once the source reached its end, and the renderer also checks
+ * isFinished() so the end is not missed if the signal fired before the
+ * renderer connected it. It owns the source.
+ *
+ * The encoders only pull input while bytesAvailable() reports data, so
+ * bytesAvailable() produces the next chunk of the source in advance when
+ * nothing is pending.
+ */
+
+#include "qsrmailbodysource.h"
+#include "qsrmailbodysource_p.h"
+
+QT_BEGIN_NAMESPACE
+
+/* size of the chunks produced in advance by bytesAvailable() */
+#define SOURCE_CHUNK_SIZE 16384
+
+/*!
+ * Destroys the instance.
+ */
+QsrMailBodySource::~QsrMailBodySource()
+{
+}
+
+/*!
+ * Returns a description of the last error of read(). The default
+ * implementation returns a generic description.
+ */
+QString QsrMailBodySource::errorString() const
+{
+    return QLatin1String("cannot produce the body");
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * \internal
+ *
+ * Construct an open device reading from *source*, which is disposed with
+ * the device.
+ */
+QsrMailBodySourceDevice::QsrMailBodySourceDevice(QsrMailBodySource *source,
+                                                 QObject *parent) :
+    QIODevice(parent),
+    mSource(source),
+    mFinished(false),
+    mFailed(false)
+{
+    open(QIODevice::ReadOnly);
+}
+
+/*!
+ * \internal
+ *
+ * Destroys the device and its source.
+ */
+QsrMailBodySourceDevice::~QsrMailBodySourceDevice()
+{
+    delete mSource;
+}
+
+/*!
+ * \internal
+ *
+ * The body is produced once, so the device is sequential.
+ */
+bool QsrMailBodySourceDevice::isSequential() const
+{
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the number of bytes which can be read without blocking. If no
+ * data is pending the next chunk is produced by the source, so the end of
+ * the body is detected here as well.
+ */
+qint64 QsrMailBodySourceDevice::bytesAvailable() const
+{
+    if (mPending.isEmpty() && !mFinished && !mFailed)
+        const_cast<QsrMailBodySourceDevice *>(this)->fetch();
+
+    return mPending.size() + QIODevice::bytesAvailable();
+}
+
+/*!
+ * \internal
+ *
+ * Pulls up to *maxSize* bytes, data produced by bytesAvailable() first.
+ */
+qint64 QsrMailBodySourceDevice::readData(char *data, qint64 maxSize)
+{
+    if (maxSize <= 0)
+        return 0;
+
+    if (!mPending.isEmpty()) {
+        qint64 size = qMin(maxSize, qint64(mPending.size()));
+        memcpy(data, mPending.constData(), size);
+        mPending.remove(0, static_cast<int>(size));
+        return size;
+    }
+
+    if (mFailed)
+        return -1;
+
+    if (mFinished)
+        return 0;
+
+    qint64 got = mSource->read(data, maxSize);
+    if (got < 0) {
+        mFailed = true;
+        setErrorString(mSource->errorString());
+        return -1;
+    }
+
+    if (got == 0) {
+        mFinished = true;
+        emit readChannelFinished();
+    }
+
+    return got;
+}
+
+/*!
+ * \internal
+ *
+ * Produces the next chunk of the source into the pending data. A failing
+ * source is reported by the next readData().
+ */
+void QsrMailBodySourceDevice::fetch()
+{
+    mPending.resize(SOURCE_CHUNK_SIZE);
+
+    qint64 got = mSource->read(mPending.data(), mPending.size());
+    if (got < 0) {
+        mPending.clear();
+        mFailed = true;
+        setErrorString(mSource->errorString());
+        return;
+    }
+
+    mPending.resize(static_cast<int>(got));
+    if (got == 0) {
+        mFinished = true;
+        emit readChannelFinished();
+    }
+}
+
+/*!
+ * \internal
+ *
+ * The device is read only.
+ */
+qint64 QsrMailBodySourceDevice::writeData(const char *data, qint64 maxSize)
+{
+    Q_UNUSED(data)
+    Q_UNUSED(maxSize)
+
+    return -1;
+}
+
+QT_END_NAMESPACE
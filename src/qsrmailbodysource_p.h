@@ -0,0 +1,62 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILBODYSOURCE_P_H
+#define QSRMAILBODYSOURCE_P_H
+
+#include <QByteArray>
+#include <QIODevice>
+
+#include "qsrmailbodysource.h"
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailBodySourceDevice : public QIODevice
+{
+    Q_OBJECT
+
+public:
+    explicit QsrMailBodySourceDevice(QsrMailBodySource *source,
+                                     QObject *parent = 0);
+    ~QsrMailBodySourceDevice();
+
+    bool isSequential() const;
+    qint64 bytesAvailable() const;
+
+    inline bool isFinished() const
+    { return mFinished; }
+
+protected:
+    qint64 readData(char *data, qint64 maxSize);
+    qint64 writeData(const char *data, qint64 maxSize);
+
+private:
+    void fetch();
+
+    QsrMailBodySource *mSource;
+    QByteArray mPending;
+    bool mFinished;
+    bool mFailed;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILBODYSOURCE_P_H
@@ -0,0 +1,96 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \internal
+ *
+ * \class QsrMailBufferPool "qsrmailbufferpool_p.h"
+ * \brief Recycles the ringbuffers of message renderers.
+ *
+ * Every renderer needs a ringbuffer while it is rendering, but a transport
+ * renders only one message at a time, plus the messages it prefetches.
+ * Instead of allocating the buffer for
+ * every queued message the renderer takes it from the pool of its transport
+ * when rendering starts and the transport hands it back once the transaction
+ * has finished. This way the memory used for buffering depends on the number
+ * of connections and not on the number of queued messages.
+ *
+ * The pool keeps at most maxBuffers free buffers; buffers returned beyond
+ * that limit are freed. Requests for buffers of another size than
+ * bufferSize() are served by a plain allocation.
+ */
+
+#include "qsrmailbufferpool_p.h"
+
+QT_BEGIN_NAMESPACE
+
+/*!
+ * \internal
+ *
+ * Construct a pool of buffers of *bufferSize* bytes which keeps up to
+ * *maxBuffers* free buffers.
+ */
+QsrMailBufferPool::QsrMailBufferPool(int bufferSize, int maxBuffers) :
+    mBufferSize(bufferSize),
+    mMaxBuffers(maxBuffers)
+{
+}
+
+/*!
+ * \internal
+ *
+ * Keep up to *maxBuffers* free buffers. Surplus buffers are freed when
+ * they are returned.
+ */
+void QsrMailBufferPool::setMaxBuffers(int maxBuffers)
+{
+    mMaxBuffers = maxBuffers;
+}
+
+/*!
+ * \internal
+ *
+ * Returns a buffer of *size* bytes. The content of the buffer is undefined.
+ */
+QByteArray QsrMailBufferPool::acquire(int size)
+{
+    if (size == mBufferSize && !mBuffers.isEmpty())
+        return mBuffers.takeLast();
+
+    return QByteArray(size, Qt::Uninitialized);
+}
+
+/*!
+ * \internal
+ *
+ * Returns *buffer* to the pool. *buffer* is null afterwards.
+ */
+void QsrMailBufferPool::release(QByteArray &buffer)
+{
+    /* only buffers we own exclusively can be handed out again */
+    if (buffer.size() == mBufferSize && buffer.isDetached()
+            && mBuffers.size() < mMaxBuffers)
+        mBuffers.append(buffer);
+
+    buffer = QByteArray();
+}
+
+QT_END_NAMESPACE
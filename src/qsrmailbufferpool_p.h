@@ -0,0 +1,53 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILBUFFERPOOL_P_H
+#define QSRMAILBUFFERPOOL_P_H
+
+#include <QByteArray>
+#include <QList>
+
+QT_BEGIN_NAMESPACE
+
+/* size of the ringbuffer - 128k should be a good value */
+#define RINGBUFFER_SIZE (128*1024)
+
+class QsrMailBufferPool
+{
+public:
+    QsrMailBufferPool(int bufferSize, int maxBuffers);
+
+    void setMaxBuffers(int maxBuffers);
+    QByteArray acquire(int size);
+    void release(QByteArray &buffer);
+
+    inline int bufferSize() const
+    { return mBufferSize; }
+
+private:
+    int mBufferSize;
+    int mMaxBuffers;
+    QList<QByteArray> mBuffers;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILBUFFERPOOL_P_H
@@ -0,0 +1,133 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \internal
+ *
+ * \class QsrMailDotStuffer "qsrmaildotstuffer_p.h"
+ * \brief Streaming transparency stage for the SMTP DATA command.
+ *
+ * RFC5321 section 4.5.2 requires the client to prepend an additional "." to
+ * every line of the message which starts with a ".". Otherwise a line
+ * consisting of a single "." would terminate the message prematurely.
+ *
+ * The stuffer does not copy any data. It splits the data delivered by the
+ * renderer into spans which are written verbatim and tells the caller where
+ * the additional "." has to be inserted. The line start state is kept across
+ * calls so lines spanning several chunks are handled correctly. Line breaks
+ * are found using memchr() which is vectorized by every reasonable libc, so
+ * large chunks without dots at the line start are passed in a single span.
+ *
+ * A typical write loop looks like this:
+ * \code
+ * while (size > 0) {
+ *     bool stuff;
+ *     int n = stuffer.scan(data, size, &stuff);
+ *     write(data, n);
+ *     if (stuff)
+ *         write(".", 1);
+ *     data += n;
+ *     size -= n;
+ * }
+ * \endcode
+ */
+
+#include "qsrmaildotstuffer_p.h"
+
+#include <string.h>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+ * \internal
+ *
+ * Construct a stuffer positioned at the start of a line.
+ */
+QsrMailDotStuffer::QsrMailDotStuffer() :
+    mLineStart(true)
+{
+}
+
+/*!
+ * \internal
+ *
+ * Reset the stuffer to the start of a line. Call this before the first
+ * chunk of a new message is processed.
+ */
+void QsrMailDotStuffer::reset()
+{
+    mLineStart = true;
+}
+
+/*!
+ * \internal
+ *
+ * Scan *size* bytes of *data* and return the number of bytes which can be
+ * written verbatim. If the span returned is to be followed by an additional
+ * "." *stuff* is set to true. The caller continues with the data following
+ * the span, which then starts with the original "." of the line. The return
+ * value might be 0 if the data itself starts with a "." at the line start.
+ */
+int QsrMailDotStuffer::scan(const char *data, int size, bool *stuff)
+{
+    *stuff = false;
+    if (size <= 0)
+        return 0;
+
+    /* dot at the start of the data continues a line break of the
+     * previous chunk
+     */
+    if (mLineStart && *data == '.') {
+        mLineStart = false;
+        *stuff = true;
+        return 0;
+    }
+
+    const char *p = data;
+    const char *end = data + size;
+
+    forever {
+        p = static_cast<const char *>(memchr(p, '\n', end - p));
+
+        /* no more line breaks - the whole remainder is verbatim */
+        if (p == 0) {
+            mLineStart = false;
+            return size;
+        }
+
+        /* line break at the end of the chunk - dot might follow
+         * in the next chunk
+         */
+        if (++p == end) {
+            mLineStart = true;
+            return size;
+        }
+
+        /* split the span in front of the dot */
+        if (*p == '.') {
+            mLineStart = false;
+            *stuff = true;
+            return static_cast<int>(p - data);
+        }
+    }
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,46 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILDOTSTUFFER_P_H
+#define QSRMAILDOTSTUFFER_P_H
+
+#include <QtGlobal>
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailDotStuffer
+{
+public:
+    QsrMailDotStuffer();
+
+    void reset();
+    int scan(const char *data, int size, bool *stuff);
+
+    inline bool atLineStart() const
+    { return mLineStart; }
+
+private:
+    bool mLineStart;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILDOTSTUFFER_P_H
@@ -0,0 +1,327 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \class QsrMailEncoderCache qsrmailencodercache.h <QsrMailEncoderCache>
+ * \brief This class controls the process wide cache of encoded part bodies.
+ *
+ * When the same attachment is sent with many messages the renderer encodes
+ * the very same data over and over again. With the cache enabled the
+ * Base64 or quoted printable output of a QsrMailMimePart body is recorded
+ * the first time it is rendered and streamed from the cache for every
+ * following message.
+ *
+ * Entries are content addressed: bodies supplied as QByteArray are keyed by
+ * their SHA-1 hash, bodies supplied as QFile by file name, size and
+ * modification time. Other devices are never cached. Together with the
+ * encoder this makes up the key.
+ *
+ * The memory used by the cache is bounded by maxMemorySize(); bodies which
+ * encode to more than a quarter of it are not cached at all. If a
+ * diskCachePath() is set every entry is also written to that directory and
+ * served from disk after it has been dropped from memory. The directory is
+ * not cleaned up by the library.
+ *
+ * The cache is disabled by default. All methods are thread-safe.
+ *
+ * Example:
+ * \code
+ * QsrMailEncoderCache::setMaxMemorySize(64 * 1024 * 1024);
+ * QsrMailEncoderCache::setEnabled(true);
+ *
+ * QsrMailMimePart brochure(QsrMailMimePart::fromFile("brochure.pdf"));
+ * foreach (const QsrMailAddress &rcpt, recipients) {
+ *     QsrMailMessage msg;
+ *     ...
+ *     // the brochure is encoded only once
+ *     tsp->queueMessage(msg);
+ * }
+ * \endcode
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailEncoderCachePrivate qsrmailencodercache_p.h
+ * \brief Implementation of the encoder cache used by QsrMailRenderer.
+ */
+
+#include "qsrmailencodercache.h"
+#include "qsrmailencodercache_p.h"
+#include "qsrmailabstractpart_p.h"
+
+#include <QCryptographicHash>
+#include <QStringBuilder>
+#include <QFileDevice>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QDir>
+
+#include <limits>
+
+QT_BEGIN_NAMESPACE
+
+Q_GLOBAL_STATIC(QsrMailEncoderCachePrivate, encoderCache)
+
+/*!
+ * \internal
+ *
+ * Construct the cache data. The cache is disabled and bounded to 32MB.
+ */
+QsrMailEncoderCachePrivate::QsrMailEncoderCachePrivate() :
+    enabled(false),
+    memory(32 * 1024 * 1024)
+{
+}
+
+/*!
+ * \internal
+ *
+ * Returns the process wide instance of the cache.
+ */
+QsrMailEncoderCachePrivate *QsrMailEncoderCachePrivate::instance()
+{
+    return encoderCache();
+}
+
+/*!
+ * \internal
+ *
+ * Returns the cache key for the body of the part *p* encoded with
+ * *encoder*. A null QByteArray is returned if the cache is disabled
+ * or the body cannot be cached.
+ *
+ * The hash of a QByteArray body is stored within the part, so parts shared
+ * by many messages are hashed only once.
+ */
+QByteArray QsrMailEncoderCachePrivate::cacheKey(
+        const QsrMailAbstractPartPrivate *p,
+        QsrMailMimePart::Encoder encoder)
+{
+    QByteArray hash;
+
+    {
+        QMutexLocker lock(&mutex);
+        if (!enabled)
+            return QByteArray();
+
+        hash = p->bodyHash;
+    }
+
+    if (p->bodyDevice == 0) {
+        /* don't bother hashing bodies which would not be cached anyway */
+        if (p->body.size() > maxEntrySize() / 2)
+            return QByteArray();
+
+        if (hash.isEmpty()) {
+            hash = QCryptographicHash::hash(p->body, QCryptographicHash::Sha1);
+
+            QMutexLocker lock(&mutex);
+            p->bodyHash = hash;
+        }
+    } else {
+        /* files are identified by name, size and modification time */
+        QFileDevice *file = qobject_cast<QFileDevice *>(p->bodyDevice);
+        if (file == 0 || file->fileName().isEmpty())
+            return QByteArray();
+
+        QFileInfo info(file->fileName());
+        if (!info.exists() || info.size() > maxEntrySize() / 2)
+            return QByteArray();
+
+        hash = QCryptographicHash::hash(
+                    info.absoluteFilePath().toUtf8()
+                    % '\0' % QByteArray::number(info.size())
+                    % '\0' % QByteArray::number(
+                        info.lastModified().toMSecsSinceEpoch()),
+                    QCryptographicHash::Sha1);
+    }
+
+    return hash.toHex() % '-' % QByteArray::number(encoder);
+}
+
+/*!
+ * \internal
+ *
+ * Look up the encoded data for *key*. On a memory hit *data* is set to the
+ * cached data, on a disk hit *fileName* is set to the file holding the data.
+ * Returns false if the key is not cached.
+ */
+bool QsrMailEncoderCachePrivate::lookup(const QByteArray &key,
+                                        QByteArray *data, QString *fileName)
+{
+    QMutexLocker lock(&mutex);
+
+    QByteArray *cached = memory.object(key);
+    if (cached != 0) {
+        *data = *cached;
+        return true;
+    }
+
+    if (!diskPath.isEmpty()) {
+        QString name(diskFileName(key));
+        if (QFile::exists(name)) {
+            *fileName = name;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*!
+ * \internal
+ *
+ * Insert the encoded *data* for *key*. The data is also written to the disk
+ * cache, if one is set up.
+ */
+void QsrMailEncoderCachePrivate::insert(const QByteArray &key,
+                                        const QByteArray &data)
+{
+    QString name;
+
+    {
+        QMutexLocker lock(&mutex);
+        if (!enabled)
+            return;
+
+        memory.insert(key, new QByteArray(data), data.size());
+
+        if (!diskPath.isEmpty())
+            name = diskFileName(key);
+    }
+
+    /* written atomically, so concurrent lookups never see partial files */
+    if (!name.isEmpty() && !QFile::exists(name)) {
+        QSaveFile file(name);
+        if (file.open(QIODevice::WriteOnly)) {
+            file.write(data);
+            file.commit();
+        }
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Returns the maximum size of the encoded data of a single entry.
+ */
+qint64 QsrMailEncoderCachePrivate::maxEntrySize() const
+{
+    QMutexLocker lock(&mutex);
+    return memory.maxCost() / 4;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the name of the file holding the data for *key* in the disk cache.
+ */
+QString QsrMailEncoderCachePrivate::diskFileName(const QByteArray &key) const
+{
+    return diskPath % QLatin1Char('/') % QString::fromLatin1(key)
+            % QLatin1String(".enc");
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * Enable or disable the cache. Disabling the cache does not drop the cached
+ * data; use clear() for that.
+ */
+void QsrMailEncoderCache::setEnabled(bool enabled)
+{
+    QsrMailEncoderCachePrivate *d = QsrMailEncoderCachePrivate::instance();
+    QMutexLocker lock(&d->mutex);
+    d->enabled = enabled;
+}
+
+/*!
+ * Returns true if the cache is enabled.
+ */
+bool QsrMailEncoderCache::isEnabled()
+{
+    QsrMailEncoderCachePrivate *d = QsrMailEncoderCachePrivate::instance();
+    QMutexLocker lock(&d->mutex);
+    return d->enabled;
+}
+
+/*!
+ * Set the maximum *size* in bytes of the encoded data kept in memory. The
+ * least recently used entries are dropped if the size is exceeded. If not
+ * specified the size is 32MB.
+ */
+void QsrMailEncoderCache::setMaxMemorySize(qint64 size)
+{
+    QsrMailEncoderCachePrivate *d = QsrMailEncoderCachePrivate::instance();
+    QMutexLocker lock(&d->mutex);
+    d->memory.setMaxCost(static_cast<int>(qBound(Q_INT64_C(0), size,
+            static_cast<qint64>(std::numeric_limits<int>::max()))));
+}
+
+/*!
+ * Returns the maximum size of the encoded data kept in memory.
+ */
+qint64 QsrMailEncoderCache::maxMemorySize()
+{
+    QsrMailEncoderCachePrivate *d = QsrMailEncoderCachePrivate::instance();
+    QMutexLocker lock(&d->mutex);
+    return d->memory.maxCost();
+}
+
+/*!
+ * Set the directory *path* where encoded data is stored in addition to the
+ * memory. The directory is created if it does not exist. Pass an empty
+ * string (the default) to disable the disk cache.
+ */
+void QsrMailEncoderCache::setDiskCachePath(const QString &path)
+{
+    if (!path.isEmpty())
+        QDir().mkpath(path);
+
+    QsrMailEncoderCachePrivate *d = QsrMailEncoderCachePrivate::instance();
+    QMutexLocker lock(&d->mutex);
+    d->diskPath = path.isEmpty() ? QString() : QDir(path).absolutePath();
+}
+
+/*!
+ * Returns the directory of the disk cache or an empty string if the disk
+ * cache is disabled.
+ */
+QString QsrMailEncoderCache::diskCachePath()
+{
+    QsrMailEncoderCachePrivate *d = QsrMailEncoderCachePrivate::instance();
+    QMutexLocker lock(&d->mutex);
+    return d->diskPath;
+}
+
+/*!
+ * Drop all data from the memory cache. Files in the disk cache are left
+ * untouched.
+ */
+void QsrMailEncoderCache::clear()
+{
+    QsrMailEncoderCachePrivate *d = QsrMailEncoderCachePrivate::instance();
+    QMutexLocker lock(&d->mutex);
+    d->memory.clear();
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,51 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILENCODERCACHE_H
+#define QSRMAILENCODERCACHE_H
+
+#include "qsrmailglobal.h"
+
+#include <QString>
+
+QT_BEGIN_NAMESPACE
+
+class QSRMAILSHARED_EXPORT QsrMailEncoderCache
+{
+public:
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+
+    static void setMaxMemorySize(qint64 size);
+    static qint64 maxMemorySize();
+
+    static void setDiskCachePath(const QString &path);
+    static QString diskCachePath();
+
+    static void clear();
+
+private:
+    QsrMailEncoderCache();
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILENCODERCACHE_H
@@ -0,0 +1,59 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILENCODERCACHE_P_H
+#define QSRMAILENCODERCACHE_P_H
+
+#include "qsrmailencodercache.h"
+#include "qsrmailmimepart.h"
+
+#include <QCache>
+#include <QMutex>
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailAbstractPartPrivate;
+class QsrMailEncoderCachePrivate
+{
+public:
+    QsrMailEncoderCachePrivate();
+
+    static QsrMailEncoderCachePrivate *instance();
+
+    QByteArray cacheKey(const QsrMailAbstractPartPrivate *p,
+                        QsrMailMimePart::Encoder encoder);
+    bool lookup(const QByteArray &key, QByteArray *data, QString *fileName);
+    void insert(const QByteArray &key, const QByteArray &data);
+    qint64 maxEntrySize() const;
+
+private:
+    QString diskFileName(const QByteArray &key) const;
+
+public:
+    mutable QMutex mutex;
+    bool enabled;
+    QCache<QByteArray, QByteArray> memory;
+    QString diskPath;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILENCODERCACHE_P_H
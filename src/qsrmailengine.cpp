@@ -0,0 +1,860 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \class QsrMailEngine
+ * \brief Delivers messages to a server using transports on several threads.
+ *
+ * A QsrMailTransport, its socket and the renderers of its messages live in
+ * a single thread, which limits the TLS and encoding work of a process to
+ * one core. The engine runs shardCount() worker threads instead. Every
+ * shard owns up to connectionsPerShard() keep-alive transports, each with
+ * its own buffer pool, delivering to the server set by setServer().
+ *
+ * Messages are submitted with submit(), which may be called from any
+ * thread. The transactions are put into the backlog of a shard and handed
+ * to its transports in small batches whenever a transport is idle. So a
+ * transport stuck on a slow session only holds the messages of its
+ * current batch; a shard without work steals from the backlog of the
+ * shard with the longest one.
+ *
+ * The settings of the engine are applied to the transports when they are
+ * created and have to be set before the first message is submitted. The
+ * bodies of submitted messages have to be in memory or in files, since
+ * they are read on the threads of the shards.
+ *
+ * Example:
+ * \code
+ * QsrMailEngine *engine = new QsrMailEngine();
+ * engine->setServer("mail.server.foo");
+ *
+ * connect(engine, &QsrMailEngine::transactionFinished,
+ *         this, &Foo::deliveryFinished);
+ *
+ * foreach (const QsrMailMessage &msg, messages)
+ *     engine->submit(msg);
+ * \endcode
+ *
+ * \sa QsrMailTransportPool
+ */
+
+/*!
+ * \fn QsrMailEngine::transactionFinished(QsrMailTransaction *transaction)
+ *
+ * This signal is emitted when a message delivery has been completed by any
+ * of the shards. The *transaction* lives in the thread of its shard. It is
+ * the developers responsibilty to dispose the transaction using
+ * deleteLater().
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailEnginePrivate qsrmailengine_p.h
+ * \brief The implementation and private data class of the QsrMailEngine
+ * class.
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailEngineShard qsrmailengine_p.h
+ * \brief A worker thread of the QsrMailEngine with its transports.
+ *
+ * The shard lives in its own thread, except for submit(), steal() and
+ * backlog() which are called by other threads and guarded by a mutex.
+ * Submitted transactions have no thread affinity, so the thread of the
+ * shard which takes them can pull them over with moveToThread() and hand
+ * them to one of its transports.
+ */
+
+#include "qsrmailengine.h"
+#include "qsrmailengine_p.h"
+
+#include "qsrmailtransaction_p.h"
+#include "qsrmailtransport_p.h"
+#include "qsrmailmessage.h"
+#include "qsrmailrenderer_p.h"
+
+#include <QThread>
+
+QT_BEGIN_NAMESPACE
+
+/* number of transactions handed to an idle transport at once */
+#define SHARD_BATCH 16
+
+/*!
+ * \internal
+ *
+ * Construct a data class for QsrMailEnginePrivate from *qq*.
+ */
+QsrMailEnginePrivate::QsrMailEnginePrivate(QsrMailEngine *qq) :
+    q_ptr(qq),
+    nextShard(0),
+    statistics(new QsrMailStatisticsCounters),
+    connectionsPerShard(2),
+    serverPort(25),
+    authMech(QsrMailTransport::AutoSelectMech),
+    systemIdentifier("localhost"),
+    timeout(6000),
+    connectTimeout(0),
+    dataTimeout(0),
+    notifyInterval(0),
+    messageRate(0),
+    recipientRate(0),
+    maxServerConnections(0),
+    tlsLevel(QsrMailTransport::TlsOptional),
+    sslConfigurationSet(false)
+{
+}
+
+/*!
+ * \internal
+ *
+ * Relays the transactions finished by the shards.
+ */
+void QsrMailEnginePrivate::_q_transactionFinished(
+        QsrMailTransaction *transaction)
+{
+    Q_Q(QsrMailEngine);
+    emit q->transactionFinished(transaction);
+}
+
+/*!
+ * \internal
+ *
+ * Select the shard for a new transaction. Shards with an idle transport
+ * are preferred, otherwise the one with the shortest backlog is used.
+ * Shards are scanned round robin, so ties are spread evenly.
+ */
+QsrMailEngineShard *QsrMailEnginePrivate::selectShard()
+{
+    int size = shards.size();
+    int start = nextShard.fetchAndAddRelaxed(1) % size;
+    if (start < 0)
+        start += size;
+
+    QsrMailEngineShard *result = 0;
+    int shortest = 0;
+    for (int i=0; i<size; ++i) {
+        QsrMailEngineShard *shard = shards.at((start + i) % size);
+        if (shard->isHungry())
+            return shard;
+
+        int backlog = shard->backlog();
+        if (result == 0 || backlog < shortest) {
+            result = shard;
+            shortest = backlog;
+        }
+    }
+
+    return result;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the shard with the longest backlog other than *thief* or 0 if
+ * all of them are empty.
+ */
+QsrMailEngineShard *QsrMailEnginePrivate::selectVictim(
+        const QsrMailEngineShard *thief) const
+{
+    QsrMailEngineShard *result = 0;
+    int longest = 0;
+    foreach (QsrMailEngineShard *shard, shards) {
+        if (shard == thief)
+            continue;
+
+        int backlog = shard->backlog();
+        if (backlog > longest) {
+            result = shard;
+            longest = backlog;
+        }
+    }
+
+    return result;
+}
+
+/*!
+ * \internal
+ *
+ * Apply the engine settings to *transport*. Is called by the shards in
+ * their threads.
+ */
+void QsrMailEnginePrivate::setupTransport(QsrMailTransport *transport) const
+{
+    transport->setUser(username);
+    transport->setPassword(password);
+    transport->setAuthMech(authMech);
+    transport->setSystemIdentifier(systemIdentifier);
+    transport->setTimeout(timeout);
+    transport->setConnectTimeout(connectTimeout);
+    transport->setDataTimeout(dataTimeout);
+    transport->setNotificationInterval(notifyInterval);
+    transport->setMessageRate(messageRate);
+    transport->setRecipientRate(recipientRate);
+    transport->setMaxServerConnections(maxServerConnections);
+    transport->setTlsLevel(tlsLevel);
+    transport->setKeepAlive(true);
+
+    if (sslConfigurationSet)
+        transport->setSslConfiguration(sslConfiguration);
+
+    /* the transport adds its counters to the ones of the engine */
+    transport->d_func()->statistics.parent = statistics;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * \internal
+ *
+ * Construct a shard of *engine*. The shard creates its transports not
+ * before it gets work.
+ */
+QsrMailEngineShard::QsrMailEngineShard(QsrMailEnginePrivate *engine) :
+    mEngine(engine),
+    mWakePending(0),
+    mHungry(1)
+{
+}
+
+/*!
+ * \internal
+ *
+ * Destroys the shard, its transports and the transactions of its backlog.
+ */
+QsrMailEngineShard::~QsrMailEngineShard()
+{
+    qDeleteAll(mBacklog);
+}
+
+/*!
+ * \internal
+ *
+ * Add *transaction* to the backlog and wake the shard. This may be called
+ * from any thread.
+ */
+void QsrMailEngineShard::submit(QsrMailTransaction *transaction)
+{
+    {
+        QMutexLocker lock(&mMutex);
+        mBacklog.enqueue(transaction);
+    }
+
+    /* a single wakeup is pending at most */
+    if (mWakePending.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "schedule", Qt::QueuedConnection);
+}
+
+/*!
+ * \internal
+ *
+ * Take up to half of the backlog, at most *count* transactions, from its
+ * end. This may be called from any thread.
+ */
+QList<QsrMailTransaction *> QsrMailEngineShard::steal(int count)
+{
+    QList<QsrMailTransaction *> result;
+
+    QMutexLocker lock(&mMutex);
+    count = qMin(count, (mBacklog.size() + 1) / 2);
+    while (count-- > 0)
+        result.prepend(mBacklog.takeLast());
+
+    return result;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the number of transactions waiting in the backlog. This may be
+ * called from any thread.
+ */
+int QsrMailEngineShard::backlog() const
+{
+    QMutexLocker lock(&mMutex);
+    return mBacklog.size();
+}
+
+/*!
+ * \internal
+ *
+ * Hand the backlog to the idle transports. Creates the transports on first
+ * use.
+ */
+void QsrMailEngineShard::schedule()
+{
+    mWakePending.store(0);
+
+    while (mSlots.size() < qMax(mEngine->connectionsPerShard, 1)) {
+        Slot s;
+        s.transport = new QsrMailTransport(this);
+        mEngine->setupTransport(s.transport);
+
+        connect(s.transport, SIGNAL(idle()), this, SLOT(transportIdle()));
+        connect(s.transport, SIGNAL(finished()),
+                this, SLOT(transportFinished()));
+        connect(s.transport,
+                SIGNAL(transactionFinished(QsrMailTransaction*)),
+                this, SLOT(relayTransaction(QsrMailTransaction*)));
+        connect(s.transport,
+                SIGNAL(transactionsFinished(QVector<QsrMailTransaction*>)),
+                this,
+                SLOT(relayTransactions(QVector<QsrMailTransaction*>)));
+
+        mSlots.append(s);
+    }
+
+    dispatch();
+}
+
+/*!
+ * \internal
+ *
+ * A keep-alive session has delivered its batch and waits for more.
+ */
+void QsrMailEngineShard::transportIdle()
+{
+    Slot *s = slot(sender());
+    if (s == 0)
+        return;
+
+    s->busy = false;
+    dispatch();
+}
+
+/*!
+ * \internal
+ *
+ * A session has been closed, either after its idle timeout or because
+ * the connection failed. The next batch opens a new session.
+ */
+void QsrMailEngineShard::transportFinished()
+{
+    Slot *s = slot(sender());
+    if (s == 0)
+        return;
+
+    s->busy = false;
+    s->running = false;
+    dispatch();
+}
+
+/*!
+ * \internal
+ *
+ * Relays the finished *transaction* to the engine.
+ */
+void QsrMailEngineShard::relayTransaction(QsrMailTransaction *transaction)
+{
+    emit transactionFinished(transaction);
+}
+
+/*!
+ * \internal
+ *
+ * Relays the *transactions* a transport finished with a notification
+ * interval to the engine.
+ */
+void QsrMailEngineShard::relayTransactions(
+        const QVector<QsrMailTransaction *> &transactions)
+{
+    foreach (QsrMailTransaction *t, transactions)
+        emit transactionFinished(t);
+}
+
+/*!
+ * \internal
+ *
+ * Returns the slot of *transport* or 0 if it is not one of the shard.
+ */
+QsrMailEngineShard::Slot *QsrMailEngineShard::slot(QObject *transport)
+{
+    for (int i=0, size=mSlots.size(); i<size; ++i) {
+        if (mSlots.at(i).transport == transport)
+            return &mSlots[i];
+    }
+
+    return 0;
+}
+
+/*!
+ * \internal
+ *
+ * Take up to *count* transactions from the front of the own backlog.
+ */
+QList<QsrMailTransaction *> QsrMailEngineShard::take(int count)
+{
+    QList<QsrMailTransaction *> result;
+
+    QMutexLocker lock(&mMutex);
+    while (count-- > 0 && !mBacklog.isEmpty())
+        result.append(mBacklog.dequeue());
+
+    return result;
+}
+
+/*!
+ * \internal
+ *
+ * Hand the next batch to the transport of *s*, taken from the own backlog
+ * or stolen from another shard. Returns false if there is no work left.
+ */
+bool QsrMailEngineShard::refill(Slot *s)
+{
+    QList<QsrMailTransaction *> batch = take(SHARD_BATCH);
+    if (batch.isEmpty()) {
+        QsrMailEngineShard *victim = mEngine->selectVictim(this);
+        if (victim != 0)
+            batch = victim->steal(SHARD_BATCH);
+    }
+
+    if (batch.isEmpty())
+        return false;
+
+    QsrMailTransportPrivate *p = s->transport->d_func();
+    foreach (QsrMailTransaction *t, batch) {
+        /* transactions without thread affinity may be pulled over */
+        t->moveToThread(thread());
+        p->queueTransaction(t);
+    }
+
+    s->busy = true;
+    if (!s->running) {
+        s->running = true;
+        s->transport->sendMessages(mEngine->serverHostname,
+                                   mEngine->serverPort);
+    }
+
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Refill all idle transports. The shard is hungry if a transport is left
+ * without work, which makes it the preferred target of new transactions.
+ */
+void QsrMailEngineShard::dispatch()
+{
+    bool hungry = false;
+    for (int i=0, size=mSlots.size(); i<size; ++i) {
+        Slot *s = &mSlots[i];
+        if (!s->busy && !refill(s))
+            hungry = true;
+    }
+
+    mHungry.store(hungry ? 1 : 0);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * Creates an engine with *shards* worker threads as child of *parent*. By
+ * default one shard per core is started.
+ */
+QsrMailEngine::QsrMailEngine(int shards, QObject *parent) :
+    QObject(parent),
+    d_ptr(new QsrMailEnginePrivate(this))
+{
+    Q_D(QsrMailEngine);
+
+    qRegisterMetaType<QsrMailTransaction *>();
+
+    if (shards <= 0)
+        shards = qMax(QThread::idealThreadCount(), 1);
+
+    for (int i=0; i<shards; ++i) {
+        QThread *thread = new QThread(this);
+        QsrMailEngineShard *shard = new QsrMailEngineShard(d);
+        shard->moveToThread(thread);
+
+        connect(thread, SIGNAL(finished()), shard, SLOT(deleteLater()));
+        connect(shard, SIGNAL(transactionFinished(QsrMailTransaction*)),
+                this, SLOT(_q_transactionFinished(QsrMailTransaction*)));
+
+        d->threads.append(thread);
+        d->shards.append(shard);
+        thread->start();
+    }
+}
+
+/*!
+ * Destroys the engine. The worker threads are stopped, which drops the
+ * sessions of the transports and destroys them together with their
+ * transactions. Messages which have not been delivered yet are dropped.
+ */
+QsrMailEngine::~QsrMailEngine()
+{
+    Q_D(QsrMailEngine);
+
+    foreach (QThread *thread, d->threads)
+        thread->quit();
+    foreach (QThread *thread, d->threads)
+        thread->wait();
+}
+
+/*!
+ * Returns the number of worker threads.
+ */
+int QsrMailEngine::shardCount() const
+{
+    Q_D(const QsrMailEngine);
+    return d->shards.size();
+}
+
+/*!
+ * Set the number of *connections* every shard opens to the server. The
+ * default is 2 connections. Values below 1 are treated as 1.
+ */
+void QsrMailEngine::setConnectionsPerShard(int connections)
+{
+    Q_D(QsrMailEngine);
+    d->connectionsPerShard = qMax(connections, 1);
+}
+
+/*!
+ * Returns the number of connections every shard opens to the server.
+ */
+int QsrMailEngine::connectionsPerShard() const
+{
+    Q_D(const QsrMailEngine);
+    return d->connectionsPerShard;
+}
+
+/*!
+ * Set the *hostname* and *port* of the server all messages are delivered
+ * to.
+ */
+void QsrMailEngine::setServer(const QString &hostname, quint16 port)
+{
+    Q_D(QsrMailEngine);
+    d->serverHostname = hostname;
+    d->serverPort = port;
+}
+
+/*!
+ * Returns the hostname of the server.
+ */
+QString QsrMailEngine::serverHostname() const
+{
+    Q_D(const QsrMailEngine);
+    return d->serverHostname;
+}
+
+/*!
+ * Returns the port of the server.
+ */
+quint16 QsrMailEngine::serverPort() const
+{
+    Q_D(const QsrMailEngine);
+    return d->serverPort;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setUser()
+ */
+void QsrMailEngine::setUser(const QString &username)
+{
+    Q_D(QsrMailEngine);
+    d->username = username;
+}
+
+/*!
+ * \copydoc QsrMailTransport::user()
+ */
+QString QsrMailEngine::user() const
+{
+    Q_D(const QsrMailEngine);
+    return d->username;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setPassword()
+ */
+void QsrMailEngine::setPassword(const QString &passwd)
+{
+    Q_D(QsrMailEngine);
+    d->password = passwd;
+}
+
+/*!
+ * \copydoc QsrMailTransport::password()
+ */
+QString QsrMailEngine::password() const
+{
+    Q_D(const QsrMailEngine);
+    return d->password;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setAuthMech()
+ */
+void QsrMailEngine::setAuthMech(QsrMailTransport::AuthMech mechanism)
+{
+    Q_D(QsrMailEngine);
+    d->authMech = mechanism;
+}
+
+/*!
+ * \copydoc QsrMailTransport::authMech()
+ */
+QsrMailTransport::AuthMech QsrMailEngine::authMech() const
+{
+    Q_D(const QsrMailEngine);
+    return d->authMech;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setSystemIdentifier()
+ */
+void QsrMailEngine::setSystemIdentifier(const QByteArray &value)
+{
+    Q_D(QsrMailEngine);
+    d->systemIdentifier = value;
+}
+
+/*!
+ * \copydoc QsrMailTransport::systemIdentifier()
+ */
+QByteArray QsrMailEngine::systemIdentifier() const
+{
+    Q_D(const QsrMailEngine);
+    return d->systemIdentifier;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setTimeout()
+ */
+void QsrMailEngine::setTimeout(int timeout)
+{
+    Q_D(QsrMailEngine);
+    d->timeout = timeout;
+}
+
+/*!
+ * \copydoc QsrMailTransport::timeout()
+ */
+int QsrMailEngine::timeout() const
+{
+    Q_D(const QsrMailEngine);
+    return d->timeout;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setConnectTimeout()
+ */
+void QsrMailEngine::setConnectTimeout(int timeout)
+{
+    Q_D(QsrMailEngine);
+    d->connectTimeout = timeout;
+}
+
+/*!
+ * \copydoc QsrMailTransport::connectTimeout()
+ */
+int QsrMailEngine::connectTimeout() const
+{
+    Q_D(const QsrMailEngine);
+    return d->connectTimeout;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setDataTimeout()
+ */
+void QsrMailEngine::setDataTimeout(int timeout)
+{
+    Q_D(QsrMailEngine);
+    d->dataTimeout = timeout;
+}
+
+/*!
+ * \copydoc QsrMailTransport::dataTimeout()
+ */
+int QsrMailEngine::dataTimeout() const
+{
+    Q_D(const QsrMailEngine);
+    return d->dataTimeout;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setNotificationInterval()
+ *
+ * The engine still reports every transaction by transactionFinished().
+ */
+void QsrMailEngine::setNotificationInterval(int msecs)
+{
+    Q_D(QsrMailEngine);
+    d->notifyInterval = qMax(msecs, 0);
+}
+
+/*!
+ * \copydoc QsrMailTransport::notificationInterval()
+ */
+int QsrMailEngine::notificationInterval() const
+{
+    Q_D(const QsrMailEngine);
+    return d->notifyInterval;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setMessageRate()
+ */
+void QsrMailEngine::setMessageRate(double messages)
+{
+    Q_D(QsrMailEngine);
+    d->messageRate = qMax(messages, 0.0);
+}
+
+/*!
+ * \copydoc QsrMailTransport::messageRate()
+ */
+double QsrMailEngine::messageRate() const
+{
+    Q_D(const QsrMailEngine);
+    return d->messageRate;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setRecipientRate()
+ */
+void QsrMailEngine::setRecipientRate(double recipients)
+{
+    Q_D(QsrMailEngine);
+    d->recipientRate = qMax(recipients, 0.0);
+}
+
+/*!
+ * \copydoc QsrMailTransport::recipientRate()
+ */
+double QsrMailEngine::recipientRate() const
+{
+    Q_D(const QsrMailEngine);
+    return d->recipientRate;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setMaxServerConnections()
+ */
+void QsrMailEngine::setMaxServerConnections(int connections)
+{
+    Q_D(QsrMailEngine);
+    d->maxServerConnections = qMax(connections, 0);
+}
+
+/*!
+ * \copydoc QsrMailTransport::maxServerConnections()
+ */
+int QsrMailEngine::maxServerConnections() const
+{
+    Q_D(const QsrMailEngine);
+    return d->maxServerConnections;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setTlsLevel()
+ */
+void QsrMailEngine::setTlsLevel(QsrMailTransport::TlsLevel level)
+{
+    Q_D(QsrMailEngine);
+    d->tlsLevel = level;
+}
+
+/*!
+ * \copydoc QsrMailTransport::tlsLevel()
+ */
+QsrMailTransport::TlsLevel QsrMailEngine::tlsLevel() const
+{
+    Q_D(const QsrMailEngine);
+    return d->tlsLevel;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setSslConfiguration()
+ */
+void QsrMailEngine::setSslConfiguration(const QSslConfiguration &value)
+{
+    Q_D(QsrMailEngine);
+    d->sslConfiguration = value;
+    d->sslConfigurationSet = true;
+}
+
+/*!
+ * \copydoc QsrMailTransport::sslConfiguration()
+ */
+QSslConfiguration QsrMailEngine::sslConfiguration() const
+{
+    Q_D(const QsrMailEngine);
+    return d->sslConfiguration;
+}
+
+/*!
+ * Returns a snapshot of the delivery counters summed over all transports
+ * of the engine. Like QsrMailTransport::statistics() this may be called
+ * from any thread.
+ */
+QsrMailStatistics QsrMailEngine::statistics() const
+{
+    Q_D(const QsrMailEngine);
+    return d->statistics->snapshot();
+}
+
+/*!
+ * Submit *message* for delivery and return its transaction. This method is
+ * thread-safe.
+ *
+ * The transaction is handed to the transport of a shard later and lives in
+ * the thread of that shard from then on. Connections to its signals are
+ * thus queued, and a transaction which fails right away may finish before
+ * a connection made after submit() is established; transactionFinished()
+ * of the engine reports every transaction.
+ *
+ * The shards read the body of the message on their own threads. Bodies
+ * read from QIODevice objects other than files usually depend on the
+ * event loop of the thread they live in and cannot be read from another
+ * one, so messages with such bodies, including body sources, are refused
+ * and null is returned. Deliver them with a QsrMailTransport living in the
+ * thread of their devices instead.
+ */
+QsrMailTransaction *QsrMailEngine::submit(const QsrMailMessage &message)
+{
+    Q_D(QsrMailEngine);
+
+    if (!QsrMailRenderer::isOffloadable(message)) {
+        qWarning("QsrMailEngine::submit: " \
+                 "bodies have to be in memory or in files");
+        return 0;
+    }
+
+    /* the transaction is pulled over by the thread of the shard taking it */
+    QsrMailTransaction *t = QsrMailTransactionPrivate::createInstance(message,
+                                                                      0);
+    t->moveToThread(0);
+
+    d->selectShard()->submit(t);
+    return t;
+}
+
+QT_END_NAMESPACE
+
+#include "moc_qsrmailengine.cpp"
@@ -0,0 +1,104 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILENGINE_H
+#define QSRMAILENGINE_H
+
+#include "qsrmailglobal.h"
+#include "qsrmailtransport.h"
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailEnginePrivate;
+class QSRMAILSHARED_EXPORT QsrMailEngine : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit QsrMailEngine(int shards = 0, QObject *parent = 0);
+    ~QsrMailEngine();
+
+    int shardCount() const;
+
+    void setConnectionsPerShard(int connections);
+    int connectionsPerShard() const;
+
+    void setServer(const QString &hostname, quint16 port = 25);
+    QString serverHostname() const;
+    quint16 serverPort() const;
+
+    void setUser(const QString &username);
+    QString user() const;
+
+    void setPassword(const QString &passwd);
+    QString password() const;
+
+    void setAuthMech(QsrMailTransport::AuthMech mechanism);
+    QsrMailTransport::AuthMech authMech() const;
+
+    void setSystemIdentifier(const QByteArray &value);
+    QByteArray systemIdentifier() const;
+
+    void setTimeout(int timeout);
+    int timeout() const;
+
+    void setConnectTimeout(int timeout);
+    int connectTimeout() const;
+
+    void setDataTimeout(int timeout);
+    int dataTimeout() const;
+
+    void setNotificationInterval(int msecs);
+    int notificationInterval() const;
+
+    void setMessageRate(double messages);
+    double messageRate() const;
+
+    void setRecipientRate(double recipients);
+    double recipientRate() const;
+
+    void setMaxServerConnections(int connections);
+    int maxServerConnections() const;
+
+    void setTlsLevel(QsrMailTransport::TlsLevel level);
+    QsrMailTransport::TlsLevel tlsLevel() const;
+
+    void setSslConfiguration(const QSslConfiguration &value);
+    QSslConfiguration sslConfiguration() const;
+
+    QsrMailStatistics statistics() const;
+
+    QsrMailTransaction *submit(const QsrMailMessage &message);
+
+Q_SIGNALS:
+    void transactionFinished(QsrMailTransaction *transaction);
+
+private:
+    Q_DECLARE_PRIVATE(QsrMailEngine)
+
+    QScopedPointer<QsrMailEnginePrivate> d_ptr;
+
+    Q_PRIVATE_SLOT(d_func(), void _q_transactionFinished(QsrMailTransaction *))
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILENGINE_H
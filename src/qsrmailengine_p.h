@@ -0,0 +1,139 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILENGINE_P_H
+#define QSRMAILENGINE_P_H
+
+#include "qsrmailengine.h"
+#include "qsrmailstatistics_p.h"
+
+#include <QAtomicInt>
+#include <QList>
+#include <QMutex>
+#include <QQueue>
+#include <QSharedPointer>
+#include <QSslConfiguration>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+
+class QThread;
+class QsrMailEngineShard;
+
+class QsrMailEngine;
+class QsrMailEnginePrivate
+{
+public:
+    explicit QsrMailEnginePrivate(QsrMailEngine *qq);
+
+    void _q_transactionFinished(QsrMailTransaction *transaction);
+
+    QsrMailEngineShard *selectShard();
+    QsrMailEngineShard *selectVictim(const QsrMailEngineShard *thief) const;
+    void setupTransport(QsrMailTransport *transport) const;
+
+public:
+    Q_DECLARE_PUBLIC(QsrMailEngine)
+
+    /* instance data */
+    QsrMailEngine *q_ptr;
+    QList<QThread *> threads;
+    QList<QsrMailEngineShard *> shards;
+    QAtomicInt nextShard;
+    QSharedPointer<QsrMailStatisticsCounters> statistics;
+
+    /* member data */
+    int connectionsPerShard;
+    QString serverHostname;
+    quint16 serverPort;
+    QString username;
+    QString password;
+    QsrMailTransport::AuthMech authMech;
+    QByteArray systemIdentifier;
+    int timeout;
+    int connectTimeout;
+    int dataTimeout;
+    int notifyInterval;
+    double messageRate;
+    double recipientRate;
+    int maxServerConnections;
+    QsrMailTransport::TlsLevel tlsLevel;
+    QSslConfiguration sslConfiguration;
+    bool sslConfigurationSet;
+};
+
+class QsrMailEngineShard : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit QsrMailEngineShard(QsrMailEnginePrivate *engine);
+    ~QsrMailEngineShard();
+
+    void submit(QsrMailTransaction *transaction);
+    QList<QsrMailTransaction *> steal(int count);
+    int backlog() const;
+
+    inline bool isHungry() const
+    { return mHungry.load() != 0; }
+
+public Q_SLOTS:
+    void schedule();
+
+Q_SIGNALS:
+    void transactionFinished(QsrMailTransaction *transaction);
+
+private Q_SLOTS:
+    void transportIdle();
+    void transportFinished();
+    void relayTransaction(QsrMailTransaction *transaction);
+    void relayTransactions(const QVector<QsrMailTransaction *> &transactions);
+
+private:
+    struct Slot
+    {
+        Slot() :
+            transport(0),
+            busy(false),
+            running(false)
+        {}
+
+        QsrMailTransport *transport;
+        bool busy;
+        bool running;
+    };
+
+    Slot *slot(QObject *transport);
+    QList<QsrMailTransaction *> take(int count);
+    bool refill(Slot *s);
+    void dispatch();
+
+    QsrMailEnginePrivate *mEngine;
+    mutable QMutex mMutex;
+    QQueue<QsrMailTransaction *> mBacklog;
+    QAtomicInt mWakePending;
+    QAtomicInt mHungry;
+    QList<Slot> mSlots;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILENGINE_P_H
@@ -0,0 +1,198 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \class QsrMailEnvelope qsrmailenvelope.h <QsrMailEnvelope>
+ * \brief The QsrMailEnvelope class holds the personalised data of a single
+ * delivery of a bulk mailing.
+ *
+ * Bulk mailings send the same message to many recipients. Instead of
+ * building a complete QsrMailMessage for every recipient the message is
+ * used as a template and QsrMailTransport::queueBulk() is called with a
+ * list of envelopes. Every envelope results in a delivery to its
+ * recipients, which replace the To, Cc and Bcc addresses of the template.
+ * The raw headers of the envelope replace the headers of the same name of
+ * the template, including the headers created from the message properties
+ * (eg. Subject).
+ *
+ * The body of the template is rendered and encoded only once and reused for
+ * all envelopes.
+ *
+ * Example:
+ * \code
+ * QsrMailMessage mailing;
+ * mailing.setFrom(QsrMailAddress("news@foo.com"));
+ * mailing.setSubject("Our newsletter");
+ * mailing.setBody(body);
+ *
+ * QList<QsrMailEnvelope> envelopes;
+ * foreach (const Subscriber &s, subscribers) {
+ *     QsrMailEnvelope envelope(QsrMailAddress(s.address, s.name));
+ *     envelope.setRawHeader("List-Unsubscribe", s.unsubscribeUrl);
+ *     envelopes.append(envelope);
+ * }
+ *
+ * tsp->queueBulk(mailing, envelopes);
+ * tsp->sendMessages("mail.foo.com");
+ * \endcode
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailEnvelopePrivate "qsrmailenvelope_p.h"
+ * \brief Private data class for QsrMailEnvelope.
+ */
+
+#include "qsrmailenvelope.h"
+#include "qsrmailenvelope_p.h"
+
+QT_BEGIN_NAMESPACE
+
+/*!
+ * \internal
+ *
+ * Default constructor.
+ */
+QsrMailEnvelopePrivate::QsrMailEnvelopePrivate()
+{
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * Constructs an empty envelope.
+ */
+QsrMailEnvelope::QsrMailEnvelope() :
+    d(new QsrMailEnvelopePrivate)
+{
+}
+
+/*!
+ * Constructs an envelope for the single *recipient*.
+ */
+QsrMailEnvelope::QsrMailEnvelope(const QsrMailAddress &recipient) :
+    d(new QsrMailEnvelopePrivate)
+{
+    d->recipients.append(recipient);
+}
+
+/*!
+ * Construct a copy of *other*. This operation is fast and takes constant
+ * time since QsrMailEnvelope is implicitly shared. Write operations on
+ * the shared data detaches it (copy-on-write).
+ */
+QsrMailEnvelope::QsrMailEnvelope(const QsrMailEnvelope &other) :
+    d(other.d)
+{
+}
+
+/*!
+ * Assigns *other* to this QsrMailEnvelope and returns this instance.
+ */
+QsrMailEnvelope &QsrMailEnvelope::operator=(const QsrMailEnvelope &other)
+{
+    if (d != other.d) {
+        QsrMailEnvelope tmp(other);
+        tmp.swap(*this);
+    }
+
+    return *this;
+}
+
+/*!
+ * Swap this instance with *other*. This function is very fast and
+ * never fails.
+ */
+void QsrMailEnvelope::swap(QsrMailEnvelope &other)
+{
+    qSwap(d, other.d);
+}
+
+/*!
+ * Destroys the instance.
+ */
+QsrMailEnvelope::~QsrMailEnvelope()
+{
+}
+
+/*!
+ * Returns true if the envelope has neither recipients nor headers.
+ */
+bool QsrMailEnvelope::isEmpty() const
+{
+    return d->recipients.isEmpty() && d->headers.isEmpty();
+}
+
+/*!
+ * Set the *recipient* of the envelope. This replaces all recipients.
+ */
+void QsrMailEnvelope::setRecipient(const QsrMailAddress &recipient)
+{
+    d->recipients.clear();
+    d->recipients.append(recipient);
+}
+
+/*!
+ * Set the *recipients* of the envelope. The recipients are used as the To
+ * addresses of the delivered message.
+ */
+void QsrMailEnvelope::setRecipients(const QList<QsrMailAddress> &recipients)
+{
+    d->recipients = recipients;
+}
+
+/*!
+ * Append the *recipient* to the list of recipients.
+ */
+void QsrMailEnvelope::appendRecipient(const QsrMailAddress &recipient)
+{
+    d->recipients.append(recipient);
+}
+
+/*!
+ * Return the recipients of the envelope.
+ */
+QList<QsrMailAddress> QsrMailEnvelope::recipients() const
+{
+    return d->recipients;
+}
+
+/*!
+ * Set the raw header *name* to *value*. The header replaces all headers of
+ * the same name of the template message. The value must be RFC compliant
+ * encoded. Passing a null *value* removes the header from the envelope.
+ */
+void QsrMailEnvelope::setRawHeader(const QByteArray &name,
+                                   const QByteArray &value)
+{
+    d->headers.setHeader(name, value);
+}
+
+/*!
+ * Return the value of the raw header *name* of the envelope.
+ */
+QByteArray QsrMailEnvelope::rawHeader(const QByteArray &name) const
+{
+    return d->headers.value(name);
+}
+
+QT_END_NAMESPACE
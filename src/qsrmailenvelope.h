@@ -0,0 +1,62 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILENVELOPE_H
+#define QSRMAILENVELOPE_H
+
+#include "qsrmailglobal.h"
+#include <QByteArray>
+#include <QList>
+#include <QSharedDataPointer>
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailAddress;
+
+class QsrMailEnvelopePrivate;
+class QSRMAILSHARED_EXPORT QsrMailEnvelope
+{
+public:
+    QsrMailEnvelope();
+    explicit QsrMailEnvelope(const QsrMailAddress &recipient);
+    QsrMailEnvelope(const QsrMailEnvelope &other);
+    QsrMailEnvelope &operator=(const QsrMailEnvelope &other);
+    void swap(QsrMailEnvelope &other);
+    virtual ~QsrMailEnvelope();
+
+    bool isEmpty() const;
+
+    void setRecipient(const QsrMailAddress &recipient);
+    void setRecipients(const QList<QsrMailAddress> &recipients);
+    void appendRecipient(const QsrMailAddress &recipient);
+    QList<QsrMailAddress> recipients() const;
+
+    void setRawHeader(const QByteArray &name, const QByteArray &value);
+    QByteArray rawHeader(const QByteArray &name) const;
+
+private:
+    friend class QsrMailRenderer;
+    QSharedDataPointer<QsrMailEnvelopePrivate> d;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILENVELOPE_H
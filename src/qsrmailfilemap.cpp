@@ -0,0 +1,123 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \internal
+ *
+ * \class QsrMailFileMap "qsrmailfilemap_p.h"
+ * \brief Maps a window of a file into memory.
+ *
+ * Attachments read from files are accessed through the mapping instead of
+ * being read into intermediate buffers, so the encoders and the renderer
+ * work on the page cache directly. Only a window of MAP_WINDOW_SIZE bytes
+ * is mapped at a time, which keeps huge files from exhausting the address
+ * space; the window is moved along as the file is processed.
+ *
+ * \note
+ * The file must not be truncated while it is mapped; accessing pages
+ * beyond the end of the file raises SIGBUS on most platforms.
+ */
+
+#include "qsrmailfilemap_p.h"
+
+QT_BEGIN_NAMESPACE
+
+/*!
+ * \internal
+ *
+ * Construct an empty mapping.
+ */
+QsrMailFileMap::QsrMailFileMap() :
+    mData(0),
+    mOffset(0),
+    mSize(0)
+{
+}
+
+/*!
+ * \internal
+ *
+ * Destroy the instance and release the mapping.
+ */
+QsrMailFileMap::~QsrMailFileMap()
+{
+    unmap();
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if *device* is an open, random access file with at least
+ * MAP_THRESHOLD bytes left to read.
+ */
+bool QsrMailFileMap::isMappable(QIODevice *device)
+{
+    QFileDevice *file = qobject_cast<QFileDevice *>(device);
+    if (file == 0 || file->isSequential() || !file->isReadable())
+        return false;
+
+    return file->size() - file->pos() >= MAP_THRESHOLD;
+}
+
+/*!
+ * \internal
+ *
+ * Map the window of *file* starting at *offset*. Returns false if the
+ * file cannot be mapped or *offset* is at the end of the file; the file
+ * has to be read then.
+ */
+bool QsrMailFileMap::map(QFileDevice *file, qint64 offset)
+{
+    unmap();
+
+    qint64 size = qMin(file->size() - offset,
+                       static_cast<qint64>(MAP_WINDOW_SIZE));
+    if (size <= 0)
+        return false;
+
+    mData = file->map(offset, size);
+    if (mData == 0)
+        return false;
+
+    mFile = file;
+    mOffset = offset;
+    mSize = static_cast<int>(size);
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Release the current window. Mappings of files which have been destroyed
+ * already are gone with the file.
+ */
+void QsrMailFileMap::unmap()
+{
+    if (mData != 0 && !mFile.isNull())
+        mFile->unmap(mData);
+
+    mFile = 0;
+    mData = 0;
+    mOffset = 0;
+    mSize = 0;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,70 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILFILEMAP_P_H
+#define QSRMAILFILEMAP_P_H
+
+#include <QFileDevice>
+#include <QPointer>
+
+QT_BEGIN_NAMESPACE
+
+/* files smaller than this are read, mapping them does not pay off */
+#define MAP_THRESHOLD (64*1024)
+
+/* size of the window mapped at once - keeps the address space small */
+#define MAP_WINDOW_SIZE (64*1024*1024)
+
+class QsrMailFileMap
+{
+public:
+    QsrMailFileMap();
+    ~QsrMailFileMap();
+
+    static bool isMappable(QIODevice *device);
+
+    bool map(QFileDevice *file, qint64 offset);
+    void unmap();
+
+    inline bool contains(qint64 pos) const
+    { return mData != 0 && pos >= mOffset && pos < mOffset + mSize; }
+
+    inline const char *data() const
+    { return reinterpret_cast<const char *>(mData); }
+
+    inline qint64 offset() const
+    { return mOffset; }
+
+    inline int size() const
+    { return mSize; }
+
+private:
+    Q_DISABLE_COPY(QsrMailFileMap)
+
+    QPointer<QFileDevice> mFile;
+    uchar *mData;
+    qint64 mOffset;
+    int mSize;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILFILEMAP_P_H
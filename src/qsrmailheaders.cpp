@@ -27,26 +27,261 @@
  *
  * This also provides some helper functions to render the headers directly to a
  * QByteArray buffer.
+ *
+ * The headers are stored in a single arena in their rendered form, so
+ * rendering a set of headers is mostly a matter of copying the arena. Header
+ * names are compared case-insensitive. They are interned to small integers
+ * which index a per instance table pointing to the first and last header of
+ * that name, so lookups do not have to scan the list. The well known names
+ * have fixed ids, other names are cached per thread, so interning a name
+ * usually neither allocates nor locks.
+ *
+ * Values are folded according to RFC5322 section 2.2.3 when they are added,
+ * so no line of a header exceeds HEADER_LINE_LENGTH characters as long as
+ * the value contains whitespace to fold at. This keeps long address lists
+ * and sequences of encoded words acceptable for all relays. value() and
+ * values() return the unfolded value.
+ *
+ * Copies of an instance are implicitly shared. overlay() returns an instance
+ * which shares the headers of the original and records only the changes
+ * made to it, which is what the cookHeaders() implementations use to merge
+ * the properties into the raw headers without copying them.
+ */
+
+#include "qsrmailheaders_p.h"
+
+#include <QHash>
+#include <QMutex>
+#include <QThreadStorage>
+
+#include <string.h>
+
+QT_BEGIN_NAMESPACE
+
+/* recommended maximum length of a header line, excluding CRLF */
+#define HEADER_LINE_LENGTH 78
+
+/* size of the lookup table of the well known header names, a power of 2 */
+#define KNOWN_TABLE_SIZE 64
+
+/* header names with fixed ids, which are their index */
+static const char *const knownNames[] = {
+    "from", "sender", "reply-to", "to", "cc", "bcc", "subject", "date",
+    "message-id", "in-reply-to", "references", "return-path", "received",
+    "user-agent", "mime-version", "content-type",
+    "content-transfer-encoding", "content-disposition", "content-id",
+    "content-description"
+};
+
+#define KNOWN_NAMES int(sizeof(knownNames) / sizeof(knownNames[0]))
+
+/* returns the hash of the lower case version of *name* */
+static uint nameHash(const char *name, int size)
+{
+    uint h = 0;
+    for (int i=0; i<size; ++i) {
+        uchar c = static_cast<uchar>(name[i]);
+        if (c >= 'A' && c <= 'Z')
+            c |= 0x20;
+        h = h * 31 + c;
+    }
+
+    return h;
+}
+
+/* read only hash table of the well known header names, built once */
+struct QsrMailKnownNames
+{
+    struct Slot
+    {
+        int id;
+        int size;
+    };
+
+    QsrMailKnownNames()
+    {
+        for (int i=0; i<KNOWN_TABLE_SIZE; ++i)
+            slots[i].id = -1;
+
+        for (int id=0; id<KNOWN_NAMES; ++id) {
+            const int size = static_cast<int>(qstrlen(knownNames[id]));
+            uint i = nameHash(knownNames[id], size) & (KNOWN_TABLE_SIZE - 1);
+            while (slots[i].id >= 0)
+                i = (i + 1) & (KNOWN_TABLE_SIZE - 1);
+
+            slots[i].id = id;
+            slots[i].size = size;
+        }
+    }
+
+    int find(const char *name, int size) const
+    {
+        uint i = nameHash(name, size) & (KNOWN_TABLE_SIZE - 1);
+        for (; slots[i].id >= 0; i = (i + 1) & (KNOWN_TABLE_SIZE - 1)) {
+            const Slot &slot = slots[i];
+            if (slot.size == size
+                    && qstrnicmp(knownNames[slot.id], name, size) == 0)
+                return slot.id;
+        }
+
+        return -1;
+    }
+
+    Slot slots[KNOWN_TABLE_SIZE];
+};
+
+Q_GLOBAL_STATIC(QsrMailKnownNames, knownNameTable)
+
+/* process wide table of the other interned header names, keyed by the
+ * lower case version of the name
+ */
+struct QsrMailHeaderNames
+{
+    QMutex mutex;
+    QHash<QByteArray, int> names;
+};
+
+Q_GLOBAL_STATIC(QsrMailHeaderNames, headerNames)
+
+/* per thread cache of the process wide table, keyed by the name as it was
+ * passed, so cached names are found without a lock and a lower case copy
+ */
+static QThreadStorage<QHash<QByteArray, int> > headerNameCache;
+
+/*!
+ * \internal
+ *
+ * Appends the header *key* with *value* to the store. *name* is the interned
+ * version of *key*.
+ */
+void QsrMailHeaders::Store::append(int name, const QByteArray &key,
+                                   const QByteArray &value)
+{
+    const int column = key.size() + 2;
+    const int folded = foldValue(value.constData(), value.size(), column, 0);
+
+    Entry entry;
+    entry.name = name;
+    entry.next = -1;
+    entry.offset = arena.size();
+    entry.nameSize = key.size();
+    entry.valueSize = folded;
+    entry.folded = folded != value.size();
+
+    /* store the header in its rendered form; the size is known in advance
+     * so the value is folded straight into the arena
+     */
+    arena.resize(entry.offset + column + folded + 2);
+    char *p = arena.data() + entry.offset;
+
+    memcpy(p, key.constData(), key.size());
+    p += key.size();
+    *p++ = ':';
+    *p++ = ' ';
+    p += foldValue(value.constData(), value.size(), column, p);
+    *p++ = '\r';
+    *p++ = '\n';
+
+    /* grow the index if the name has not been used so far */
+    if (name >= index.size()) {
+        int size = index.size();
+        index.resize(name + 1);
+        for (; size<index.size(); ++size)
+            index[size].first = index[size].last = -1;
+    }
+
+    /* link the entry to the chain of headers with the same name */
+    const int pos = entries.size();
+    Slot &slot = index[name];
+    if (slot.last >= 0)
+        entries[slot.last].next = pos;
+    else
+        slot.first = pos;
+    slot.last = pos;
+
+    entries.append(entry);
+    live++;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the value of *entry*. Line breaks inserted by folding are
+ * removed again.
  */
+QByteArray QsrMailHeaders::Store::value(const Entry &entry) const
+{
+    QByteArray result(arena.mid(entry.offset + entry.nameSize + 2,
+                                entry.valueSize));
+
+    if (entry.folded) {
+        char *s = result.data();
+        char *t = s;
+        const char *end = s + result.size();
+
+        for (; s<end; ++s) {
+            if (*s == '\r' && s+2 < end && s[1] == '\n'
+                    && (s[2] == ' ' || s[2] == '\t')) {
+                ++s;
+                continue;
+            }
+            *t++ = *s;
+        }
+
+        result.truncate(static_cast<int>(t - result.constData()));
+    }
+
+    return result;
+}
 
 /*!
  * \internal
  *
- * \typedef QsrMailHeaders::HeaderPair
- * Represents a header name with a header value. The header name an value
- * must be RFC complient encoded.
+ * Removes all headers with the interned *name* from the store. The data
+ * stays in the arena and is skipped while rendering.
  */
+void QsrMailHeaders::Store::remove(int name)
+{
+    if (name >= index.size())
+        return;
+
+    Slot &slot = index[name];
+    for (int i=slot.first; i>=0; i=entries.at(i).next) {
+        entries[i].name = -1;
+        live--;
+    }
+
+    slot.first = slot.last = -1;
+}
 
 /*!
  * \internal
  *
- * \typedef QsrMailHeaders::HeaderList
- * A list of headers formed of HeaderPairs
+ * Constructs an empty set of headers.
  */
+QsrMailHeaders::QsrMailHeaders() :
+    d(new Store)
+{
+}
 
-#include "qsrmailheaders_p.h"
+/*!
+ * \internal
+ *
+ * Returns a set of headers which initially contains the same headers as
+ * this instance. Changes applied to the returned instance are recorded
+ * separately, the headers of this instance are shared and not copied.
+ */
+QsrMailHeaders QsrMailHeaders::overlay() const
+{
+    /* overlays of overlays are ordinary copies */
+    if (base)
+        return *this;
 
-QT_BEGIN_NAMESPACE
+    QsrMailHeaders result;
+    result.base = d;
+
+    return result;
+}
 
 /*!
  * \internal
@@ -62,20 +297,56 @@ void QsrMailHeaders::setHeader(const QByteArray &name, const QByteArray &value)
         return;
 
     /* remove all instances of the named header */
-    HeaderList::Iterator it(headers.begin());
-    while (it != headers.end()) {
-        if (it->first == name)
-            it = headers.erase(it);
-        else
-            ++it;
-    }
+    const int id = internName(name);
+    if (base)
+        mask(id);
+    if (d->first(id) >= 0)
+        d->remove(id);
 
     /* if value is null the user expects a delete */
     if (value.isNull())
         return;
 
     /* add the new header */
-    headers.append(HeaderPair(name, value));
+    d->append(id, name, value);
+}
+
+/*!
+ * \internal
+ *
+ * Set all headers of the *other* instance in this instance. Headers of this
+ * instance which have the same name as one of the *other* headers are
+ * replaced, all other headers are kept.
+ */
+void QsrMailHeaders::setHeaders(const QsrMailHeaders &other)
+{
+    const Store *stores[2] = { other.base.constData(), other.d.constData() };
+    QBitArray replaced;
+
+    for (int s=0; s<2; ++s) {
+        if (stores[s] == 0)
+            continue;
+
+        foreach (const Entry &entry, stores[s]->entries) {
+            if (entry.name < 0 || (s == 0 && other.isMasked(entry.name)))
+                continue;
+
+            /* drop our own headers on the first occurrence of the name */
+            if (entry.name >= replaced.size())
+                replaced.resize(entry.name + 1);
+            if (!replaced.testBit(entry.name)) {
+                replaced.setBit(entry.name);
+                if (base)
+                    mask(entry.name);
+                if (d->first(entry.name) >= 0)
+                    d->remove(entry.name);
+            }
+
+            d->append(entry.name,
+                      stores[s]->arena.mid(entry.offset, entry.nameSize),
+                      stores[s]->value(entry));
+        }
+    }
 }
 
 /*!
@@ -93,7 +364,7 @@ void QsrMailHeaders::appendHeader(const QByteArray &name,
         return;
 
     /* add the new header */
-    headers.append(HeaderPair(name, value));
+    d->append(internName(name), name, value);
 }
 
 /*!
@@ -103,41 +374,36 @@ void QsrMailHeaders::appendHeader(const QByteArray &name,
  */
 void QsrMailHeaders::appendHeader(const QsrMailHeaders &other)
 {
-    /* append headers from other object */
-    headers.append(other.headers);
-}
+    const Store *stores[2] = { other.base.constData(), other.d.constData() };
 
-/*!
- * \internal
- *
- * Find a header by its *name* and return an iterator pointing to the
- * first header found in the list. The list is searched from the beginning.
- *
- * If no header name matches *name* a iterator to headers.constEnd() is
- * returned.
- */
-QsrMailHeaders::HeaderList::ConstIterator
-QsrMailHeaders::findHeader(const QByteArray &name) const
-{
-    HeaderList::ConstIterator it(headers.constBegin());
-    while (it != headers.constEnd()) {
-        if (it->first == name)
-            break;
-        ++it;
-    }
+    for (int s=0; s<2; ++s) {
+        if (stores[s] == 0)
+            continue;
+
+        foreach (const Entry &entry, stores[s]->entries) {
+            if (entry.name < 0 || (s == 0 && other.isMasked(entry.name)))
+                continue;
 
-    return it;
+            d->append(entry.name,
+                      stores[s]->arena.mid(entry.offset, entry.nameSize),
+                      stores[s]->value(entry));
+        }
+    }
 }
 
 /*!
  * \internal
  *
  * Return *true* if the list contains at least one header named *name*.
- * This is a convenience wrapper for findHeader().
  */
 bool QsrMailHeaders::hasHeader(const QByteArray &name) const
 {
-    return findHeader(name) == headers.constEnd();
+    const int id = internName(name);
+
+    if (d->first(id) >= 0)
+        return true;
+
+    return base && !isMasked(id) && base->first(id) >= 0;
 }
 
 /*!
@@ -148,11 +414,16 @@ bool QsrMailHeaders::hasHeader(const QByteArray &name) const
  */
 QByteArray QsrMailHeaders::value(const QByteArray &name) const
 {
-    HeaderList::ConstIterator it(findHeader(name));
-    if (it == headers.constEnd())
-        return QByteArray();
+    const int id = internName(name);
+    int pos;
+
+    if (base && !isMasked(id) && (pos = base->first(id)) >= 0)
+        return base->value(base->entries.at(pos));
+
+    if ((pos = d->first(id)) >= 0)
+        return d->value(d->entries.at(pos));
 
-    return it->second;
+    return QByteArray();
 }
 
 /*!
@@ -162,41 +433,227 @@ QByteArray QsrMailHeaders::value(const QByteArray &name) const
  */
 QList<QByteArray> QsrMailHeaders::values(const QByteArray &name) const
 {
+    const int id = internName(name);
     QList<QByteArray> result;
 
-    HeaderList::ConstIterator it(headers.constBegin());
-    while (it != headers.constEnd()) {
-        if (it->first == name)
-            result.append(it->second);
+    if (base && !isMasked(id)) {
+        for (int i=base->first(id); i>=0; i=base->entries.at(i).next)
+            result.append(base->value(base->entries.at(i)));
     }
 
+    for (int i=d->first(id); i>=0; i=d->entries.at(i).next)
+        result.append(d->value(d->entries.at(i)));
+
     return result;
 }
 
+/*!
+ * \internal
+ *
+ * Return *true* if the list does not contain any header.
+ */
+bool QsrMailHeaders::isEmpty() const
+{
+    if (d->live > 0)
+        return false;
+    if (!base)
+        return true;
+
+    foreach (const Entry &entry, base->entries) {
+        if (entry.name >= 0 && !isMasked(entry.name))
+            return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the number of bytes renderHeaders() produces.
+ */
+int QsrMailHeaders::renderedSize() const
+{
+    if (!base && d->live == d->entries.size())
+        return d->arena.size();
+
+    const Store *stores[2] = { base.constData(), d.constData() };
+    int result = 0;
+
+    for (int s=0; s<2; ++s) {
+        if (stores[s] == 0)
+            continue;
+
+        foreach (const Entry &entry, stores[s]->entries) {
+            if (entry.name < 0 || (s == 0 && isMasked(entry.name)))
+                continue;
+
+            result += entry.nameSize + entry.valueSize + 4;
+        }
+    }
+
+    return result;
+}
+
+/*!
+ * \internal
+ *
+ * Render all headers to *out*, which must provide space for at least
+ * renderedSize() bytes, and return the pointer to the byte following the
+ * headers. Every header is output as the header name, followd by ': ',
+ * followed by the (folded) value, followed by CRLF.
+ */
+char *QsrMailHeaders::renderHeaders(char *out) const
+{
+    const Store *stores[2] = { base.constData(), d.constData() };
+
+    for (int s=0; s<2; ++s) {
+        if (stores[s] == 0)
+            continue;
+
+        foreach (const Entry &entry, stores[s]->entries) {
+            if (entry.name < 0 || (s == 0 && isMasked(entry.name)))
+                continue;
+
+            const int size = entry.nameSize + entry.valueSize + 4;
+            memcpy(out, stores[s]->arena.constData() + entry.offset, size);
+            out += size;
+        }
+    }
+
+    return out;
+}
+
 /*!
  * \internal
  *
  * Render all headers into a QByteArray and return the buffer. This is
- * useful for writing the headers to the wire. The implementation
- * iterates the header list, outputs the header name, followd by ': ',
- * followed by the value, followed by CRLF.
+ * useful for writing the headers to the wire. The buffer is allocated
+ * once with the size returned by renderedSize().
+ *
+ * As long as no header has been replaced or removed the arena is returned
+ * as is, so no data needs to be copied.
  */
 QByteArray QsrMailHeaders::renderHeaders() const
 {
-    QByteArray result;
-    HeaderList::ConstIterator it(headers.constBegin());
-    while (it != headers.constEnd()) {
-        if (!(it->first.isEmpty()) && !(it->second.isNull())) {
-            result += it->first;
-            result += ": ";
-            result += it->second;
-            result += "\r\n";
+    if (!base && d->live == d->entries.size())
+        return d->arena;
+
+    QByteArray result(renderedSize(), Qt::Uninitialized);
+    renderHeaders(result.data());
+
+    return result;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the interned version of the header *name*. Names which differ
+ * only in case are interned to the same integer. The integers are small,
+ * starting at zero, and are valid for the lifetime of the process.
+ *
+ * The well known names are looked up in a read only table. Other names are
+ * looked up in the cache of the calling thread; only names not seen by the
+ * thread before take the lock of the process wide table.
+ */
+int QsrMailHeaders::internName(const QByteArray &name)
+{
+    int id = knownNameTable()->find(name.constData(), name.size());
+    if (id >= 0)
+        return id;
+
+    QHash<QByteArray, int> &cache = headerNameCache.localData();
+    QHash<QByteArray, int>::ConstIterator it(cache.constFind(name));
+    if (it != cache.constEnd())
+        return it.value();
+
+    QByteArray key(name.toLower());
+    {
+        QsrMailHeaderNames *table = headerNames();
+        QMutexLocker lock(&table->mutex);
+
+        QHash<QByteArray, int>::ConstIterator pos(table->names.constFind(key));
+        if (pos != table->names.constEnd()) {
+            id = pos.value();
+        } else {
+            id = KNOWN_NAMES + table->names.size();
+            table->names.insert(key, id);
+        }
+    }
+
+    /* deep copy, the name might refer to raw data */
+    cache.insert(QByteArray(name.constData(), name.size()), id);
+    return id;
+}
+
+/*!
+ * \internal
+ *
+ * Fold the header *value* of *size* bytes, which starts at *column* of the
+ * line, and write the result to *out*. Line breaks are inserted in front
+ * of the whitespace preceding a word which would exceed HEADER_LINE_LENGTH.
+ * Line breaks already present in the value are kept. Returns the size of
+ * the folded value; if *out* is null nothing is written, which allows to
+ * determine the size in advance.
+ */
+int QsrMailHeaders::foldValue(const char *value, int size, int column,
+                              char *out)
+{
+    int result = 0;
+    int i = 0;
+
+    while (i < size) {
+        /* keep existing line breaks */
+        if (value[i] == '\r' || value[i] == '\n') {
+            if (out != 0)
+                out[result] = value[i];
+            result++;
+            column = 0;
+            i++;
+            continue;
         }
 
-        ++it;
+        /* a word is the whitespace followed by non-whitespace */
+        int end = i;
+        while (end < size && (value[end] == ' ' || value[end] == '\t'))
+            end++;
+        while (end < size && value[end] != ' ' && value[end] != '\t'
+               && value[end] != '\r' && value[end] != '\n')
+            end++;
+
+        /* fold in front of the whitespace */
+        const int length = end - i;
+        if (i > 0 && column > 0 && column + length > HEADER_LINE_LENGTH
+                && (value[i] == ' ' || value[i] == '\t')) {
+            if (out != 0) {
+                out[result] = '\r';
+                out[result+1] = '\n';
+            }
+            result += 2;
+            column = 0;
+        }
+
+        if (out != 0)
+            memcpy(out + result, value + i, length);
+        result += length;
+        column += length;
+        i = end;
     }
 
     return result;
 }
 
+/*!
+ * \internal
+ *
+ * Hides all headers with the interned *name* of the shared base headers.
+ */
+void QsrMailHeaders::mask(int name)
+{
+    if (name >= masked.size())
+        masked.resize(name + 1);
+
+    masked.setBit(name);
+}
+
 QT_END_NAMESPACE
@@ -22,30 +22,80 @@
 #ifndef QSRMAILHEADERS_P_H
 #define QSRMAILHEADERS_P_H
 
-#include <QList>
-#include <QPair>
+#include <QBitArray>
 #include <QByteArray>
+#include <QList>
+#include <QSharedData>
+#include <QVector>
 
 QT_BEGIN_NAMESPACE
 
 class QsrMailHeaders
 {
 public:
-    typedef QPair<QByteArray, QByteArray> HeaderPair;
-    typedef QList<HeaderPair> HeaderList;
+    QsrMailHeaders();
+
+    QsrMailHeaders overlay() const;
 
-public:
     void setHeader(const QByteArray &name, const QByteArray &value);
+    void setHeaders(const QsrMailHeaders &other);
     void appendHeader(const QByteArray &name, const QByteArray &value);
     void appendHeader(const QsrMailHeaders &other);
-    HeaderList::ConstIterator findHeader(const QByteArray &name) const;
     bool hasHeader(const QByteArray &name) const;
     QByteArray value(const QByteArray &name) const;
     QList<QByteArray> values(const QByteArray &name) const;
+    bool isEmpty() const;
+    int renderedSize() const;
+    char *renderHeaders(char *out) const;
     QByteArray renderHeaders() const;
 
-public:
-    HeaderList headers;
+    static int internName(const QByteArray &name);
+    static int foldValue(const char *value, int size, int column, char *out);
+
+private:
+    struct Entry
+    {
+        int name;
+        int next;
+        int offset;
+        int nameSize;
+        int valueSize;
+        bool folded;
+    };
+
+    struct Slot
+    {
+        int first;
+        int last;
+    };
+
+    class Store : public QSharedData
+    {
+    public:
+        Store() : live(0) {}
+
+        int first(int name) const
+        { return name < index.size() ? index.at(name).first : -1; }
+
+        QByteArray value(const Entry &entry) const;
+
+        void append(int name, const QByteArray &key, const QByteArray &value);
+        void remove(int name);
+
+        QByteArray arena;
+        QVector<Entry> entries;
+        QVector<Slot> index;
+        int live;
+    };
+
+    bool isMasked(int name) const
+    { return name < masked.size() && masked.testBit(name); }
+
+    void mask(int name);
+
+    QSharedDataPointer<Store> d;
+    QSharedDataPointer<Store> base;
+    QBitArray masked;
 };
 
 QT_END_NAMESPACE
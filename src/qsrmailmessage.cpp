@@ -71,8 +71,6 @@
 #include "qsrmailmessage_p.h"
 #include "qsrmailrfctools_p.h"
 
-#include <QUuid>
-#include <QHostInfo>
 #include <QStringBuilder>
 
 QT_BEGIN_NAMESPACE
@@ -86,6 +84,38 @@ QsrMailMessagePrivate::QsrMailMessagePrivate()
 {
 }
 
+/*!
+ * \internal
+ *
+ * Returns the *addresses* as a comma separated list suitable for address
+ * headers. The size of the result is computed first, so the list is built
+ * in a single allocation. If the list is empty a null QByteArray is
+ * returned.
+ */
+QByteArray QsrMailMessagePrivate::addressList(
+        const QList<QsrMailAddress> &addresses)
+{
+    if (addresses.isEmpty())
+        return QByteArray();
+
+    QList<QByteArray> items;
+    int size = 0;
+    for (int i=0, count=addresses.size(); i<count; ++i) {
+        items.append(addresses.at(i).toByteArray());
+        size += items.last().size() + 2;
+    }
+
+    QByteArray result;
+    result.reserve(size);
+    for (int i=0, count=items.size(); i<count; ++i) {
+        if (i > 0)
+            result += ", ";
+        result += items.at(i);
+    }
+
+    return result;
+}
+
 /*!
  * \internal
  *
@@ -105,33 +135,22 @@ QsrMailMessagePrivate::QsrMailMessagePrivate()
 QsrMailHeaders QsrMailMessagePrivate::cookHeaders() const
 {
     /* preset with the raw headers */
-    QsrMailHeaders result(headers);
+    QsrMailHeaders result(headers.overlay());
 
-    /* add From addresses */
-    for (int i=0, size=from.size(); i<size; ++i)
-        result.appendHeader("From", from.at(i).toByteArray());
-
-    /* add To addresses */
-    for (int i=0, size=to.size(); i<size; ++i)
-        result.appendHeader("To", to.at(i).toByteArray());
-
-    /* add Reply-To addresses */
-    for (int i=0, size=replyTo.size(); i<size; ++i)
-        result.appendHeader("Reply-To", replyTo.at(i).toByteArray());
-
-    /* add Cc addresses */
-    for (int i=0, size=cc.size(); i<size; ++i)
-        result.appendHeader("Cc", cc.at(i).toByteArray());
-
-    /* add Bcc addresses */
-    for (int i=0, size=bcc.size(); i<size; ++i)
-        result.appendHeader("Bcc", bcc.at(i).toByteArray());
+    /* add the address lists; each list forms a single header which is
+     * folded by QsrMailHeaders
+     */
+    result.appendHeader("From", addressList(from));
+    result.appendHeader("To", addressList(to));
+    result.appendHeader("Reply-To", addressList(replyTo));
+    result.appendHeader("Cc", addressList(cc));
+    result.appendHeader("Bcc", addressList(bcc));
 
     /* add date/time, fallback to current date time */
     if (date.isValid())
         result.setHeader("Date", QsrMailRfcTools::rfc2822Date(date));
     else if (!result.hasHeader("Date"))
-        result.setHeader("Date", QsrMailRfcTools::rfc2822Date(QDateTime::currentDateTime()));
+        result.setHeader("Date", QsrMailRfcTools::currentDate());
 
     /* set Subject */
     if (!subject.isNull())
@@ -156,9 +175,7 @@ QsrMailMessage::QsrMailMessage() :
     d(new QsrMailMessagePrivate)
 {
     /* create a default messageId */
-    QByteArray uuid(QUuid::createUuid().toRfc4122());
-    QString host(QHostInfo::localHostName().split('.').value(0, "unknown"));
-    d->messageId = '<' % uuid.toHex() % '@' % host.toLatin1() % '>';
+    d->messageId = QsrMailRfcTools::createMessageId();
 }
 
 /*!
@@ -185,6 +202,19 @@ QsrMailMessage &QsrMailMessage::operator=(const QsrMailMessage &other)
     return *this;
 }
 
+#ifdef Q_COMPILER_RVALUE_REFS
+/*!
+ * Move-assigns *other* to this QsrMailMessage and returns a reference to
+ * this instance. The shared data is taken over without touching its
+ * reference count.
+ */
+QsrMailMessage &QsrMailMessage::operator=(QsrMailMessage &&other)
+{
+    swap(other);
+    return *this;
+}
+#endif
+
 /*!
  * Swap this instance with *other*. This function is very fast and
  * never fails.
@@ -208,7 +238,7 @@ QsrMailMessage::~QsrMailMessage()
 bool QsrMailMessage::isEmpty() const
 {
     return d->messageId.isEmpty()
-            && d->headers.headers.isEmpty()
+            && d->headers.isEmpty()
             && d->body.isEmpty();
 }
 
@@ -40,6 +40,9 @@ public:
     QsrMailMessage();
     QsrMailMessage(const QsrMailMessage &other);
     QsrMailMessage &operator=(const QsrMailMessage &other);
+#ifdef Q_COMPILER_RVALUE_REFS
+    QsrMailMessage &operator=(QsrMailMessage &&other);
+#endif
     void swap(QsrMailMessage &other);
     virtual ~QsrMailMessage();
 
@@ -43,6 +43,8 @@ public:
 
     QsrMailHeaders cookHeaders() const;
 
+    static QByteArray addressList(const QList<QsrMailAddress> &addresses);
+
 public:
     QByteArray messageId;
     QsrMailHeaders headers;
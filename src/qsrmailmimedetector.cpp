@@ -0,0 +1,136 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \internal
+ *
+ * \class QsrMailMimeDetector "qsrmailmimedetector_p.h"
+ * \brief Content-Type detection for parts without an explicit type.
+ *
+ * All renderers share a single QMimeDatabase instance instead of creating
+ * one for every part. The detection avoids looking at the data whenever
+ * possible:
+ *
+ * - if the body is a QFileDevice or the part has a filename attribute the
+ *   extension is matched against the glob patterns of the database. The
+ *   result is used if the extension is unambiguous.
+ * - otherwise only the first MIME_SNIFF_SIZE bytes of the body are passed
+ *   to the magic matcher. Devices are peeked, so no data is consumed.
+ *
+ * The result is stored in the part, so parts shared by many messages or
+ * rendered more than once are examined only once. The stored result is
+ * reset when the body or the filename of the part changes.
+ */
+
+#include "qsrmailmimedetector_p.h"
+#include "qsrmailabstractpart_p.h"
+
+#include <QFileDevice>
+#include <QMimeDatabase>
+#include <QMutex>
+
+QT_BEGIN_NAMESPACE
+
+/* number of bytes examined by the magic matcher, which is plenty for all
+ * magic rules shipped with the shared-mime-info database
+ */
+#define MIME_SNIFF_SIZE 4096
+
+Q_GLOBAL_STATIC(QMimeDatabase, mimeDatabase)
+Q_GLOBAL_STATIC(QMutex, mimeMutex)
+
+/*!
+ * \internal
+ *
+ * Returns the detected content type of the part *p*. The detection is only
+ * performed on the first call for a part, later calls return the stored
+ * result. If the type cannot be determined "text/plain; charset=us-ascii"
+ * is returned as required by RFC2045. This function is thread-safe.
+ */
+QByteArray QsrMailMimeDetector::contentType(
+        const QsrMailAbstractPartPrivate *p)
+{
+    {
+        QMutexLocker lock(mimeMutex());
+        if (!p->detectedContentType.isEmpty())
+            return p->detectedContentType;
+    }
+
+    QByteArray result(detect(p));
+
+    /* fallback to RFC default if type cannot be determined */
+    if (result.isEmpty())
+        result = "text/plain; charset=us-ascii";
+
+    QMutexLocker lock(mimeMutex());
+    p->detectedContentType = result;
+
+    return result;
+}
+
+/*!
+ * \internal
+ *
+ * Performs the actual detection for the part *p*.
+ */
+QByteArray QsrMailMimeDetector::detect(const QsrMailAbstractPartPrivate *p)
+{
+    QMimeDatabase *db = mimeDatabase();
+
+    /* try the filename extension first */
+    QString name(p->filename);
+    QFileDevice *file = qobject_cast<QFileDevice *>(p->bodyDevice);
+    if (file != 0 && !file->fileName().isEmpty())
+        name = file->fileName();
+
+    if (!name.isEmpty()) {
+        QList<QMimeType> types(db->mimeTypesForFileName(name));
+        if (types.size() == 1)
+            return types.first().name().toLatin1();
+    }
+
+    /* examine a bounded prefix of the content */
+    QByteArray prefix;
+
+    if (p->bodyDevice == 0) {
+        prefix = QByteArray::fromRawData(p->body.constData(),
+                                         qMin(p->body.size(), MIME_SNIFF_SIZE));
+    } else {
+        QIODevice *device = p->bodyDevice;
+        bool opened = false;
+
+        if (!device->isOpen())
+            opened = device->open(QIODevice::ReadOnly);
+
+        if (device->isReadable())
+            prefix = device->peek(MIME_SNIFF_SIZE);
+
+        if (opened)
+            device->close();
+    }
+
+    /* extract content type - just convert it to latin1. this should not be
+     * a problem since mime types are usually US-ASCII
+     */
+    return db->mimeTypeForData(prefix).name().toLatin1();
+}
+
+QT_END_NAMESPACE
@@ -121,6 +121,30 @@ QsrMailMimeMultipart::operator=(const QsrMailMimeMultipart &other)
     return *this;
 }
 
+#ifdef Q_COMPILER_RVALUE_REFS
+/*!
+ * Move-constructs an instance from *other*, which is left empty. Unlike a
+ * copy the instance takes over the reference of *other*, so data nobody
+ * else refers to can be modified without a detach.
+ */
+QsrMailMimeMultipart::QsrMailMimeMultipart(QsrMailMimeMultipart &&other) :
+    QsrMailAbstractMimePart(*sharedNull)
+{
+    swap(other);
+}
+
+/*!
+ * Move-assigns *other* to this instance and returns a reference to it.
+ * *other* takes over the previous data of this instance.
+ */
+QsrMailMimeMultipart &
+QsrMailMimeMultipart::operator=(QsrMailMimeMultipart &&other)
+{
+    swap(other);
+    return *this;
+}
+#endif
+
 /*!
  * Swap this instance with *other*. This function is very fast and
  * never fails.
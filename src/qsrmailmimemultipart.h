@@ -39,6 +39,10 @@ public:
     explicit QsrMailMimeMultipart(ContentType type);
     QsrMailMimeMultipart(const QsrMailMimeMultipart &other);
     QsrMailMimeMultipart &operator=(const QsrMailMimeMultipart &other);
+#ifdef Q_COMPILER_RVALUE_REFS
+    QsrMailMimeMultipart(QsrMailMimeMultipart &&other);
+    QsrMailMimeMultipart &operator=(QsrMailMimeMultipart &&other);
+#endif
     void swap(QsrMailMimeMultipart &other);
     ~QsrMailMimeMultipart();
 
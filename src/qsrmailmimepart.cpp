@@ -40,7 +40,9 @@
  * \var QsrMailMimePart::AutoDetectEncoder
  * Select a suitable encoder, based on the content type. This results in
  * QuotedPrintableEncoder for text/... content types and Base64Encoder
- * for everything else.
+ * for everything else. If the server supports 8BITMIME (RFC6152) text
+ * bodies set by setBody() are sent unencoded, unless they contain NUL,
+ * bare CR or lines longer than 998 characters.
  *
  * \var QsrMailMimePart::PassthroughEncoder
  * Do nothing - just pass the data
@@ -56,6 +58,7 @@
 
 #include "qsrmailmimepart.h"
 #include "qsrmailabstractpart_p.h"
+#include "qsrmailbodysource_p.h"
 
 #include <QFileDevice>
 #include <QFileInfo>
@@ -95,6 +98,29 @@ QsrMailMimePart &QsrMailMimePart::operator=(const QsrMailMimePart &other)
     return *this;
 }
 
+#ifdef Q_COMPILER_RVALUE_REFS
+/*!
+ * Move-constructs an instance from *other*, which is left empty. Unlike a
+ * copy the instance takes over the reference of *other*, so data nobody
+ * else refers to can be modified without a detach.
+ */
+QsrMailMimePart::QsrMailMimePart(QsrMailMimePart &&other) :
+    QsrMailAbstractMimePart(*sharedNull)
+{
+    swap(other);
+}
+
+/*!
+ * Move-assigns *other* to this instance and returns a reference to it.
+ * *other* takes over the previous data of this instance.
+ */
+QsrMailMimePart &QsrMailMimePart::operator=(QsrMailMimePart &&other)
+{
+    swap(other);
+    return *this;
+}
+#endif
+
 /*!
  * Swap this instance with *other*. This function is very fast and
  * never fails.
@@ -187,8 +213,22 @@ void QsrMailMimePart::setContentEncoding(const QByteArray &encoding)
 void QsrMailMimePart::setBody(const QByteArray &content)
 {
     d->body = content;
+    d->bodyHash.clear();
+    d->detectedContentType.clear();
 }
 
+#ifdef Q_COMPILER_RVALUE_REFS
+/*!
+ * \copydoc QsrMailBodyPart::setBody(QByteArray &&)
+ */
+void QsrMailMimePart::setBody(QByteArray &&content)
+{
+    d->body.swap(content);
+    d->bodyHash.clear();
+    d->detectedContentType.clear();
+}
+#endif
+
 /*!
  * \copydoc QsrMailBodyPart::body()
  */
@@ -203,6 +243,8 @@ QByteArray QsrMailMimePart::body() const
 void QsrMailMimePart::setBodyDevice(QIODevice *device)
 {
     d->bodyDevice = device;
+    d->bodyHash.clear();
+    d->detectedContentType.clear();
 }
 
 /*!
@@ -213,6 +255,20 @@ QIODevice *QsrMailMimePart::bodyDevice() const
     return d->bodyDevice;
 }
 
+/*!
+ * Set the body to be produced by *source* while the message is sent. The
+ * part takes ownership of the source, which is disposed after it has been
+ * processed. bodyDevice() returns the device reading from the source and
+ * autoDelete() is enabled.
+ *
+ * \sa QsrMailBodySource
+ */
+void QsrMailMimePart::setBodySource(QsrMailBodySource *source)
+{
+    setBodyDevice(new QsrMailBodySourceDevice(source));
+    d->autoDelete = true;
+}
+
 /*!
  * Construct a part from a file *device*. The resulting QsrMailMimePart object
  * is an attachment with the contents of the file. The filename attribute
@@ -274,6 +330,27 @@ QsrMailMimePart QsrMailMimePart::fromDevice(const QString &filename,
     return result;
 }
 
+/*!
+ * Construct a part whose body is produced by *source*. The resulting
+ * QsrMailMimePart object is an attachment and the filename attribute will
+ * be set to the basename of *filename*. The object takes ownership of
+ * *source*.
+ *
+ * \sa setBodySource()
+ */
+QsrMailMimePart QsrMailMimePart::fromSource(const QString &filename,
+                                            QsrMailBodySource *source)
+{
+    QsrMailMimePart result;
+    QFileInfo info(filename);
+
+    result.setBodySource(source);
+    result.d->dispositionType = AttachmentDisposition;
+    result.d->filename = info.fileName();
+
+    return result;
+}
+
 /*!
  * Construct a part from a simple *text*. The resulting QsrMailMimePart
  * is an inline attachment of text/plain with UTF-8 encoding, suited for
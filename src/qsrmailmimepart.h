@@ -28,6 +28,7 @@ QT_BEGIN_NAMESPACE
 
 class QIODevice;
 class QFileDevice;
+class QsrMailBodySource;
 
 class QSRMAILSHARED_EXPORT QsrMailMimePart : public QsrMailAbstractMimePart
 {
@@ -41,6 +42,10 @@ public:
     QsrMailMimePart();
     QsrMailMimePart(const QsrMailMimePart &other);
     QsrMailMimePart &operator=(const QsrMailMimePart &other);
+#ifdef Q_COMPILER_RVALUE_REFS
+    QsrMailMimePart(QsrMailMimePart &&other);
+    QsrMailMimePart &operator=(QsrMailMimePart &&other);
+#endif
     void swap(QsrMailMimePart &other);
     ~QsrMailMimePart();
 
@@ -55,16 +60,23 @@ public:
     void setContentEncoding(const QByteArray &encoding);
 
     void setBody(const QByteArray &data);
+#ifdef Q_COMPILER_RVALUE_REFS
+    void setBody(QByteArray &&data);
+#endif
     QByteArray body() const;
 
     void setBodyDevice(QIODevice *device);
     QIODevice *bodyDevice() const;
 
+    void setBodySource(QsrMailBodySource *source);
+
     static QsrMailMimePart fromFile(QFileDevice *file);
     static QsrMailMimePart fromRawData(const QString &filename,
                                        const QByteArray &data);
     static QsrMailMimePart fromDevice(const QString &filename,
                                       QIODevice *device);
+    static QsrMailMimePart fromSource(const QString &filename,
+                                      QsrMailBodySource *source);
     static QsrMailMimePart fromText(const QString &filename);
 };
 
@@ -64,11 +64,73 @@
 #include "qsrmailqpencoder.h"
 #include "qsrmailqpencoder_p.h"
 
+#include <string.h>
+
+#if defined(__SSE2__)
+#  define QSRMAIL_QP_SSE2
+#  include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#  define QSRMAIL_QP_NEON
+#  include <arm_neon.h>
+#endif
+
+/* size of the input block */
+#define QP_BLOCK_SIZE (64*1024)
+
 QT_BEGIN_NAMESPACE
 
 /* dictionary for quoted printable encoder */
 const char qpdict[] = "0123456789ABCDEF";
 
+/* safe characters are printable and can be copied without further checks;
+ * TAB and SPC are excluded since they need lookahead for rule 3
+ */
+static inline bool qpIsSafe(uchar c)
+{
+    return c >= 33 && c <= 126 && c != '=';
+}
+
+/* returns the length of the run of safe characters starting at *p* */
+static int qpSafeRun(const uchar *p, const uchar *end)
+{
+    const uchar *start = p;
+
+#if defined(QSRMAIL_QP_SSE2)
+    const __m128i lo = _mm_set1_epi8(32);
+    const __m128i hi = _mm_set1_epi8(127);
+    const __m128i eq = _mm_set1_epi8('=');
+
+    for (; end - p >= 16; p += 16) {
+        /* bytes above 127 are negative and fail the signed range check */
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        const __m128i safe = _mm_andnot_si128(_mm_cmpeq_epi8(v, eq),
+                _mm_and_si128(_mm_cmpgt_epi8(v, lo), _mm_cmplt_epi8(v, hi)));
+
+        const int mask = _mm_movemask_epi8(safe);
+        if (mask != 0xffff)
+            return static_cast<int>(p - start) + __builtin_ctz(~mask);
+    }
+#elif defined(QSRMAIL_QP_NEON)
+    const uint8x16_t lo = vdupq_n_u8(33);
+    const uint8x16_t hi = vdupq_n_u8(126);
+    const uint8x16_t eq = vdupq_n_u8('=');
+
+    for (; end - p >= 16; p += 16) {
+        const uint8x16_t v = vld1q_u8(p);
+        const uint8x16_t safe = vbicq_u8(vandq_u8(vcgeq_u8(v, lo),
+                                                  vcleq_u8(v, hi)),
+                                         vceqq_u8(v, eq));
+        if (vminvq_u8(safe) != 0xff)
+            break;
+    }
+#endif
+
+    while (p < end && qpIsSafe(*p))
+        p++;
+
+    return static_cast<int>(p - start);
+}
+
 /*!
  * \internal
  *
@@ -77,7 +139,10 @@ const char qpdict[] = "0123456789ABCDEF";
 QsrMailQpEncoderPrivate::QsrMailQpEncoderPrivate(QsrMailQpEncoder *qq) :
     QsrMailAbstractEncoderPrivate(qq),
     lineWidth(76),
-    lineChars(0)
+    lineChars(0),
+    textMode(false),
+    blockPos(0),
+    blockSize(0)
 {
 }
 
@@ -90,13 +155,27 @@ QsrMailQpEncoderPrivate::~QsrMailQpEncoderPrivate()
 {
 }
 
+/*!
+ * \internal
+ *
+ * Emits readyRead() if input is left in the block after the underlying
+ * device finished, so the remaining data gets encoded.
+ */
+void QsrMailQpEncoderPrivate::_q_flushBuffers()
+{
+    Q_Q(QsrMailQpEncoder);
+
+    if (blockPos < blockSize)
+        emit q->readyRead();
+}
+
 /*!
  * \internal
  *
  * Implementation for QIODevice::readData(). The method encodes the data
  * on-the-fly to it's quoted printable representation.
  *
- * The data is read from the underlying QIODevice and the converted
+ * The data is read from the underlying QIODevice in blocks and the converted
  * data is written to *data* up to *maxlen* bytes. The method returns
  * the actual number of bytes written to *data* or -1 if some error
  * occured.
@@ -105,62 +184,151 @@ qint64 QsrMailQpEncoderPrivate::readDataImpl(char *data, qint64 maxlen)
 {
     Q_Q(QsrMailQpEncoder);
 
-    #define ENSURE_SPACE(n) { \
-        if (remaining < n) { \
-            device->ungetChar(static_cast<char>(c)); \
-            break; \
-        } \
-    }
-
     /* multiple readChannelFinished() signals */
-    if (deviceAtEnd())
+    if (blockPos == blockSize && deviceAtEnd())
         return 0;
 
-    char c = 0;
     qint64 remaining = maxlen;
-    bool isTextModeEnabled = q->isTextModeEnabled();
+    textMode = q->isTextModeEnabled();
 
-    while (device->bytesAvailable() && remaining > 0) {
-        if (!device->getChar(&c))
+    /* encode until either the output is full or more input is required
+     * which is not available yet
+     */
+    forever {
+        bool filled = fillBlock();
+        int pos = blockPos;
+
+        encodeBlock(&data, &remaining, deviceAtEnd());
+
+        if (blockPos == pos && !filled)
             break;
+    }
+
+    /* emit signal if at end of input stream */
+    if (blockPos == blockSize && deviceAtEnd())
+        emit q->readChannelFinished();
+
+    return maxlen - remaining;
+}
+
+/*!
+ * \internal
+ *
+ * Read the available data of the underlying device into the input block.
+ * Data which has not been encoded yet is moved to the start of the block.
+ * Returns true if data has been read.
+ */
+bool QsrMailQpEncoderPrivate::fillBlock()
+{
+    if (block.isEmpty())
+        block.resize(QP_BLOCK_SIZE);
+
+    if (device->bytesAvailable() <= 0)
+        return false;
 
+    /* move the remainder to the front */
+    if (blockPos > 0) {
+        blockSize -= blockPos;
+        memmove(block.data(), block.constData() + blockPos, blockSize);
+        blockPos = 0;
+    }
+
+    if (blockSize == block.size())
+        return false;
+
+    qint64 got = device->read(block.data() + blockSize,
+                              block.size() - blockSize);
+    if (got <= 0)
+        return false;
+
+    blockSize += static_cast<int>(got);
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Encode the input block to *data* as long as *remaining* bytes of space
+ * are available. Runs of safe characters are copied in one go; everything
+ * else is encoded character by character. The output of a character
+ * (including a preceding soft line break) is written completely or not at
+ * all, so the result does not depend on the size of the read buffers.
+ *
+ * Rule 3 and 4 need up to two characters lookahead. If they are not
+ * available the encoding stops and continues with the next block, unless
+ * *atEnd* indicates that no more input is to be expected.
+ */
+void QsrMailQpEncoderPrivate::encodeBlock(char **data, qint64 *remaining,
+                                          bool atEnd)
+{
+    const uchar *begin = reinterpret_cast<const uchar *>(block.constData());
+    const uchar *p = begin + blockPos;
+    const uchar *end = begin + blockSize;
+    char *out = *data;
+    qint64 space = *remaining;
+
+    while (p < end) {
+        /* copy runs of safe characters up to the soft line break; a dot at
+         * the start of the line needs to be encoded. The scan stops at the
+         * line break so long lines are not scanned over and over.
+         */
+        if (!(lineChars == 0 && *p == '.')) {
+            qint64 limit = qMin<qint64>(lineWidth - 2 - lineChars, space);
+            limit = qMin<qint64>(limit, end - p);
+
+            int n = limit > 0 ? qpSafeRun(p, p + limit) : 0;
+            if (n > 0) {
+                memcpy(out, p, n);
+                out += n;
+                p += n;
+                space -= n;
+                lineChars += n;
+                continue;
+            }
+        }
+
+        uchar c = *p;
         bool forceEncoding = false;
 
-        /* Rule 3: TAB/SPC followed by linebreak must be encoded */
+        /* Rule 3: TAB/SPC followed by linebreak must be encoded; so must
+         * be whitespace at the very end of the input
+         */
         if (c == 9 || c == 32) {
-            char buf[2];
-            if (device->peek(buf, sizeof(buf)) != sizeof(buf)) {
-                device->ungetChar(c);
-                break;
+            if (end - p < 3) {
+                if (!atEnd)
+                    break;
+                forceEncoding = end - p == 1;
+            } else {
+                forceEncoding = p[1] == '\r' && p[2] == '\n';
             }
-
-            forceEncoding = buf[0] == '\r' && buf[1] == '\n';
         }
 
         /* Rule 4: Linebreaks */
         if (c == '\r') {
-            if (!device->getChar(&c)) {
-                device->ungetChar('\r');
+            if (end - p < 2 && !atEnd)
                 break;
-            }
 
-            if (c == '\n') {
-                ENSURE_SPACE(2)
-                *data++ = '\r';
-                *data++ = '\n';
-                remaining -= 2;
+            if (end - p >= 2 && p[1] == '\n') {
+                if (space < 2)
+                    break;
+
+                *out++ = '\r';
+                *out++ = '\n';
+                p += 2;
+                space -= 2;
                 lineChars = 0;
                 continue;
             }
-
-            device->ungetChar(c);
         }
 
-        if (isTextModeEnabled && c == '\n') {
-            ENSURE_SPACE(2)
-            *data++ = '\r';
-            *data++ = '\n';
-            remaining -= 2;
+        if (textMode && c == '\n') {
+            if (space < 2)
+                break;
+
+            *out++ = '\r';
+            *out++ = '\n';
+            p++;
+            space -= 2;
             lineChars = 0;
             continue;
         }
@@ -179,35 +347,37 @@ qint64 QsrMailQpEncoderPrivate::readDataImpl(char *data, qint64 maxlen)
         /* check if the line can accomodate the output. include space
          * for a '=' in case a linebreak is needed
          */
-        if ((lineChars + (isPrintable ? 2 : 4)) >= lineWidth) {
-            ENSURE_SPACE(3)
-            *data++ = '=';
-            *data++ = '\r';
-            *data++ = '\n';
-            remaining -= 3;
+        bool softBreak = (lineChars + (isPrintable ? 2 : 4)) >= lineWidth;
+        if (space < (softBreak ? 3 : 0) + (isPrintable ? 1 : 3))
+            break;
+
+        if (softBreak) {
+            *out++ = '=';
+            *out++ = '\r';
+            *out++ = '\n';
+            space -= 3;
             lineChars = 0;
         }
 
         /* now write the data itself */
         if (isPrintable) {
-            *data++ = c;
-            remaining--;
+            *out++ = static_cast<char>(c);
+            space--;
             lineChars++;
         } else {
-            ENSURE_SPACE(3)
-            *data++ = '=';
-            *data++ = qpdict[(static_cast<quint8>(c) >> 4) & 0x0f];
-            *data++ = qpdict[static_cast<quint8>(c) & 0x0f];
-            remaining -= 3;
+            *out++ = '=';
+            *out++ = qpdict[(c >> 4) & 0x0f];
+            *out++ = qpdict[c & 0x0f];
+            space -= 3;
             lineChars += 3;
         }
-    }
 
-    /* emit signal if at end of input stream */
-    if (deviceAtEnd())
-        emit q->readChannelFinished();
+        p++;
+    }
 
-    return maxlen - remaining;
+    blockPos = static_cast<int>(p - begin);
+    *data = out;
+    *remaining = space;
 }
 
 /* -------------------------------------------------------------------------- */
@@ -251,6 +421,7 @@ qint64 QsrMailQpEncoder::bytesAvailable() const
      * more bytes available, but this is the safe assumption
      */
     return d->device->bytesAvailable()
+            + (d->blockSize - d->blockPos)
             + QIODevice::bytesAvailable();
 }
 
@@ -289,12 +460,6 @@ bool QsrMailQpEncoder::open(OpenMode mode)
         return false;
     }
 
-    /* must be buffered (wie make use of ungetChar */
-    if (mode & QIODevice::Unbuffered) {
-        setErrorString(tr("device must be buffered"));
-        return false;
-    }
-
     /* open the underlying QIODevice as requested */
     bool deviceOk = false;
     if (d->device->isOpen()) {
@@ -309,6 +474,8 @@ bool QsrMailQpEncoder::open(OpenMode mode)
 
     /* reset internal states */
     d->lineChars = 0;
+    d->blockPos = 0;
+    d->blockSize = 0;
 
     /* call parent implementation (never fails) */
     return QIODevice::open(mode);
@@ -33,13 +33,22 @@ public:
     explicit QsrMailQpEncoderPrivate(QsrMailQpEncoder *qq);
     ~QsrMailQpEncoderPrivate();
 
+    void _q_flushBuffers();
     qint64 readDataImpl(char *data, qint64 maxlen);
+    bool fillBlock();
+    void encodeBlock(char **data, qint64 *remaining, bool atEnd);
 
 public:
     Q_DECLARE_PUBLIC(QsrMailQpEncoder)
 
     int lineWidth;
     int lineChars;
+    bool textMode;
+
+    /* input block; bytes from blockPos to blockSize are not yet encoded */
+    QByteArray block;
+    int blockPos;
+    int blockSize;
 };
 
 QT_END_NAMESPACE
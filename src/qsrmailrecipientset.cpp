@@ -0,0 +1,221 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \internal
+ *
+ * \class QsrMailRecipientSet "qsrmailrecipientset_p.h"
+ * \brief Ordered set of the envelope recipients of a transaction.
+ *
+ * The transport builds the set once per message from the forward paths
+ * or the To, Cc and Bcc addresses and then walks it by index, both for
+ * the single RCPT TO commands and for the pipelined envelope batch. The
+ * recipients keep the order in which they were inserted, so the RCPT TO
+ * commands and the per-recipient status of the transaction always line
+ * up with the order of the message addresses.
+ *
+ * Duplicates are dropped on insertion. Following RFC5321 the local part
+ * of an address is compared case sensitive while the domain - everything
+ * after the last @ - is compared case insensitive.
+ *
+ * All addresses are stored back to back in one arena with an offset list
+ * and looked up through an open addressing table with linear probing, so
+ * building the set costs a handful of allocations regardless of the
+ * number of recipients.
+ */
+
+#include "qsrmailrecipientset_p.h"
+
+#include <string.h>
+
+QT_BEGIN_NAMESPACE
+
+/* smallest size of the open addressing table, must be a power of two */
+#define MIN_TABLE_SIZE 16
+
+/* return the ASCII lower case variant of c */
+#define TOLOWER(c) ((c >= 'A' && c <= 'Z') ? (c | 0x20) : c)
+
+/*!
+ * \internal
+ *
+ * Construct an empty set.
+ */
+QsrMailRecipientSet::QsrMailRecipientSet()
+{
+    mOffsets.append(0);
+}
+
+/*!
+ * \internal
+ *
+ * Remove all recipients. The allocated memory is kept for the next
+ * message.
+ */
+void QsrMailRecipientSet::clear()
+{
+    mArena.resize(0);
+    mOffsets.resize(1);
+    mTable.fill(-1);
+}
+
+/*!
+ * \internal
+ *
+ * Prepare the set for *count* recipients so inserting them does not need
+ * to grow the lookup table.
+ */
+void QsrMailRecipientSet::reserve(int count)
+{
+    mOffsets.reserve(count + 1);
+
+    int capacity = MIN_TABLE_SIZE;
+    while (capacity < count * 2)
+        capacity <<= 1;
+    if (capacity > mTable.size())
+        rehash(capacity);
+}
+
+/*!
+ * \internal
+ *
+ * Append *address* unless an equal address is already part of the set.
+ * Returns true if the address has been appended.
+ */
+bool QsrMailRecipientSet::insert(const QByteArray &address)
+{
+    /* keep the load factor below 1/2 */
+    if ((size() + 1) * 2 > mTable.size())
+        rehash(qMax(MIN_TABLE_SIZE, mTable.size() * 2));
+
+    const char *data = address.constData();
+    const int length = address.size();
+    const int mask = mTable.size() - 1;
+    int slot = static_cast<int>(hash(data, length)) & mask;
+
+    forever {
+        const int index = mTable.at(slot);
+        if (index < 0)
+            break;
+        if (equals(index, data, length))
+            return false;
+        slot = (slot + 1) & mask;
+    }
+
+    mTable[slot] = size();
+    mArena.append(data, length);
+    mOffsets.append(mArena.size());
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Return the recipient at *index* in insertion order. The result refers
+ * to the memory of the set and stays valid until the set is modified.
+ */
+QByteArray QsrMailRecipientSet::at(int index) const
+{
+    const int offset = mOffsets.at(index);
+    return QByteArray::fromRawData(mArena.constData() + offset,
+                                   mOffsets.at(index + 1) - offset);
+}
+
+/* return the index of the last @ of data or size if there is none; the
+ * domain follows the last @ since a quoted local part may carry more
+ */
+static inline int domainOffset(const char *data, int size)
+{
+    for (int i=size-1; i>=0; --i) {
+        if (data[i] == '@')
+            return i;
+    }
+
+    return size;
+}
+
+/*!
+ * \internal
+ *
+ * FNV-1a hash of the address with the domain part folded to lower case.
+ */
+uint QsrMailRecipientSet::hash(const char *data, int size)
+{
+    const int domain = domainOffset(data, size);
+    uint h = 2166136261u;
+
+    for (int i=0; i<size; ++i) {
+        const char ch = (i > domain) ? TOLOWER(data[i]) : data[i];
+        h = (h ^ static_cast<quint8>(ch)) * 16777619u;
+    }
+
+    return h;
+}
+
+/*!
+ * \internal
+ *
+ * Return true if the recipient at *index* equals *data* of *size* bytes
+ * with the domain part compared case insensitive.
+ */
+bool QsrMailRecipientSet::equals(int index, const char *data, int size) const
+{
+    const int offset = mOffsets.at(index);
+    if (mOffsets.at(index + 1) - offset != size)
+        return false;
+
+    const char *entry = mArena.constData() + offset;
+    const int domain = domainOffset(data, size);
+
+    /* equal sized entries with equal local parts share the @ position */
+    if (memcmp(entry, data, qMin(domain + 1, size)) != 0)
+        return false;
+
+    for (int i=domain+1; i<size; ++i) {
+        if (TOLOWER(entry[i]) != TOLOWER(data[i]))
+            return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Rebuild the lookup table with *capacity* slots. The capacity must be a
+ * power of two.
+ */
+void QsrMailRecipientSet::rehash(int capacity)
+{
+    mTable.fill(-1, capacity);
+
+    const int mask = capacity - 1;
+    for (int i=0, count=size(); i<count; ++i) {
+        const int offset = mOffsets.at(i);
+        int slot = static_cast<int>(hash(mArena.constData() + offset,
+                                         mOffsets.at(i + 1) - offset)) & mask;
+        while (mTable.at(slot) >= 0)
+            slot = (slot + 1) & mask;
+        mTable[slot] = i;
+    }
+}
+
+QT_END_NAMESPACE
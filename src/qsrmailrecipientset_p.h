@@ -0,0 +1,61 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILRECIPIENTSET_P_H
+#define QSRMAILRECIPIENTSET_P_H
+
+#include <QByteArray>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailRecipientSet
+{
+public:
+    QsrMailRecipientSet();
+
+    void clear();
+    void reserve(int count);
+    bool insert(const QByteArray &address);
+    QByteArray at(int index) const;
+
+    inline int size() const
+    { return mOffsets.size() - 1; }
+
+    inline bool isEmpty() const
+    { return mOffsets.size() <= 1; }
+
+    inline int dataSize() const
+    { return mArena.size(); }
+
+private:
+    static uint hash(const char *data, int size);
+    bool equals(int index, const char *data, int size) const;
+    void rehash(int capacity);
+
+    QByteArray mArena;
+    QVector<int> mOffsets;
+    QVector<int> mTable;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILRECIPIENTSET_P_H
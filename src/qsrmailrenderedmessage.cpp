@@ -0,0 +1,337 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \class QsrMailRenderedMessage qsrmailrenderedmessage.h <QsrMailRenderedMessage>
+ * \brief The QsrMailRenderedMessage class holds a message rendered into
+ * its wire format.
+ *
+ * A QsrMailMessage is rendered and encoded every time it is delivered,
+ * including every retry and every delivery to another relay. render()
+ * does this work once and keeps the result: the complete message with
+ * line breaks normalized to CRLF, together with its exact size and the
+ * positions of the lines which have to be dot-stuffed for the DATA
+ * command. The rendered message is immutable and can be queued on any
+ * number of transports any number of times by
+ * QsrMailTransport::queueMessage(), nothing is encoded again.
+ *
+ * The data is held in memory or, if a file name is passed to render(), in
+ * a file. Files are mapped instead of being read when the message is sent,
+ * and on plaintext connections the DATA command sends a file backed
+ * message straight from the file using sendfile() where available. The
+ * file is removed once the last copy of the rendered message has been
+ * destroyed.
+ *
+ * The envelope is taken from the message when it is rendered: the sender,
+ * or the first From address if no sender has been set, and all To, Cc and
+ * Bcc recipients.
+ *
+ * render() can be called from any thread, eg. to render a batch of
+ * messages in parallel using QtConcurrent::mapped(). The messages must not
+ * share devices with each other or with messages rendered elsewhere, since
+ * devices can be read only once. Rendering does not run an event loop, so
+ * the bodies have to be kept in memory or in files.
+ *
+ * Example:
+ * \code
+ * QsrMailRenderedMessage rendered =
+ *         QsrMailRenderedMessage::render(message, "/var/spool/app/1.eml");
+ * if (!rendered.isValid())
+ *     qWarning() << rendered.errorString();
+ *
+ * primary->queueMessage(rendered);
+ * fallback->queueMessage(rendered);
+ * \endcode
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailRenderedMessagePrivate "qsrmailrenderedmessage_p.h"
+ * \brief Private data class for QsrMailRenderedMessage.
+ */
+
+#include "qsrmailrenderedmessage.h"
+#include "qsrmailrenderedmessage_p.h"
+
+#include "qsrmailmessage.h"
+#include "qsrmailrenderer_p.h"
+#include "qsrmailrenderpipe_p.h"
+
+#include <QBuffer>
+#include <QFile>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+ * \internal
+ *
+ * Default constructor.
+ */
+QsrMailRenderedMessagePrivate::QsrMailRenderedMessagePrivate() :
+    size(0),
+    binary(false),
+    valid(false)
+{
+}
+
+/*!
+ * \internal
+ *
+ * Removes the file of a file backed message.
+ */
+QsrMailRenderedMessagePrivate::~QsrMailRenderedMessagePrivate()
+{
+    if (!fileName.isEmpty())
+        QFile::remove(fileName);
+}
+
+/*!
+ * \internal
+ *
+ * Render *message* to *device* and record its envelope. Messages which do
+ * not require BINARYMIME are written in wire format. Returns false if the
+ * message cannot be rendered or written.
+ */
+bool QsrMailRenderedMessagePrivate::render(const QsrMailMessage &message,
+                                           QIODevice *device)
+{
+    if (message.sender().isValid())
+        sender = message.sender();
+    else if (!message.from().isEmpty())
+        sender = message.from().first();
+
+    recipients.append(message.to());
+    recipients.append(message.cc());
+    recipients.append(message.bcc());
+
+    QsrMailRenderer renderer(message);
+    binary = renderer.requiresBinaryMime();
+
+    QsrMailRenderWriter writer(&renderer, device);
+    writer.setWireFormat(!binary);
+
+    if (!writer.run()) {
+        errorString = writer.errorString();
+        return false;
+    }
+
+    size = writer.bytesWritten();
+    stuffing = writer.stuffing();
+    return true;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * Constructs an invalid rendered message.
+ */
+QsrMailRenderedMessage::QsrMailRenderedMessage() :
+    d(new QsrMailRenderedMessagePrivate)
+{
+}
+
+/*!
+ * Construct a copy of *other*. This operation is fast and takes constant
+ * time since QsrMailRenderedMessage is implicitly shared; the rendered
+ * data is never copied.
+ */
+QsrMailRenderedMessage::QsrMailRenderedMessage(
+        const QsrMailRenderedMessage &other) :
+    d(other.d)
+{
+}
+
+/*!
+ * Assigns *other* to this QsrMailRenderedMessage and returns this
+ * instance.
+ */
+QsrMailRenderedMessage &QsrMailRenderedMessage::operator=(
+        const QsrMailRenderedMessage &other)
+{
+    if (d != other.d) {
+        QsrMailRenderedMessage tmp(other);
+        tmp.swap(*this);
+    }
+
+    return *this;
+}
+
+/*!
+ * Swap this instance with *other*. This function is very fast and
+ * never fails.
+ */
+void QsrMailRenderedMessage::swap(QsrMailRenderedMessage &other)
+{
+    qSwap(d, other.d);
+}
+
+/*!
+ * Destroys the instance.
+ */
+QsrMailRenderedMessage::~QsrMailRenderedMessage()
+{
+}
+
+/*!
+ * Render *message* into memory. The devices of the message are consumed.
+ * Check isValid() to see whether rendering succeeded.
+ */
+QsrMailRenderedMessage QsrMailRenderedMessage::render(
+        const QsrMailMessage &message)
+{
+    QsrMailRenderedMessage rendered;
+    QsrMailRenderedMessagePrivate *d = rendered.d.data();
+
+    QBuffer buffer(&d->data);
+    buffer.open(QIODevice::WriteOnly);
+
+    d->valid = d->render(message, &buffer);
+    if (!d->valid)
+        d->data.clear();
+
+    return rendered;
+}
+
+/*!
+ * \overload
+ *
+ * Render *message* into the file *fileName*, which is created or replaced.
+ * The file belongs to the rendered message from now on and is removed with
+ * its last copy, or right away if rendering fails.
+ */
+QsrMailRenderedMessage QsrMailRenderedMessage::render(
+        const QsrMailMessage &message, const QString &fileName)
+{
+    QsrMailRenderedMessage rendered;
+    QsrMailRenderedMessagePrivate *d = rendered.d.data();
+
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        d->errorString = file.errorString();
+        return rendered;
+    }
+
+    d->fileName = fileName;
+    d->valid = d->render(message, &file);
+
+    if (d->valid && !file.flush()) {
+        d->errorString = file.errorString();
+        d->valid = false;
+    }
+
+    if (!d->valid) {
+        file.remove();
+        d->fileName.clear();
+    }
+
+    return rendered;
+}
+
+/*!
+ * Returns true if the message has been rendered successfully.
+ */
+bool QsrMailRenderedMessage::isValid() const
+{
+    return d->valid;
+}
+
+/*!
+ * Returns the reason why rendering failed.
+ */
+QString QsrMailRenderedMessage::errorString() const
+{
+    return d->errorString;
+}
+
+/*!
+ * Returns true if the rendered data is held in a file.
+ */
+bool QsrMailRenderedMessage::isFileBacked() const
+{
+    return !d->fileName.isEmpty();
+}
+
+/*!
+ * Returns the name of the file holding the rendered data, or an empty
+ * string if the data is held in memory.
+ */
+QString QsrMailRenderedMessage::fileName() const
+{
+    return d->fileName;
+}
+
+/*!
+ * Returns the rendered data held in memory. The data is not dot-stuffed.
+ * File backed messages return an empty QByteArray.
+ */
+QByteArray QsrMailRenderedMessage::data() const
+{
+    return d->data;
+}
+
+/*!
+ * Returns the size of the rendered message in bytes. This is the size
+ * declared to the server by the SIZE extension (RFC1870).
+ */
+qint64 QsrMailRenderedMessage::size() const
+{
+    return d->size;
+}
+
+/*!
+ * Returns the number of bytes the DATA command transfers for the message,
+ * which is size() plus the dots added by dot-stuffing, excluding the
+ * terminating dot.
+ */
+qint64 QsrMailRenderedMessage::wireSize() const
+{
+    return d->size + d->stuffing.size();
+}
+
+/*!
+ * Returns true if the message contains parts with the binary content
+ * transfer encoding. Such messages are kept as rendered, without line
+ * break normalization, and can only be sent to servers supporting
+ * BINARYMIME (RFC3030).
+ */
+bool QsrMailRenderedMessage::requiresBinaryMime() const
+{
+    return d->binary;
+}
+
+/*!
+ * Returns the sender of the message.
+ */
+QsrMailAddress QsrMailRenderedMessage::sender() const
+{
+    return d->sender;
+}
+
+/*!
+ * Returns the recipients of the message.
+ */
+QList<QsrMailAddress> QsrMailRenderedMessage::recipients() const
+{
+    return d->recipients;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,74 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILRENDEREDMESSAGE_H
+#define QSRMAILRENDEREDMESSAGE_H
+
+#include "qsrmailglobal.h"
+#include <QByteArray>
+#include <QList>
+#include <QMetaType>
+#include <QSharedDataPointer>
+#include <QString>
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailAddress;
+class QsrMailMessage;
+
+class QsrMailRenderedMessagePrivate;
+class QSRMAILSHARED_EXPORT QsrMailRenderedMessage
+{
+public:
+    QsrMailRenderedMessage();
+    QsrMailRenderedMessage(const QsrMailRenderedMessage &other);
+    QsrMailRenderedMessage &operator=(const QsrMailRenderedMessage &other);
+    void swap(QsrMailRenderedMessage &other);
+    virtual ~QsrMailRenderedMessage();
+
+    static QsrMailRenderedMessage render(const QsrMailMessage &message);
+    static QsrMailRenderedMessage render(const QsrMailMessage &message,
+                                         const QString &fileName);
+
+    bool isValid() const;
+    QString errorString() const;
+
+    bool isFileBacked() const;
+    QString fileName() const;
+    QByteArray data() const;
+
+    qint64 size() const;
+    qint64 wireSize() const;
+    bool requiresBinaryMime() const;
+
+    QsrMailAddress sender() const;
+    QList<QsrMailAddress> recipients() const;
+
+private:
+    friend class QsrMailTransportPrivate;
+    QSharedDataPointer<QsrMailRenderedMessagePrivate> d;
+};
+
+QT_END_NAMESPACE
+
+Q_DECLARE_METATYPE(QsrMailRenderedMessage)
+
+#endif // QSRMAILRENDEREDMESSAGE_H
@@ -0,0 +1,63 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILRENDEREDMESSAGE_P_H
+#define QSRMAILRENDEREDMESSAGE_P_H
+
+#include <QSharedData>
+#include <QList>
+#include <QVector>
+
+#include "qsrmailaddress.h"
+
+QT_BEGIN_NAMESPACE
+
+class QIODevice;
+class QsrMailMessage;
+
+class QsrMailRenderedMessagePrivate : public QSharedData
+{
+public:
+    QsrMailRenderedMessagePrivate();
+    ~QsrMailRenderedMessagePrivate();
+
+    bool render(const QsrMailMessage &message, QIODevice *device);
+
+public:
+    /* the data is either held in memory or in the file */
+    QByteArray data;
+    QString fileName;
+    qint64 size;
+    bool binary;
+    bool valid;
+    QString errorString;
+
+    /* offsets of the lines which have to be dot-stuffed for DATA */
+    QVector<qint64> stuffing;
+
+    /* the envelope of the message */
+    QsrMailAddress sender;
+    QList<QsrMailAddress> recipients;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILRENDEREDMESSAGE_P_H
@@ -44,10 +44,21 @@
  * required QIODevices on the fly, inserts the boundaries and so on. For nested
  * MIME messages it utilizes a QStack object and the StackFrame structure.
  *
+ * Large chunks of memory and files which are passed through (including
+ * encoded files of the encoder cache) bypass the ringbuffer: they are
+ * served as a span directly from their memory or from a mapping of the
+ * file once the ringbuffer has been drained.
+ *
+ * The ringbuffer wraps around: the FSM is restarted as soon as the
+ * consumer drained it to the low watermark and devices are read up to the
+ * high watermark, see setWatermarks(). Data crossing the end of the buffer
+ * is handed out as two segments by dataSegments().
+ *
  *  Color  | Usage
  *  ------ | --------------------------------------------------------
  *  green  | unibody (SimpleBody) message
  *  blue   | (nested) multipart message
+ *  orange | bulk message whose body has been rendered before
  *  grey   | pseudo state which does not explicitly exists in the FSM
  *
  * \dot
@@ -60,6 +71,8 @@
  *      "MimeBoundary" [label="MimeBoundary\n(Queues boundary)"];
  *      "MimePart" [label="MimePart\n(Queues part header)"];
  *      "MimePartBody" [label="MimePartBody\n(Queues part body)"];
+ *      "SharedBody" [label="SharedBody\n(Queues rendered body)"];
+ *      "Offloaded" [label="Offloaded\n(Reads from render thread)"];
  *      "Finished" [label="Finished\n(readChannelFinished)"];
  *      "t1" [color="grey" fontcolor="grey"
  *            label="Push current Multipart\nto stack and\nset Node as current Multipart"];
@@ -77,11 +90,31 @@
  *      "t1" -> "MimeBoundary" [label="First Node\nof Multipart"];
  *      "MimePart" -> "MimePartBody" [label="Node is\nPart"];
  *      "MimePartBody" -> "MimeBoundary" [label="Next Node"];
+ *      "Idle" -> "SharedBody" [color="orange" label="Bulk body\nrendered"];
+ *      "SharedBody" -> "Finished" [color="orange"];
+ *      "Idle" -> "Offloaded" [color="purple" label="Render thread\nassigned"];
+ *      "Offloaded" -> "Finished" [color="purple"];
  * }
  * \enddot
  *
- * After every Queued... operation the state engine is interrupted until the
- * queued data has been consumed.
+ * Headers, boundaries and in-memory bodies are copied to the ringbuffer
+ * synchronously and the state engine advances right away. It is only
+ * interrupted after a Queued... operation which involves an I/O device or
+ * does not fit into the ringbuffer, until the queued data has been
+ * consumed.
+ *
+ * Messages of a bulk delivery (see QsrMailTransport::queueBulk()) share a
+ * QsrMailSharedBody. The first renderer records everything it produces after
+ * the message headers. All following renderers only queue their own headers
+ * and the recorded body.
+ *
+ * If a render thread has been assigned by setRenderThread() the message is
+ * rendered by a second renderer running on that thread, see
+ * QsrMailRenderWorker. The output is passed through a QsrMailRenderPipe and
+ * this renderer only serves the data of the pipe to the transport. Messages
+ * with bodies read from sequential devices, which are bound to the thread
+ * of their owner, and messages of a bulk delivery are always rendered on
+ * the thread of the transport.
  *
  * For an example on how to use this class refer to the implementation of
  * QsrMailTransport which utilizes the class for message rendering.
@@ -111,6 +144,14 @@
  * \var QsrMailRenderer::MimePartBodyState
  * The QIODevice will output the encoded version of the part body.
  *
+ * \var QsrMailRenderer::SharedBodyState
+ * The QIODevice will output the body rendered for another message of the
+ * same bulk delivery.
+ *
+ * \var QsrMailRenderer::OffloadedState
+ * The message is rendered on the render thread and the data is taken from
+ * the QsrMailRenderPipe.
+ *
  * \var QsrMailRenderer::FinishedState
  * The FSM has ended and readChannelFinished() has been emitted.
  */
@@ -151,14 +192,14 @@
 /*!
  * \internal
  *
- * \fn QsrMailRenderer::progressUpdate(int processed, int total)
+ * \fn QsrMailRenderer::progressUpdate(qint64 processed, qint64 total)
  *
- * Emits when a queued buffer has been consumed using readyRead(). The object
- * has knowledge of the total number of buffers which will be queued during
- * the complete rendering cycle and passes this value as *total*. *processed*
- * is the number of the just finished buffer. This number will steadily
- * increase until *total* is reached. In other words the data can be normalized
- * to 100% which makes this suitable for progress bars.
+ * Emits when data has been consumed using advanceDataPointer(). *processed*
+ * is the number of bytes consumed so far and *total* the exact size of the
+ * rendered message as returned by totalSize(). The byte count steadily
+ * increases until *total* is reached, so the data can be normalized to 100%
+ * which makes this suitable for progress bars and transfer rates. *total* is
+ * -1 if the size of the message cannot be determined in advance.
  */
 
 /*!
@@ -170,20 +211,57 @@
  * error message is available through lastError().
  */
 
+/*!
+ * \internal
+ *
+ * \class QsrMailSharedBody "qsrmailrenderer_p.h"
+ * \brief The body of a bulk delivery shared by the renderers of all
+ * envelopes.
+ *
+ * The renderer which first gets to the body records its output in *data*
+ * and sets *complete* when it succeeded. *bodySize* is the size of the body
+ * as computed by the first call to QsrMailRenderer::totalSize(), or -2 if it
+ * has not been computed yet. *wrapper* is the multipart used for the body,
+ * so all messages use the same boundary.
+ *
+ * If the recording has been aborted *failed* is set, *oversized* is set if
+ * the body exceeds the recording limit. In both cases bodies which cannot be
+ * read a second time are not available to the other renderers anymore.
+ *
+ * The object is used from the thread of the transport only and therefore
+ * not protected.
+ */
+
 #include "qsrmailrenderer_p.h"
 #include "qsrmailmessage_p.h"
+#include "qsrmailenvelope_p.h"
+#include "qsrmailencodercache_p.h"
+#include "qsrmailmimedetector_p.h"
+#include "qsrmailfilemap_p.h"
+#include "qsrmailrenderpipe_p.h"
+#include "qsrmailbodysource_p.h"
 
 #include "qsrmailbase64encoder.h"
 #include "qsrmailqpencoder.h"
 
 #include <QBuffer>
-#include <QMimeDatabase>
+#include <QFile>
+#include <QFileInfo>
+#include <QScopedPointer>
 #include <QStringBuilder>
 
+#include <string.h>
+
 QT_BEGIN_NAMESPACE
 
-/* size of the ringbuffer - 128k should be a good value */
-#define RINGBUFFER_SIZE (128*1024)
+/* max size of a recorded bulk body */
+#define SHARED_BODY_LIMIT (64*1024*1024)
+
+/* chunks at least this large are served as span instead of being copied */
+#define SPAN_THRESHOLD (16*1024)
+
+/* RFC5322: maximum length of a line excluding CRLF */
+#define MAX_LINE_LENGTH 998
 
 /*!
  * \internal
@@ -199,14 +277,28 @@ QsrMailRenderer::QsrMailRenderer(const QsrMailMessage &message,
     mAutoDelete(false),
     mPartP(0),
     mPartEncoder(QsrMailMimePart::AutoDetectEncoder),
-    mBuffer(QByteArray(RINGBUFFER_SIZE, Qt::Uninitialized)),
-    mReadPointer(mBuffer.constData()),
+    mCapturingBody(false),
+    mCaptureSkip(0),
+    mEightBitMime(false),
+    mPrerenderedBinary(false),
+    mSpanPos(0),
+    mSpanFile(0),
+    mSpanAutoDelete(false),
+    mRenderThread(0),
+    mWorker(0),
+    mBufferPool(0),
+    mBufferSize(RINGBUFFER_SIZE),
+    mLowWatermark(0),
+    mHighWatermark(0),
     mReadPos(0),
-    mWritePointer(mBuffer.data()),
     mWritePos(0),
-    mMessageP(message.d.constData()),
-    mTotalChunks(0),
-    mProcessedChunks(0)
+    mUsed(0),
+    mRefillPending(false),
+    mMessage(message),
+    mMessageP(mMessage.d.constData()),
+    mTotalSize(-1),
+    mProcessedSize(0),
+    mSizeValid(false)
 {
     /* setup parts for rendering - involves connecting readChannelFinished() */
     setupPart(mMessageP->body.d.constData());
@@ -219,6 +311,9 @@ QsrMailRenderer::QsrMailRenderer(const QsrMailMessage &message,
  */
 QsrMailRenderer::~QsrMailRenderer()
 {
+    releaseWorker();
+    releaseSpan();
+    releaseCapture(true);
 }
 
 /*!
@@ -226,7 +321,8 @@ QsrMailRenderer::~QsrMailRenderer()
  *
  * Sets the ringbuffer to *size*. Usually the default oh 128kByte should
  * be more than enough for buffering. This method exists so the parameter
- * can potentially be exposed to the API.
+ * can potentially be exposed to the API. The buffer itself is allocated
+ * when rendering starts.
  */
 void QsrMailRenderer::setBufferSize(int size)
 {
@@ -237,7 +333,7 @@ void QsrMailRenderer::setBufferSize(int size)
         return;
     }
 
-    mBuffer = QByteArray(size, Qt::Uninitialized);
+    mBufferSize = size;
 }
 
 /*!
@@ -248,7 +344,102 @@ void QsrMailRenderer::setBufferSize(int size)
  */
 int QsrMailRenderer::bufferSize() const
 {
-    return mBuffer.size();
+    return mBufferSize;
+}
+
+/*!
+ * \internal
+ *
+ * Set the fill levels of the ringbuffer. Devices are read until *high*
+ * bytes are buffered, and the FSM is woken to refill the buffer once
+ * the consumer drained it to *low* bytes. The producer thus keeps
+ * encoding while the socket sends the rest of the buffer instead of
+ * waiting for it to run dry. A value of 0 selects the default, which
+ * is a quarter of the buffer for *low* and the full buffer for *high*.
+ */
+void QsrMailRenderer::setWatermarks(int low, int high)
+{
+    if (isRunning()) {
+        qWarning("QsrMailRenderer::setWatermarks: " \
+                 "cannot change watermarks while rendering");
+        return;
+    }
+
+    mLowWatermark = qMax(0, low);
+    mHighWatermark = qMax(0, high);
+}
+
+/*!
+ * \internal
+ *
+ * Returns the fill level at which the buffer is refilled, see
+ * setWatermarks().
+ */
+int QsrMailRenderer::lowWatermark() const
+{
+    const int size = mBuffer.isNull() ? mBufferSize : mBuffer.size();
+    if (mLowWatermark == 0)
+        return size / 4;
+
+    return qMin(mLowWatermark, highWatermark() - 1);
+}
+
+/*!
+ * \internal
+ *
+ * Returns the fill level up to which devices are read, see
+ * setWatermarks().
+ */
+int QsrMailRenderer::highWatermark() const
+{
+    const int size = mBuffer.isNull() ? mBufferSize : mBuffer.size();
+    if (mHighWatermark == 0)
+        return size;
+
+    return qMin(mHighWatermark, size);
+}
+
+/*!
+ * \internal
+ *
+ * Take the ringbuffer from *pool* instead of allocating it. The pool must
+ * stay valid as long as the renderer holds a buffer, see releaseBuffer().
+ */
+void QsrMailRenderer::setBufferPool(QsrMailBufferPool *pool)
+{
+    mBufferPool = pool;
+}
+
+/*!
+ * \internal
+ *
+ * Render the message on *thread* instead of the thread of the renderer, if
+ * the message allows. Must be called before the rendering starts.
+ */
+void QsrMailRenderer::setRenderThread(QThread *thread)
+{
+    mRenderThread = thread;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the ringbuffer to the buffer pool, or frees it if there is no
+ * pool. Must not be called while rendering; the data pointer is invalid
+ * afterwards.
+ */
+void QsrMailRenderer::releaseBuffer()
+{
+    Q_ASSERT(!isRunning());
+
+    if (mBufferPool != 0)
+        mBufferPool->release(mBuffer);
+    else
+        mBuffer = QByteArray();
+
+    mReadPos = 0;
+    mWritePos = 0;
+    mUsed = 0;
 }
 
 /*!
@@ -261,7 +452,13 @@ int QsrMailRenderer::bufferSize() const
  */
 const char *QsrMailRenderer::dataPointer() const
 {
-    return mReadPointer;
+    if (!mPipe.isNull())
+        return mPipe->dataPointer();
+
+    if (mUsed == 0 && !mSpan.isNull())
+        return mSpan.constData() + mSpanPos;
+
+    return mBuffer.constData() + mReadPos;
 }
 
 /*!
@@ -271,7 +468,41 @@ const char *QsrMailRenderer::dataPointer() const
  */
 int QsrMailRenderer::bytesAvailable() const
 {
-    return mWritePos - mReadPos;
+    if (!mPipe.isNull())
+        return mPipe->bytesAvailable();
+
+    if (mUsed == 0 && !mSpan.isNull())
+        return mSpan.size() - mSpanPos;
+
+    return qMin(mUsed, mBuffer.size() - mReadPos);
+}
+
+/*!
+ * \internal
+ *
+ * Stores pointers to the data available for reading in *data* and their
+ * sizes in *sizes*, both of which must have room for two entries, and
+ * returns the number of segments. Once the ringbuffer has wrapped around
+ * its data is split in two segments: the tail of the buffer followed by
+ * its start. The consumer can hand both to the socket at once and then
+ * advance the data pointer by their total size.
+ */
+int QsrMailRenderer::dataSegments(const char **data, int *sizes) const
+{
+    const int first = bytesAvailable();
+    if (first <= 0)
+        return 0;
+
+    data[0] = dataPointer();
+    sizes[0] = first;
+
+    /* the rest of the ringbuffer continues at its start */
+    if (!mPipe.isNull() || first >= mUsed)
+        return 1;
+
+    data[1] = mBuffer.constData();
+    sizes[1] = mUsed - first;
+    return 2;
 }
 
 /*!
@@ -284,33 +515,74 @@ int QsrMailRenderer::bytesAvailable() const
  */
 void QsrMailRenderer::advanceDataPointer(int bytes)
 {
-    /* shift pointer and adjust size of chunk */
-    mReadPointer += bytes;
-    mReadPos += bytes;
+    /* the data comes from the render thread - wake it if it waits */
+    if (!mPipe.isNull()) {
+        if (mPipe->advanceDataPointer(bytes))
+            QMetaObject::invokeMethod(mWorker, "pump", Qt::QueuedConnection);
 
-    if (mReadPos >= mWritePos) {        
-        /* handle buffer wrap */
-        if (mWritePos == mBuffer.size()) {
-            mReadPointer = mBuffer.constData();
-            mReadPos = 0;
-            mWritePointer = mBuffer.data();
-            mWritePos = 0;
-        }
-
-        if (mDevice == 0) {
-            /* if there's no device open we must trigger the FSM to
-             * produce more content - this will emit chunk ready...
-             */
+        mProcessedSize += bytes;
+        emit progressUpdate(mProcessedSize, mTotalSize);
 
+        if (mState == FinishedState && mLastError.isEmpty()
+                && mPipe->bytesAvailable() == 0) {
             QMetaObject::invokeMethod(this, "processStates",
                                       Qt::QueuedConnection);
-        } else {
-            /* if there's a device we just try to read once more now
-             * or wait for the next readyRead() signal
-             */
-            QMetaObject::invokeMethod(this, "readFromDevice",
-                                      Qt::QueuedConnection);
         }
+        return;
+    }
+
+    /* the span is read once the ringbuffer has been drained */
+    if (mUsed == 0 && !mSpan.isNull()) {
+        mSpanPos += bytes;
+
+        mProcessedSize += bytes;
+        emit progressUpdate(mProcessedSize, mTotalSize);
+
+        if (mSpanPos >= mSpan.size())
+            nextSpan();
+        return;
+    }
+
+    /* shift the read position, the data may span the buffer wrap */
+    Q_ASSERT(bytes <= mUsed);
+    mReadPos += bytes;
+    if (mReadPos >= mBuffer.size())
+        mReadPos -= mBuffer.size();
+    mUsed -= bytes;
+
+    /* an empty buffer starts over to keep the data in one segment */
+    if (mUsed == 0) {
+        mReadPos = 0;
+        mWritePos = 0;
+    }
+
+    mProcessedSize += bytes;
+    emit progressUpdate(mProcessedSize, mTotalSize);
+
+    /* the consumer continues with the span */
+    if (!mSpan.isNull())
+        return;
+
+    /* refill once the low watermark has been reached; the last data of
+     * a finished FSM is drained completely before readChannelFinished()
+     */
+    if (mRefillPending || mUsed > lowWatermark()
+            || (mUsed > 0 && mState == FinishedState && mDevice == 0))
+        return;
+
+    mRefillPending = true;
+    if (mDevice == 0) {
+        /* if there's no device open we must trigger the FSM to
+         * produce more content - this will emit chunk ready...
+         */
+        QMetaObject::invokeMethod(this, "processStates",
+                                  Qt::QueuedConnection);
+    } else {
+        /* if there's a device we just try to read once more now
+         * or wait for the next readyRead() signal
+         */
+        QMetaObject::invokeMethod(this, "readFromDevice",
+                                  Qt::QueuedConnection);
     }
 }
 
@@ -321,7 +593,9 @@ void QsrMailRenderer::advanceDataPointer(int bytes)
  */
 bool QsrMailRenderer::atEnd() const
 {
-    return mState == FinishedState && mDevice == 0 && mReadPos >= mWritePos;
+    return mState == FinishedState && mDevice == 0 && mSpan.isNull()
+            && mUsed == 0
+            && (mPipe.isNull() || mPipe->bytesAvailable() == 0);
 }
 
 /*!
@@ -345,6 +619,278 @@ QString QsrMailRenderer::lastError() const
     return mLastError;
 }
 
+/*!
+ * \internal
+ *
+ * Returns true if the message contains parts with the binary content
+ * transfer encoding. Such messages have to be transferred using the
+ * BINARYMIME extension (RFC3030).
+ */
+bool QsrMailRenderer::requiresBinaryMime() const
+{
+    if (isPrerendered())
+        return mPrerenderedBinary;
+
+    return isBinaryPart(mMessageP->body.d.constData());
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if the rendered message contains 8bit data, so it has to
+ * be announced as BODY=8BITMIME (RFC6152). Text parts without 8bit
+ * characters are sent as 7bit even if the server accepts 8bit data.
+ * Prerendered messages and bodies read from devices are not scanned and
+ * count as 8bit.
+ */
+bool QsrMailRenderer::requiresEightBitMime() const
+{
+    if (isPrerendered())
+        return true;
+
+    return isEightBitData(mMessageP->body.d.constData(), isEightBitEnabled());
+}
+
+/*!
+ * \internal
+ *
+ * Returns the exact number of bytes the rendered message will consist of,
+ * or -1 if the size cannot be determined in advance. The size is computed
+ * on the first call and does not include SMTP dot-stuffing.
+ *
+ * Base64 sizes are computed analytically, quoted printable bodies are
+ * measured by running the encoder once over the data. Bodies supplied as
+ * sequential devices cannot be measured, as well as quoted printable
+ * bodies supplied as devices other than QFile.
+ */
+qint64 QsrMailRenderer::totalSize()
+{
+    if (!mSizeValid) {
+        qint64 size = messageHeaders().size();
+        qint64 body;
+
+        /* the body of a bulk is measured once - later on it might even be
+         * consumed already
+         */
+        if (mShared && mShared->bodySize > -2)
+            body = mShared->bodySize;
+        else if (rootPart()->isMimeMultipart())
+            body = multipartSize(rootPart(), isEightBitEnabled());
+        else
+            body = rawBodySize(rootPart());
+
+        if (mShared)
+            mShared->bodySize = body;
+
+        mTotalSize = body < 0 ? -1 : size + body;
+        mSizeValid = true;
+    }
+
+    return mTotalSize;
+}
+
+/*!
+ * \internal
+ *
+ * Makes the message part of a bulk delivery. All messages of the bulk share
+ * the same *body* which is rendered only once. The headers of the *envelope*
+ * replace the message headers of the same name. Must be called before the
+ * rendering starts.
+ */
+void QsrMailRenderer::setSharedBody(
+        const QSharedPointer<QsrMailSharedBody> &body,
+        const QsrMailEnvelope &envelope)
+{
+    Q_ASSERT(mState == IdleState && mMessageHeaders.isNull());
+
+    mShared = body;
+    mEnvelopeHeaders = envelope.d->headers;
+
+    /* all messages must use the same wrapper to get identical boundaries */
+    if (mMessageP->body.d->isMimePart()) {
+        if (mShared->wrapper.d->parts.isEmpty())
+            mShared->wrapper = wrapper();
+        else
+            mWrapper = mShared->wrapper;
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Serves *data*, a message rendered before, instead of rendering the
+ * message of the renderer. *binary* tells whether the data requires
+ * BINARYMIME. The data is not copied and has to stay valid until the
+ * renderer has been aborted or destroyed. Must be called before the
+ * rendering starts.
+ */
+void QsrMailRenderer::setPrerendered(const QByteArray &data, bool binary)
+{
+    Q_ASSERT(mState == IdleState);
+
+    mPrerendered = data;
+    mPrerenderedBinary = binary;
+    mTotalSize = data.size();
+    mSizeValid = true;
+}
+
+/*!
+ * \internal
+ *
+ * \overload
+ *
+ * Serves the message rendered before into the file *fileName*, which
+ * holds *size* bytes. The file is mapped like any other file and has to
+ * exist until the renderer has been aborted or destroyed.
+ */
+void QsrMailRenderer::setPrerendered(const QString &fileName, qint64 size,
+                                     bool binary)
+{
+    Q_ASSERT(mState == IdleState);
+
+    mPrerenderedFile = fileName;
+    mPrerenderedBinary = binary;
+    mTotalSize = size;
+    mSizeValid = true;
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if the renderer serves a message rendered before instead of
+ * rendering its message.
+ */
+bool QsrMailRenderer::isPrerendered() const
+{
+    return !mPrerendered.isNull() || !mPrerenderedFile.isEmpty();
+}
+
+/*!
+ * \internal
+ *
+ * If *enabled* the server accepts 8bit data (RFC6152) and text parts
+ * which would be encoded by AutoDetectEncoder are sent unencoded, as
+ * far as their content allows it. Must be called before the rendering
+ * starts.
+ */
+void QsrMailRenderer::setEightBitMime(bool enabled)
+{
+    Q_ASSERT(mState == IdleState);
+
+    if (mEightBitMime == enabled)
+        return;
+
+    mEightBitMime = enabled;
+    if (!isPrerendered())
+        mSizeValid = false;
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if text parts may be sent as 8bit data.
+ */
+bool QsrMailRenderer::eightBitMime() const
+{
+    return mEightBitMime;
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if the parts are rendered for a server accepting 8bit data.
+ * The body of a bulk delivery is shared with messages which might go to
+ * other servers, so it is always encoded.
+ */
+bool QsrMailRenderer::isEightBitEnabled() const
+{
+    return mEightBitMime && mShared.isNull();
+}
+
+/*!
+ * \internal
+ *
+ * Returns false if the message is part of a bulk delivery and its body
+ * cannot be rendered. This is the case if the body contains devices which
+ * have been consumed by a renderer which failed to record the body.
+ */
+bool QsrMailRenderer::isBodyAvailable() const
+{
+    if (!mShared || mShared->complete || isReusablePart(rootPart()))
+        return true;
+
+    return !mShared->capturing && !mShared->failed;
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if rendering has been started.
+ */
+bool QsrMailRenderer::isStarted() const
+{
+    return mState != IdleState;
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if the message can be rendered again by a new renderer.
+ * This is the case if rendering has not been started yet or if the body
+ * does not depend on devices which have already been consumed.
+ */
+bool QsrMailRenderer::isRestartable() const
+{
+    if (mState == IdleState || isPrerendered()
+            || isReusablePart(rootPart()))
+        return true;
+
+    return mShared && mShared->complete;
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if the message can be rendered ahead of its delivery. The
+ * body has to be renderable again, should the delivery be retried, and
+ * must not be the shared body of a bulk delivery, which is recorded by the
+ * renderer of the message in transfer.
+ */
+bool QsrMailRenderer::isPrefetchable() const
+{
+    return mShared.isNull()
+            && (isPrerendered() || isReusablePart(rootPart()));
+}
+
+/*!
+ * \internal
+ *
+ * Takes over the buffer settings and the shared body of *other*, which is
+ * a renderer of the same message to be started over. The headers and
+ * boundaries already rendered are kept, so the message does not change.
+ */
+void QsrMailRenderer::setupRestart(const QsrMailRenderer *other)
+{
+    if (mMessageP->body.d->isMimePart())
+        mWrapper = other->wrapper();
+    mMessageHeaders = other->mMessageHeaders;
+    mBufferPool = other->mBufferPool;
+    mBufferSize = other->mBufferSize;
+    mLowWatermark = other->mLowWatermark;
+    mHighWatermark = other->mHighWatermark;
+    mShared = other->mShared;
+    mEnvelopeHeaders = other->mEnvelopeHeaders;
+    mEightBitMime = other->mEightBitMime;
+    mPrerendered = other->mPrerendered;
+    mPrerenderedFile = other->mPrerenderedFile;
+    mPrerenderedBinary = other->mPrerenderedBinary;
+
+    if (isPrerendered()) {
+        mTotalSize = other->mTotalSize;
+        mSizeValid = true;
+    }
+}
+
 /*!
  * \internal
  *
@@ -365,6 +911,23 @@ void QsrMailRenderer::renderMessage()
         return;
     }
 
+    /* hand the work to the render thread if possible */
+    if (mRenderThread != 0 && mShared.isNull() && !isPrerendered()
+            && isOffloadablePart(rootPart())) {
+        startWorker();
+        return;
+    }
+
+    /* the ringbuffer is needed from now on */
+    if (mBufferPool != 0)
+        mBuffer = mBufferPool->acquire(mBufferSize);
+    else
+        mBuffer = QByteArray(mBufferSize, Qt::Uninitialized);
+
+    mReadPos = 0;
+    mWritePos = 0;
+    mUsed = 0;
+
     /* trigger start */
     QMetaObject::invokeMethod(this, "processStates", Qt::QueuedConnection);
 }
@@ -382,11 +945,15 @@ void QsrMailRenderer::abort()
     if (mDevice != 0)
         detachDevice();
 
-    mReadPointer = mBuffer.constData();
-    mReadPos = 0;
+    releaseWorker();
+
+    releaseSpan();
+
+    releaseCapture(true);
 
-    mWritePointer = mBuffer.data();
+    mReadPos = 0;
     mWritePos = 0;
+    mUsed = 0;
 
     mState = FinishedState;
 }
@@ -419,44 +986,573 @@ void QsrMailRenderer::setupPart(const QsrMailAbstractPartPrivate *p)
 /*!
  * \internal
  *
- * Returns the number of buffers a message *p* will produce. This is done by
- * resursively counting the message parts and adding the fixed values for
- * boundaries, headers and so on.
+ * Returns the part the rendering starts with. This is the body of the
+ * message or the multipart wrapping it, if the body is a single MIME part.
+ */
+const QsrMailAbstractPartPrivate *QsrMailRenderer::rootPart() const
+{
+    if (mMessageP->body.d->isMimePart())
+        return wrapper().d.constData();
+
+    return mMessageP->body.d.constData();
+}
+
+/*!
+ * \internal
+ *
+ * Returns the multipart wrapping a body which is a single MIME part. The
+ * wrapper is built on first use, since renderers started over or sharing
+ * a bulk body take the wrapper of another renderer instead.
+ */
+const QsrMailMimeMultipart &QsrMailRenderer::wrapper() const
+{
+    /* a single part has to be wrapped into a multipart - a bit ugly */
+    if (mWrapper.d->parts.isEmpty())
+        mWrapper.d->parts.append(mMessageP->body);
+
+    return mWrapper;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the rendered message headers including the empty line which
+ * separates them from the body. The headers are cooked only once, so the
+ * generated Date header does not change between totalSize() and the
+ * actual rendering.
+ */
+const QByteArray &QsrMailRenderer::messageHeaders()
+{
+    if (mMessageHeaders.isNull()) {
+        QsrMailHeaders headers(mMessageP->cookHeaders());
+        const QsrMailAbstractPartPrivate *p = rootPart();
+
+        /* personalize a bulk message */
+        if (!mEnvelopeHeaders.isEmpty())
+            headers.setHeaders(mEnvelopeHeaders);
+
+        if (p->isMimeMultipart()) {
+            /* output mime version and multipart headers */
+            headers.setHeader("MIME-Version", "1.0");
+            mMessageHeaders = headers.renderHeaders()
+                    % p->cookHeaders().renderHeaders()
+                    % "\r\n";
+        } else {
+            /* output end-of-header sig. */
+            mMessageHeaders = headers.renderHeaders() % "\r\n";
+        }
+    }
+
+    return mMessageHeaders;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the rendered headers of the MIME part *p* including the empty
+ * line after the headers. This is where the Content-Type autodetection
+ * takes place and where the encoder is selected, which is returned in
+ * *encoder*. If *eightBit* is set the server accepts 8bit data.
+ */
+QByteArray QsrMailRenderer::partHeaders(const QsrMailAbstractPartPrivate *p,
+                                        QsrMailMimePart::Encoder *encoder,
+                                        bool eightBit)
+{
+    *encoder = p->encoder;
+
+    /* build part headers */
+    QsrMailHeaders headerList(p->cookHeaders());
+
+    /* determine content type */
+    QByteArray contentType(headerList.value("Content-Type"));
+    if (contentType.isEmpty()) {
+        /* detect contentType - the result is stored in the part */
+        contentType = QsrMailMimeDetector::contentType(p);
+
+        /* override the Content-Type header */
+        headerList.setHeader("Content-Type", contentType);
+    }
+
+    /* determine encoder */
+
+    /* autodetect selects quoted printable for text class,
+     * base64 for everything else; text which is fit for 8bit transport
+     * is not encoded at all if the server accepts it
+     */
+    bool highBit = false;
+    if (*encoder == QsrMailMimePart::AutoDetectEncoder) {
+        int bareLineFeeds;
+        if (!contentType.startsWith("text/"))
+            *encoder = QsrMailMimePart::Base64Encoder;
+        else if (eightBit && p->bodyDevice == 0
+                 && scanEightBit(p->body, &bareLineFeeds, &highBit))
+            *encoder = QsrMailMimePart::PassthroughEncoder;
+        else
+            *encoder = QsrMailMimePart::QuotedPrintableEncoder;
+
+        if (*encoder == QsrMailMimePart::PassthroughEncoder) {
+            headerList.setHeader("Content-Transfer-Encoding",
+                                 highBit ? "8bit" : "7bit");
+        }
+    }
+
+    /* override content transfer encoding based on selected encoder */
+    if (*encoder == QsrMailMimePart::Base64Encoder) {
+        headerList.setHeader("Content-Transfer-Encoding",
+                             "base64");
+    } else if (*encoder == QsrMailMimePart::QuotedPrintableEncoder) {
+        headerList.setHeader("Content-Transfer-Encoding",
+                             "quoted-printable");
+    }
+
+    /* render the headers for the part */
+    return headerList.renderHeaders() % "\r\n";
+}
+
+/*!
+ * \internal
+ *
+ * Returns the size of the multipart *p* excluding its headers, which is the
+ * size of all boundaries and parts. Mirrors the output of the boundary and
+ * part states of the FSM. Returns -1 if the size of one of the parts is
+ * unknown. *eightBit* is passed to partHeaders().
+ */
+qint64 QsrMailRenderer::multipartSize(const QsrMailAbstractPartPrivate *p,
+                                      bool eightBit)
+{
+    const qint64 boundary = p->boundary.size() + 4;
+    qint64 result = 0;
+    bool afterPart = false;
+
+    foreach (const QsrMailAbstractPart &part, p->parts) {
+        const QsrMailAbstractPartPrivate *partP = part.d.constData();
+        qint64 size;
+
+        if (partP->isMimeMultipart()) {
+            size = partP->cookHeaders().renderedSize() + 2;
+            qint64 body = multipartSize(partP, eightBit);
+            size = body < 0 ? -1 : size + body;
+        } else {
+            QsrMailMimePart::Encoder encoder;
+            size = partHeaders(partP, &encoder, eightBit).size();
+            qint64 body = encodedBodySize(partP, encoder);
+            size = body < 0 ? -1 : size + body;
+        }
+
+        if (size < 0)
+            return -1;
+
+        /* boundary, preceded by a line break after a MIME part */
+        result += (afterPart ? 2 : 0) + boundary + size;
+        afterPart = partP->isMimePart();
+    }
+
+    /* final boundary */
+    return result + (afterPart ? 2 : 0) + boundary + 2;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the size of the body of the part *p* as it is, or -1 if the body
+ * is a sequential device.
+ */
+qint64 QsrMailRenderer::rawBodySize(const QsrMailAbstractPartPrivate *p)
+{
+    QIODevice *device = p->bodyDevice;
+
+    if (device == 0)
+        return p->body.size();
+    if (device->isSequential())
+        return -1;
+
+    return device->size() - (device->isOpen() ? device->pos() : 0);
+}
+
+/*!
+ * \internal
+ *
+ * Returns the size of the body of the part *p* encoded using *encoder*, or
+ * -1 if the size cannot be determined without consuming the body.
+ */
+qint64 QsrMailRenderer::encodedBodySize(const QsrMailAbstractPartPrivate *p,
+                                        QsrMailMimePart::Encoder encoder)
+{
+    switch (encoder) {
+    case QsrMailMimePart::Base64Encoder: {
+        qint64 size = rawBodySize(p);
+        return size < 0 ? -1 : QsrMailBase64Encoder::encodedSize(size);
+    }
+
+    case QsrMailMimePart::QuotedPrintableEncoder:
+        break;
+
+    case QsrMailMimePart::PassthroughEncoder:
+        /* 8bit text is sent with CRLF line breaks */
+        if (isEightBitPart(p, encoder)) {
+            int bareLineFeeds = 0;
+            bool highBit;
+            scanEightBit(p->body, &bareLineFeeds, &highBit);
+            return p->body.size() + bareLineFeeds;
+        }
+        return rawBodySize(p);
+
+    default:
+        return rawBodySize(p);
+    }
+
+    /* the output of quoted printable depends on the content; if it has been
+     * encoded for another message the cache knows its size
+     */
+    QsrMailEncoderCachePrivate *cache = QsrMailEncoderCachePrivate::instance();
+    QByteArray cacheKey(cache->cacheKey(p, encoder));
+    QByteArray cachedData;
+    QString cachedFile;
+
+    if (!cacheKey.isNull()
+            && cache->lookup(cacheKey, &cachedData, &cachedFile)) {
+        if (cachedFile.isEmpty())
+            return cachedData.size();
+        else
+            return QFileInfo(cachedFile).size();
+    }
+
+    /* ... otherwise run the encoder over a private copy of the body */
+    QScopedPointer<QIODevice> base;
+
+    if (p->bodyDevice == 0) {
+        QBuffer *buffer = new QBuffer;
+        buffer->setData(p->body);
+        base.reset(buffer);
+    } else {
+        QFileDevice *file = qobject_cast<QFileDevice *>(p->bodyDevice);
+        if (file == 0 || file->fileName().isEmpty()
+                || (file->isOpen() && file->pos() != 0))
+            return -1;
+
+        base.reset(new QFile(file->fileName()));
+        if (!base->open(QIODevice::ReadOnly))
+            return -1;
+    }
+
+    QsrMailQpEncoder qp(base.data());
+    if (!qp.open(QIODevice::ReadOnly))
+        return -1;
+
+    QByteArray buffer(64 * 1024, Qt::Uninitialized);
+    qint64 result = 0;
+    forever {
+        qint64 got = qp.read(buffer.data(), buffer.size());
+        if (got < 0)
+            return -1;
+        if (got == 0)
+            break;
+
+        result += got;
+    }
+
+    return result;
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if the part *p* or one of it's children is passed through
+ * with the binary content transfer encoding.
+ */
+bool QsrMailRenderer::isBinaryPart(const QsrMailAbstractPartPrivate *p)
+{
+    if (p->isMimeMultipart()) {
+        foreach (const QsrMailAbstractPart &part, p->parts) {
+            if (isBinaryPart(part.d.constData()))
+                return true;
+        }
+        return false;
+    }
+
+    return p->isMimePart()
+            && p->encoder == QsrMailMimePart::PassthroughEncoder
+            && p->contentEncoding.toLower() == "binary";
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if the part *p* or one of it's children is output with 8bit
+ * characters. *eightBit* is passed to partHeaders().
+ */
+bool QsrMailRenderer::isEightBitData(const QsrMailAbstractPartPrivate *p,
+                                     bool eightBit)
+{
+    if (p->isMimeMultipart()) {
+        foreach (const QsrMailAbstractPart &part, p->parts) {
+            if (isEightBitData(part.d.constData(), eightBit))
+                return true;
+        }
+        return false;
+    }
+
+    if (p->isMimePart()) {
+        if (p->encoder == QsrMailMimePart::AutoDetectEncoder) {
+            /* only text selected for 8bit transport is sent unencoded */
+            int bareLineFeeds;
+            bool highBit = false;
+            if (!eightBit || p->bodyDevice != 0
+                    || !scanEightBit(p->body, &bareLineFeeds, &highBit)
+                    || !highBit)
+                return false;
+
+            QsrMailMimePart::Encoder encoder;
+            partHeaders(p, &encoder, eightBit);
+            return encoder == QsrMailMimePart::PassthroughEncoder;
+        }
+
+        if (p->encoder != QsrMailMimePart::PassthroughEncoder)
+            return false;
+    }
+
+    /* simple bodies and passthrough parts are sent as they are */
+    if (p->bodyDevice != 0)
+        return true;
+
+    const uchar *data = reinterpret_cast<const uchar *>(p->body.constData());
+    for (int i=0, size=p->body.size(); i<size; ++i) {
+        if (data[i] & 0x80)
+            return true;
+    }
+
+    return false;
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if the MIME part *p* is sent as 8bit text, which is the
+ * case if partHeaders() selected the *encoder* PassthroughEncoder instead
+ * of AutoDetectEncoder.
+ */
+bool QsrMailRenderer::isEightBitPart(const QsrMailAbstractPartPrivate *p,
+                                     QsrMailMimePart::Encoder encoder)
+{
+    return encoder == QsrMailMimePart::PassthroughEncoder
+            && p->encoder == QsrMailMimePart::AutoDetectEncoder;
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if *body* can be sent unencoded as 8bit data (RFC2045):
+ * it contains neither NUL nor bare CR and no line is longer than 998
+ * octets. Bare LF are sent as CRLF; their number is returned in
+ * *bareLineFeeds*. *highBit* is set if the body contains 8bit characters.
+ */
+bool QsrMailRenderer::scanEightBit(const QByteArray &body,
+                                   int *bareLineFeeds, bool *highBit)
+{
+    const uchar *p = reinterpret_cast<const uchar *>(body.constData());
+    const uchar *end = p + body.size();
+    const uchar *line = p;
+    uchar bits = 0;
+
+    *bareLineFeeds = 0;
+
+    for (; p < end; ++p) {
+        uchar c = *p;
+        bits |= c;
+
+        if (c == '\n') {
+            if (p == line || p[-1] != '\r') {
+                if (p - line > MAX_LINE_LENGTH)
+                    return false;
+                (*bareLineFeeds)++;
+            } else if (p - line - 1 > MAX_LINE_LENGTH) {
+                return false;
+            }
+            line = p + 1;
+        } else if (c == '\r') {
+            if (p + 1 == end || p[1] != '\n')
+                return false;
+        } else if (c == 0) {
+            return false;
+        }
+    }
+
+    *highBit = (bits & 0x80) != 0;
+    return end - line <= MAX_LINE_LENGTH;
+}
+
+/*!
+ * \internal
+ *
+ * Returns *body*, which has been checked by scanEightBit(), with bare LF
+ * replaced by CRLF. The body is not copied if it contains none.
+ */
+QByteArray QsrMailRenderer::eightBitBody(const QByteArray &body)
+{
+    int bareLineFeeds;
+    bool highBit;
+    scanEightBit(body, &bareLineFeeds, &highBit);
+    if (bareLineFeeds == 0)
+        return body;
+
+    QByteArray result;
+    result.reserve(body.size() + bareLineFeeds);
+
+    const char *data = body.constData();
+    for (int i=0, size=body.size(); i<size; ++i) {
+        if (data[i] == '\n' && (i == 0 || data[i-1] != '\r'))
+            result += '\r';
+        result += data[i];
+    }
+
+    return result;
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if the body of the part *p* and all of it's children can be
+ * rendered more than once, which is the case if no devices are involved.
+ */
+bool QsrMailRenderer::isReusablePart(const QsrMailAbstractPartPrivate *p)
+{
+    if (p->isMimeMultipart()) {
+        foreach (const QsrMailAbstractPart &part, p->parts) {
+            if (!isReusablePart(part.d.constData()))
+                return false;
+        }
+        return true;
+    }
+
+    return p->bodyDevice == 0;
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if the part *p* and all of it's children can be rendered on
+ * another thread. This is not the case for bodies read from sequential
+ * devices, which usually depend on the event loop of their thread.
+ */
+bool QsrMailRenderer::isOffloadablePart(const QsrMailAbstractPartPrivate *p)
+{
+    if (p->isMimeMultipart()) {
+        foreach (const QsrMailAbstractPart &part, p->parts) {
+            if (!isOffloadablePart(part.d.constData()))
+                return false;
+        }
+        return true;
+    }
+
+    if (p->bodyDevice == 0)
+        return true;
+
+    QFileDevice *file = qobject_cast<QFileDevice *>(p->bodyDevice);
+    return file != 0 && !file->isSequential();
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if the message does not depend on the event loop of the
+ * thread of its body devices, see isOffloadablePart().
+ */
+bool QsrMailRenderer::isOffloadable() const
+{
+    return isOffloadablePart(rootPart());
+}
+
+/*!
+ * \internal
+ *
+ * Returns true if *message* can be rendered on another thread than the one
+ * of its body devices, see isOffloadablePart().
+ */
+bool QsrMailRenderer::isOffloadable(const QsrMailMessage &message)
+{
+    return isOffloadablePart(message.d->body.d.constData());
+}
+
+/*!
+ * \internal
+ *
+ * Records *size* bytes of rendered output starting at *data* for the other
+ * messages of a bulk delivery. The message headers are skipped. Gives up if
+ * the body exceeds SHARED_BODY_LIMIT.
  */
-int QsrMailRenderer::totalBuffers(const QsrMailAbstractPartPrivate *p)
+void QsrMailRenderer::captureBody(const char *data, qint64 size)
 {
-    if (p->isMimePart()) {
-        return 1;
-    } else if (p->isMimeMultipart()) {
-        /* header */
-        int result = 1;
+    if (mCaptureSkip > 0) {
+        qint64 skip = qMin<qint64>(mCaptureSkip, size);
+        mCaptureSkip -= skip;
+        data += skip;
+        size -= skip;
+    }
 
-        /* each part... */
-        foreach (const QsrMailAbstractPart &part, p->parts) {
-            /* boundary, header and parts */
-            result += 2;
-            result += totalBuffers(part.d.constData());
-        }
+    if (mBodyCapture.size() + size > SHARED_BODY_LIMIT) {
+        mShared->oversized = true;
+        releaseCapture(true);
+        return;
+    }
 
-        /* final boundary */
-        result += 1;
+    mBodyCapture.append(data, size);
+}
 
-        return result;
-    } else {
-        /* invalid? huh?? anyway return 0 */
-        return 0;
-    }
+/*!
+ * \internal
+ *
+ * Stops recording the body of a bulk delivery. *failed* is set in the shared
+ * body unless the recording has been committed.
+ */
+void QsrMailRenderer::releaseCapture(bool failed)
+{
+    if (!mCapturingBody)
+        return;
+
+    mShared->capturing = false;
+    mShared->failed = mShared->failed || failed;
+
+    mCapturingBody = false;
+    mBodyCapture.clear();
 }
 
 /*!
  * \internal
  *
- * Creates and queues a QIODevice with the contents of *chunk*. The device
- * will be opened and the first readFromDevice() is triggered.
+ * Queues *chunk*. Small chunks are copied to the ringbuffer right away if
+ * they fit, large chunks are served as span. Otherwise a QIODevice with
+ * the contents of *chunk* is created and the first readFromDevice() is
+ * triggered.
  */
 void QsrMailRenderer::enqueue(const QByteArray &chunk)
 {
-    Q_ASSERT(mDevice == 0);
+    Q_ASSERT(mDevice == 0 && mSpan.isNull());
+
+    if (chunk.size() < SPAN_THRESHOLD
+            && chunk.size() <= mBuffer.size() - mUsed) {
+        /* the chunk may wrap around the end of the buffer */
+        const char *data = chunk.constData();
+        int remaining = chunk.size();
+        while (remaining > 0) {
+            int bytes = qMin(remaining, mBuffer.size() - mWritePos);
+            char *p = mBuffer.data() + mWritePos;
+            memcpy(p, data, bytes);
+
+            /* record the body for the other messages of a bulk */
+            if (mCapturingBody)
+                captureBody(p, bytes);
+
+            commitWrite(bytes);
+            data += bytes;
+            remaining -= bytes;
+        }
+        return;
+    }
+
+    if (chunk.size() >= SPAN_THRESHOLD) {
+        enqueueSpan(chunk);
+        return;
+    }
 
     QBuffer *device = new QBuffer(this);
     device->setData(chunk);
@@ -498,6 +1594,11 @@ void QsrMailRenderer::enqueue(QIODevice *device, bool autoDelete)
         return;
     }
 
+    /* files are served from a mapping instead of being read */
+    if (QsrMailFileMap::isMappable(device)
+            && enqueueFile(static_cast<QFileDevice *>(device), autoDelete))
+        return;
+
     /* device is valid - remember it */
     mDevice = device;
     mAutoDelete = autoDelete;
@@ -506,6 +1607,148 @@ void QsrMailRenderer::enqueue(QIODevice *device, bool autoDelete)
     QMetaObject::invokeMethod(this, "readFromDevice", Qt::QueuedConnection);
 }
 
+/*!
+ * \internal
+ *
+ * Creates the renderer doing the actual work on the render thread. It uses
+ * the headers and the boundaries of this renderer, so the message matches
+ * the size reported by totalSize().
+ */
+void QsrMailRenderer::startWorker()
+{
+    messageHeaders();
+
+    QsrMailRenderer *r = new QsrMailRenderer(mMessage);
+    r->setupRestart(this);
+
+    /* the pool belongs to this thread; the size is not computed twice */
+    r->mBufferPool = 0;
+    r->mTotalSize = mTotalSize;
+    r->mSizeValid = true;
+
+    mPipe = QSharedPointer<QsrMailRenderPipe>(
+                new QsrMailRenderPipe(mBufferSize));
+    mWorker = new QsrMailRenderWorker(r, mPipe);
+    mWorker->moveToThread(mRenderThread);
+
+    connect(mWorker, SIGNAL(readyRead()), this, SLOT(readFromPipe()));
+    connect(mWorker, SIGNAL(finished(QString)),
+            this, SLOT(endOfPipe(QString)));
+
+    mState = OffloadedState;
+    emit progressUpdate(mProcessedSize, mTotalSize);
+
+    QMetaObject::invokeMethod(mWorker, "start", Qt::QueuedConnection);
+}
+
+/*!
+ * \internal
+ *
+ * Stops the render thread from working on the message. The worker and its
+ * renderer are destroyed on the render thread.
+ */
+void QsrMailRenderer::releaseWorker()
+{
+    if (mWorker == 0)
+        return;
+
+    mPipe->cancel();
+    mWorker->disconnect(this);
+    mWorker->deleteLater();
+
+    mWorker = 0;
+    mPipe.clear();
+}
+
+/*!
+ * \internal
+ *
+ * Queues *span* which is read directly from its memory after the data in
+ * the ringbuffer. The FSM continues once it has been read completely.
+ */
+void QsrMailRenderer::enqueueSpan(const QByteArray &span)
+{
+    mSpan = span;
+    mSpanPos = 0;
+
+    /* record the body for the other messages of a bulk */
+    if (mCapturingBody)
+        captureBody(mSpan.constData(), mSpan.size());
+
+    QMetaObject::invokeMethod(this, "readyRead", Qt::QueuedConnection);
+}
+
+/*!
+ * \internal
+ *
+ * Queues the remaining content of *file* as a series of spans, each of
+ * which maps a window of the file. Returns false if the file cannot be
+ * mapped; it has to be read then.
+ */
+bool QsrMailRenderer::enqueueFile(QFileDevice *file, bool autoDelete)
+{
+    if (!mSpanMap.map(file, file->pos()))
+        return false;
+
+    mSpanFile = file;
+    mSpanAutoDelete = autoDelete;
+
+    enqueueSpan(QByteArray::fromRawData(mSpanMap.data(), mSpanMap.size()));
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * The current span has been read. Maps the next window of the file, if
+ * any, or continues with the FSM. If a window cannot be mapped the rest of
+ * the file is read as device.
+ */
+void QsrMailRenderer::nextSpan()
+{
+    mSpan.clear();
+    mSpanPos = 0;
+
+    if (mSpanFile != 0) {
+        qint64 offset = mSpanMap.offset() + mSpanMap.size();
+        if (offset < mSpanFile->size()) {
+            if (mSpanMap.map(mSpanFile, offset)) {
+                enqueueSpan(QByteArray::fromRawData(mSpanMap.data(),
+                                                    mSpanMap.size()));
+                return;
+            }
+
+            QFileDevice *file = mSpanFile;
+            mSpanFile = 0;
+            file->seek(offset);
+            enqueue(file, mSpanAutoDelete);
+            return;
+        }
+    }
+
+    releaseSpan();
+    QMetaObject::invokeMethod(this, "processStates", Qt::QueuedConnection);
+}
+
+/*!
+ * \internal
+ *
+ * Drops the current span and unmaps and disposes its file.
+ */
+void QsrMailRenderer::releaseSpan()
+{
+    mSpan.clear();
+    mSpanPos = 0;
+    mSpanMap.unmap();
+
+    if (mSpanFile != 0 && mSpanAutoDelete) {
+        mSpanFile->close();
+        mSpanFile->deleteLater();
+    }
+
+    mSpanFile = 0;
+}
+
 /*!
  * \internal
  *
@@ -537,6 +1780,10 @@ void QsrMailRenderer::detachDevice()
 
     /* ... no longer processing a device */
     mDevice = 0;    
+
+    /* drop a capture which has not been committed to the cache */
+    mCacheKey.clear();
+    mCapture.clear();
 }
 
 /*!
@@ -578,14 +1825,14 @@ bool QsrMailRenderer::deviceAtEnd() const
          * encoder buffer then flush the encoder. The method will emit
          * readyRead.
          */
-        if (!buffersEmpty && mDeviceFinished.contains(device)) {
+        if (!buffersEmpty && isDeviceFinished(device)) {
             encoder->flush();
             return false;
         }
 
         /* Determine EOF based on device type and buffer state */
         if (device->isSequential())
-            return buffersEmpty && mDeviceFinished.contains(device);
+            return buffersEmpty && isDeviceFinished(device);
         else
             return buffersEmpty && device->atEnd();
     } else {
@@ -593,12 +1840,68 @@ bool QsrMailRenderer::deviceAtEnd() const
 
         /* Determine EOF based on device type and buffer state */
         if (mDevice->isSequential())
-            return buffersEmpty && mDeviceFinished.contains(mDevice);
+            return buffersEmpty && isDeviceFinished(mDevice);
         else
             return buffersEmpty && mDevice->atEnd();
     }
 }
 
+/*!
+ * \internal
+ *
+ * Returns true if the sequential *device* has sent readChannelFinished().
+ * Body sources know their end, so their signal cannot be missed.
+ */
+bool QsrMailRenderer::isDeviceFinished(QIODevice *device) const
+{
+    QsrMailBodySourceDevice *source =
+            qobject_cast<QsrMailBodySourceDevice *>(device);
+    if (source != 0 && source->isFinished())
+        return true;
+
+    return mDeviceFinished.contains(device);
+}
+
+/*!
+ * \internal
+ *
+ * The render thread put data into the pipe. Notifications arriving after
+ * the renderer has been aborted are ignored.
+ */
+void QsrMailRenderer::readFromPipe()
+{
+    if (mPipe.isNull())
+        return;
+
+    mPipe->acknowledge();
+    if (mPipe->bytesAvailable() > 0)
+        emit readyRead();
+}
+
+/*!
+ * \internal
+ *
+ * The render thread is done with the message. *errorString* is not empty
+ * if it failed. Otherwise readChannelFinished() follows once the
+ * pipe has been drained.
+ */
+void QsrMailRenderer::endOfPipe(const QString &errorString)
+{
+    if (mPipe.isNull() || mState != OffloadedState)
+        return;
+
+    mState = FinishedState;
+
+    if (!errorString.isEmpty()) {
+        mLastError = errorString;
+        emit error();
+        return;
+    }
+
+    if (mPipe->bytesAvailable() == 0)
+        QMetaObject::invokeMethod(this, "processStates", Qt::QueuedConnection);
+}
+
 /*!
  * \internal
  *
@@ -611,14 +1914,66 @@ void QsrMailRenderer::readFromDevice()
     /* make sure the device is valid since the device might have
      * been disposed meanwhile (eg. by abort())
      */
+    mRefillPending = false;
     if (mDevice == 0)
         return;
 
-    /* try to fill the buffer */
+    bool dataAvailable = fillFromDevice();
+
+    /* in case we got no more data from a completed device we trigger the
+     * FSM to jump to the next state
+     */
+    if (mDevice == 0 && !dataAvailable)
+        QMetaObject::invokeMethod(this, "processStates", Qt::QueuedConnection);
+
+    /* if there was anything buffered emit the signal */
+    if (dataAvailable)
+        emit readyRead();
+}
+
+/*!
+ * \internal
+ *
+ * Returns the number of bytes which may be written at the write position
+ * in one go without passing the end of the buffer or the high watermark.
+ */
+int QsrMailRenderer::writeSpace() const
+{
+    return qMin(highWatermark() - mUsed, mBuffer.size() - mWritePos);
+}
+
+/*!
+ * \internal
+ *
+ * Marks *bytes* at the write position as written; the write position
+ * wraps to the start of the buffer at its end.
+ */
+void QsrMailRenderer::commitWrite(int bytes)
+{
+    mWritePos += bytes;
+    if (mWritePos >= mBuffer.size())
+        mWritePos -= mBuffer.size();
+    mUsed += bytes;
+}
+
+/*!
+ * \internal
+ *
+ * Reads from the current device into the ringbuffer as long as there is
+ * space available. The device is detached once all its data has been read.
+ * Returns true if anything has been buffered.
+ */
+bool QsrMailRenderer::fillFromDevice()
+{
+    /* try to fill the buffer up to the high watermark */
     bool dataAvailable = false;
-    qint64 remaining = mBuffer.size() - mWritePos;
-    while (remaining > 0) {
-        qint64 got = mDevice->read(mWritePointer, remaining);
+    forever {
+        const int space = writeSpace();
+        if (space <= 0)
+            break;
+
+        char *p = mBuffer.data() + mWritePos;
+        qint64 got = mDevice->read(p, space);
 
         /* handle error */
         if (got < 0) {
@@ -632,37 +1987,58 @@ void QsrMailRenderer::readFromDevice()
         if (got == 0)
             break;
 
-        /* adjust pointers, etc. */
-        remaining -= got;
+        /* record the encoded output for the encoder cache */
+        if (!mCacheKey.isNull()) {
+            qint64 limit =
+                    QsrMailEncoderCachePrivate::instance()->maxEntrySize();
+            if (mCapture.size() + got > limit) {
+                mCacheKey.clear();
+                mCapture.clear();
+            } else {
+                mCapture.append(p, got);
+            }
+        }
 
-        mWritePos += got;
-        mWritePointer += got;
+        /* record the body for the other messages of a bulk */
+        if (mCapturingBody)
+            captureBody(p, got);
 
+        commitWrite(static_cast<int>(got));
         dataAvailable = true;
     }
 
+    /* the consumer might have aborted us on error */
+    if (mDevice == 0)
+        return dataAvailable;
+
     /* Detach the device if all data has been read. Be aware
      * that sequential QIODevices need different handling of EOF.
      */
     if (deviceAtEnd()) {
-        /* chunk is complete */
-        mProcessedChunks++;
+        /* chunk is complete - a completely captured body goes to the cache */
+        if (!mCacheKey.isNull())
+            QsrMailEncoderCachePrivate::instance()->insert(mCacheKey, mCapture);
+
         detachDevice();
+    }
 
-        emit progressUpdate(mProcessedChunks, mTotalChunks);
+    return dataAvailable;
+}
 
-        /* in case we got no more data we trigger the FSM to jump
-         * to the next state
-         */
-        if (!dataAvailable) {
-            QMetaObject::invokeMethod(this, "processStates",
-                                      Qt::QueuedConnection);
-        }
-    }
+/*!
+ * \internal
+ *
+ * Returns true if *device* reads from memory, either directly or through
+ * an encoder. Such devices never have to wait for data.
+ */
+bool QsrMailRenderer::isMemoryDevice(QIODevice *device)
+{
+    QsrMailAbstractEncoder *encoder =
+            qobject_cast<QsrMailAbstractEncoder *>(device);
+    if (encoder != 0)
+        device = encoder->device();
 
-    /* if there was anything buffered emit the signal */
-    if (dataAvailable)
-        emit readyRead();
+    return qobject_cast<QBuffer *>(device) != 0;
 }
 
 /*!
@@ -680,66 +2056,113 @@ void QsrMailRenderer::endOfDevice()
 /*!
  * \internal
  *
- * Advance the FSM one state. When this function returns the FSM is either
- * in FinishedState or a QIODevice has been queued for processing. This is
- * also the 'mainloop' where all the magic happens.
+ * Run the FSM. Headers, boundaries and in-memory bodies are copied to the
+ * ringbuffer synchronously, so the FSM advances through as many states as
+ * the ringbuffer can take without returning to the event loop. Only real
+ * I/O devices, chunks which do not fit and spans are processed
+ * asynchronously. readyRead() is emitted once for all the data buffered.
+ *
+ * The consumer restarts the FSM once the buffer has been drained to the
+ * low watermark, so the FSM usually runs while data is still buffered.
  */
 void QsrMailRenderer::processStates()
+{
+    bool buffered = false;
+    mRefillPending = false;
+
+    /* a stale wakeup - the device, the span or the consumer restarts us */
+    if (mDevice != 0 || !mSpan.isNull()
+            || (mState == FinishedState && mUsed > 0))
+        return;
+
+    forever {
+        State state = mState;
+        int used = mUsed;
+
+        processState();
+        buffered = buffered || mUsed != used;
+
+        /* the consumer drops the renderer after an error */
+        if (state == FinishedState || state == OffloadedState
+                || !mLastError.isEmpty())
+            return;
+
+        /* in-memory devices are read right away */
+        if (mDevice != 0 && isMemoryDevice(mDevice)) {
+            buffered = fillFromDevice() || buffered;
+            if (!mLastError.isEmpty())
+                return;
+        }
+
+        /* wait for the device, the span or the consumer */
+        if (mDevice != 0 || !mSpan.isNull()
+                || (mState == FinishedState && mUsed > 0))
+            break;
+    }
+
+    if (buffered)
+        emit readyRead();
+}
+
+/*!
+ * \internal
+ *
+ * Advance the FSM one state. When this function returns the FSM is either
+ * in FinishedState, the data of the state has been buffered or a QIODevice
+ * has been queued for processing. This is also where all the magic
+ * happens.
+ */
+void QsrMailRenderer::processState()
 {
     switch (mState) {
     case IdleState: {
-        /* we start with the body */
-        mPartP = mMessageP->body.d.constData();
+        /* the size is determined before anything is rendered */
+        totalSize();
 
-        /* create message headers */
-        QByteArray headers;
-        QsrMailHeaders messageHeaders(mMessageP->cookHeaders());
+        /* we start with the body or the multipart wrapping it */
+        mPartP = rootPart();
+        emit progressUpdate(mProcessedSize, mTotalSize);
 
-        /* react on the different types */
-        switch (mPartP->partType) {
-        case QsrMailAbstractPart::MimePartType:
-            /* we need to wrap the part into a multipart - this is a bit ugly */
-            mWrapper.d.data()->parts.append(mMessageP->body);
-            mPartP = mWrapper.d.constData();
+        /* the message has been rendered before, eg. into a spool */
+        if (!mPrerendered.isNull()) {
+            enqueue(mPrerendered);
+            mState = FinishedState;
+            break;
+        } else if (!mPrerenderedFile.isEmpty()) {
+            enqueue(new QFile(mPrerenderedFile), true);
+            mState = FinishedState;
+            break;
+        }
 
-            QSRMAIL_FALLTHROUGH;
+        if (mShared) {
+            /* reuse the body rendered for another message of the bulk */
+            if (mShared->complete) {
+                enqueue(messageHeaders());
+                mState = SharedBodyState;
+                break;
+            }
 
-        case QsrMailAbstractPart::MimeMultipartType:
-            /* the mail header itself needs not to be counted as it is part of
-             * the multipart header
-             */
-            mProcessedChunks = 0;
-            mTotalChunks = totalBuffers(mPartP);
-            emit progressUpdate(mProcessedChunks, mTotalChunks);
+            /* ... or record it if nobody else does */
+            if (!mShared->capturing && !mShared->oversized
+                    && (!mShared->failed || isReusablePart(mPartP))) {
+                mShared->capturing = true;
+                mCapturingBody = true;
+                mCaptureSkip = messageHeaders().size();
+            }
+        }
 
-            /* output mime version and multipart headers */
-            messageHeaders.setHeader("MIME-Version", "1.0");
-            headers = messageHeaders.renderHeaders()
-                    % mPartP->cookHeaders().renderHeaders()
-                    % "\r\n";
-            enqueue(headers);
+        /* output the message headers */
+        enqueue(messageHeaders());
 
+        if (mPartP->isMimeMultipart()) {
             /* put the multipart on the stack and branch to the
              * boundary processing
              */
             mParents.push(StackFrame(mPartP));
-
             mState = MimeBoundaryState;
-            break;
-
-        case QsrMailAbstractPart::NullType:
-        case QsrMailAbstractPart::BodyPartType:
+        } else {
             /* everything else is handled as bodyPart */
-            mProcessedChunks = 0;
-            mTotalChunks = 2;
-            emit progressUpdate(mProcessedChunks, mTotalChunks);
-
-            /* output end-of-header sig. */
-            headers = messageHeaders.renderHeaders() % "\r\n";
-            enqueue(headers);
-
             mState = SimpleBodyState;
-            break;
         }
         break;
     }
@@ -803,62 +2226,9 @@ void QsrMailRenderer::processStates()
         /* switch to next part */
         mParents.top().next();
 
-        /* setup part data iterator */
-        mPartEncoder = mPartP->encoder;
-
-        /* build part headers */
-        QsrMailHeaders headerList(mPartP->cookHeaders());
-
-        /* determine content type */
-        QByteArray contentType(headerList.value("Content-Type"));
-        if (contentType.isEmpty()) {
-            /* detect contentType using QMimeDatabase */
-            QMimeDatabase mimeDb;
-            QMimeType mimeType;
-
-            if (mPartP->bodyDevice == 0)
-                mimeType = mimeDb.mimeTypeForData(mPartP->body);
-            else
-                mimeType = mimeDb.mimeTypeForData(mPartP->bodyDevice);
-
-            /* extract content type - just convert it to latin1. this
-             * should not be a problem since mime types are usually
-             * US-ASCII
-             */
-            contentType = mimeType.name().toLatin1();
-
-            /* fallback to RFC default if type cannot be determined */
-            if (contentType.isEmpty())
-                contentType = "text/plain; charset=us-ascii";
-
-            /* override the Content-Type header */
-            headerList.setHeader("Content-Type", contentType);
-        }
-
-        /* determine encoder */
-
-        /* autodetect selects quoted printable for text class,
-         * base64 for everything else
-         */
-        if (mPartEncoder == QsrMailMimePart::AutoDetectEncoder) {
-            if (contentType.startsWith("text/"))
-                mPartEncoder = QsrMailMimePart::QuotedPrintableEncoder;
-            else
-                mPartEncoder = QsrMailMimePart::Base64Encoder;
-        }
-
-        /* override content transfer encoding based on selected encoder */
-        if (mPartEncoder == QsrMailMimePart::Base64Encoder) {
-            headerList.setHeader("Content-Transfer-Encoding",
-                                 "base64");
-        } else if (mPartEncoder == QsrMailMimePart::QuotedPrintableEncoder) {
-            headerList.setHeader("Content-Transfer-Encoding",
-                                 "quoted-printable");
-        }
-
-        /* render the headers for the part */
-        QByteArray headers(headerList.renderHeaders());
-        headers += "\r\n";
+        /* render the headers and select the encoder */
+        QByteArray headers(partHeaders(mPartP, &mPartEncoder,
+                                       isEightBitEnabled()));
         enqueue(headers);
 
         mState = MimePartBodyState;
@@ -869,11 +2239,35 @@ void QsrMailRenderer::processStates()
         /* enqueue depending on encoder */
         if (mPartEncoder == QsrMailMimePart::PassthroughEncoder) {
             /* passthrough encoder simply enqueues the data */
-            if (mPartP->bodyDevice == 0)
+            if (isEightBitPart(mPartP, mPartEncoder))
+                enqueue(eightBitBody(mPartP->body));
+            else if (mPartP->bodyDevice == 0)
                 enqueue(mPartP->body);
             else
                 enqueue(mPartP->bodyDevice, mPartP->autoDelete);
         } else {
+            /* the body might have been encoded already for another message */
+            QsrMailEncoderCachePrivate *cache =
+                    QsrMailEncoderCachePrivate::instance();
+            QByteArray cacheKey = cache->cacheKey(mPartP, mPartEncoder);
+            QByteArray cachedData;
+            QString cachedFile;
+
+            if (!cacheKey.isNull()
+                    && cache->lookup(cacheKey, &cachedData, &cachedFile)) {
+                if (cachedFile.isEmpty())
+                    enqueue(cachedData);
+                else
+                    enqueue(new QFile(cachedFile), true);
+
+                /* the body device is not needed anymore */
+                if (mPartP->bodyDevice != 0 && mPartP->autoDelete)
+                    mPartP->bodyDevice->deleteLater();
+
+                mState = MimeBoundaryState;
+                break;
+            }
+
             /* if an encoder is requested it will wrap the original data
              * or device
              */
@@ -919,15 +2313,35 @@ void QsrMailRenderer::processStates()
                        "invalid encoder (encoder=%d)", mPartEncoder);
             }
 
-            /* queue the wrapper */
+            /* queue the wrapper and capture the output on a cache miss */
             enqueue(wrapper, autoDelete);
+            if (mDevice != 0)
+                mCacheKey = cacheKey;
         }
 
         mState = MimeBoundaryState;
         break;
     }
 
+    case SharedBodyState: {
+        enqueue(mShared->data);
+
+        mState = FinishedState;
+        break;
+    }
+
+    case OffloadedState:
+        /* the render thread does the work */
+        break;
+
     case FinishedState: {
+        /* a completely recorded body is passed to the other messages */
+        if (mCapturingBody && mLastError.isEmpty()) {
+            mShared->data = mBodyCapture;
+            mShared->complete = true;
+        }
+        releaseCapture(!mShared.isNull() && !mShared->complete);
+
         /* FSM has ended - the message is now complete */
         emit readChannelFinished();
         break;
@@ -26,15 +26,43 @@
 #include <QQueue>
 #include <QStack>
 #include <QSet>
-#include <QMimeDatabase>
+#include <QSharedPointer>
 
 #include "qsrmailmessage.h"
 #include "qsrmailmimemultipart.h"
 #include "qsrmailabstractpart_p.h"
 #include "qsrmailabstractencoder.h"
+#include "qsrmailheaders_p.h"
+#include "qsrmailbufferpool_p.h"
+#include "qsrmailfilemap_p.h"
 
 QT_BEGIN_NAMESPACE
 
+class QThread;
+class QsrMailEnvelope;
+class QsrMailRenderPipe;
+class QsrMailRenderWorker;
+
+class QsrMailSharedBody
+{
+public:
+    QsrMailSharedBody() :
+        bodySize(-2),
+        capturing(false),
+        complete(false),
+        failed(false),
+        oversized(false)
+    {}
+
+    QsrMailMimeMultipart wrapper;
+    QByteArray data;
+    qint64 bodySize;
+    bool capturing;
+    bool complete;
+    bool failed;
+    bool oversized;
+};
+
 class QsrMailRenderer : public QObject
 {
     Q_OBJECT
@@ -46,12 +74,35 @@ public:
 
     void setBufferSize(int size);
     int bufferSize() const;
+    void setWatermarks(int low, int high);
+    int lowWatermark() const;
+    int highWatermark() const;
+    void setBufferPool(QsrMailBufferPool *pool);
+    void setRenderThread(QThread *thread);
+    void releaseBuffer();
     const char *dataPointer() const;
     int bytesAvailable() const;
+    int dataSegments(const char **data, int *sizes) const;
     void advanceDataPointer(int bytes);
     bool atEnd() const;
     bool isRunning() const;
     QString lastError() const;
+    bool requiresBinaryMime() const;
+    bool requiresEightBitMime() const;
+    qint64 totalSize();
+    void setSharedBody(const QSharedPointer<QsrMailSharedBody> &body,
+                       const QsrMailEnvelope &envelope);
+    bool isBodyAvailable() const;
+    void setPrerendered(const QByteArray &data, bool binary);
+    void setPrerendered(const QString &fileName, qint64 size, bool binary);
+    void setEightBitMime(bool enabled);
+    bool eightBitMime() const;
+    bool isStarted() const;
+    bool isRestartable() const;
+    bool isPrefetchable() const;
+    bool isOffloadable() const;
+    static bool isOffloadable(const QsrMailMessage &message);
+    void setupRestart(const QsrMailRenderer *other);
 
 public Q_SLOTS:
     void renderMessage();
@@ -60,20 +111,58 @@ public Q_SLOTS:
 Q_SIGNALS:
     void readyRead();
     void readChannelFinished();
-    void progressUpdate(int processed, int total);
+    void progressUpdate(qint64 processed, qint64 total);
     void error();
 
 private:
     void setupPart(const QsrMailAbstractPartPrivate *p);
-    int totalBuffers(const QsrMailAbstractPartPrivate *p);
+    const QsrMailAbstractPartPrivate *rootPart() const;
+    const QsrMailMimeMultipart &wrapper() const;
+    const QByteArray &messageHeaders();
+    static QByteArray partHeaders(const QsrMailAbstractPartPrivate *p,
+                                  QsrMailMimePart::Encoder *encoder,
+                                  bool eightBit);
+    static qint64 multipartSize(const QsrMailAbstractPartPrivate *p,
+                                bool eightBit);
+    static qint64 rawBodySize(const QsrMailAbstractPartPrivate *p);
+    static qint64 encodedBodySize(const QsrMailAbstractPartPrivate *p,
+                                  QsrMailMimePart::Encoder encoder);
+    static bool isBinaryPart(const QsrMailAbstractPartPrivate *p);
+    static bool isEightBitData(const QsrMailAbstractPartPrivate *p,
+                               bool eightBit);
+    static bool isEightBitPart(const QsrMailAbstractPartPrivate *p,
+                               QsrMailMimePart::Encoder encoder);
+    static bool scanEightBit(const QByteArray &body, int *bareLineFeeds,
+                             bool *highBit);
+    static QByteArray eightBitBody(const QByteArray &body);
+    bool isEightBitEnabled() const;
+    static bool isReusablePart(const QsrMailAbstractPartPrivate *p);
+    static bool isOffloadablePart(const QsrMailAbstractPartPrivate *p);
+    bool isPrerendered() const;
+    void startWorker();
+    void releaseWorker();
+    void captureBody(const char *data, qint64 size);
+    void releaseCapture(bool failed);
     void enqueue(const QByteArray &chunk);
     void enqueue(QIODevice *device, bool autoDelete);
+    void enqueueSpan(const QByteArray &span);
+    bool enqueueFile(QFileDevice *file, bool autoDelete);
+    void nextSpan();
+    void releaseSpan();
     void detachDevice();
     bool deviceAtEnd() const;
+    bool isDeviceFinished(QIODevice *device) const;
+    bool fillFromDevice();
+    int writeSpace() const;
+    void commitWrite(int bytes);
+    static bool isMemoryDevice(QIODevice *device);
+    void processState();
 
 private Q_SLOTS:
     void readFromDevice();
     void endOfDevice();
+    void readFromPipe();
+    void endOfPipe(const QString &errorString);
     void processStates();
 
 private:
@@ -83,6 +172,8 @@ private:
         MimeBoundaryState,
         MimePartState,
         MimePartBodyState,
+        SharedBodyState,
+        OffloadedState,
         FinishedState
     };
 
@@ -117,7 +208,7 @@ private:
 
     /* instance data */
     State mState;
-    QsrMailMimeMultipart mWrapper;
+    mutable QsrMailMimeMultipart mWrapper;
     QString mLastError;
     QIODevice *mDevice;
     QSet<QIODevice *> mDeviceFinished;
@@ -126,17 +217,55 @@ private:
     const QsrMailAbstractPartPrivate *mPartP;
     QsrMailMimePart::Encoder mPartEncoder;
 
+    /* encoder cache related data */
+    QByteArray mCacheKey;
+    QByteArray mCapture;
+
+    /* bulk delivery related data */
+    QSharedPointer<QsrMailSharedBody> mShared;
+    QsrMailHeaders mEnvelopeHeaders;
+    bool mCapturingBody;
+    int mCaptureSkip;
+    QByteArray mBodyCapture;
+
+    /* RFC6152: text parts are sent unencoded */
+    bool mEightBitMime;
+
+    /* pre-rendered message data */
+    QByteArray mPrerendered;
+    QString mPrerenderedFile;
+    bool mPrerenderedBinary;
+
+    /* span related data */
+    QByteArray mSpan;
+    int mSpanPos;
+    QFileDevice *mSpanFile;
+    bool mSpanAutoDelete;
+    QsrMailFileMap mSpanMap;
+
+    /* off-thread rendering related data */
+    QThread *mRenderThread;
+    QsrMailRenderWorker *mWorker;
+    QSharedPointer<QsrMailRenderPipe> mPipe;
+
     /* ringbuffer related data */
+    QsrMailBufferPool *mBufferPool;
+    int mBufferSize;
+    int mLowWatermark;
+    int mHighWatermark;
     QByteArray mBuffer;
-    const char *mReadPointer;
     int mReadPos;
-    char *mWritePointer;
     int mWritePos;
+    int mUsed;
+    bool mRefillPending;
 
     /* member data */
+    QsrMailMessage mMessage;
     const QsrMailMessagePrivate *mMessageP;
-    int mTotalChunks;
-    int mProcessedChunks;
+    QByteArray mMessageHeaders;
+    qint64 mTotalSize;
+    qint64 mProcessedSize;
+    bool mSizeValid;
 };
 
 QT_END_NAMESPACE
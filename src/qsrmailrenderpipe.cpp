@@ -0,0 +1,580 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \internal
+ *
+ * \class QsrMailRenderPipe "qsrmailrenderpipe_p.h"
+ * \brief Lock-free single producer, single consumer ringbuffer between a
+ * renderer running on a worker thread and the thread of the transport.
+ *
+ * The producer (QsrMailRenderWorker) copies the rendered data into the
+ * pipe using write(), the consumer (the QsrMailRenderer of the transport)
+ * reads it in place using dataPointer(), bytesAvailable() and
+ * advanceDataPointer(). Each side owns one of the positions and publishes it
+ * with release semantics, so no locking is required.
+ *
+ * Wakeups are rate limited by two flags. notify() returns true only for the
+ * first chunk written after the consumer called acknowledge(), so at most
+ * one notification is in flight. A producer which finds the pipe full calls
+ * stall() and stops; the consumer learns from advanceDataPointer() that
+ * the producer has to be woken up once space is available. This is the
+ * backpressure which keeps a fast renderer from running ahead of the
+ * socket.
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailRenderWorker "qsrmailrenderpipe_p.h"
+ * \brief Runs a QsrMailRenderer on a worker thread and feeds its output
+ * into a QsrMailRenderPipe.
+ *
+ * The worker takes ownership of the renderer and is moved to one of the
+ * render threads returned by nextThread(), together with the renderer.
+ * Rendering and encoding then happen on that thread. The consumer is
+ * informed by the readyRead() and finished() signals, which are delivered
+ * as queued signals to the thread of the transport.
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailRenderWriter "qsrmailrenderpipe_p.h"
+ * \brief Drives a QsrMailRenderer to completion and writes its output to
+ * a device.
+ *
+ * The writer is used to render messages ahead of their delivery, eg. into
+ * the spool or into a QsrMailRenderedMessage. In wire format mode the line
+ * breaks are normalized to CRLF, the data is terminated by a line break
+ * and the offsets of all lines starting with a dot are recorded, so the
+ * data can be sent without being scanned again.
+ *
+ * The writer does not run an event loop, which would deliver the events of
+ * the caller while it waits. It dispatches the queued calls of the
+ * renderer only, so it renders bodies kept in memory or in files; bodies
+ * read from other devices depend on events and are refused.
+ */
+
+#include "qsrmailrenderpipe_p.h"
+#include "qsrmailrenderer_p.h"
+
+#include <QCoreApplication>
+#include <QEvent>
+#include <QIODevice>
+#include <QList>
+#include <QMutex>
+#include <QThread>
+
+#include <string.h>
+
+QT_BEGIN_NAMESPACE
+
+/* process wide pool of threads used for rendering */
+struct QsrMailRenderThreads
+{
+    QsrMailRenderThreads() :
+        next(0)
+    {}
+
+    ~QsrMailRenderThreads()
+    {
+        foreach (QThread *thread, threads) {
+            thread->quit();
+            thread->wait();
+            delete thread;
+        }
+    }
+
+    QMutex mutex;
+    QList<QThread *> threads;
+    int next;
+};
+
+Q_GLOBAL_STATIC(QsrMailRenderThreads, renderThreads)
+
+/*!
+ * \internal
+ *
+ * Construct a pipe buffering up to *capacity* bytes.
+ */
+QsrMailRenderPipe::QsrMailRenderPipe(int capacity) :
+    mBuffer(capacity + 1, Qt::Uninitialized),
+    mData(mBuffer.data()),
+    mSize(capacity + 1),
+    mHead(0),
+    mTail(0),
+    mStalled(0),
+    mNotified(0),
+    mCancelled(0)
+{
+}
+
+/*!
+ * \internal
+ *
+ * Producer: copies up to *size* bytes from *data* into the pipe. Returns
+ * the number of bytes written, which is less than *size* if the pipe is
+ * full.
+ */
+int QsrMailRenderPipe::write(const char *data, int size)
+{
+    int tail = mTail.load();
+    int written = 0;
+
+    while (written < size) {
+        /* one byte is kept free to tell a full pipe from an empty one */
+        int head = mHead.loadAcquire();
+        int space;
+        if (tail >= head)
+            space = mSize - tail - (head == 0 ? 1 : 0);
+        else
+            space = head - tail - 1;
+
+        if (space <= 0)
+            break;
+
+        int chunk = qMin(space, size - written);
+        memcpy(mData + tail, data + written, chunk);
+
+        tail += chunk;
+        if (tail == mSize)
+            tail = 0;
+
+        mTail.storeRelease(tail);
+        written += chunk;
+    }
+
+    return written;
+}
+
+/*!
+ * \internal
+ *
+ * Producer: marks the producer as waiting for space. Returns true if the
+ * consumer freed space meanwhile and the producer has to continue, false
+ * if it is woken up by the consumer.
+ */
+bool QsrMailRenderPipe::stall()
+{
+    mStalled.fetchAndStoreOrdered(1);
+
+    /* the consumer might have read everything before seeing the flag */
+    int head = mHead.loadAcquire();
+    int tail = mTail.load();
+    if ((tail + 1) % mSize == head)
+        return false;
+
+    return mStalled.testAndSetOrdered(1, 0);
+}
+
+/*!
+ * \internal
+ *
+ * Producer: returns true if the consumer has to be notified about the data
+ * written. This is the case if no other notification is pending.
+ */
+bool QsrMailRenderPipe::notify()
+{
+    return mNotified.testAndSetOrdered(0, 1);
+}
+
+/*!
+ * \internal
+ *
+ * Consumer: a direct pointer to the data available for reading. Use
+ * bytesAvailable() to find the number of bytes at the pointer.
+ */
+const char *QsrMailRenderPipe::dataPointer() const
+{
+    return mData + mHead.load();
+}
+
+/*!
+ * \internal
+ *
+ * Consumer: number of bytes available at dataPointer(). This is 0 only if
+ * the pipe is empty.
+ */
+int QsrMailRenderPipe::bytesAvailable() const
+{
+    int head = mHead.load();
+    int tail = mTail.loadAcquire();
+
+    return tail >= head ? tail - head : mSize - head;
+}
+
+/*!
+ * \internal
+ *
+ * Consumer: releases *bytes* bytes at dataPointer(). Returns true if the
+ * producer is stalled and has to be woken up.
+ */
+bool QsrMailRenderPipe::advanceDataPointer(int bytes)
+{
+    int head = mHead.load() + bytes;
+    if (head == mSize)
+        head = 0;
+
+    mHead.storeRelease(head);
+
+    return mStalled.testAndSetOrdered(1, 0);
+}
+
+/*!
+ * \internal
+ *
+ * Consumer: acknowledges the notification. Has to be called before the data
+ * is read, so data written afterwards results in a new notification.
+ */
+void QsrMailRenderPipe::acknowledge()
+{
+    mNotified.fetchAndStoreOrdered(0);
+}
+
+/*!
+ * \internal
+ *
+ * Consumer: tells the producer to stop rendering.
+ */
+void QsrMailRenderPipe::cancel()
+{
+    mCancelled.storeRelease(1);
+}
+
+/*!
+ * \internal
+ *
+ * Construct a worker running *renderer* and writing its output to *pipe*.
+ * The worker becomes the parent of *renderer*.
+ */
+QsrMailRenderWorker::QsrMailRenderWorker(
+        QsrMailRenderer *renderer,
+        const QSharedPointer<QsrMailRenderPipe> &pipe) :
+    mRenderer(renderer),
+    mPipe(pipe)
+{
+    mRenderer->setParent(this);
+
+    connect(mRenderer, SIGNAL(readyRead()), this, SLOT(pump()));
+    connect(mRenderer, SIGNAL(readChannelFinished()),
+            this, SLOT(rendererFinished()));
+    connect(mRenderer, SIGNAL(error()), this, SLOT(rendererError()));
+}
+
+/*!
+ * \internal
+ *
+ * Destroy the worker. The renderer is aborted, so devices it created are
+ * released.
+ */
+QsrMailRenderWorker::~QsrMailRenderWorker()
+{
+    mRenderer->abort();
+}
+
+/*!
+ * \internal
+ *
+ * Returns the render thread for the next worker. Threads are started on
+ * demand up to QThread::idealThreadCount() and then handed out in turn.
+ * This function is thread-safe.
+ */
+QThread *QsrMailRenderWorker::nextThread()
+{
+    QsrMailRenderThreads *pool = renderThreads();
+    QMutexLocker lock(&pool->mutex);
+
+    if (pool->threads.size() < qMax(1, QThread::idealThreadCount())) {
+        QThread *thread = new QThread;
+        thread->setObjectName(QLatin1String("QsrMailRenderThread"));
+        thread->start();
+
+        pool->threads.append(thread);
+        return thread;
+    }
+
+    pool->next = (pool->next + 1) % pool->threads.size();
+    return pool->threads.at(pool->next);
+}
+
+/*!
+ * \internal
+ *
+ * Start rendering. Is invoked on the render thread.
+ */
+void QsrMailRenderWorker::start()
+{
+    if (!mPipe->isCancelled())
+        mRenderer->renderMessage();
+}
+
+/*!
+ * \internal
+ *
+ * Move the data available from the renderer into the pipe until either
+ * the renderer or the pipe runs dry. Is called when the renderer has data
+ * available and when the consumer freed space in a full pipe.
+ */
+void QsrMailRenderWorker::pump()
+{
+    while (!mPipe->isCancelled()) {
+        int size = mRenderer->bytesAvailable();
+        if (size <= 0)
+            return;
+
+        int written = mPipe->write(mRenderer->dataPointer(), size);
+        if (written > 0) {
+            if (mPipe->notify())
+                emit readyRead();
+
+            mRenderer->advanceDataPointer(written);
+        }
+
+        /* wait for the consumer if the pipe is full */
+        if (written < size && !mPipe->stall())
+            return;
+    }
+}
+
+/*!
+ * \internal
+ *
+ * The renderer has completed the message and all of its output is in the
+ * pipe.
+ */
+void QsrMailRenderWorker::rendererFinished()
+{
+    emit finished(QString());
+}
+
+/*!
+ * \internal
+ *
+ * The renderer failed - the error is passed to the consumer.
+ */
+void QsrMailRenderWorker::rendererError()
+{
+    emit finished(mRenderer->lastError());
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * \internal
+ *
+ * Construct a writer which writes the output of *renderer* to *device*.
+ */
+QsrMailRenderWriter::QsrMailRenderWriter(QsrMailRenderer *renderer,
+                                         QIODevice *device) :
+    mRenderer(renderer),
+    mDevice(device),
+    mWritten(0),
+    mCalls(0),
+    mDone(false),
+    mWireFormat(false),
+    mLineStart(true),
+    mCarriageReturn(false)
+{
+    connect(mRenderer, SIGNAL(readyRead()), this, SLOT(drain()));
+    connect(mRenderer, SIGNAL(readChannelFinished()), this, SLOT(drain()));
+    connect(mRenderer, SIGNAL(error()), this, SLOT(fail()));
+}
+
+/*!
+ * \internal
+ *
+ * If *enabled* the output is written in wire format: bare CR and LF are
+ * turned into CRLF, the data ends with CRLF and the lines starting with
+ * a dot are recorded in stuffing(). Must not be used for messages which
+ * require BINARYMIME, their data has to be sent unchanged.
+ */
+void QsrMailRenderWriter::setWireFormat(bool enabled)
+{
+    mWireFormat = enabled;
+}
+
+/*!
+ * \internal
+ *
+ * Render the message. The queued calls the renderer posts to itself are
+ * dispatched until the message is complete, no other events are
+ * delivered. Returns false if rendering or writing failed, or if the
+ * message has bodies which cannot be rendered that way.
+ */
+bool QsrMailRenderWriter::run()
+{
+    if (!mRenderer->isOffloadable()) {
+        mErrorString = tr("bodies have to be in memory or in files");
+        return false;
+    }
+
+    mRenderer->installEventFilter(this);
+    mRenderer->renderMessage();
+
+    while (!mDone) {
+        mCalls = 0;
+        QCoreApplication::sendPostedEvents(mRenderer, QEvent::MetaCall);
+
+        /* nothing left to do for a renderer which is not finished */
+        if (mCalls == 0 && !mDone) {
+            mErrorString = tr("rendering stalled");
+            mRenderer->abort();
+            break;
+        }
+    }
+
+    mRenderer->removeEventFilter(this);
+
+    if (mErrorString.isEmpty() && mWireFormat && !finishWireFormat())
+        mErrorString = mDevice->errorString();
+
+    return mErrorString.isEmpty();
+}
+
+/*!
+ * \internal
+ *
+ * Counts the queued calls dispatched to the renderer.
+ */
+bool QsrMailRenderWriter::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched == mRenderer && event->type() == QEvent::MetaCall)
+        mCalls++;
+
+    return QObject::eventFilter(watched, event);
+}
+
+/*!
+ * \internal
+ *
+ * Write the data available from the renderer to the device.
+ */
+void QsrMailRenderWriter::drain()
+{
+    const char *data[2] = { 0, 0 };
+    int sizes[2] = { 0, 0 };
+    int parts;
+
+    while ((parts = mRenderer->dataSegments(data, sizes)) > 0) {
+        int size = 0;
+        for (int i=0; i<parts; ++i) {
+            if (!writeData(data[i], sizes[i])) {
+                mErrorString = mDevice->errorString();
+                mRenderer->abort();
+                mDone = true;
+                return;
+            }
+            size += sizes[i];
+        }
+
+        mRenderer->advanceDataPointer(size);
+    }
+
+    if (mRenderer->atEnd())
+        mDone = true;
+}
+
+/*!
+ * \internal
+ *
+ * The renderer failed.
+ */
+void QsrMailRenderWriter::fail()
+{
+    mErrorString = mRenderer->lastError();
+    mDone = true;
+}
+
+/*!
+ * \internal
+ *
+ * Write *size* bytes of *data* to the device, converted to wire format if
+ * requested.
+ */
+bool QsrMailRenderWriter::writeData(const char *data, int size)
+{
+    if (mWireFormat)
+        return writeWireFormat(data, size);
+
+    if (mDevice->write(data, size) != size)
+        return false;
+
+    mWritten += size;
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Write *size* bytes of *data* with normalized line breaks. The state of
+ * the current line is kept across calls, since lines and line breaks may
+ * be split between the chunks of the renderer.
+ */
+bool QsrMailRenderWriter::writeWireFormat(const char *data, int size)
+{
+    /* in the worst case every byte is a bare line break */
+    mScratch.resize(2 * size);
+    char *out = mScratch.data();
+    int length = 0;
+
+    for (int i=0; i<size; ++i) {
+        const char c = data[i];
+
+        if (mCarriageReturn && c != '\n') {
+            out[length++] = '\n';
+            mLineStart = true;
+        } else if (!mCarriageReturn && c == '\n') {
+            out[length++] = '\r';
+        }
+
+        if (mLineStart && c == '.')
+            mStuffing.append(mWritten + length);
+
+        out[length++] = c;
+        mCarriageReturn = c == '\r';
+        mLineStart = c == '\n';
+    }
+
+    if (mDevice->write(out, length) != length)
+        return false;
+
+    mWritten += length;
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Complete the last line of the wire format data.
+ */
+bool QsrMailRenderWriter::finishWireFormat()
+{
+    if (mLineStart)
+        return true;
+
+    if (mCarriageReturn)
+        return writeWireFormat("\n", 1);
+
+    return writeWireFormat("\r\n", 2);
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,146 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILRENDERPIPE_P_H
+#define QSRMAILRENDERPIPE_P_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QSharedPointer>
+#include <QVector>
+
+QT_BEGIN_NAMESPACE
+
+class QIODevice;
+class QThread;
+class QsrMailRenderer;
+
+class QsrMailRenderPipe
+{
+public:
+    explicit QsrMailRenderPipe(int capacity);
+
+    /* producer side */
+    int write(const char *data, int size);
+    bool stall();
+    bool notify();
+
+    /* consumer side */
+    const char *dataPointer() const;
+    int bytesAvailable() const;
+    bool advanceDataPointer(int bytes);
+    void acknowledge();
+    void cancel();
+
+    inline bool isCancelled() const
+    { return mCancelled.loadAcquire() != 0; }
+
+private:
+    Q_DISABLE_COPY(QsrMailRenderPipe)
+
+    QByteArray mBuffer;
+    char *mData;
+    int mSize;
+    QAtomicInt mHead;
+    QAtomicInt mTail;
+    QAtomicInt mStalled;
+    QAtomicInt mNotified;
+    QAtomicInt mCancelled;
+};
+
+class QsrMailRenderWorker : public QObject
+{
+    Q_OBJECT
+
+public:
+    QsrMailRenderWorker(QsrMailRenderer *renderer,
+                        const QSharedPointer<QsrMailRenderPipe> &pipe);
+    ~QsrMailRenderWorker();
+
+    static QThread *nextThread();
+
+public Q_SLOTS:
+    void start();
+    void pump();
+
+Q_SIGNALS:
+    void readyRead();
+    void finished(const QString &error);
+
+private Q_SLOTS:
+    void rendererFinished();
+    void rendererError();
+
+private:
+    QsrMailRenderer *mRenderer;
+    QSharedPointer<QsrMailRenderPipe> mPipe;
+};
+
+class QsrMailRenderWriter : public QObject
+{
+    Q_OBJECT
+
+public:
+    QsrMailRenderWriter(QsrMailRenderer *renderer, QIODevice *device);
+
+    void setWireFormat(bool enabled);
+    bool run();
+
+    inline qint64 bytesWritten() const
+    { return mWritten; }
+
+    inline QVector<qint64> stuffing() const
+    { return mStuffing; }
+
+    inline QString errorString() const
+    { return mErrorString; }
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event);
+
+private Q_SLOTS:
+    void drain();
+    void fail();
+
+private:
+    bool writeData(const char *data, int size);
+    bool writeWireFormat(const char *data, int size);
+    bool finishWireFormat();
+
+    QsrMailRenderer *mRenderer;
+    QIODevice *mDevice;
+    qint64 mWritten;
+    int mCalls;
+    bool mDone;
+    QString mErrorString;
+
+    /* wire format related data */
+    bool mWireFormat;
+    bool mLineStart;
+    bool mCarriageReturn;
+    QByteArray mScratch;
+    QVector<qint64> mStuffing;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILRENDERPIPE_P_H
@@ -0,0 +1,292 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \internal
+ *
+ * \class QsrMailResolver "qsrmailresolver_p.h"
+ * \brief Process wide, asynchronous cache of resolved server addresses.
+ *
+ * Transports usually talk to the same few servers all the time. Instead of
+ * resolving the server name for every session the resolver keeps the
+ * addresses for the time to live of the DNS records. cachedAddresses()
+ * answers synchronously from the cache. On a miss lookup() returns a
+ * resolver object which emits finished() once the A and AAAA records have
+ * been resolved; concurrent lookups of the same name within the same thread
+ * share one resolver object. The object deletes itself after finished().
+ *
+ * The addresses are returned in the order recommended by RFC8305 for
+ * connection racing: address families alternate, starting with IPv6.
+ * Addresses of the same family are rotated randomly so the load is spread
+ * over all addresses.
+ */
+
+#include "qsrmailresolver_p.h"
+
+#include <QDateTime>
+#include <QDnsLookup>
+#include <QHash>
+#include <QMutex>
+#include <QPointer>
+#include <QStringBuilder>
+#include <QThread>
+
+QT_BEGIN_NAMESPACE
+
+/* upper limit for the cache time, in seconds */
+#define MAX_ADDRESS_TTL (60*60)
+
+/* process wide address cache and running lookups */
+struct QsrMailResolverCache
+{
+    struct Entry
+    {
+        QList<QHostAddress> ipv6;
+        QList<QHostAddress> ipv4;
+        qint64 expires;
+    };
+
+    QMutex mutex;
+    QHash<QString, Entry> entries;
+    QHash<QString, QPointer<QsrMailResolver> > running;
+};
+
+Q_GLOBAL_STATIC(QsrMailResolverCache, resolverCache)
+
+/*!
+ * \internal
+ *
+ * Construct a resolver for *hostname* which is registered as *key* and
+ * start the lookups required for *protocol*.
+ */
+QsrMailResolver::QsrMailResolver(const QString &key, const QString &hostname,
+                                 QAbstractSocket::NetworkLayerProtocol protocol) :
+    QObject(0),
+    mKey(key),
+    mTtl(MAX_ADDRESS_TTL)
+{
+    QList<QDnsLookup::Type> types;
+
+    if (protocol != QAbstractSocket::IPv4Protocol)
+        types.append(QDnsLookup::AAAA);
+    if (protocol != QAbstractSocket::IPv6Protocol)
+        types.append(QDnsLookup::A);
+
+    foreach (QDnsLookup::Type type, types) {
+        QDnsLookup *lookup = new QDnsLookup(type, hostname, this);
+        connect(lookup, SIGNAL(finished()), this, SLOT(lookupFinished()));
+        mLookups.append(lookup);
+    }
+
+    foreach (QDnsLookup *lookup, mLookups)
+        lookup->lookup();
+}
+
+/*!
+ * \internal
+ *
+ * Destroys the instance.
+ */
+QsrMailResolver::~QsrMailResolver()
+{
+}
+
+/*!
+ * \internal
+ *
+ * Looks up *hostname* for *protocol* in the cache. Returns true and stores
+ * the addresses in *addresses* on a hit.
+ */
+bool QsrMailResolver::cachedAddresses(
+        const QString &hostname, QAbstractSocket::NetworkLayerProtocol protocol,
+        QList<QHostAddress> *addresses)
+{
+    QsrMailResolverCache *cache = resolverCache();
+    const QString key(cacheKey(hostname, protocol));
+
+    QMutexLocker lock(&cache->mutex);
+    QHash<QString, QsrMailResolverCache::Entry>::Iterator entry =
+            cache->entries.find(key);
+
+    if (entry == cache->entries.end())
+        return false;
+
+    if (entry->expires <= QDateTime::currentMSecsSinceEpoch()) {
+        cache->entries.erase(entry);
+        return false;
+    }
+
+    *addresses = interleave(entry->ipv6, entry->ipv4);
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Start resolving *hostname* for *protocol*, or join a lookup of the same
+ * name which is already running in the current thread. Connect to the
+ * finished() signal of the returned object to receive the result.
+ */
+QsrMailResolver *QsrMailResolver::lookup(
+        const QString &hostname, QAbstractSocket::NetworkLayerProtocol protocol)
+{
+    QsrMailResolverCache *cache = resolverCache();
+    const QString key(cacheKey(hostname, protocol));
+
+    QMutexLocker lock(&cache->mutex);
+    QsrMailResolver *resolver = cache->running.value(key);
+
+    if (resolver == 0 || resolver->thread() != QThread::currentThread()) {
+        resolver = new QsrMailResolver(key, hostname, protocol);
+        cache->running.insert(key, resolver);
+    }
+
+    return resolver;
+}
+
+/*!
+ * \internal
+ *
+ * Removes all addresses from the cache.
+ */
+void QsrMailResolver::clearCache()
+{
+    QsrMailResolverCache *cache = resolverCache();
+
+    QMutexLocker lock(&cache->mutex);
+    cache->entries.clear();
+}
+
+/*!
+ * \internal
+ *
+ * Returns the resolved addresses; the list is empty if the name could not
+ * be resolved.
+ */
+QList<QHostAddress> QsrMailResolver::addresses() const
+{
+    return interleave(mIpv6, mIpv4);
+}
+
+/*!
+ * \internal
+ *
+ * Returns the reason why the name could not be resolved.
+ */
+QString QsrMailResolver::errorString() const
+{
+    return mErrorString;
+}
+
+/*!
+ * \internal
+ *
+ * One of the lookups has finished. Once all are done the result is cached
+ * and finished() is emitted.
+ */
+void QsrMailResolver::lookupFinished()
+{
+    QDnsLookup *lookup = qobject_cast<QDnsLookup *>(sender());
+    if (!mLookups.removeOne(lookup))
+        return;
+
+    lookup->deleteLater();
+
+    if (lookup->error() == QDnsLookup::NoError) {
+        foreach (const QDnsHostAddressRecord &record,
+                 lookup->hostAddressRecords()) {
+            if (record.value().protocol() == QAbstractSocket::IPv6Protocol)
+                mIpv6.append(record.value());
+            else
+                mIpv4.append(record.value());
+
+            mTtl = qMin(mTtl, record.timeToLive());
+        }
+    } else if (lookup->error() != QDnsLookup::NotFoundError
+               || mErrorString.isEmpty()) {
+        mErrorString = lookup->errorString();
+    }
+
+    if (!mLookups.isEmpty())
+        return;
+
+    /* all lookups are done - publish the result */
+    QsrMailResolverCache *cache = resolverCache();
+    {
+        QMutexLocker lock(&cache->mutex);
+
+        if (cache->running.value(mKey) == this)
+            cache->running.remove(mKey);
+
+        if (mIpv6.isEmpty() && mIpv4.isEmpty()) {
+            if (mErrorString.isEmpty())
+                mErrorString = tr("host has no address");
+        } else if (mTtl > 0) {
+            QsrMailResolverCache::Entry entry;
+            entry.ipv6 = mIpv6;
+            entry.ipv4 = mIpv4;
+            entry.expires = QDateTime::currentMSecsSinceEpoch()
+                    + mTtl * Q_INT64_C(1000);
+
+            cache->entries.insert(mKey, entry);
+        }
+    }
+
+    emit finished();
+    deleteLater();
+}
+
+/*!
+ * \internal
+ *
+ * Returns the key of *hostname* and *protocol* in the cache.
+ */
+QString QsrMailResolver::cacheKey(const QString &hostname,
+                                  QAbstractSocket::NetworkLayerProtocol
+                                  protocol)
+{
+    return hostname.toLower() % QLatin1Char('/') % QString::number(protocol);
+}
+
+/*!
+ * \internal
+ *
+ * Returns the addresses of *ipv6* and *ipv4* in alternating order, both
+ * lists rotated by a random offset.
+ */
+QList<QHostAddress> QsrMailResolver::interleave(QList<QHostAddress> ipv6,
+                                                QList<QHostAddress> ipv4)
+{
+    QList<QHostAddress> result;
+    const int offset6 = ipv6.isEmpty() ? 0 : qrand() % ipv6.size();
+    const int offset4 = ipv4.isEmpty() ? 0 : qrand() % ipv4.size();
+
+    for (int i=0, size=qMax(ipv6.size(), ipv4.size()); i<size; ++i) {
+        if (i < ipv6.size())
+            result.append(ipv6.at((i + offset6) % ipv6.size()));
+        if (i < ipv4.size())
+            result.append(ipv4.at((i + offset4) % ipv4.size()));
+    }
+
+    return result;
+}
+
+QT_END_NAMESPACE
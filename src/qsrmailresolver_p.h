@@ -0,0 +1,78 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILRESOLVER_P_H
+#define QSRMAILRESOLVER_P_H
+
+#include <QObject>
+#include <QAbstractSocket>
+#include <QHostAddress>
+#include <QList>
+
+QT_BEGIN_NAMESPACE
+
+class QDnsLookup;
+
+class QsrMailResolver : public QObject
+{
+    Q_OBJECT
+
+public:
+    ~QsrMailResolver();
+
+    static bool cachedAddresses(const QString &hostname,
+                                QAbstractSocket::NetworkLayerProtocol protocol,
+                                QList<QHostAddress> *addresses);
+    static QsrMailResolver *lookup(const QString &hostname,
+                                   QAbstractSocket::NetworkLayerProtocol
+                                   protocol);
+    static void clearCache();
+
+    QList<QHostAddress> addresses() const;
+    QString errorString() const;
+
+Q_SIGNALS:
+    void finished();
+
+private Q_SLOTS:
+    void lookupFinished();
+
+private:
+    QsrMailResolver(const QString &key, const QString &hostname,
+                    QAbstractSocket::NetworkLayerProtocol protocol);
+
+    static QString cacheKey(const QString &hostname,
+                            QAbstractSocket::NetworkLayerProtocol protocol);
+    static QList<QHostAddress> interleave(QList<QHostAddress> ipv6,
+                                          QList<QHostAddress> ipv4);
+
+private:
+    QString mKey;
+    QList<QDnsLookup *> mLookups;
+    QList<QHostAddress> mIpv6;
+    QList<QHostAddress> mIpv4;
+    quint32 mTtl;
+    QString mErrorString;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILRESOLVER_P_H
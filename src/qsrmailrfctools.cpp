@@ -32,72 +32,81 @@
 
 #include "qsrmailrfctools_p.h"
 
+#include <QAtomicInt>
+#include <QHostInfo>
+#include <QMutex>
 #include <QString>
 #include <QStringBuilder>
+#include <QUuid>
+
+#include <string.h>
 
 QT_BEGIN_NAMESPACE
 
-/* return c if ATEXT, 0 otherwise */
-#define ATEXT(c) ((c & 0x80) ? 0 : atext[static_cast<quint8>(c)])
-static const char atext[128] = {
-    0,      0,      0,      0,      0,      0,      0,      0,
-    0,      0,      0,      0,      0,      0,      0,      0,
-    0,      0,      0,      0,      0,      0,      0,      0,
-    0,      0,      0,      0,      0,      0,      0,      0,
-    0,      '!',    0,      '#',    '$',    '%',    '&',    '\'',
-    0,      0,      '*',    '+',    0,      '-',    0,      '/',
-    '0',    '1',    '2',    '3',    '4',    '5',    '6',    '7',
-    '8',    '9',    0,      0,      0,      '=',    0,      '?',
-    0,      'A',    'B',    'C',    'D',    'E',    'F',    'G',
-    'H',    'I',    'J',    'K',    'L',    'M',    'N',    'O',
-    'P',    'Q',    'R',    'S',    'T',    'U',    'V',    'W',
-    'X',    'Y',    'Z',    0,      0,      0,      '^',    '_',
-    '`',    'a',    'b',    'c',    'd',    'e',    'f',    'g',
-    'h',    'i',    'j',    'k',    'l',    'm',    'n',    'o',
-    'p',    'q',    'r',    's',    't',    'u',    'v',    'w',
-    'x',    'y',    'z',    '{',    '|',    '}',    '~',    0
-};
+/* character classes, see the charclass table below */
+#define CC_ATEXT        0x01    /* RFC2822, Section 3.2.4 */
+#define CC_DTEXT        0x02    /* RFC2822, Section 3.4.1 */
+#define CC_ENCODEDTEXT  0x04    /* RFC2047, Section 5(3), without '=' */
+#define CC_FWS          0x08    /* folding white space */
+#define CC_DOTATOM      0x10    /* atext or '.' */
 
-/* return c if DTEXT, 0 otherwise */
-#define DTEXT(c) ((c & 0x80) ? 0 : dtext[static_cast<quint8>(c)])
-static const char dtext[128] = {
-    0,      1,      2,      3,      4,      5,      6,      7,
-    8,      0,      0,      11,     12,     0,      14,     15,
-    16,     17,     18,     19,     20,     21,     22,     23,
-    24,     25,     26,     27,     28,     29,     30,     31,
-    0,      '!',    '"',    '#',    '$',    '%',    '&',    '\'',
-    '(',    ')',    '*',    '+',    ',',    '-',    '.',    '/',
-    '0',    '1',    '2',    '3',    '4',    '5',    '6',    '7',
-    '8',    '9',    ':',    ';',    '<',    '=',    '>',    '?',
-    '@',    'A',    'B',    'C',    'D',    'E',    'F',    'G',
-    'H',    'I',    'J',    'K',    'L',    'M',    'N',    'O',
-    'P',    'Q',    'R',    'S',    'T',    'U',    'V',    'W',
-    'X',    'Y',    'Z',    0,      0,      0,      '^',    '_',
-    '`',    'a',    'b',    'c',    'd',    'e',    'f',    'g',
-    'h',    'i',    'j',    'k',    'l',    'm',    'n',    'o',
-    'p',    'q',    'r',    's',    't',    'u',    'v',    'w',
-    'x',    'y',    'z',    '{',    '|',    '}',    '~',    127
+/* character class bits for every octet; octets with the high bit set
+ * belong to no class which saves the extra 0x80 test per character
+ */
+static const quint8 charclass[256] = {
+    0x00, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
+    0x02, 0x08, 0x08, 0x02, 0x02, 0x08, 0x02, 0x02,
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
+    0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02, 0x02,
+    0x08, 0x17, 0x02, 0x13, 0x13, 0x13, 0x13, 0x13,
+    0x02, 0x02, 0x17, 0x17, 0x02, 0x17, 0x12, 0x17,
+    0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17,
+    0x17, 0x17, 0x02, 0x02, 0x02, 0x13, 0x02, 0x13,
+    0x02, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17,
+    0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17,
+    0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17,
+    0x17, 0x17, 0x17, 0x00, 0x00, 0x00, 0x13, 0x13,
+    0x13, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17,
+    0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17,
+    0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17, 0x17,
+    0x17, 0x17, 0x17, 0x13, 0x13, 0x13, 0x13, 0x02,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
 };
 
-/* return c if ENCODEDTEXT, 0 otherwise (RFC2047, Section 5(3)) */
-#define ENCODEDTEXT(c) ((c & 0x80) ? 0 : encodedtext[static_cast<quint8>(c)])
-static const char encodedtext[128] = {
-    0,      0,      0,      0,      0,      0,      0,      0,
-    0,      0,      0,      0,      0,      0,      0,      0,
-    0,      0,      0,      0,      0,      0,      0,      0,
-    0,      0,      0,      0,      0,      0,      0,      0,
-    0,      '!',    0,      0,      0,      0,      0,      0,
-    0,      0,      '*',    '+',    0,      '-',    0,      '/',
-    '0',    '1',    '2',    '3',    '4',    '5',    '6',    '7',
-    '8',    '9',    0,      0,      0,      '=',    0,      0,
-    0,      'A',    'B',    'C',    'D',    'E',    'F',    'G',
-    'H',    'I',    'J',    'K',    'L',    'M',    'N',    'O',
-    'P',    'Q',    'R',    'S',    'T',    'U',    'V',    'W',
-    'X',    'Y',    'Z',    0,      0,      0,      0,      0,
-    0,      'a',    'b',    'c',    'd',    'e',    'f',    'g',
-    'h',    'i',    'j',    'k',    'l',    'm',    'n',    'o',
-    'p',    'q',    'r',    's',    't',    'u',    'v',    'w',
-    'x',    'y',    'z',    0,      0,      0,      0,      0
+/* maximum length of an encoded word including the delimiters (RFC2047,
+ * Section 2) and the space left for the encoded text in each word
+ */
+#define ENCODED_WORD_LENGTH 75
+#define ENCODED_WORD_TEXT (ENCODED_WORD_LENGTH - 12)
+
+/* input bytes one B encoded word can carry */
+#define ENCODED_WORD_B_INPUT (ENCODED_WORD_TEXT / 4 * 3)
+
+/* true for UTF-8 continuation bytes */
+#define isUTF8CONT(c) ((static_cast<quint8>(c) & 0xc0) == 0x80)
+
+/* base64 alphabet */
+static const char tobase64[64] = {
+    'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M',
+    'N', 'O', 'P', 'Q', 'R', 'S', 'T', 'U', 'V', 'W', 'X', 'Y', 'Z',
+    'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h', 'i', 'j', 'k', 'l', 'm',
+    'n', 'o', 'p', 'q', 'r', 's', 't', 'u', 'v', 'w', 'x', 'y', 'z',
+    '0', '1', '2', '3', '4', '5', '6', '7', '8', '9', '+', '/'
 };
 
 /* hex table */
@@ -105,10 +114,12 @@ static const char encodedtext[128] = {
 static const char tohex[16] = { '0', '1', '2', '3', '4', '5', '6', '7',
                                 '8', '9', 'A', 'B', 'C', 'D', 'E', 'F' };
 
-#define isFWS(c) (c == ' ' || c == '\t' || c == '\r' || c == '\n')
-#define isATEXT(c) (ATEXT(c) != 0)
-#define isDTEXT(c) (DTEXT(c) != 0)
-#define isENCODEDTEXT(c) (ENCODEDTEXT(c) != 0)
+#define CHARCLASS(c, cc) ((charclass[static_cast<quint8>(c)] & (cc)) != 0)
+#define isFWS(c) CHARCLASS(c, CC_FWS)
+#define isATEXT(c) CHARCLASS(c, CC_ATEXT)
+#define isDTEXT(c) CHARCLASS(c, CC_DTEXT)
+#define isENCODEDTEXT(c) CHARCLASS(c, CC_ENCODEDTEXT)
+#define isDOTATOM(c) CHARCLASS(c, CC_DOTATOM)
 
 /* weekdays (1 based offset) */
 static const char *wdays[7] = {
@@ -138,6 +149,22 @@ bool QsrMailRfcTools::validateAddrSpec(const QByteArray &data)
     const char *c = data.constData();
     char ch = 0;
 
+    /* fast path: the vast majority of addresses is a plain dot-atom on
+     * both sides of the @ without any quoting, comments or folding white
+     * space; those are accepted after a single table driven scan. All
+     * other input falls through to the full grammar below.
+     */
+    const char *p = c;
+    while (isDOTATOM(*p))
+        p++;
+    if (p != c && *p == '@') {
+        const char *domain = ++p;
+        while (isDOTATOM(*p))
+            p++;
+        if (p != domain && *p == 0)
+            return true;
+    }
+
     /* -- LOCAL PART -- */
     c = skipCFWS(c);
     if (c == 0 || *c == 0)
@@ -159,7 +186,7 @@ bool QsrMailRfcTools::validateAddrSpec(const QByteArray &data)
             return false;
     } else {
         /* if not quoted string it must be a dot-atom */
-        while (*c == '.' || isATEXT(*c))
+        while (isDOTATOM(*c))
             c++;
     }
 
@@ -191,7 +218,7 @@ bool QsrMailRfcTools::validateAddrSpec(const QByteArray &data)
             return false;
     } else {
         /* if not domain literal it must be a dot-atom */
-        while (*c == '.' || isATEXT(*c))
+        while (isDOTATOM(*c))
             c++;
     }
 
@@ -236,7 +263,7 @@ bool QsrMailRfcTools::validateDisplayName(const QByteArray &data)
             return false;
     } else {
         /* if not quoted string it must be a dot-atom */
-        while (*c == '.' || isATEXT(*c))
+        while (isDOTATOM(*c))
             c++;
     }
 
@@ -245,48 +272,205 @@ bool QsrMailRfcTools::validateDisplayName(const QByteArray &data)
     return c != 0 && *c == 0;
 }
 
+/* return the range [b, e) without leading and trailing FWS; if *unquote*
+ * is set a surrounding quoted string is removed and unescaped
+ */
+static QByteArray trimmedRange(const char *b, const char *e, bool unquote)
+{
+    while (b < e && isFWS(*b))
+        b++;
+    while (e > b && isFWS(*(e-1)))
+        e--;
+
+    if (!unquote || e-b < 2 || *b != '"' || *(e-1) != '"')
+        return QByteArray(b, static_cast<int>(e-b));
+
+    QByteArray result;
+    result.reserve(static_cast<int>(e-b));
+    for (++b, --e; b < e; ++b) {
+        if (*b == '\\' && b+1 < e)
+            b++;
+        result.append(*b);
+    }
+
+    return result;
+}
+
+/*!
+ * \internal
+ *
+ * Split the address list *data* (for example the value of a To: header
+ * as typed by a user) into its addr-spec and display name parts which
+ * are appended to *addrSpecs* and *displayNames*. Both lists always grow
+ * by the same number of entries; items without a display name get an
+ * empty one. Commas inside quoted strings, comments and angle brackets
+ * do not separate items. Empty items are skipped.
+ *
+ * The list is split in a single pass over the data. The items are not
+ * validated; use validateAddrSpec() on the resulting addr-specs.
+ */
+void QsrMailRfcTools::splitAddressList(const QByteArray &data,
+                                       QList<QByteArray> &addrSpecs,
+                                       QList<QByteArray> &displayNames)
+{
+    const char *c = data.constData();
+    const char *end = c + data.size();
+
+    while (c < end) {
+        const char *item = c;
+        const char *angle = 0;
+        const char *close = 0;
+        bool quoted = false;
+        int level = 0;
+
+        /* find the end of the item */
+        for (; c < end; ++c) {
+            const char ch = *c;
+            if (ch == '\\' && (quoted || level > 0) && c+1 < end) {
+                c++;
+            } else if (quoted) {
+                quoted = (ch != '"');
+            } else if (level > 0) {
+                if (ch == '(')
+                    level++;
+                else if (ch == ')')
+                    level--;
+            } else if (ch == '"') {
+                quoted = true;
+            } else if (ch == '(') {
+                level++;
+            } else if (ch == '<' && angle == 0) {
+                angle = c;
+            } else if (ch == '>' && angle != 0 && close == 0) {
+                close = c;
+            } else if (ch == ',' && (angle == 0 || close != 0)) {
+                break;
+            }
+        }
+
+        const char *itemEnd = c;
+        if (c < end)
+            c++;
+
+        QByteArray addrSpec;
+        QByteArray displayName;
+        if (angle != 0) {
+            displayName = trimmedRange(item, angle, true);
+            addrSpec = trimmedRange(angle+1, close ? close : itemEnd, false);
+        } else {
+            addrSpec = trimmedRange(item, itemEnd, false);
+        }
+
+        if (addrSpec.isEmpty() && displayName.isEmpty())
+            continue;
+
+        addrSpecs.append(addrSpec);
+        displayNames.append(displayName);
+    }
+}
+
 /*!
  * \internal
  *
  * Encode *data* to a QByteArray representation as defined by RFC2047
  * section 5 'Encoded Words'. This method is useful when UTF-8 strings
  * should be transfered using internet headers since most header values
- * are allowed to carry encoded words.
+ * are allowed to carry encoded words. Strings made of plain encoded-text
+ * characters are returned unchanged.
+ *
+ * The text is split into as many encoded words of at most 75 characters
+ * as needed, separated by a space where the header may be folded. Words
+ * never end inside a UTF-8 sequence. Each word uses the Q encoding if it
+ * carries at least as much of the text as the B encoding would; mostly
+ * ASCII text stays readable while non-latin scripts get the more compact
+ * B encoding. Since only characters allowed in a 'phrase' are left
+ * unencoded the result may be used for display names as well.
  */
 QByteArray QsrMailRfcTools::toEncodedWords(const QString &data)
 {
-    /* this is the smallest denominator for the qp encoding according
-     * to RFC2047/Section 5 (3)
-     */
     QByteArray text(data.toUtf8());
-    QByteArray encoded(text.size() * 3, Qt::Uninitialized);
     const char *s = text.constData();
+    const char *end = s + text.size();
+
+    /* the string doesn't need any encoding */
+    const char *c = s;
+    while (c < end && isENCODEDTEXT(*c))
+        c++;
+    if (c == end)
+        return text;
+
+    /* a word carries at least ENCODED_WORD_B_INPUT - 3 bytes of the text
+     * unless it is the last one, this bounds the size of the result
+     */
+    const int words = text.size() / (ENCODED_WORD_B_INPUT - 3) + 1;
+    QByteArray encoded(words * (ENCODED_WORD_LENGTH + 1), Qt::Uninitialized);
     char *d = encoded.data();
     char *t = d;
-    bool isEncoded = false;
-
-    while (char c = *s++) {
-        if (isENCODEDTEXT(c)) {
-            *t++ = c;
-        } else if (c == ' ') {
-            /* encode space as _ */
-            *t++ = '_';
-            isEncoded = true;
+
+    while (s < end) {
+        /* longest run of complete characters fitting into a Q word */
+        const char *q = s;
+        const char *qEnd = s;
+        int length = 0;
+        while (q < end) {
+            length += (isENCODEDTEXT(*q) || *q == ' ') ? 1 : 3;
+            if (length > ENCODED_WORD_TEXT)
+                break;
+            if (++q == end || !isUTF8CONT(*q))
+                qEnd = q;
+        }
+
+        /* longest run of complete characters fitting into a B word */
+        const char *bEnd = s + qMin<qptrdiff>(end - s, ENCODED_WORD_B_INPUT);
+        while (bEnd < end && bEnd > s && isUTF8CONT(*bEnd))
+            bEnd--;
+
+        if (t != d)
+            *t++ = ' ';
+
+        if (qEnd - s >= bEnd - s) {
+            memcpy(t, "=?UTF-8?Q?", 10);
+            t += 10;
+            for (; s < qEnd; ++s) {
+                const char ch = *s;
+                if (isENCODEDTEXT(ch)) {
+                    *t++ = ch;
+                } else if (ch == ' ') {
+                    /* encode space as _ */
+                    *t++ = '_';
+                } else {
+                    *t++ = '=';
+                    *t++ = TOHEX((ch >> 4) & 0xf);
+                    *t++ = TOHEX(ch & 0xf);
+                }
+            }
         } else {
-            *t++ = '=';
-            *t++ = TOHEX((c >> 4) & 0xf);
-            *t++ = TOHEX(c & 0xf);
-            isEncoded = true;
+            memcpy(t, "=?UTF-8?B?", 10);
+            t += 10;
+            for (; bEnd - s >= 3; s += 3) {
+                const quint8 *u = reinterpret_cast<const quint8 *>(s);
+                *t++ = tobase64[u[0] >> 2];
+                *t++ = tobase64[((u[0] & 0x03) << 4) | (u[1] >> 4)];
+                *t++ = tobase64[((u[1] & 0x0f) << 2) | (u[2] >> 6)];
+                *t++ = tobase64[u[2] & 0x3f];
+            }
+            if (s < bEnd) {
+                const quint8 *u = reinterpret_cast<const quint8 *>(s);
+                const quint8 u1 = (bEnd - s > 1) ? u[1] : 0;
+                *t++ = tobase64[u[0] >> 2];
+                *t++ = tobase64[((u[0] & 0x03) << 4) | (u1 >> 4)];
+                *t++ = (bEnd - s > 1) ? tobase64[(u1 & 0x0f) << 2] : '=';
+                *t++ = '=';
+                s = bEnd;
+            }
         }
+
+        *t++ = '?';
+        *t++ = '=';
     }
     encoded.truncate(static_cast<int>(t-d));
 
-    /* if the string has been encoded we need to apply some wrapper to it */
-    if (isEncoded)
-        return "=?UTF-8?Q?" % encoded % "?=";
-
-    /* the string didn't need any encoding */
-    return text;
+    return encoded;
 }
 
 /*!
@@ -330,6 +514,87 @@ QByteArray QsrMailRfcTools::rfc2822Date(const QDateTime &dateTime)
             .toLatin1();
 }
 
+/* process wide data which is expensive to compute for every message */
+struct QsrMailRfcCache
+{
+    QsrMailRfcCache() :
+        dateSecs(-1)
+    {
+        /* the short hostname, "unknown" if not available */
+        hostName = QHostInfo::localHostName().toLatin1();
+        int dot = hostName.indexOf('.');
+        if (dot >= 0)
+            hostName.truncate(dot);
+        if (hostName.isEmpty())
+            hostName = "unknown";
+
+        /* random prefix making the message ids of this process unique */
+        QByteArray uuid(QUuid::createUuid().toRfc4122());
+        idPrefix = '<' % uuid.toHex() % '.';
+        idSuffix = '@' % hostName % '>';
+    }
+
+    QByteArray hostName;
+    QByteArray idPrefix;
+    QByteArray idSuffix;
+    QAtomicInt idCounter;
+
+    QMutex dateMutex;
+    qint64 dateSecs;
+    QByteArray date;
+};
+
+Q_GLOBAL_STATIC(QsrMailRfcCache, rfcCache)
+
+/*!
+ * \internal
+ *
+ * Returns the current local date time as RFC2822 date. The date is
+ * formatted at most once per second, subsequent calls within the same
+ * second return the cached string.
+ */
+QByteArray QsrMailRfcTools::currentDate()
+{
+    QsrMailRfcCache *cache = rfcCache();
+    const qint64 msecs = QDateTime::currentMSecsSinceEpoch();
+    const qint64 secs = msecs / 1000;
+
+    QMutexLocker lock(&cache->dateMutex);
+    if (secs != cache->dateSecs) {
+        cache->date = rfc2822Date(QDateTime::fromMSecsSinceEpoch(secs * 1000));
+        cache->dateSecs = secs;
+    }
+
+    return cache->date;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the short name of the local host (the part up to the first dot),
+ * or "unknown" if the name cannot be determined. The name is looked up
+ * once per process.
+ */
+QByteArray QsrMailRfcTools::localHostName()
+{
+    return rfcCache()->hostName;
+}
+
+/*!
+ * \internal
+ *
+ * Returns a new unique message id in the form '<prefix.counter@host>'. The
+ * prefix is random and created once per process, the counter is increased
+ * atomically for every id, so no locking or system calls are required.
+ */
+QByteArray QsrMailRfcTools::createMessageId()
+{
+    QsrMailRfcCache *cache = rfcCache();
+    const uint id = static_cast<uint>(cache->idCounter.fetchAndAddRelaxed(1));
+
+    return cache->idPrefix % QByteArray::number(id, 16) % cache->idSuffix;
+}
+
 /*!
  * \internal
  *
@@ -24,6 +24,7 @@
 
 #include <QByteArray>
 #include <QDateTime>
+#include <QList>
 
 QT_BEGIN_NAMESPACE
 
@@ -32,8 +33,14 @@ class QsrMailRfcTools
 public:
     static bool validateAddrSpec(const QByteArray &data);
     static bool validateDisplayName(const QByteArray &data);
+    static void splitAddressList(const QByteArray &data,
+                                 QList<QByteArray> &addrSpecs,
+                                 QList<QByteArray> &displayNames);
     static QByteArray toEncodedWords(const QString &data);
     static QByteArray rfc2822Date(const QDateTime &dateTime);
+    static QByteArray currentDate();
+    static QByteArray localHostName();
+    static QByteArray createMessageId();
 
 private:
     static const char *skipCFWS(const char *c);
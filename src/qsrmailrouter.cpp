@@ -0,0 +1,750 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \class QsrMailRouter qsrmailrouter.h <QsrMailRouter>
+ * \brief This class delivers messages directly to the mail exchangers of
+ * the recipient domains.
+ *
+ * QsrMailTransport and QsrMailTransportPool deliver all messages to a single
+ * server, usually a smarthost which relays the messages. The router instead
+ * splits every message into one delivery per recipient domain, looks up the
+ * MX records of the domains and delivers each group to the mail exchangers
+ * in the order of their preference. Exchangers with the same preference are
+ * tried in random order, as required by RFC5321. Domains without MX records
+ * are delivered to the domain itself.
+ *
+ * Deliveries to the same exchangers share their sessions, even if they are
+ * for different domains. Up to maxConnectionsPerHost() sessions are opened
+ * in parallel to the same exchangers and all exchangers are contacted at the
+ * same time. If an exchanger cannot be resolved or the session fails before
+ * the server is ready to accept messages, the next exchanger is used.
+ *
+ * The MX records are cached process wide for the time to live announced by
+ * the DNS server.
+ *
+ * Example:
+ * \code
+ * QsrMailRouter *router = new QsrMailRouter();
+ *
+ * connect(router, &QsrMailRouter::transactionFinished,
+ *         this, &Foo::deliveryFinished);
+ * connect(router, &QsrMailRouter::finished,
+ *         router, &QsrMailRouter::deleteLater);
+ *
+ * foreach (const QsrMailMessage &msg, messages)
+ *     router->queueMessage(msg);
+ *
+ * router->sendMessages();
+ * \endcode
+ *
+ * \sa QsrMailTransportPool
+ */
+
+/*!
+ * \fn QsrMailRouter::transactionFinished(QsrMailTransaction *transaction)
+ *
+ * This signal is emitted when the delivery of a message to the recipients
+ * of one domain has been completed. QsrMailTransaction::message() returns
+ * the delivered message and QsrMailTransaction::recipients() the recipients
+ * of the delivery. The transaction is owned by one of the transports of the
+ * router. It is the developers responsibilty to dispose the transaction
+ * using deleteLater().
+ */
+
+/*!
+ * \fn QsrMailRouter::finished()
+ *
+ * Is emitted when all deliveries have been completed.
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailRouterPrivate qsrmailrouter_p.h
+ * \brief The implementation and private data class of the QsrMailRouter
+ * class.
+ *
+ * Queued messages are kept until sendMessages() is called. The messages are
+ * then split into Delivery records, grouped by recipient domain, and the MX
+ * records of all domains are looked up in parallel. Once all lookups have
+ * finished the deliveries are assigned to the Route of their exchangers.
+ * A route is identified by the ordered list of exchangers and holds the
+ * transports delivering to them.
+ */
+
+#include "qsrmailrouter.h"
+#include "qsrmailrouter_p.h"
+
+#include "qsrmailtransport_p.h"
+#include "qsrmailtransaction.h"
+
+#include <QDateTime>
+#include <QMutex>
+#include <QPair>
+#include <QtAlgorithms>
+
+QT_BEGIN_NAMESPACE
+
+/* cache time for domains without MX records, in seconds */
+#define IMPLICIT_MX_TTL 300
+
+/* upper limit for the cache time, in seconds */
+#define MAX_MX_TTL (24*60*60)
+
+/* process wide cache of the mail exchangers of domains */
+struct QsrMailMxCache
+{
+    struct Entry
+    {
+        QStringList exchanges;
+        qint64 expires;
+    };
+
+    QMutex mutex;
+    QHash<QString, Entry> entries;
+};
+
+Q_GLOBAL_STATIC(QsrMailMxCache, mxCache)
+
+/*!
+ * \internal
+ *
+ * Orders mail exchanger records by preference.
+ */
+static bool lessPreference(const QDnsMailExchangeRecord &a,
+                           const QDnsMailExchangeRecord &b)
+{
+    return a.preference() < b.preference();
+}
+
+/*!
+ * \internal
+ *
+ * Construct a data class for QsrMailRouterPrivate from *qq*.
+ */
+QsrMailRouterPrivate::QsrMailRouterPrivate(QsrMailRouter *qq) :
+    q_ptr(qq),
+    running(false),
+    aborted(false),
+    sslConfigurationSet(false),
+    maxConnectionsPerHost(2),
+    systemIdentifier("localhost"),
+    timeout(6000),
+    messageRate(0),
+    recipientRate(0),
+    maxServerConnections(0),
+    tlsLevel(QsrMailTransport::TlsOptional),
+    serverPort(25)
+{
+}
+
+/*!
+ * \internal
+ *
+ * A MX lookup has finished. Records the exchangers of the domain and starts
+ * the delivery once all lookups are done.
+ */
+void QsrMailRouterPrivate::_q_lookupFinished()
+{
+    Q_Q(QsrMailRouter);
+
+    QDnsLookup *lookup = qobject_cast<QDnsLookup *>(q->sender());
+    if (!lookups.remove(lookup))
+        return;
+
+    lookup->deleteLater();
+
+    const QString domain(lookup->name());
+    QStringList result;
+    int ttl = 0;
+
+    if (lookup->error() == QDnsLookup::NoError
+            && !lookup->mailExchangeRecords().isEmpty()) {
+        result = mailExchanges(lookup, &ttl);
+    } else if (lookup->error() == QDnsLookup::NoError
+               || lookup->error() == QDnsLookup::NotFoundError) {
+        /* RFC5321 5.1: without MX records the domain is the exchanger */
+        result.append(domain);
+        ttl = IMPLICIT_MX_TTL;
+    } else {
+        /* temporary failure - the address lookup of the domain will tell
+         * if it can be reached at all, but the result is not cached
+         */
+        result.append(domain);
+    }
+
+    if (ttl > 0) {
+        QsrMailMxCache *cache = mxCache();
+        QsrMailMxCache::Entry entry;
+        entry.exchanges = result;
+        entry.expires = QDateTime::currentMSecsSinceEpoch()
+                + qMin(ttl, MAX_MX_TTL) * Q_INT64_C(1000);
+
+        QMutexLocker lock(&cache->mutex);
+        cache->entries.insert(domain, entry);
+    }
+
+    exchanges.insert(domain, result);
+
+    if (lookups.isEmpty())
+        startDelivery();
+}
+
+/*!
+ * \internal
+ *
+ * Relays the transactionFinished() signal of the managed transports.
+ */
+void QsrMailRouterPrivate::_q_transactionFinished(
+        QsrMailTransaction *transaction)
+{
+    Q_Q(QsrMailRouter);
+    emit q->transactionFinished(transaction);
+}
+
+/*!
+ * \internal
+ *
+ * One of the transports has finished. If it was the last running transport
+ * the finished() signal of the router is emitted.
+ */
+void QsrMailRouterPrivate::_q_finished()
+{
+    Q_Q(QsrMailRouter);
+
+    if (!runningTransports.remove(q->sender()))
+        return;
+
+    if (runningTransports.isEmpty()) {
+        running = false;
+        emit q->finished();
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Select the transport of *route* which receives the next delivery. Like
+ * QsrMailTransportPool the transport with the least queued messages is
+ * used and new transports are created until maxConnectionsPerHost is
+ * reached.
+ */
+QsrMailTransport *QsrMailRouterPrivate::selectTransport(Route &route)
+{
+    Q_Q(QsrMailRouter);
+
+    Connection *result = 0;
+    for (int i=0, size=route.connections.size(); i<size; ++i) {
+        Connection *c = &route.connections[i];
+        if (result == 0 || c->queued < result->queued)
+            result = c;
+    }
+
+    if (result == 0 || (result->queued > 0
+                        && route.connections.size() < maxConnectionsPerHost)) {
+        Connection c;
+        c.transport = new QsrMailTransport(q);
+        setupTransport(c.transport);
+
+        route.connections.append(c);
+        result = &route.connections.last();
+    }
+
+    result->queued++;
+    return result->transport;
+}
+
+/*!
+ * \internal
+ *
+ * Apply the router settings to *transport* and connect its signals.
+ */
+void QsrMailRouterPrivate::setupTransport(QsrMailTransport *transport)
+{
+    Q_Q(QsrMailRouter);
+
+    transport->setSystemIdentifier(systemIdentifier);
+    transport->setTimeout(timeout);
+    transport->setMessageRate(messageRate);
+    transport->setRecipientRate(recipientRate);
+    transport->setMaxServerConnections(maxServerConnections);
+    transport->setTlsLevel(tlsLevel);
+
+    if (sslConfigurationSet)
+        transport->setSslConfiguration(sslConfiguration);
+
+    QObject::connect(transport, SIGNAL(transactionFinished(QsrMailTransaction*)),
+                     q, SLOT(_q_transactionFinished(QsrMailTransaction*)));
+    QObject::connect(transport, SIGNAL(finished()),
+                     q, SLOT(_q_finished()));
+}
+
+/*!
+ * \internal
+ *
+ * All exchangers are known - queue the deliveries to the transports of
+ * their routes and start all transports which have messages queued.
+ */
+void QsrMailRouterPrivate::startDelivery()
+{
+    Q_Q(QsrMailRouter);
+
+    QHash<QString, Route>::Iterator route;
+    for (route=routes.begin(); route != routes.end(); ++route) {
+        for (int i=0, size=route->connections.size(); i<size; ++i)
+            route->connections[i].queued = 0;
+    }
+
+    QHash<QString, QList<Delivery> >::ConstIterator it;
+    for (it=deliveries.constBegin(); it != deliveries.constEnd(); ++it) {
+        const QStringList hosts(exchanges.value(it.key()));
+
+        route = routes.find(hosts.join(QLatin1Char(' ')));
+        if (route == routes.end()) {
+            route = routes.insert(hosts.join(QLatin1Char(' ')), Route());
+            route->exchanges = hosts;
+        }
+
+        foreach (const Delivery &delivery, it.value()) {
+            QsrMailTransport *transport = selectTransport(*route);
+            transport->d_func()->queueMessageImpl(delivery.message,
+                                                  delivery.recipients);
+        }
+    }
+
+    deliveries.clear();
+    exchanges.clear();
+
+    /* register all transports first - finished() might be emitted while
+     * starting the others
+     */
+    QList<QPair<QsrMailTransport *, QStringList> > starts;
+    for (route=routes.begin(); route != routes.end(); ++route) {
+        for (int i=0, size=route->connections.size(); i<size; ++i) {
+            if (route->connections.at(i).queued == 0)
+                continue;
+
+            QsrMailTransport *transport = route->connections.at(i).transport;
+            runningTransports.insert(transport);
+            starts.append(qMakePair(transport, route->exchanges));
+        }
+    }
+
+    if (starts.isEmpty()) {
+        running = false;
+        emit q->finished();
+        return;
+    }
+
+    for (int i=0, size=starts.size(); i<size; ++i) {
+        QsrMailTransport *transport = starts.at(i).first;
+
+        if (aborted) {
+            transport->d_func()->rejectQueue(QsrMailTransaction::AbortedError,
+                                             QString());
+        } else {
+            transport->sendMessages(starts.at(i).second, serverPort);
+        }
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Returns the lower case domain of *address* or an empty string if the
+ * address has no domain.
+ */
+QString QsrMailRouterPrivate::domainOf(const QsrMailAddress &address)
+{
+    const QString value(address.address());
+    int at = value.lastIndexOf(QLatin1Char('@'));
+
+    return at < 0 ? QString() : value.mid(at + 1).toLower();
+}
+
+/*!
+ * \internal
+ *
+ * Returns the exchangers of the MX *lookup* in the order they have to be
+ * tried. *ttl* receives the smallest time to live of the records. A null MX
+ * (RFC7505) results in an empty list.
+ */
+QStringList QsrMailRouterPrivate::mailExchanges(const QDnsLookup *lookup,
+                                                int *ttl)
+{
+    QList<QDnsMailExchangeRecord> records(lookup->mailExchangeRecords());
+    QStringList result;
+
+    /* shuffle first, so exchangers of equal preference are tried in
+     * random order after the stable sort
+     */
+    for (int i=records.size()-1; i>0; --i)
+        records.swap(i, qrand() % (i + 1));
+    qStableSort(records.begin(), records.end(), lessPreference);
+
+    *ttl = MAX_MX_TTL;
+    foreach (const QDnsMailExchangeRecord &record, records) {
+        *ttl = qMin<int>(*ttl, record.timeToLive());
+
+        const QString exchange(record.exchange());
+        if (!exchange.isEmpty() && exchange != QLatin1String("."))
+            result.append(exchange);
+    }
+
+    return result;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * Construct a new router. Optionally assign a *parent* to the object.
+ */
+QsrMailRouter::QsrMailRouter(QObject *parent) :
+    QObject(parent),
+    d_ptr(new QsrMailRouterPrivate(this))
+{
+}
+
+/*!
+ * Destroys the instance and all transports of the router.
+ */
+QsrMailRouter::~QsrMailRouter()
+{
+}
+
+/*!
+ * Set the maximum number of concurrent *connections* to the same mail
+ * exchangers. The default is 2 connections, since mail exchangers usually
+ * limit the number of connections per client. Values below 1 are treated
+ * as 1.
+ */
+void QsrMailRouter::setMaxConnectionsPerHost(int connections)
+{
+    Q_D(QsrMailRouter);
+    d->maxConnectionsPerHost = qMax(1, connections);
+}
+
+/*!
+ * Returns the maximum number of concurrent connections to the same mail
+ * exchangers.
+ */
+int QsrMailRouter::maxConnectionsPerHost() const
+{
+    Q_D(const QsrMailRouter);
+    return d->maxConnectionsPerHost;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setSystemIdentifier()
+ *
+ * Mail exchangers often verify the identifier, so it should be the fully
+ * qualified name of the host.
+ */
+void QsrMailRouter::setSystemIdentifier(const QByteArray &value)
+{
+    Q_D(QsrMailRouter);
+    d->systemIdentifier = value;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setSystemIdentifier(value);
+}
+
+/*!
+ * \copydoc QsrMailTransport::systemIdentifier()
+ */
+QByteArray QsrMailRouter::systemIdentifier() const
+{
+    Q_D(const QsrMailRouter);
+    return d->systemIdentifier;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setTimeout()
+ */
+void QsrMailRouter::setTimeout(int timeout)
+{
+    Q_D(QsrMailRouter);
+    d->timeout = timeout;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setTimeout(timeout);
+}
+
+/*!
+ * \copydoc QsrMailTransport::timeout()
+ */
+int QsrMailRouter::timeout() const
+{
+    Q_D(const QsrMailRouter);
+    return d->timeout;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setMessageRate()
+ */
+void QsrMailRouter::setMessageRate(double messages)
+{
+    Q_D(QsrMailRouter);
+    d->messageRate = qMax(messages, 0.0);
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setMessageRate(messages);
+}
+
+/*!
+ * \copydoc QsrMailTransport::messageRate()
+ */
+double QsrMailRouter::messageRate() const
+{
+    Q_D(const QsrMailRouter);
+    return d->messageRate;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setRecipientRate()
+ */
+void QsrMailRouter::setRecipientRate(double recipients)
+{
+    Q_D(QsrMailRouter);
+    d->recipientRate = qMax(recipients, 0.0);
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setRecipientRate(recipients);
+}
+
+/*!
+ * \copydoc QsrMailTransport::recipientRate()
+ */
+double QsrMailRouter::recipientRate() const
+{
+    Q_D(const QsrMailRouter);
+    return d->recipientRate;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setMaxServerConnections()
+ */
+void QsrMailRouter::setMaxServerConnections(int connections)
+{
+    Q_D(QsrMailRouter);
+    d->maxServerConnections = qMax(connections, 0);
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setMaxServerConnections(connections);
+}
+
+/*!
+ * \copydoc QsrMailTransport::maxServerConnections()
+ */
+int QsrMailRouter::maxServerConnections() const
+{
+    Q_D(const QsrMailRouter);
+    return d->maxServerConnections;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setTlsLevel()
+ */
+void QsrMailRouter::setTlsLevel(QsrMailTransport::TlsLevel level)
+{
+    Q_D(QsrMailRouter);
+    d->tlsLevel = level;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setTlsLevel(level);
+}
+
+/*!
+ * \copydoc QsrMailTransport::tlsLevel()
+ */
+QsrMailTransport::TlsLevel QsrMailRouter::tlsLevel() const
+{
+    Q_D(const QsrMailRouter);
+    return d->tlsLevel;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setSslConfiguration()
+ */
+void QsrMailRouter::setSslConfiguration(const QSslConfiguration &value)
+{
+    Q_D(QsrMailRouter);
+    d->sslConfiguration = value;
+    d->sslConfigurationSet = true;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setSslConfiguration(value);
+}
+
+/*!
+ * \copydoc QsrMailTransport::sslConfiguration()
+ */
+QSslConfiguration QsrMailRouter::sslConfiguration() const
+{
+    Q_D(const QsrMailRouter);
+    return d->sslConfiguration;
+}
+
+/*!
+ * Returns the transports currently managed by the router. Transports are
+ * created per mail exchanger while sending and are kept for later
+ * deliveries.
+ */
+QList<QsrMailTransport *> QsrMailRouter::transports() const
+{
+    Q_D(const QsrMailRouter);
+    QList<QsrMailTransport *> result;
+
+    foreach (const QsrMailRouterPrivate::Route &route, d->routes) {
+        for (int i=0, size=route.connections.size(); i<size; ++i)
+            result.append(route.connections.at(i).transport);
+    }
+
+    return result;
+}
+
+/*!
+ * Add *message* to the queue of the router. The message is delivered to
+ * its To, Cc and Bcc recipients when sendMessages() is called; the
+ * transactions for the deliveries are reported by transactionFinished().
+ *
+ * Adding messages while the router is sending is not supported.
+ */
+void QsrMailRouter::queueMessage(const QsrMailMessage &message)
+{
+    Q_D(QsrMailRouter);
+    d->queue.append(message);
+}
+
+/*!
+ * Start the delivery of all queued messages. The mail exchangers are
+ * contacted on *serverPort*, which should only be changed for testing.
+ * finished() is emitted once all deliveries have been completed.
+ *
+ * Recipients without a domain are reported with
+ * QsrMailTransaction::ResolverError, as well as domains which do not accept
+ * mail.
+ */
+void QsrMailRouter::sendMessages(quint16 serverPort)
+{
+    Q_D(QsrMailRouter);
+
+    if (d->running) {
+        qWarning("QsrMailRouter::sendMessages: delivery is already running");
+        return;
+    }
+
+    d->serverPort = serverPort;
+    d->aborted = false;
+    d->running = true;
+
+    /* split all messages into one delivery per recipient domain */
+    foreach (const QsrMailMessage &message, d->queue) {
+        QList<QsrMailAddress> recipients;
+        recipients.append(message.to());
+        recipients.append(message.cc());
+        recipients.append(message.bcc());
+
+        QHash<QString, int> index;
+        QList<QsrMailRouterPrivate::Delivery> groups;
+        foreach (const QsrMailAddress &recipient, recipients) {
+            const QString domain(QsrMailRouterPrivate::domainOf(recipient));
+
+            if (!index.contains(domain)) {
+                index.insert(domain, groups.size());
+                groups.append(QsrMailRouterPrivate::Delivery());
+                groups.last().message = message;
+            }
+            groups[index.value(domain)].recipients.append(recipient);
+        }
+
+        QHash<QString, int>::ConstIterator it;
+        for (it=index.constBegin(); it != index.constEnd(); ++it)
+            d->deliveries[it.key()].append(groups.at(it.value()));
+    }
+
+    d->queue.clear();
+
+    /* lookup the exchangers of all domains which are not cached */
+    QsrMailMxCache *cache = mxCache();
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    foreach (const QString &domain, d->deliveries.keys()) {
+        if (domain.isEmpty()) {
+            d->exchanges.insert(domain, QStringList());
+            continue;
+        }
+
+        {
+            QMutexLocker lock(&cache->mutex);
+            QHash<QString, QsrMailMxCache::Entry>::ConstIterator entry =
+                    cache->entries.constFind(domain);
+
+            if (entry != cache->entries.constEnd() && entry->expires > now) {
+                d->exchanges.insert(domain, entry->exchanges);
+                continue;
+            }
+        }
+
+        QDnsLookup *lookup = new QDnsLookup(QDnsLookup::MX, domain, this);
+        connect(lookup, SIGNAL(finished()), this, SLOT(_q_lookupFinished()));
+        d->lookups.insert(lookup);
+        lookup->lookup();
+    }
+
+    if (d->lookups.isEmpty())
+        d->startDelivery();
+}
+
+/*!
+ * Clears the process wide cache of MX records.
+ */
+void QsrMailRouter::clearMxCache()
+{
+    QsrMailMxCache *cache = mxCache();
+
+    QMutexLocker lock(&cache->mutex);
+    cache->entries.clear();
+}
+
+/*!
+ * Abort the delivery. Messages which are still waiting for the lookup of
+ * their mail exchangers fail with QsrMailTransaction::AbortedError.
+ *
+ * \sa QsrMailTransport::abort()
+ */
+void QsrMailRouter::abort()
+{
+    Q_D(QsrMailRouter);
+
+    d->aborted = true;
+
+    foreach (QDnsLookup *lookup, d->lookups)
+        lookup->abort();
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->abort();
+}
+
+QT_END_NAMESPACE
+
+#include "moc_qsrmailrouter.cpp"
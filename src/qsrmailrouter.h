@@ -0,0 +1,89 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILROUTER_H
+#define QSRMAILROUTER_H
+
+#include "qsrmailglobal.h"
+#include "qsrmailtransport.h"
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailRouterPrivate;
+class QSRMAILSHARED_EXPORT QsrMailRouter : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit QsrMailRouter(QObject *parent = 0);
+    ~QsrMailRouter();
+
+    void setMaxConnectionsPerHost(int connections);
+    int maxConnectionsPerHost() const;
+
+    void setSystemIdentifier(const QByteArray &value);
+    QByteArray systemIdentifier() const;
+
+    void setTimeout(int timeout);
+    int timeout() const;
+
+    void setMessageRate(double messages);
+    double messageRate() const;
+
+    void setRecipientRate(double recipients);
+    double recipientRate() const;
+
+    void setMaxServerConnections(int connections);
+    int maxServerConnections() const;
+
+    void setTlsLevel(QsrMailTransport::TlsLevel level);
+    QsrMailTransport::TlsLevel tlsLevel() const;
+
+    void setSslConfiguration(const QSslConfiguration &value);
+    QSslConfiguration sslConfiguration() const;
+
+    QList<QsrMailTransport *> transports() const;
+
+    void queueMessage(const QsrMailMessage &message);
+    void sendMessages(quint16 serverPort = 25);
+
+    static void clearMxCache();
+
+public Q_SLOTS:
+    void abort();
+
+Q_SIGNALS:
+    void transactionFinished(QsrMailTransaction *transaction);
+    void finished();
+
+private:
+    Q_DECLARE_PRIVATE(QsrMailRouter)
+
+    QScopedPointer<QsrMailRouterPrivate> d_ptr;
+
+    Q_PRIVATE_SLOT(d_func(), void _q_lookupFinished())
+    Q_PRIVATE_SLOT(d_func(), void _q_transactionFinished(QsrMailTransaction *))
+    Q_PRIVATE_SLOT(d_func(), void _q_finished())
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILROUTER_H
@@ -0,0 +1,108 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILROUTER_P_H
+#define QSRMAILROUTER_P_H
+
+#include "qsrmailrouter.h"
+#include "qsrmailaddress.h"
+#include "qsrmailmessage.h"
+
+#include <QDnsLookup>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QSslConfiguration>
+#include <QStringList>
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailRouter;
+class QsrMailRouterPrivate
+{
+public:
+    explicit QsrMailRouterPrivate(QsrMailRouter *qq);
+
+    void _q_lookupFinished();
+    void _q_transactionFinished(QsrMailTransaction *transaction);
+    void _q_finished();
+
+private:
+    struct Delivery
+    {
+        QsrMailMessage message;
+        QList<QsrMailAddress> recipients;
+    };
+
+    struct Connection
+    {
+        Connection() :
+            transport(0),
+            queued(0)
+        {}
+
+        QsrMailTransport *transport;
+        int queued;
+    };
+
+    struct Route
+    {
+        QStringList exchanges;
+        QList<Connection> connections;
+    };
+
+    QsrMailTransport *selectTransport(Route &route);
+    void setupTransport(QsrMailTransport *transport);
+    void startDelivery();
+
+    static QString domainOf(const QsrMailAddress &address);
+    static QStringList mailExchanges(const QDnsLookup *lookup, int *ttl);
+
+public:
+    Q_DECLARE_PUBLIC(QsrMailRouter)
+
+    /* instance data */
+    QsrMailRouter *q_ptr;
+    QList<QsrMailMessage> queue;
+    QHash<QString, QList<Delivery> > deliveries;
+    QHash<QString, QStringList> exchanges;
+    QHash<QString, Route> routes;
+    QSet<QDnsLookup *> lookups;
+    QSet<QObject *> runningTransports;
+    bool running;
+    bool aborted;
+    bool sslConfigurationSet;
+
+    /* member data */
+    int maxConnectionsPerHost;
+    QByteArray systemIdentifier;
+    int timeout;
+    double messageRate;
+    double recipientRate;
+    int maxServerConnections;
+    QsrMailTransport::TlsLevel tlsLevel;
+    QSslConfiguration sslConfiguration;
+    quint16 serverPort;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILROUTER_P_H
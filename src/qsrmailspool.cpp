@@ -0,0 +1,707 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \class QsrMailSpool qsrmailspool.h <QsrMailSpool>
+ * \brief A persistent outbound queue of pre-rendered messages.
+ *
+ * The queue of a QsrMailTransport keeps every message, its transaction
+ * and renderer in memory. While a relay is unavailable the queue grows
+ * without bound and whatever has not been delivered is lost when the
+ * process ends. The spool instead renders each message once into a file
+ * below path() and keeps nothing but a small key per message in memory.
+ *
+ * The messages are appended to segment files together with their
+ * envelope. Once a segment reaches segmentSize() the next one is started
+ * and a segment is removed as soon as all of its messages have been
+ * delivered. A separate append-only index records the queued and the
+ * delivered messages, so open() picks up the messages which have not been
+ * delivered before the process ended.
+ *
+ * A transport delivers the spooled messages once the spool has been
+ * assigned with QsrMailTransport::setSpool(). It takes only a small window
+ * of messages at a time from the spool and streams their data directly
+ * from a mapping of the segment file. Messages which have been accepted
+ * or permanently rejected by the server are removed from the spool;
+ * messages which failed with a transient error stay for the next call
+ * of QsrMailTransport::sendMessages().
+ *
+ * Example:
+ * \code
+ * QsrMailSpool *spool = new QsrMailSpool("/var/spool/myapp", this);
+ * if (!spool->open())
+ *     qFatal("%s", qPrintable(spool->errorString()));
+ *
+ * spool->enqueue(message);
+ *
+ * QsrMailTransport *transport = new QsrMailTransport(this);
+ * transport->setSpool(spool);
+ * transport->sendMessages("mail.server.foo");
+ * \endcode
+ *
+ * The spool and the transports using it have to live in the same thread.
+ * A spool must only be used by one transport at a time.
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailSpoolPrivate qsrmailspool_p.h
+ * \brief The private data class of the QsrMailSpool class.
+ *
+ * Every message is identified by a key made of its segment number and
+ * the offset of its record in the segment file. The record consists of a
+ * header of SPOOL_RECORD_HEADER bytes (little endian):
+ *
+ * Offset | Size | Content
+ * ------ | ---- | -------------------------------------------------
+ *  0     | 4    | magic, zero until the record has been completed
+ *  4     | 4    | flags, bit 0 set if the message requires BINARYMIME
+ *  8     | 4    | size of the envelope
+ *  12    | 4    | reserved
+ *  16    | 8    | size of the message data
+ *
+ * followed by the envelope, which is the sender and the recipients
+ * separated by LF, and the rendered message data. The index file consists
+ * of 16 byte records of the key and the IndexOp.
+ *
+ * The keys of the messages waiting for delivery are kept in *pending*.
+ * A message handed to a transport by checkout() is mapped and moved to
+ * *checkedOut* until the transport reports its delivery by complete() or
+ * gives it back by release().
+ */
+
+#include "qsrmailspool.h"
+#include "qsrmailspool_p.h"
+
+#include "qsrmailmessage.h"
+#include "qsrmailaddress.h"
+#include "qsrmailrenderer_p.h"
+#include "qsrmailrenderpipe_p.h"
+
+#include <QDir>
+#include <QSaveFile>
+#include <QSet>
+#include <QStringBuilder>
+#include <QtEndian>
+
+#include <string.h>
+
+QT_BEGIN_NAMESPACE
+
+/* marks a completed record - "QSRS" */
+#define SPOOL_MAGIC 0x53525351
+
+/* size of a record of the index file */
+#define SPOOL_INDEX_RECORD 16
+
+/*!
+ * \internal
+ *
+ * Construct a data class for QsrMailSpoolPrivate from *qq*.
+ */
+QsrMailSpoolPrivate::QsrMailSpoolPrivate(QsrMailSpool *qq) :
+    q_ptr(qq),
+    opened(false),
+    activeSegment(0),
+    segmentSize(SPOOL_SEGMENT_SIZE)
+{
+}
+
+/*!
+ * \internal
+ *
+ * Closes all files.
+ */
+QsrMailSpoolPrivate::~QsrMailSpoolPrivate()
+{
+    closeFiles();
+}
+
+/*!
+ * \internal
+ *
+ * Takes the next message waiting for delivery. The envelope and the data
+ * of the message are returned in *entry*; the data refers to a mapping of
+ * the segment file which is valid until the message is passed to
+ * complete() or release(). Damaged records are dropped. Returns false if
+ * no message is waiting.
+ */
+bool QsrMailSpoolPrivate::checkout(QsrMailSpoolEntry *entry)
+{
+    while (!pending.isEmpty()) {
+        qint64 key = pending.dequeue();
+        qint64 offset = keyOffset(key);
+        QFile *file = segmentFile(keySegment(key));
+
+        uchar header[SPOOL_RECORD_HEADER];
+        if (file == 0 || !file->seek(offset)
+                || file->read(reinterpret_cast<char *>(header),
+                              SPOOL_RECORD_HEADER) != SPOOL_RECORD_HEADER
+                || qFromLittleEndian<quint32>(header) != SPOOL_MAGIC) {
+            qWarning("QsrMailSpool: dropping damaged record %lld", key);
+            complete(key);
+            continue;
+        }
+
+        quint32 flags = qFromLittleEndian<quint32>(header + 4);
+        int envelopeSize = qFromLittleEndian<quint32>(header + 8);
+        qint64 dataSize = qFromLittleEndian<qint64>(header + 16);
+
+        QByteArray envelope(file->read(envelopeSize));
+        if (envelope.size() != envelopeSize || dataSize <= 0
+                || dataSize > 0x7fffffff) {
+            qWarning("QsrMailSpool: dropping damaged record %lld", key);
+            complete(key);
+            continue;
+        }
+
+        /* the data is mapped; should that fail it is read */
+        qint64 dataOffset = offset + SPOOL_RECORD_HEADER + envelopeSize;
+        uchar *map = file->map(dataOffset, dataSize);
+        if (map != 0) {
+            entry->data = QByteArray::fromRawData(
+                        reinterpret_cast<const char *>(map),
+                        static_cast<int>(dataSize));
+        } else if (file->seek(dataOffset)) {
+            entry->data = file->read(dataSize);
+        }
+
+        if (entry->data.size() != dataSize) {
+            if (map != 0)
+                file->unmap(map);
+            qWarning("QsrMailSpool: dropping damaged record %lld", key);
+            complete(key);
+            continue;
+        }
+
+        QList<QByteArray> fields(envelope.split('\n'));
+        entry->key = key;
+        entry->binary = (flags & 1) != 0;
+        entry->sender = fields.takeFirst();
+        entry->recipients = fields;
+
+        checkedOut.insert(key, map);
+        return true;
+    }
+
+    return false;
+}
+
+/*!
+ * \internal
+ *
+ * The message with *key* has been delivered or permanently rejected and
+ * is removed from the spool. The segment file is removed along with its
+ * last message.
+ */
+void QsrMailSpoolPrivate::complete(qint64 key)
+{
+    unmap(key);
+    appendIndex(key, DoneOp);
+
+    quint32 segment = keySegment(key);
+    if (--segmentRefs[segment] <= 0 && segment != activeSegment)
+        dropSegment(segment);
+}
+
+/*!
+ * \internal
+ *
+ * The message with *key* has not been delivered; it is queued again
+ * behind the other messages.
+ */
+void QsrMailSpoolPrivate::release(qint64 key)
+{
+    unmap(key);
+    pending.enqueue(key);
+}
+
+/*!
+ * \internal
+ *
+ * Returns the file name of *segment*.
+ */
+QString QsrMailSpoolPrivate::segmentPath(quint32 segment) const
+{
+    return path % QLatin1Char('/')
+            % QString::number(segment).rightJustified(8, QLatin1Char('0'))
+            % QLatin1String(".seg");
+}
+
+/*!
+ * \internal
+ *
+ * Returns the opened file of *segment* or null if it cannot be opened.
+ */
+QFile *QsrMailSpoolPrivate::segmentFile(quint32 segment)
+{
+    QFile *file = files.value(segment);
+    if (file != 0)
+        return file;
+
+    file = new QFile(segmentPath(segment));
+    if (!file->open(QIODevice::ReadOnly)) {
+        delete file;
+        return 0;
+    }
+
+    files.insert(segment, file);
+    return file;
+}
+
+/*!
+ * \internal
+ *
+ * Start a new segment file for the messages to come. The previous
+ * segment is removed if all of its messages have been delivered already.
+ */
+bool QsrMailSpoolPrivate::startSegment()
+{
+    quint32 previous = activeSegment;
+
+    QFile *file = new QFile(segmentPath(activeSegment + 1));
+    if (!file->open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        errorString = file->errorString();
+        delete file;
+        return false;
+    }
+
+    activeSegment++;
+    files.insert(activeSegment, file);
+
+    if (previous != 0 && segmentRefs.value(previous) <= 0)
+        dropSegment(previous);
+
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Close and remove the file of *segment*.
+ */
+void QsrMailSpoolPrivate::dropSegment(quint32 segment)
+{
+    QFile *file = files.take(segment);
+    if (file != 0) {
+        file->close();
+        delete file;
+    }
+
+    segmentRefs.remove(segment);
+    QFile::remove(segmentPath(segment));
+}
+
+/*!
+ * \internal
+ *
+ * Release the mapping of the checked out message with *key*.
+ */
+void QsrMailSpoolPrivate::unmap(qint64 key)
+{
+    uchar *map = checkedOut.take(key);
+    if (map == 0)
+        return;
+
+    QFile *file = files.value(keySegment(key));
+    if (file != 0)
+        file->unmap(map);
+}
+
+/*!
+ * \internal
+ *
+ * Append the record *op* for *key* to the index file.
+ */
+bool QsrMailSpoolPrivate::appendIndex(qint64 key, IndexOp op)
+{
+    uchar record[SPOOL_INDEX_RECORD];
+    qToLittleEndian<qint64>(key, record);
+    qToLittleEndian<qint64>(op, record + 8);
+
+    if (index.write(reinterpret_cast<const char *>(record),
+                    SPOOL_INDEX_RECORD) != SPOOL_INDEX_RECORD
+            || !index.flush()) {
+        errorString = index.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Render *message* and append it to the active segment. The record is
+ * completed before it is added to the index, so a record interrupted by
+ * a crash is never delivered.
+ */
+bool QsrMailSpoolPrivate::writeRecord(const QsrMailMessage &message)
+{
+    /* the envelope, as the transport builds it from the message */
+    QByteArray envelope;
+    if (message.sender().isValid())
+        envelope = message.sender().address().toUtf8();
+    else if (!message.from().isEmpty() && message.from().first().isValid())
+        envelope = message.from().first().address().toUtf8();
+
+    if (envelope.isEmpty()) {
+        errorString = QsrMailSpool::tr("message has no sender");
+        return false;
+    }
+
+    QList<QsrMailAddress> recipients(message.to());
+    recipients.append(message.cc());
+    recipients.append(message.bcc());
+
+    int count = 0;
+    for (int i=0, size=recipients.size(); i<size; ++i) {
+        const QsrMailAddress &address = recipients.at(i);
+        if (address.isValid()) {
+            envelope += '\n' % address.address().toUtf8();
+            count++;
+        }
+    }
+
+    if (count == 0) {
+        errorString = QsrMailSpool::tr("message has no recipients");
+        return false;
+    }
+
+    /* open the next segment if the active one is full */
+    QFile *file = files.value(activeSegment);
+    if (file == 0 || file->size() >= segmentSize) {
+        if (!startSegment())
+            return false;
+        file = files.value(activeSegment);
+    }
+
+    qint64 offset = file->size();
+    uchar header[SPOOL_RECORD_HEADER];
+    memset(header, 0, sizeof(header));
+
+    /* the header is written with the magic once the data is complete */
+    bool ok = file->seek(offset)
+            && file->write(reinterpret_cast<const char *>(header),
+                           SPOOL_RECORD_HEADER) == SPOOL_RECORD_HEADER
+            && file->write(envelope) == envelope.size();
+
+    if (ok) {
+        QsrMailRenderer renderer(message);
+        QsrMailRenderWriter writer(&renderer, file);
+
+        ok = writer.run();
+        if (!ok) {
+            errorString = writer.errorString();
+        } else {
+            quint32 flags = renderer.requiresBinaryMime() ? 1 : 0;
+            qToLittleEndian<quint32>(SPOOL_MAGIC, header);
+            qToLittleEndian<quint32>(flags, header + 4);
+            qToLittleEndian<quint32>(envelope.size(), header + 8);
+            qToLittleEndian<qint64>(writer.bytesWritten(), header + 16);
+
+            ok = file->seek(offset)
+                    && file->write(reinterpret_cast<const char *>(header),
+                                   SPOOL_RECORD_HEADER) == SPOOL_RECORD_HEADER
+                    && file->flush();
+        }
+    }
+
+    qint64 key = entryKey(activeSegment, offset);
+    if (!ok || !appendIndex(key, QueuedOp)) {
+        if (errorString.isEmpty())
+            errorString = file->errorString();
+        file->resize(offset);
+        return false;
+    }
+
+    pending.enqueue(key);
+    segmentRefs[activeSegment]++;
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Read the index and queue the messages which have not been delivered.
+ * Segment files without such messages are removed and the index is
+ * rewritten to contain only the queued messages, so neither grows with
+ * the number of delivered messages. New messages go to a new segment.
+ */
+bool QsrMailSpoolPrivate::recover()
+{
+    QDir dir(path);
+    if (!dir.mkpath(QLatin1String("."))) {
+        errorString = QsrMailSpool::tr("cannot create spool directory ")
+                % path;
+        return false;
+    }
+
+    /* replay the index */
+    index.setFileName(dir.filePath(QLatin1String("spool.idx")));
+
+    QList<qint64> queued;
+    QSet<qint64> done;
+    if (index.open(QIODevice::ReadOnly)) {
+        QByteArray data(index.readAll());
+        const uchar *p = reinterpret_cast<const uchar *>(data.constData());
+
+        for (int i=0; i+SPOOL_INDEX_RECORD<=data.size();
+             i+=SPOOL_INDEX_RECORD) {
+            qint64 key = qFromLittleEndian<qint64>(p + i);
+            qint64 op = qFromLittleEndian<qint64>(p + i + 8);
+
+            if (op == QueuedOp)
+                queued.append(key);
+            else if (op == DoneOp)
+                done.insert(key);
+        }
+
+        index.close();
+    }
+
+    for (int i=0, size=queued.size(); i<size; ++i) {
+        qint64 key = queued.at(i);
+        if (!done.contains(key)) {
+            pending.enqueue(key);
+            segmentRefs[keySegment(key)]++;
+        }
+    }
+
+    /* remove the segments which have been delivered completely */
+    activeSegment = 0;
+    QStringList names(dir.entryList(QStringList(QLatin1String("*.seg")),
+                                    QDir::Files));
+    foreach (const QString &name, names) {
+        bool ok;
+        quint32 segment = name.left(name.size() - 4).toUInt(&ok);
+        if (!ok)
+            continue;
+
+        activeSegment = qMax(activeSegment, segment);
+        if (!segmentRefs.contains(segment))
+            QFile::remove(dir.filePath(name));
+    }
+
+    /* compact the index to the queued messages */
+    QSaveFile compacted(index.fileName());
+    if (!compacted.open(QIODevice::WriteOnly)) {
+        errorString = compacted.errorString();
+        return false;
+    }
+
+    for (int i=0, size=pending.size(); i<size; ++i) {
+        uchar record[SPOOL_INDEX_RECORD];
+        qToLittleEndian<qint64>(pending.at(i), record);
+        qToLittleEndian<qint64>(QueuedOp, record + 8);
+        compacted.write(reinterpret_cast<const char *>(record),
+                        SPOOL_INDEX_RECORD);
+    }
+
+    if (!compacted.commit()) {
+        errorString = compacted.errorString();
+        return false;
+    }
+
+    if (!index.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        errorString = index.errorString();
+        return false;
+    }
+
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Close all files and forget the queued messages.
+ */
+void QsrMailSpoolPrivate::closeFiles()
+{
+    QHash<qint64, uchar *>::ConstIterator it = checkedOut.constBegin();
+    for (; it != checkedOut.constEnd(); ++it) {
+        QFile *file = files.value(keySegment(it.key()));
+        if (file != 0 && it.value() != 0)
+            file->unmap(it.value());
+    }
+
+    qDeleteAll(files);
+    files.clear();
+    index.close();
+
+    pending.clear();
+    checkedOut.clear();
+    segmentRefs.clear();
+    activeSegment = 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * Construct a spool which stores its files in the directory *path*.
+ * Optionally assign a *parent* to the object. The spool has to be opened
+ * before it can be used.
+ */
+QsrMailSpool::QsrMailSpool(const QString &path, QObject *parent) :
+    QObject(parent),
+    d_ptr(new QsrMailSpoolPrivate(this))
+{
+    Q_D(QsrMailSpool);
+    d->path = path;
+}
+
+/*!
+ * Destroys the instance. The spooled messages are kept on disk.
+ */
+QsrMailSpool::~QsrMailSpool()
+{
+}
+
+/*!
+ * Returns the directory of the spool.
+ */
+QString QsrMailSpool::path() const
+{
+    Q_D(const QsrMailSpool);
+    return d->path;
+}
+
+/*!
+ * Set the *size* in bytes at which a segment file is considered full and
+ * the next message starts a new segment. A segment is removed once all
+ * of its messages have been delivered, so smaller segments release disk
+ * space earlier at the cost of more files. The default is 64MB.
+ */
+void QsrMailSpool::setSegmentSize(qint64 size)
+{
+    Q_D(QsrMailSpool);
+    d->segmentSize = qBound(Q_INT64_C(1), size, Q_INT64_C(1) << 39);
+}
+
+/*!
+ * Returns the size at which a new segment file is started.
+ */
+qint64 QsrMailSpool::segmentSize() const
+{
+    Q_D(const QsrMailSpool);
+    return d->segmentSize;
+}
+
+/*!
+ * Open the spool. The directory is created if it does not exist and the
+ * messages which have not been delivered by an earlier instance are
+ * queued again. Returns false if the spool cannot be opened, see
+ * errorString().
+ */
+bool QsrMailSpool::open()
+{
+    Q_D(QsrMailSpool);
+
+    if (d->opened)
+        return true;
+
+    d->errorString.clear();
+    if (!d->recover()) {
+        d->closeFiles();
+        return false;
+    }
+
+    d->opened = true;
+    return true;
+}
+
+/*!
+ * Close the spool. The spooled messages are kept on disk. The spool must
+ * not be closed while a transport delivers its messages.
+ */
+void QsrMailSpool::close()
+{
+    Q_D(QsrMailSpool);
+
+    d->closeFiles();
+    d->opened = false;
+}
+
+/*!
+ * Returns true if the spool has been opened.
+ */
+bool QsrMailSpool::isOpen() const
+{
+    Q_D(const QsrMailSpool);
+    return d->opened;
+}
+
+/*!
+ * Returns a description of the last error.
+ */
+QString QsrMailSpool::errorString() const
+{
+    Q_D(const QsrMailSpool);
+    return d->errorString;
+}
+
+/*!
+ * Render *message* into the spool. The message is rendered right away
+ * and is not referenced afterwards. No event loop is run, so the bodies
+ * have to be kept in memory or in files; messages with bodies read from
+ * other devices are refused.
+ *
+ * The envelope is taken from the message like QsrMailTransport does:
+ * the sender (or the first From address) and all To, Cc and Bcc
+ * addresses. Returns false if the message has no sender or recipients or
+ * if it cannot be written, see errorString().
+ */
+bool QsrMailSpool::enqueue(const QsrMailMessage &message)
+{
+    Q_D(QsrMailSpool);
+
+    if (!d->opened) {
+        d->errorString = tr("spool is not open");
+        return false;
+    }
+
+    d->errorString.clear();
+    return d->writeRecord(message);
+}
+
+/*!
+ * Returns the number of messages in the spool, including the messages
+ * which are being delivered.
+ */
+int QsrMailSpool::count() const
+{
+    Q_D(const QsrMailSpool);
+    return d->pending.size() + d->checkedOut.size();
+}
+
+/*!
+ * Returns the number of messages waiting for delivery.
+ */
+int QsrMailSpool::available() const
+{
+    Q_D(const QsrMailSpool);
+    return d->pending.size();
+}
+
+QT_END_NAMESPACE
+
+#include "moc_qsrmailspool.cpp"
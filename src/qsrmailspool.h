@@ -0,0 +1,66 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILSPOOL_H
+#define QSRMAILSPOOL_H
+
+#include "qsrmailglobal.h"
+#include <QObject>
+#include <QScopedPointer>
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailMessage;
+
+class QsrMailSpoolPrivate;
+class QSRMAILSHARED_EXPORT QsrMailSpool : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit QsrMailSpool(const QString &path, QObject *parent = 0);
+    ~QsrMailSpool();
+
+    QString path() const;
+
+    void setSegmentSize(qint64 size);
+    qint64 segmentSize() const;
+
+    bool open();
+    void close();
+    bool isOpen() const;
+    QString errorString() const;
+
+    bool enqueue(const QsrMailMessage &message);
+
+    int count() const;
+    int available() const;
+
+private:
+    Q_DECLARE_PRIVATE(QsrMailSpool)
+    friend class QsrMailTransportPrivate;
+
+    QScopedPointer<QsrMailSpoolPrivate> d_ptr;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILSPOOL_H
@@ -0,0 +1,115 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILSPOOL_P_H
+#define QSRMAILSPOOL_P_H
+
+#include "qsrmailspool.h"
+
+#include <QFile>
+#include <QHash>
+#include <QList>
+#include <QQueue>
+
+QT_BEGIN_NAMESPACE
+
+/* default size at which the spool starts a new segment file */
+#define SPOOL_SEGMENT_SIZE (64*1024*1024)
+
+/* size of the record header preceding every spooled message */
+#define SPOOL_RECORD_HEADER 24
+
+struct QsrMailSpoolEntry
+{
+    QsrMailSpoolEntry() :
+        key(-1),
+        binary(false)
+    {}
+
+    qint64 key;
+    QByteArray data;
+    bool binary;
+    QByteArray sender;
+    QList<QByteArray> recipients;
+};
+
+class QsrMailSpoolPrivate
+{
+public:
+    enum IndexOp {
+        QueuedOp = 1,
+        DoneOp = 2
+    };
+
+public:
+    explicit QsrMailSpoolPrivate(QsrMailSpool *qq);
+    ~QsrMailSpoolPrivate();
+
+    bool checkout(QsrMailSpoolEntry *entry);
+    void complete(qint64 key);
+    void release(qint64 key);
+
+    static inline qint64 entryKey(quint32 segment, qint64 offset)
+    { return (qint64(segment) << 40) | offset; }
+
+    static inline quint32 keySegment(qint64 key)
+    { return quint32(key >> 40); }
+
+    static inline qint64 keyOffset(qint64 key)
+    { return key & ((Q_INT64_C(1) << 40) - 1); }
+
+private:
+    QString segmentPath(quint32 segment) const;
+    QFile *segmentFile(quint32 segment);
+    bool startSegment();
+    void dropSegment(quint32 segment);
+    void unmap(qint64 key);
+    bool appendIndex(qint64 key, IndexOp op);
+    bool writeRecord(const QsrMailMessage &message);
+    bool recover();
+    void closeFiles();
+
+public:
+    Q_DECLARE_PUBLIC(QsrMailSpool)
+
+    /* instance data */
+    QsrMailSpool *q_ptr;
+    bool opened;
+    QString errorString;
+
+    /* files */
+    QFile index;
+    QHash<quint32, QFile *> files;
+    quint32 activeSegment;
+
+    /* entries */
+    QQueue<qint64> pending;
+    QHash<qint64, uchar *> checkedOut;
+    QHash<quint32, int> segmentRefs;
+
+    /* member data */
+    QString path;
+    qint64 segmentSize;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILSPOOL_P_H
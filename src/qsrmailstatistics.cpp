@@ -0,0 +1,214 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \class QsrMailStatistics qsrmailstatistics.h <QsrMailStatistics>
+ * \brief A snapshot of the delivery counters of a transport or pool.
+ *
+ * Every QsrMailTransport counts its deliveries while it runs. The counters
+ * are updated by the transport's thread using relaxed atomic operations
+ * and QsrMailTransport::statistics() (or QsrMailTransportPool::statistics()
+ * for the sum of all transports of a pool) may be called from any thread,
+ * eg. by a monitoring thread, without ever blocking the delivery.
+ *
+ * The counters are read one after another, so a snapshot taken while
+ * messages are sent is not an atomic picture of all counters: a message
+ * might be counted as sent while its bytes are not yet. The totals of
+ * consecutive snapshots only ever grow (except for *queueDepth*), so rates
+ * are best computed from the difference of two snapshots.
+ *
+ * - *messagesSent* - messages accepted by the server
+ * - *messagesFailed* - messages finished with an error, see failures()
+ * - *queueDepth* - messages queued but not yet finished
+ * - *bytesRendered* - bytes of message data taken from the renderers
+ * - *bytesWritten* - bytes written to the connections, including the
+ *   commands and the dot-stuffing
+ * - *renderTime* - nanoseconds spent streaming message data, see
+ *   encoderRate()
+ * - *reconnects* - connections reestablished after the server dropped a
+ *   session which had been ready to send
+ * - *tlsHandshakes* - completed TLS handshakes, *tlsResumed* of those
+ *   resumed an earlier session
+ *
+ * The number of replies received is kept per code, see replies().
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailStatisticsCounters qsrmailstatistics_p.h
+ * \brief The atomic counters behind QsrMailStatistics.
+ *
+ * The counters are written by the thread of a single transport. The
+ * updates are relaxed fetch-and-add operations, which do not order any
+ * other memory access and are as cheap as a plain increment on most
+ * architectures. If *parent* is set every update is added to the parent
+ * as well, which is how the pool sums up its transports; the parent is
+ * shared since the transports may outlive the pool's private data.
+ */
+
+#include "qsrmailstatistics.h"
+#include "qsrmailstatistics_p.h"
+
+#include <string.h>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+ * \internal
+ *
+ * Count a message which finished with *error*. NoError counts as sent.
+ */
+void QsrMailStatisticsCounters::addFailure(
+        QsrMailTransaction::TransactionError error)
+{
+    if (error == QsrMailTransaction::NoError) {
+        add(MessagesSent);
+        return;
+    }
+
+    add(MessagesFailed);
+
+    if (error < 0 || error >= QsrMailStatistics::ErrorCount)
+        return;
+
+    for (QsrMailStatisticsCounters *c=this; c; c=c->parent.data())
+        c->errors[error].fetchAndAddRelaxed(1);
+}
+
+/*!
+ * \internal
+ *
+ * Count a server reply with *code*. Codes outside of the range SMTP
+ * defines are ignored.
+ */
+void QsrMailStatisticsCounters::addReply(int code)
+{
+    if (code < 0 || code >= QsrMailStatistics::ReplyCodeCount)
+        return;
+
+    for (QsrMailStatisticsCounters *c=this; c; c=c->parent.data())
+        c->replies[code].fetchAndAddRelaxed(1);
+}
+
+/*!
+ * \internal
+ *
+ * Returns a snapshot of the counters. This may be called from any thread.
+ */
+QsrMailStatistics QsrMailStatisticsCounters::snapshot() const
+{
+    QsrMailStatistics s;
+
+    s.messagesSent = counters[MessagesSent].load();
+    s.messagesFailed = counters[MessagesFailed].load();
+    s.queueDepth = counters[QueueDepth].load();
+    s.bytesRendered = counters[BytesRendered].load();
+    s.bytesWritten = counters[BytesWritten].load();
+    s.renderTime = counters[RenderTime].load();
+    s.reconnects = counters[Reconnects].load();
+    s.tlsHandshakes = counters[TlsHandshakes].load();
+    s.tlsResumed = counters[TlsResumed].load();
+
+    for (int i=0; i<QsrMailStatistics::ErrorCount; ++i)
+        s.errorCounts[i] = errors[i].load();
+
+    for (int i=0; i<QsrMailStatistics::ReplyCodeCount; ++i)
+        s.replyCounts[i] = replies[i].load();
+
+    return s;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * Constructs a snapshot with all counters set to zero.
+ */
+QsrMailStatistics::QsrMailStatistics() :
+    messagesSent(0),
+    messagesFailed(0),
+    queueDepth(0),
+    bytesRendered(0),
+    bytesWritten(0),
+    renderTime(0),
+    reconnects(0),
+    tlsHandshakes(0),
+    tlsResumed(0)
+{
+    memset(errorCounts, 0, sizeof(errorCounts));
+    memset(replyCounts, 0, sizeof(replyCounts));
+}
+
+/*!
+ * Returns the number of messages which failed with *error*.
+ */
+qint64 QsrMailStatistics::failures(
+        QsrMailTransaction::TransactionError error) const
+{
+    if (error < 0 || error >= ErrorCount)
+        return 0;
+
+    return errorCounts[error];
+}
+
+/*!
+ * Returns the number of replies with *code* received from the servers.
+ */
+qint64 QsrMailStatistics::replies(int code) const
+{
+    if (code < 0 || code >= ReplyCodeCount)
+        return 0;
+
+    return replyCounts[code];
+}
+
+/*!
+ * Returns the number of replies whose code starts with *digit*, eg. 4 for
+ * all transient failures.
+ */
+qint64 QsrMailStatistics::replyClass(int digit) const
+{
+    if (digit < 1 || digit > 5)
+        return 0;
+
+    qint64 result = 0;
+    for (int i=digit*100; i<(digit+1)*100; ++i)
+        result += replyCounts[i];
+
+    return result;
+}
+
+/*!
+ * Returns the rate the message data has been rendered and encoded while
+ * it was streamed to the servers in megabytes (10^6 bytes) per second or 0
+ * if no data has been sent. The rendering runs ahead of and in parallel
+ * to the socket writes, so this is a lower bound of the encoder speed
+ * which is limited by the network.
+ */
+double QsrMailStatistics::encoderRate() const
+{
+    if (renderTime <= 0)
+        return 0;
+
+    return bytesRendered * 1e3 / renderTime;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,69 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILSTATISTICS_H
+#define QSRMAILSTATISTICS_H
+
+#include "qsrmailglobal.h"
+#include "qsrmailtransaction.h"
+
+QT_BEGIN_NAMESPACE
+
+class QSRMAILSHARED_EXPORT QsrMailStatistics
+{
+public:
+    enum {
+        ErrorCount = QsrMailTransaction::MessageSizeError + 1,
+        ReplyCodeCount = 600
+    };
+
+public:
+    QsrMailStatistics();
+
+    qint64 failures(QsrMailTransaction::TransactionError error) const;
+    qint64 replies(int code) const;
+    qint64 replyClass(int digit) const;
+    double encoderRate() const;
+
+public:
+    /* messages */
+    qint64 messagesSent;
+    qint64 messagesFailed;
+    qint64 queueDepth;
+
+    /* data */
+    qint64 bytesRendered;
+    qint64 bytesWritten;
+    qint64 renderTime;
+
+    /* connections */
+    qint64 reconnects;
+    qint64 tlsHandshakes;
+    qint64 tlsResumed;
+
+    /* per error and per reply code counters */
+    qint64 errorCounts[ErrorCount];
+    qint64 replyCounts[ReplyCodeCount];
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILSTATISTICS_H
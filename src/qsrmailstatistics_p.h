@@ -0,0 +1,71 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILSTATISTICS_P_H
+#define QSRMAILSTATISTICS_P_H
+
+#include "qsrmailstatistics.h"
+
+#include <QAtomicInteger>
+#include <QSharedPointer>
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailStatisticsCounters
+{
+public:
+    enum Counter {
+        MessagesSent,
+        MessagesFailed,
+        QueueDepth,
+        BytesRendered,
+        BytesWritten,
+        RenderTime,
+        Reconnects,
+        TlsHandshakes,
+        TlsResumed,
+        CounterCount
+    };
+
+public:
+    inline void add(Counter counter, qint64 value = 1)
+    {
+        for (QsrMailStatisticsCounters *c=this; c; c=c->parent.data())
+            c->counters[counter].fetchAndAddRelaxed(value);
+    }
+
+    void addFailure(QsrMailTransaction::TransactionError error);
+    void addReply(int code);
+    QsrMailStatistics snapshot() const;
+
+public:
+    /* the counters of the pool which also receives the updates */
+    QSharedPointer<QsrMailStatisticsCounters> parent;
+
+private:
+    QAtomicInteger<qint64> counters[CounterCount];
+    QAtomicInteger<qint64> errors[QsrMailStatistics::ErrorCount];
+    QAtomicInteger<qint64> replies[QsrMailStatistics::ReplyCodeCount];
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILSTATISTICS_P_H
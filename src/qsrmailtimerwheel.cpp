@@ -0,0 +1,335 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \internal
+ *
+ * \class QsrMailTimerWheel "qsrmailtimerwheel_p.h"
+ * \brief Hashed timer wheel serving the deadlines of all transports of a
+ * thread.
+ *
+ * Restarting a QTimer for every chunk written is expensive if hundreds of
+ * connections transfer data. The wheel uses a single repeating QTimer per
+ * thread which ticks every WHEEL_TICK msecs as long as deadlines are
+ * active. The deadlines are kept in WHEEL_SLOTS lists, hashed by the tick
+ * at which they expire.
+ *
+ * Extending a deadline only stores its new expiry, the deadline stays in
+ * its slot. Once the wheel reaches the slot it fires the deadlines which
+ * are due and moves the others to the slot of their new expiry. So a
+ * deadline touched many times is rehashed at most once per period. The
+ * time base is the time of the last tick, which makes deadlines up to one
+ * tick shorter than requested.
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailDeadline "qsrmailtimerwheel_p.h"
+ * \brief Single shot deadline served by the QsrMailTimerWheel of the
+ * thread.
+ *
+ * The deadline invokes the slot *member* of *receiver* if it has not been
+ * stopped or touched within its interval. Other than QTimer it is cheap
+ * to extend, see touch(). The deadline has to be used by the thread of the
+ * receiver.
+ */
+
+#include "qsrmailtimerwheel_p.h"
+
+#include <QThreadStorage>
+
+#include <string.h>
+
+QT_BEGIN_NAMESPACE
+
+/* the timer wheels of the threads */
+Q_GLOBAL_STATIC(QThreadStorage<QsrMailTimerWheel *>, timerWheels)
+
+/*!
+ * \internal
+ *
+ * Construct an empty wheel. The wheel does not tick until a deadline is
+ * started.
+ */
+QsrMailTimerWheel::QsrMailTimerWheel() :
+    mNow(0),
+    mCurrent(0),
+    mCount(0)
+{
+    memset(mSlots, 0, sizeof(mSlots));
+    mClock.start();
+
+    mTimer.setInterval(WHEEL_TICK);
+    connect(&mTimer, SIGNAL(timeout()), this, SLOT(tick()));
+}
+
+/*!
+ * \internal
+ *
+ * Destroys the wheel. The deadlines left are stopped.
+ */
+QsrMailTimerWheel::~QsrMailTimerWheel()
+{
+    for (int i=0; i<=WHEEL_SLOTS; ++i) {
+        while (mSlots[i] != 0)
+            remove(mSlots[i]);
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Returns the wheel of the current thread, which is created on first use
+ * and destroyed with the thread.
+ */
+QsrMailTimerWheel *QsrMailTimerWheel::instance()
+{
+    QThreadStorage<QsrMailTimerWheel *> *wheels = timerWheels();
+    if (!wheels->hasLocalData())
+        wheels->setLocalData(new QsrMailTimerWheel);
+
+    return wheels->localData();
+}
+
+/*!
+ * \internal
+ *
+ * Advance the wheel to the current time. The deadlines in the slots passed
+ * are fired if they are due, or moved to the slot of their expiry if they
+ * have been touched meanwhile.
+ */
+void QsrMailTimerWheel::tick()
+{
+    mNow = mClock.elapsed();
+    qint64 target = mNow / WHEEL_TICK;
+
+    /* a late tick handles every slot at most once */
+    qint64 first = qMax(mCurrent + 1, target - WHEEL_SLOTS + 1);
+    for (qint64 t=first; t<=target; ++t)
+        expire(int(t % WHEEL_SLOTS), t);
+    mCurrent = target;
+
+    /* the receivers may start or stop any deadline, even this one */
+    while (mSlots[WHEEL_SLOTS] != 0) {
+        QsrMailDeadline *deadline = mSlots[WHEEL_SLOTS];
+        remove(deadline);
+        QMetaObject::invokeMethod(deadline->mReceiver, deadline->mMember,
+                                  Qt::DirectConnection);
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Activate *deadline*, which expires after its interval.
+ */
+void QsrMailTimerWheel::insert(QsrMailDeadline *deadline)
+{
+    /* the wheel starts ticking with its first deadline */
+    if (mCount++ == 0) {
+        mNow = mClock.elapsed();
+        mCurrent = mNow / WHEEL_TICK;
+        mTimer.start();
+    }
+
+    deadline->mWheel = this;
+    deadline->mExpiry = mNow + deadline->mInterval;
+    place(deadline);
+}
+
+/*!
+ * \internal
+ *
+ * Deactivate *deadline*.
+ */
+void QsrMailTimerWheel::remove(QsrMailDeadline *deadline)
+{
+    unlink(deadline);
+    deadline->mWheel = 0;
+
+    if (--mCount == 0)
+        mTimer.stop();
+}
+
+/*!
+ * \internal
+ *
+ * Put *deadline* into the slot of the tick at which it expires.
+ */
+void QsrMailTimerWheel::place(QsrMailDeadline *deadline)
+{
+    qint64 t = (deadline->mExpiry + WHEEL_TICK - 1) / WHEEL_TICK;
+    if (t <= mCurrent)
+        t = mCurrent + 1;
+
+    deadline->mTick = t;
+    link(deadline, int(t % WHEEL_SLOTS));
+}
+
+/*!
+ * \internal
+ *
+ * Add *deadline* to the list of *slot*.
+ */
+void QsrMailTimerWheel::link(QsrMailDeadline *deadline, int slot)
+{
+    deadline->mSlot = slot;
+    deadline->mPrev = 0;
+    deadline->mNext = mSlots[slot];
+
+    if (mSlots[slot] != 0)
+        mSlots[slot]->mPrev = deadline;
+    mSlots[slot] = deadline;
+}
+
+/*!
+ * \internal
+ *
+ * Remove *deadline* from the list of its slot.
+ */
+void QsrMailTimerWheel::unlink(QsrMailDeadline *deadline)
+{
+    if (deadline->mSlot < 0)
+        return;
+
+    if (deadline->mPrev != 0)
+        deadline->mPrev->mNext = deadline->mNext;
+    else
+        mSlots[deadline->mSlot] = deadline->mNext;
+
+    if (deadline->mNext != 0)
+        deadline->mNext->mPrev = deadline->mPrev;
+
+    deadline->mPrev = 0;
+    deadline->mNext = 0;
+    deadline->mSlot = -1;
+}
+
+/*!
+ * \internal
+ *
+ * Handle the deadlines of *slot* at *tick*. Due deadlines are moved to the
+ * list of deadlines about to fire, the others are placed again. Deadlines
+ * which are more than a period ahead land in the same slot again.
+ */
+void QsrMailTimerWheel::expire(int slot, qint64 tick)
+{
+    Q_UNUSED(tick)
+
+    QsrMailDeadline *deadline = mSlots[slot];
+    mSlots[slot] = 0;
+
+    while (deadline != 0) {
+        QsrMailDeadline *next = deadline->mNext;
+        deadline->mPrev = 0;
+        deadline->mNext = 0;
+        deadline->mSlot = -1;
+
+        if (deadline->mExpiry <= mNow)
+            link(deadline, WHEEL_SLOTS);
+        else
+            place(deadline);
+
+        deadline = next;
+    }
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * \internal
+ *
+ * Construct an inactive deadline which invokes the slot *member* of
+ * *receiver* when it expires. *member* is the plain name of the slot.
+ */
+QsrMailDeadline::QsrMailDeadline(QObject *receiver, const char *member) :
+    mReceiver(receiver),
+    mMember(member),
+    mInterval(0),
+    mExpiry(0),
+    mWheel(0),
+    mPrev(0),
+    mNext(0),
+    mSlot(-1),
+    mTick(0)
+{
+}
+
+/*!
+ * \internal
+ *
+ * Destroys the deadline, which is stopped.
+ */
+QsrMailDeadline::~QsrMailDeadline()
+{
+    stop();
+}
+
+/*!
+ * \internal
+ *
+ * Start the deadline with an interval of *msecs*; an active deadline is
+ * restarted. The deadline is only rehashed if it expires earlier than
+ * before.
+ */
+void QsrMailDeadline::start(int msecs)
+{
+    mInterval = msecs;
+
+    if (mWheel == 0) {
+        QsrMailTimerWheel::instance()->insert(this);
+        return;
+    }
+
+    mExpiry = mWheel->mNow + mInterval;
+
+    qint64 t = (mExpiry + WHEEL_TICK - 1) / WHEEL_TICK;
+    if (mSlot == WHEEL_SLOTS || t < mTick) {
+        mWheel->unlink(this);
+        mWheel->place(this);
+    }
+}
+
+/*!
+ * \internal
+ *
+ * \overload
+ *
+ * Start or restart the deadline with its current interval.
+ */
+void QsrMailDeadline::start()
+{
+    start(mInterval);
+}
+
+/*!
+ * \internal
+ *
+ * Stop the deadline.
+ */
+void QsrMailDeadline::stop()
+{
+    if (mWheel != 0)
+        mWheel->remove(this);
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,111 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILTIMERWHEEL_P_H
+#define QSRMAILTIMERWHEEL_P_H
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+
+QT_BEGIN_NAMESPACE
+
+/* resolution of the timer wheel in msecs */
+#define WHEEL_TICK 100
+
+/* number of slots of the timer wheel, covering 51.2 secs */
+#define WHEEL_SLOTS 512
+
+class QsrMailDeadline;
+
+class QsrMailTimerWheel : public QObject
+{
+    Q_OBJECT
+
+public:
+    QsrMailTimerWheel();
+    ~QsrMailTimerWheel();
+
+    static QsrMailTimerWheel *instance();
+
+private Q_SLOTS:
+    void tick();
+
+private:
+    friend class QsrMailDeadline;
+
+    void insert(QsrMailDeadline *deadline);
+    void remove(QsrMailDeadline *deadline);
+    void place(QsrMailDeadline *deadline);
+    void link(QsrMailDeadline *deadline, int slot);
+    void unlink(QsrMailDeadline *deadline);
+    void expire(int slot, qint64 tick);
+
+    QElapsedTimer mClock;
+    QTimer mTimer;
+    qint64 mNow;
+    qint64 mCurrent;
+    int mCount;
+
+    /* the last slot holds the deadlines about to fire */
+    QsrMailDeadline *mSlots[WHEEL_SLOTS + 1];
+};
+
+class QsrMailDeadline
+{
+public:
+    QsrMailDeadline(QObject *receiver, const char *member);
+    ~QsrMailDeadline();
+
+    void start(int msecs);
+    void start();
+    void stop();
+
+    /* extend an active deadline, this is a mere store */
+    inline void touch()
+    { if (mWheel != 0) mExpiry = mWheel->mNow + mInterval; }
+
+    inline bool isActive() const
+    { return mWheel != 0; }
+
+    inline int interval() const
+    { return mInterval; }
+
+private:
+    Q_DISABLE_COPY(QsrMailDeadline)
+    friend class QsrMailTimerWheel;
+
+    QObject *mReceiver;
+    const char *mMember;
+    int mInterval;
+    qint64 mExpiry;
+
+    /* wheel related data */
+    QsrMailTimerWheel *mWheel;
+    QsrMailDeadline *mPrev;
+    QsrMailDeadline *mNext;
+    int mSlot;
+    qint64 mTick;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILTIMERWHEEL_P_H
@@ -0,0 +1,181 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \internal
+ *
+ * \class QsrMailTraceRing qsrmailtrace_p.h
+ * \brief A fixed size ring of the recent protocol lines of a transport.
+ *
+ * The transport records every command it writes and every response line
+ * it reads together with a timestamp of the monotonic transaction clock.
+ * Each entry keeps the first TRACE_TEXT_SIZE bytes of its line in place,
+ * so recording never allocates memory and the oldest entries are simply
+ * overwritten.
+ *
+ * The ring has a single writer, the thread of the transport, while dump()
+ * may be called from any thread. Every entry is guarded by a sequence
+ * counter which is odd while the entry is written. The reader copies an
+ * entry and takes it only if the counter was even and did not change in
+ * between, so neither side ever waits for the other.
+ */
+
+#include "qsrmailtrace_p.h"
+#include "qsrmailtransaction_p.h"
+
+#include <QStringBuilder>
+
+#include <string.h>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+ * \internal
+ *
+ * Construct a ring holding the last *entries* lines.
+ */
+QsrMailTraceRing::QsrMailTraceRing(int entries) :
+    mEntries(new Entry[qMax(1, entries)]),
+    mSize(qMax(1, entries)),
+    mHead(0)
+{
+}
+
+/*!
+ * \internal
+ *
+ * Destroys the ring.
+ */
+QsrMailTraceRing::~QsrMailTraceRing()
+{
+    delete [] mEntries;
+}
+
+/*!
+ * \internal
+ *
+ * Record the line *data* of *size* bytes sent in *direction*. Lines longer
+ * than TRACE_TEXT_SIZE are truncated; the entry remembers their size.
+ */
+void QsrMailTraceRing::record(Direction direction, const char *data, int size)
+{
+    qint64 head = mHead.load();
+    Entry &e = mEntries[head % mSize];
+
+    /* mark the entry as being written; the ordered increment keeps the
+     * writes below from becoming visible before the odd counter
+     */
+    int seq = e.seq.fetchAndAddOrdered(1);
+
+    e.index = head;
+    e.time = QsrMailTransactionPrivate::now();
+    e.size = size;
+    e.length = qMin(size, TRACE_TEXT_SIZE);
+    e.direction = static_cast<char>(direction);
+    memcpy(e.text, data, e.length);
+
+    e.seq.storeRelease(seq + 2);
+    mHead.storeRelease(head + 1);
+}
+
+/*!
+ * \internal
+ *
+ * Record each of the CRLF separated lines in *data*, as written for
+ * pipelined commands.
+ */
+void QsrMailTraceRing::recordLines(Direction direction, const QByteArray &data)
+{
+    const char *begin = data.constData();
+    const char *end = begin + data.size();
+
+    while (begin < end) {
+        const char *eol = static_cast<const char *>(
+                    memchr(begin, '\n', end - begin));
+        const char *next = eol != 0 ? eol + 1 : end;
+
+        if (eol == 0)
+            eol = end;
+        if (eol > begin && *(eol-1) == '\r')
+            eol--;
+
+        record(direction, begin, static_cast<int>(eol - begin));
+        begin = next;
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Returns the recorded lines, oldest first. Every line starts with the
+ * time in seconds of the monotonic clock, followed by "C:" for commands,
+ * "S:" for responses and "*" for events of the connection. Control
+ * characters are replaced by a dot and truncated lines end with their
+ * size.
+ */
+QByteArray QsrMailTraceRing::dump() const
+{
+    QByteArray result;
+
+    qint64 head = mHead.loadAcquire();
+    qint64 i = qMax(Q_INT64_C(0), head - mSize);
+    result.reserve(static_cast<int>(head - i) * (TRACE_TEXT_SIZE + 32));
+
+    for (; i<head; ++i) {
+        const Entry &e = mEntries[i % mSize];
+
+        /* skip entries being written or overwritten while copying */
+        int seq = e.seq.loadAcquire();
+        if (seq & 1)
+            continue;
+
+        qint64 index = e.index;
+        qint64 time = e.time;
+        int size = e.size;
+        int length = qBound(0, e.length, TRACE_TEXT_SIZE);
+        char direction = e.direction;
+        char text[TRACE_TEXT_SIZE];
+        memcpy(text, e.text, length);
+
+        if (e.seq.fetchAndAddOrdered(0) != seq || index != i)
+            continue;
+
+        for (int j=0; j<length; j++) {
+            if (static_cast<uchar>(text[j]) < 32 || text[j] == 127)
+                text[j] = '.';
+        }
+
+        result += QByteArray::number(time / 1e9, 'f', 6).rightJustified(14);
+        result += ' ';
+        result += direction;
+        if (direction != EventDirection)
+            result += ':';
+        result += ' ';
+        result.append(text, length);
+        if (size > length)
+            result += "... (" % QByteArray::number(size) % " bytes)";
+        result += '\n';
+    }
+
+    return result;
+}
+
+QT_END_NAMESPACE
@@ -0,0 +1,82 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILTRACE_P_H
+#define QSRMAILTRACE_P_H
+
+#include <QByteArray>
+#include <QAtomicInt>
+#include <QAtomicInteger>
+
+QT_BEGIN_NAMESPACE
+
+/* bytes of each traced line which are kept */
+#define TRACE_TEXT_SIZE 116
+
+class QsrMailTraceRing
+{
+public:
+    enum Direction {
+        ClientDirection = 'C',
+        ServerDirection = 'S',
+        EventDirection = '*'
+    };
+
+public:
+    explicit QsrMailTraceRing(int entries);
+    ~QsrMailTraceRing();
+
+    inline int size() const
+    { return mSize; }
+
+    void record(Direction direction, const char *data, int size);
+    inline void record(Direction direction, const QByteArray &data)
+    { record(direction, data.constData(), data.size()); }
+    void recordLines(Direction direction, const QByteArray &data);
+
+    QByteArray dump() const;
+
+private:
+    struct Entry
+    {
+        Entry() :
+            index(-1)
+        {}
+
+        mutable QAtomicInt seq;
+        qint64 index;
+        qint64 time;
+        int size;
+        int length;
+        char direction;
+        char text[TRACE_TEXT_SIZE];
+    };
+
+    Q_DISABLE_COPY(QsrMailTraceRing)
+
+    Entry *mEntries;
+    int mSize;
+    QAtomicInteger<qint64> mHead;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILTRACE_P_H
@@ -78,6 +78,14 @@
  * \var QsrMailTransaction::DataError
  * For some reason the data renderer could not render the message. errorText()
  * contains details.
+ *
+ * \var QsrMailTransaction::UnsupportedExtensionError
+ * The message requires a SMTP extension (eg. BINARYMIME) which the server
+ * does not offer. errorText() contains details.
+ *
+ * \var QsrMailTransaction::MessageSizeError
+ * The message exceeds the maximum message size announced by the server using
+ * the SIZE extension (RFC1870). The message has not been transferred.
  */
 
 /*!
@@ -100,6 +108,65 @@
  *
  * Reflects the sending progress of the message normalized to 100%. This signal
  * is intented for UI purposes to display some sort of progress to the user.
+ * It is emitted only when the percentage changes.
+ *
+ * \sa transferProgress()
+ */
+
+/*!
+ * \fn QsrMailTransaction::transferProgress(qint64 bytesSent, qint64 bytesTotal)
+ *
+ * Reflects the sending progress of the message in bytes. *bytesSent* is the
+ * number of bytes of the message written so far, *bytesTotal* the exact size
+ * of the message. If the size of the message cannot be determined in
+ * advance (eg. an attachment is read from a sequential device) *bytesTotal*
+ * is -1. The signal is emitted whenever data has been written, which makes
+ * it suitable to calculate transfer rates.
+ */
+
+/*!
+ * \fn QsrMailTransaction::timingAvailable(const QsrMailTransactionTiming &timing)
+ *
+ * This signal is emitted right before the finished signal if the message
+ * reached the server, that is the MAIL FROM command has been sent. *timing*
+ * holds the durations of the delivery phases, see timing().
+ */
+
+/*!
+ * \class QsrMailTransactionTiming qsrmailtransaction.h <QsrMailTransactionTiming>
+ * \brief The durations of the phases of a message delivery.
+ *
+ * The transport takes a timestamp of a monotonic clock whenever its state
+ * machine enters the next phase of the SMTP dialog. The durations are given
+ * in nanoseconds and are -1 for phases which did not take place (eg.
+ * tlsTime for plaintext connections or dataResponseTime for BDAT
+ * transfers).
+ *
+ * The session phases describe the connection the message was sent on; with
+ * keep-alive sessions several messages share them and sessionReused is set
+ * for all but the first:
+ *
+ * - *resolveTime* - host name lookup
+ * - *connectTime* - TCP connect, including the racing of the addresses
+ * - *greetingTime* - from the connect to the response of the first EHLO,
+ *   including the TLS handshake for implicit TLS
+ * - *tlsTime* - from STARTTLS (or the connect for implicit TLS) to the end
+ *   of the TLS handshake
+ * - *authTime* - from the AUTH command to its final response
+ *
+ * The message phases are measured from the MAIL FROM command, except for
+ * queueTime:
+ *
+ * - *queueTime* - from queueing the message to the MAIL FROM command
+ * - *envelopeTime* - until the response to the last RCPT TO command
+ * - *dataResponseTime* - until the 354 response to DATA
+ * - *dataTime* - the time spent streaming the message data, starting with
+ *   the first byte and ending with the end of data. *bytesSent* is the
+ *   number of bytes of the message written in that time, see dataRate().
+ * - *completionTime* - until the final (250) response to the message data
+ *
+ * The timing is available from QsrMailTransaction::timing() and it is
+ * passed by the QsrMailTransaction::timingAvailable() signal.
  */
 
 /*!
@@ -114,10 +181,22 @@
 
 #include "qsrmailtransport.h"
 
+#include <QElapsedTimer>
 #include <QStringBuilder>
 
 QT_BEGIN_NAMESPACE
 
+/* process wide monotonic clock for the timestamps of the transactions */
+struct QsrMailTransactionClock
+{
+    QsrMailTransactionClock()
+    { timer.start(); }
+
+    QElapsedTimer timer;
+};
+
+Q_GLOBAL_STATIC(QsrMailTransactionClock, transactionClock)
+
 /*!
  * \internal
  *
@@ -127,7 +206,13 @@ QsrMailTransactionPrivate::QsrMailTransactionPrivate(QsrMailTransaction *qq) :
     q_ptr(qq),
     error(QsrMailTransaction::NoError),
     status(0),
+    progress(0),
+    attempts(0),
+    retryTime(0),
+    queuedAt(now()),
+    spoolKey(-1),
     encrypted(false),
+    sessionResumed(false),
     authenticated(false)
 {
 }
@@ -146,9 +231,23 @@ void QsrMailTransactionPrivate::finalize()
     if (error != QsrMailTransaction::NoError)
         emit q->error(error);
 
+    if (timing.isValid())
+        emit q->timingAvailable(timing);
+
     emit q->finished();
 }
 
+/*!
+ * \internal
+ *
+ * Returns the current time of a process wide monotonic clock in
+ * nanoseconds, used for the timestamps of the delivery phases.
+ */
+qint64 QsrMailTransactionPrivate::now()
+{
+    return transactionClock()->timer.nsecsElapsed();
+}
+
 /*!
  * \internal
  *
@@ -203,6 +302,16 @@ void QsrMailTransactionPrivate::setError(QsrMailTransaction::TransactionError co
         case QsrMailTransaction::DataError:
             errorText = QLatin1String("Message cannot be rendered.");
             break;
+
+        case QsrMailTransaction::UnsupportedExtensionError:
+            errorText = QLatin1String("Server does not support a required " \
+                                      "extension.");
+            break;
+
+        case QsrMailTransaction::MessageSizeError:
+            errorText = QLatin1String("Message exceeds the maximum message " \
+                                      "size of the server.");
+            break;
         }
     }
 }
@@ -210,35 +319,107 @@ void QsrMailTransactionPrivate::setError(QsrMailTransaction::TransactionError co
 /*!
  * \internal
  *
- * Set the server status response to *code* and it's *text* representation.
- * The multiple lines are joined by a SPC character to form a single line.
+ * Set the server status response to *code* and it's *text* representation,
+ * which holds the LF separated lines of the response. The text is shared
+ * with the response and only converted when statusText() is called.
  */
-void QsrMailTransactionPrivate::setStatus(int code, const QList<QByteArray> &text)
+void QsrMailTransactionPrivate::setStatus(int code, const QByteArray &text)
 {
     status = code;
+    statusText = text;
+}
+
+/*!
+ * \internal
+ *
+ * Set the server response for the recipient at *index* to *code* and it's
+ * *text* representation. The index refers to the position of the recipient
+ * in the *recipients* list which is the order the RCPT TO commands have
+ * been issued to the server.
+ */
+void QsrMailTransactionPrivate::setRecipientStatus(int index, int code,
+                                                   const QByteArray &text)
+{
+    if (index < 0 || index >= recipients.size())
+        return;
+
+    recipientStatus[index] = code;
+    recipientStatusText[index] = text;
+}
 
-    if (text.size() < 2) {
-        /* shortcut for single line */
-        statusText = QString::fromLatin1(text.value(0));
-    } else {
-        QByteArray buffer;
-        foreach (const QByteArray &line, text)
-            buffer = buffer % line % ' ';
-        buffer.chop(1);
-        statusText = QString::fromLatin1(buffer);
+/*!
+ * \internal
+ *
+ * Returns the LF separated response lines in *text* as a single string. The
+ * lines are joined by a SPC character to form a single line.
+ */
+QString QsrMailTransactionPrivate::joinStatusText(const QByteArray &text)
+{
+    /* shortcut for single line */
+    if (!text.contains('\n'))
+        return QString::fromLatin1(text);
+
+    return QString::fromLatin1(QByteArray(text).replace('\n', ' '));
+}
+
+/*!
+ * \internal
+ *
+ * Set the transaction delivery progress to *processed* of *total* bytes.
+ * This emits the transferProgress() signal and the progressUpdate() signal
+ * if the percentage changed. Returns the new percentage. If *total* is
+ * unknown the percentage is not updated.
+ */
+int QsrMailTransactionPrivate::setProgress(qint64 processed, qint64 total)
+{
+    Q_Q(QsrMailTransaction);
+
+    timing.bytesSent = processed;
+    emit q->transferProgress(processed, total);
+
+    /* calculate the percentage; make sure it does not exceed 100% */
+    int percent = 0;
+    if (total > 0)
+        percent = static_cast<int>(qMin(processed * 100 / total,
+                                        Q_INT64_C(100)));
+
+    if (percent != progress) {
+        progress = percent;
+        emit q->progressUpdate(percent);
     }
+
+    return progress;
 }
 
 /*!
  * \internal
  *
- * Set the transaction delivery progress to percent. This emits the
- * progressUpdate() signal.
+ * Prepare the message to be sent again after a failed attempt. A renderer
+ * which has already been started is replaced by a new one. Returns false
+ * if the message cannot be rendered again since its body has been read
+ * from devices.
  */
-void QsrMailTransactionPrivate::setProgress(int percent)
+bool QsrMailTransactionPrivate::restartRenderer()
 {
     Q_Q(QsrMailTransaction);
-    emit q->progressUpdate(percent);
+
+    if (!renderer->isStarted())
+        return true;
+
+    if (!renderer->isRestartable())
+        return false;
+
+    QsrMailRenderer *r = new QsrMailRenderer(message, q);
+    r->setupRestart(renderer);
+
+    renderer->disconnect();
+    renderer->abort();
+    renderer->releaseBuffer();
+    renderer->deleteLater();
+    renderer = r;
+
+    progress = 0;
+    return true;
 }
 
 /*!
@@ -275,6 +456,7 @@ QsrMailTransaction::QsrMailTransaction(QsrMailTransport *transport) :
     d_ptr(new QsrMailTransactionPrivate(this))
 {
     qRegisterMetaType<QsrMailTransaction::TransactionError>();
+    qRegisterMetaType<QsrMailTransactionTiming>();
 }
 
 /*!
@@ -343,7 +525,75 @@ int QsrMailTransaction::status() const
 QString QsrMailTransaction::statusText() const
 {
     Q_D(const QsrMailTransaction);
-    return d->statusText;
+    return d->joinStatusText(d->statusText);
+}
+
+/*!
+ * Returns the number of attempts made to deliver the message. Messages
+ * failing with a transient error are retried as configured by
+ * QsrMailTransport::setMaxAttempts().
+ */
+int QsrMailTransaction::attempts() const
+{
+    Q_D(const QsrMailTransaction);
+    return d->attempts;
+}
+
+/*!
+ * Returns the envelope recipients of the message in the order they have been
+ * presented to the server. The list is populated when the transaction is
+ * processed by the transport and is empty before.
+ */
+QStringList QsrMailTransaction::recipients() const
+{
+    Q_D(const QsrMailTransaction);
+    return d->recipients;
+}
+
+/*!
+ * Returns the status code the server replied to the RCPT TO command for
+ * *recipient*. A value of 250 or 251 means the server accepted the
+ * recipient. If the recipient is not part of the envelope or the server did
+ * not reply (yet) zero is returned.
+ *
+ * The message is delivered to all accepted recipients. It only fails with
+ * ResponseError if none of the recipients has been accepted, so it is a
+ * good idea to check rejectedRecipients() even if error() returns NoError.
+ */
+int QsrMailTransaction::recipientStatus(const QString &recipient) const
+{
+    Q_D(const QsrMailTransaction);
+    return d->recipientStatus.value(d->recipients.indexOf(recipient));
+}
+
+/*!
+ * Returns the textual part of the server response to the RCPT TO command for
+ * *recipient*.
+ */
+QString QsrMailTransaction::recipientStatusText(const QString &recipient) const
+{
+    Q_D(const QsrMailTransaction);
+    return d->joinStatusText(
+                d->recipientStatusText.value(d->recipients.indexOf(recipient)));
+}
+
+/*!
+ * Returns all recipients which have not been accepted by the server. This
+ * includes recipients the server did not respond to because the transaction
+ * failed before.
+ */
+QStringList QsrMailTransaction::rejectedRecipients() const
+{
+    Q_D(const QsrMailTransaction);
+    QStringList result;
+
+    for (int i=0, size=d->recipients.size(); i<size; ++i) {
+        int code = d->recipientStatus.at(i);
+        if (code != 250 && code != 251)
+            result.append(d->recipients.at(i));
+    }
+
+    return result;
 }
 
 /*!
@@ -355,6 +605,19 @@ bool QsrMailTransaction::isEncrypted() const
     return d->encrypted;
 }
 
+/*!
+ * Returns true if the encrypted connection resumed the TLS session of an
+ * earlier connection to the server, which saves the full handshake.
+ *
+ * The sessions are shared by all transports of the process. A server which
+ * replaces the offered session ticket is reported as not resumed.
+ */
+bool QsrMailTransaction::isSessionResumed() const
+{
+    Q_D(const QsrMailTransaction);
+    return d->sessionResumed;
+}
+
 /*!
  * Returns the sockets ssl configuration at the time the transaction was
  * transmitted.
@@ -392,6 +655,33 @@ QString QsrMailTransaction::username() const
     return d->username;
 }
 
+/*!
+ * Returns the durations of the delivery phases of the message. The timing
+ * is valid once the MAIL FROM command of the message has been sent and
+ * complete when the transaction has finished. Retried messages report
+ * the last attempt.
+ *
+ * \sa QsrMailTransactionTiming, timingAvailable()
+ */
+QsrMailTransactionTiming QsrMailTransaction::timing() const
+{
+    Q_D(const QsrMailTransaction);
+    return d->timing;
+}
+
+/*!
+ * Returns the protocol trace of the transport taken when the transaction
+ * failed. The trace is only recorded if enabled with
+ * QsrMailTransport::setTraceSize() and is empty for delivered messages.
+ *
+ * \sa QsrMailTransport::protocolTrace()
+ */
+QByteArray QsrMailTransaction::protocolTrace() const
+{
+    Q_D(const QsrMailTransaction);
+    return d->protocolTrace;
+}
+
 /*!
  * Abort the message. Immediatly aborts the message and emits the finished
  * signal.
@@ -403,6 +693,48 @@ void QsrMailTransaction::abort()
     d->finalize();
 }
 
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * Constructs an invalid timing with all durations set to -1.
+ */
+QsrMailTransactionTiming::QsrMailTransactionTiming() :
+    resolveTime(-1),
+    connectTime(-1),
+    greetingTime(-1),
+    tlsTime(-1),
+    authTime(-1),
+    sessionReused(false),
+    queueTime(-1),
+    envelopeTime(-1),
+    dataResponseTime(-1),
+    dataTime(-1),
+    completionTime(-1),
+    bytesSent(0)
+{
+}
+
+/*!
+ * Returns true if the timing has been taken, that is the message has been
+ * presented to the server.
+ */
+bool QsrMailTransactionTiming::isValid() const
+{
+    return queueTime >= 0;
+}
+
+/*!
+ * Returns the transfer rate while streaming the message data in bytes
+ * per second or 0 if no data has been sent.
+ */
+double QsrMailTransactionTiming::dataRate() const
+{
+    if (dataTime <= 0)
+        return 0;
+
+    return bytesSent * 1e9 / dataTime;
+}
+
 QT_END_NAMESPACE
 
 #include "moc_qsrmailtransaction.cpp"
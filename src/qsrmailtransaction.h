@@ -25,6 +25,7 @@
 #include "qsrmailglobal.h"
 #include <QObject>
 #include <QSslConfiguration>
+#include <QStringList>
 
 #include "qsrmailtransport.h"
 
@@ -34,6 +35,32 @@ class QsrMailMessage;
 class QsrMailTransport;
 class QsrMailError;
 
+class QSRMAILSHARED_EXPORT QsrMailTransactionTiming
+{
+public:
+    QsrMailTransactionTiming();
+
+    bool isValid() const;
+    double dataRate() const;
+
+public:
+    /* session phases, shared by the messages of a connection */
+    qint64 resolveTime;
+    qint64 connectTime;
+    qint64 greetingTime;
+    qint64 tlsTime;
+    qint64 authTime;
+    bool sessionReused;
+
+    /* message phases */
+    qint64 queueTime;
+    qint64 envelopeTime;
+    qint64 dataResponseTime;
+    qint64 dataTime;
+    qint64 completionTime;
+    qint64 bytesSent;
+};
+
 class QsrMailTransactionPrivate;
 class QSRMAILSHARED_EXPORT QsrMailTransaction : public QObject
 {
@@ -51,7 +78,9 @@ public:
         ResolverError,
         TimeoutError,
         AbortedError,
-        DataError
+        DataError,
+        UnsupportedExtensionError,
+        MessageSizeError
     };
 
 public:
@@ -64,14 +93,24 @@ public:
     QString errorText() const;
     int status() const;
     QString statusText() const;
+    int attempts() const;
+
+    QStringList recipients() const;
+    int recipientStatus(const QString &recipient) const;
+    QString recipientStatusText(const QString &recipient) const;
+    QStringList rejectedRecipients() const;
 
     bool isEncrypted() const;
+    bool isSessionResumed() const;
     QSslConfiguration sslConfiguration() const;
 
     bool isAuthenticated() const;
     QsrMailTransport::AuthMech authMech() const;
     QString username() const;
 
+    QsrMailTransactionTiming timing() const;
+    QByteArray protocolTrace() const;
+
 public Q_SLOTS:
     void abort();
 
@@ -79,6 +118,8 @@ Q_SIGNALS:
     void finished();    
     void error(QsrMailTransaction::TransactionError error);
     void progressUpdate(int percent);
+    void transferProgress(qint64 bytesSent, qint64 bytesTotal);
+    void timingAvailable(const QsrMailTransactionTiming &timing);
 
 private:
     explicit QsrMailTransaction(QsrMailTransport *transport);
@@ -93,5 +134,6 @@ private:
 QT_END_NAMESPACE
 
 Q_DECLARE_METATYPE(QsrMailTransaction::TransactionError)
+Q_DECLARE_METATYPE(QsrMailTransactionTiming)
 
 #endif // QSRMAILTRANSACTION_H
@@ -22,9 +22,13 @@
 #ifndef QSRMAILTRANSACTION_P_H
 #define QSRMAILTRANSACTION_P_H
 
+#include "qsrmailaddress.h"
 #include "qsrmailmessage.h"
 #include "qsrmailtransaction.h"
 #include "qsrmailrenderer_p.h"
+#include "qsrmailrenderedmessage.h"
+
+#include <QStringList>
 
 QT_BEGIN_NAMESPACE
 
@@ -39,9 +43,14 @@ public:
     void setError(QsrMailTransaction::TransactionError code,
                   const QString &text = QString());
 
-    void setStatus(int code, const QList<QByteArray> &text);
+    void setStatus(int code, const QByteArray &text);
+    void setRecipientStatus(int index, int code, const QByteArray &text);
+
+    static QString joinStatusText(const QByteArray &text);
+    static qint64 now();
 
-    void setProgress(int percent);
+    int setProgress(qint64 processed, qint64 total);
+    bool restartRenderer();
 
     static QsrMailTransaction *createInstance(const QsrMailMessage &message,
                                               QsrMailTransport *transport);
@@ -55,13 +64,27 @@ public:
 
     QsrMailTransport *transport;
     QsrMailMessage message;
+    QList<QsrMailAddress> forwardPaths;
     QString messageId;
     QsrMailTransaction::TransactionError error;
     QString errorText;
     int status;
-    QString statusText;
+    QByteArray statusText;
+    int progress;
+    int attempts;
+    qint64 retryTime;
+    qint64 queuedAt;
+    qint64 spoolKey;
+    QsrMailRenderedMessage rendered;
+    QsrMailTransactionTiming timing;
+    QByteArray protocolTrace;
+
+    QStringList recipients;
+    QList<int> recipientStatus;
+    QList<QByteArray> recipientStatusText;
 
     bool encrypted;
+    bool sessionResumed;
     QSslConfiguration sslConfiguration;
 
     bool authenticated;
@@ -36,7 +36,7 @@
  * Some of the features of this implementation of SMTP include:
  *
  * - RFC compliant implementation of the SMTP protocol
- * - TLS encryption using STARTTLS
+ * - TLS encryption using STARTTLS or implicit TLS
  * - User authentication with support for PLAIN, LOGIN, CRAM-MD5
  * - Supports MIME extensions in QsrMailMessage
  *
@@ -101,6 +101,10 @@
  * \var QsrMailTransport::TlsRequired
  * Encryption is mandatory and the connection will fail if the SMTP server
  * does not provide encryption.
+ *
+ * \var QsrMailTransport::TlsImplicit
+ * The connection is encrypted right from the start without STARTTLS
+ * (SMTPS, RFC8314), usually on port 465.
  */
 
 /*!
@@ -149,13 +153,39 @@
  * The signal passes the related QsrMailTransaction object which can be
  * inspected for errors and so on. Eventually it is the developers responsibilty
  * to dispose the transaction using deleteLater().
+ *
+ * The signal is not emitted if a notification interval is set, see
+ * transactionsFinished().
+ */
+
+/*!
+ * \fn QsrMailTransport::transactionsFinished(const QVector<QsrMailTransaction *> &transactions)
+ *
+ * This signal is emitted instead of transactionFinished() if a notification
+ * interval is set. It passes the *transactions* completed since the last
+ * batch, in the order they have been completed. The developer has to
+ * dispose them just like the ones passed by transactionFinished().
+ *
+ * \sa setNotificationInterval()
+ */
+
+/*!
+ * \fn QsrMailTransport::idle()
+ *
+ * Is emitted in keep-alive mode when all queued messages have been processed
+ * and the session is kept open for further messages. Messages queued with
+ * queueMessage() from now on are delivered right away using the established
+ * session.
+ *
+ * \sa setKeepAlive()
  */
 
 /*!
  * \fn QsrMailTransport::finished()
  *
  * Is emitted when all messages have been processed and the connection to the
- * server has been closed. This marks the end of the delivery process.
+ * server has been closed. This marks the end of the delivery process. In
+ * keep-alive mode the signal is delayed until the session is closed.
  */
 
 /*!
@@ -193,10 +223,12 @@
  *      "Resolving" -> "Resolved" [color="orange" label="DNS\nresolved"];
  *      "Resolved" -> "Disconnected" [color="crimson" label="Resolver\nfailed"];
  *      "Resolved" -> "Connecting" [color="orange" label="Connect\nresolved IP"];
+ *      "Resolved" -> "Resolving" [color="orange" label="Resolver failed\n(next server)"];
  *      "Connecting" -> "Disconnected" [color="crimson" label="Can't\nconnect"];
  *      "Connecting" -> "Connected" [color="orange" label="Connection\nestablished"];
  *      "Connected" -> "Banner" [color="orange" label="Wait for\nserver banner"];
  *      "Banner" -> "SessionInit" [color="orange" label="EHLO"];
+ *      "Banner" -> "EncryptedSessionInit" [color="darkgreen" label="EHLO\n(implicit TLS)"];
  *      "SessionInit" -> "SessionSetup" [color="orange" label="HELO\n(fallback)"]
  *      "SessionInit" -> "TlsSetup" [color="darkgreen" label="STARTTLS"];
  *      "SessionInit" -> "Closing" [color="crimson" label="QUIT\n(TLS required)"]
@@ -211,16 +243,25 @@
  *      "SessionSetup" -> "ReadyToSend" [color="dodgerblue" label="No authentication\nrequested"];
  *      "Auth" -> "ReadyToSend" [color="dodgerblue" label="Challenge\nResponse"];
  *      "ReadyToSend" -> "Closing" [color="dodgerblue" label="QUIT\n(queue empty)"]
+ *      "ReadyToSend" -> "KeepAlive" [color="dodgerblue" label="Keep session\n(queue empty)"]
+ *      "KeepAlive" -> "Noop" [color="dodgerblue" label="NOOP\n(heartbeat)"]
+ *      "Noop" -> "KeepAlive" [color="dodgerblue"]
+ *      "KeepAlive" -> "ReadyToSend" [color="dodgerblue" label="Message\nqueued"]
+ *      "KeepAlive" -> "Closing" [color="dodgerblue" label="QUIT\n(idle timeout)"]
  *      "ReadyToSend" -> "MailFrom" [color="dodgerblue" label="MAIL FROM"];
+ *      "ReadyToSend" -> "MailFrom" [color="dodgerblue" label="MAIL FROM\nRCPT TO\nDATA\n(pipelined)"];
  *      "MailFrom" -> "RcptTo" [color="dodgerblue" label="RCPT TO"];
  *      "RcptTo" -> "RcptTo" [color="dodgerblue" label="RCPT TO\n(multiple)"];
  *      "RcptTo" -> "Data" [color="dodgerblue" label="DATA"];
+ *      "RcptTo" -> "Bdat" [color="dodgerblue" label="Send message\n(chunking)"];
+ *      "Bdat" -> "ReadyToSend" [color="dodgerblue" label="BDAT LAST\nFinalize\nmessage"];
  *      "Data" -> "EndOfMessage" [color="dodgerblue" label="Send message"];
  *      "EndOfMessage" -> "DataSent" [color="dodgerblue" label="Send EOM"];
  *      "EndOfMessage" -> "Disconnected" [color="crimson" label="Renderer\nerror"];
  *      "DataSent" -> "ReadyToSend" [color="dodgerblue" label="Finalize\nmessage"];
  *      "Closing" -> "Disconnected" [color="dodgerblue" label="Disconnect\nfrom host"];
  *      "Disconnected" -> "Connecting" [color="orange" label="Reconnect\n(More messages)"];
+ *      "Disconnected" -> "Resolving" [color="orange" label="Can't connect\n(next server)"];
  *      "Disconnected" -> "Finished" [color="dodgerblue" label="Finalize\nqueue"];
  * }
  * \enddot
@@ -242,8 +283,9 @@
  * The FSM is idle and has not yet been started.
  *
  * \var QsrMailTransportPrivate::ResolvingState
- * Start the resolver and lookup the serverHostname, respecting the selected
- * serverProtocol.
+ * Lookup the serverHostname, respecting the selected serverProtocol. If the
+ * addresses are in the QsrMailResolver cache the FSM continues with
+ * ConnectingState right away, otherwise the resolver is started.
  *
  * \var QsrMailTransportPrivate::ResolvedState
  * The resolver has finished. Now check the result and start connecting the
@@ -251,14 +293,19 @@
  *
  * \var QsrMailTransportPrivate::ConnectingState
  * The FSM is connects the server and waits for the connection to be
- * established.
+ * established. If the server has several addresses the connection attempts
+ * are raced: every CONNECTION_ATTEMPT_DELAY msecs (or as soon as an attempt
+ * fails) the next address is tried using an additional socket. The first
+ * socket which connects replaces the socket of the transport.
  *
  * \var QsrMailTransportPrivate::ConnectedState
  * The server has been connected successfully and is now expected to send the
- * banner text.
+ * banner text. With implicit TLS the handshake is started first and the
+ * banner arrives over the encrypted connection.
  *
  * \var QsrMailTransportPrivate::BannerState
- * The banner has been received and the FSM sends the EHLO command.
+ * The banner has been received and the FSM sends the EHLO command. With
+ * implicit TLS the FSM directly continues with EncryptedSessionInitState.
  *
  * \var QsrMailTransportPrivate::SessionInitState
  * Response to the EHLO came back. If the server did not understand we retry
@@ -286,29 +333,38 @@
  * possibly setting up the encryption. The next thing will be to start
  * authentication if it has been requested by the server. For authentication
  * the FSM sends the AUTH command indicating the selected authentication mech
- * and then enters the AuthState. If no authentication is selected the next
- * state is ReadyToSendState.
+ * and then enters the AuthState. PLAIN and LOGIN send their first response
+ * along with the command (RFC4954). If no authentication is selected the
+ * next state is ReadyToSendState.
  *
  * \var QsrMailTransportPrivate::AuthState
  * The server replied to the AUTH command and sent a challenge which is
  * answered using the credentials supplied in username and password according
- * to the selected authentication mech.
+ * to the selected authentication mech. The mech which succeeded is
+ * remembered for the server and used again by later sessions.
  *
  * \var QsrMailTransportPrivate::ReadyToSendState
  * The FSM is now ready to actually send data. A long journey. In this state
  * the FSM issues the MAIL FROM command for the next message in the queue and
- * continues to the MailFromState. If the queue is empty the QUIT command is
- * issued to terminate the connection. The next state is then ClosingState.
+ * continues to the MailFromState. If the server supports PIPELINING the
+ * RCPT TO commands for all recipients and the DATA command are sent along in
+ * the same batch. If the queue is empty the QUIT command is issued to
+ * terminate the connection. The next state is then ClosingState. In
+ * keep-alive mode the FSM enters the KeepAliveState instead.
  *
  * \var QsrMailTransportPrivate::MailFromState
  * The MAIL FROM command has been acknowledged by the server. In this state
  * the FSM issues the RCPT TO command for the first recipient of the current
- * message.
+ * message (or just waits for the response if pipelining).
  *
  * \var QsrMailTransportPrivate::RcptToState
- * The RCPT TO command has been acknowledged. If the message contains more
+ * The server responded to a RCPT TO command and the response is recorded as
+ * the recipients status in the transaction. If the message contains more
  * recipient the FSM sends the next RCPT TO command and stays in this state.
- * When all receipients have been processed the next state is DataState.
+ * When all receipients have been processed the next state is DataState. If
+ * the server did not accept any recipient the message is rejected.
+ *
+ * If the server supports CHUNKING the next state is BdatState instead.
  *
  * \var QsrMailTransportPrivate::DataState
  * This installs a QsrMailRenderer which renders the complete mail body and
@@ -319,10 +375,29 @@
  * The message has been written to the server - now write the CRLF.CRLF
  * makrer to terminate the message.
  *
+ * \var QsrMailTransportPrivate::BdatState
+ * The message is transferred using the BDAT command (RFC3030). Every chunk
+ * the renderer provides is sent as a sized BDAT chunk, thus no dot-stuffing
+ * is applied. Without PIPELINING the FSM waits for the response of each
+ * chunk before the next chunk is sent. After the renderer finished the
+ * BDAT 0 LAST command completes the message and the next state is
+ * ReadyToSendState.
+ *
  * \var QsrMailTransportPrivate::DataSentState
  * The server acknowledged the data transfer with it's queue id. The next
  * state is ReadyToSendState and closes the circle.
  *
+ * \var QsrMailTransportPrivate::KeepAliveState
+ * The session is kept open waiting for more messages. Newly queued messages
+ * bring the FSM back to the ReadyToSendState. The heartbeat timer issues a
+ * NOOP command to keep the session alive; when the idle timer expires or
+ * the session is closed explicitly the QUIT command is issued and the next
+ * state is ClosingState.
+ *
+ * \var QsrMailTransportPrivate::NoopState
+ * The server replied to the heartbeat NOOP command. The FSM returns to the
+ * KeepAliveState.
+ *
  * \var QsrMailTransportPrivate::ClosingState
  * The server acknowledged the QUIT command. The FSM issues the disconnection
  * of the host since the protocol has been shut down.
@@ -331,7 +406,9 @@
  * This state is entered when the socket detected a disconnection from the
  * server either willingly or unwillingly. The FSM then finalizes the remaining
  * messages in the queue and sets error states where required. The next state
- * is FinishedState.
+ * is FinishedState. If the session failed before it was ready to send and
+ * fallback servers are left, the FSM continues with the next server in
+ * ResolvingState instead.
  *
  * \var QsrMailTransportPrivate::FinishedState
  * This is the ending state and emits the finished() signal.
@@ -347,11 +424,13 @@
 /*!
  * \internal
  *
- * \var QsrMailTransportPrivate::SmtpResponse::line
- * The last valid line received from the server (without it's status code)
+ * \var QsrMailTransportPrivate::SmtpResponse::text
+ * The text of all the lines of the response (sans status code), separated
+ * by LF characters. The memory is reused for the following responses.
  *
- * \var QsrMailTransportPrivate::SmtpResponse::lines
- * All the lines of the response (sans status code)
+ * \var QsrMailTransportPrivate::SmtpResponse::lineOffset
+ * The position of the last valid line received from the server within
+ * *text*, see line().
  *
  * \var QsrMailTransportPrivate::SmtpResponse::code
  * The status code of the response. Valid after the first response line has
@@ -387,16 +466,199 @@
 #include "qsrmailtransport_p.h"
 
 #include "qsrmailmessage_p.h"
+#include "qsrmailenvelope.h"
+#include "qsrmailrfctools_p.h"
+#include "qsrmailresolver_p.h"
+#include "qsrmailrenderpipe_p.h"
+#include "qsrmailstatistics.h"
+#include "qsrmailspool_p.h"
+#include "qsrmailrenderedmessage_p.h"
+#include "qsrmailaddress.h"
 
 #include <QStringBuilder>
 #include <QSslConfiguration>
 #include <QCryptographicHash>
+#include <QDateTime>
 #include <QHostInfo>
-#include <QDnsLookup>
+#include <QMutex>
 #include <QUuid>
 
+#include <limits>
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <errno.h>
+#endif
+
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
 QT_BEGIN_NAMESPACE
 
+/* delay between connection attempts to the addresses of a server, in msecs
+ * (RFC8305 recommends 250ms)
+ */
+#define CONNECTION_ATTEMPT_DELAY 250
+
+/* initial size of the buffer for the responses of the server */
+#define READ_BUFFER_SIZE 4096
+
+/* maximum number of segments gathered into a single write */
+#define MAX_WRITE_SEGMENTS 64
+
+/* upper bound of the data buffered by the socket during a transfer */
+#define MAX_WRITE_WINDOW (4 * 1024 * 1024)
+
+/* maximum number of servers kept in the tls session cache */
+#define MAX_TLS_SESSIONS 256
+
+/* delay before a transport tries again to get a connection to a server
+ * whose connection limit is reached, in msecs
+ */
+#define CONNECTION_WAIT_DELAY 1000
+
+/* the rates of a throttling server are halved down to this fraction and
+ * recover by THROTTLE_RECOVERY with every delivered message
+ */
+#define MIN_THROTTLE_FACTOR 0.0625
+#define THROTTLE_RECOVERY 0.05
+
+/*!
+ * \internal
+ *
+ * Returns true if *data* consists of 7bit characters only.
+ */
+static inline bool isAscii(const QByteArray &data)
+{
+    for (int i=0, size=data.size(); i<size; ++i) {
+        if (uchar(data.at(i)) >= 0x80)
+            return false;
+    }
+    return true;
+}
+
+/* process wide cache of the tls session tickets of servers */
+struct QsrMailTlsSessionCache
+{
+    QMutex mutex;
+    QHash<QString, QByteArray> tickets;
+};
+
+Q_GLOBAL_STATIC(QsrMailTlsSessionCache, tlsSessionCache)
+
+/* process wide state of the circuit breakers of servers */
+struct QsrMailBreakerCache
+{
+    struct Entry
+    {
+        Entry() :
+            failures(0),
+            openUntil(0)
+        {}
+
+        int failures;
+        qint64 openUntil;
+    };
+
+    QMutex mutex;
+    QHash<QString, Entry> entries;
+};
+
+Q_GLOBAL_STATIC(QsrMailBreakerCache, breakerCache)
+
+/* process wide pacing state of servers */
+struct QsrMailThrottleCache
+{
+    struct Entry
+    {
+        Entry() :
+            messageTokens(0),
+            recipientTokens(0),
+            updated(0),
+            factor(1.0),
+            connections(0)
+        {}
+
+        double messageTokens;
+        double recipientTokens;
+        qint64 updated;
+        double factor;
+        int connections;
+    };
+
+    QMutex mutex;
+    QHash<QString, Entry> entries;
+};
+
+Q_GLOBAL_STATIC(QsrMailThrottleCache, throttleCache)
+
+/*!
+ * \internal
+ *
+ * Refill the token buckets of *entry* for the time passed until *now*.
+ * A bucket holds the tokens of one second, but at least one, so a
+ * transport may send a burst after being idle. The rates are scaled by
+ * the throttle factor of the server.
+ */
+static void refillBuckets(QsrMailThrottleCache::Entry &entry,
+                          double messageRate, double recipientRate,
+                          qint64 now)
+{
+    double messages = messageRate * entry.factor;
+    double recipients = recipientRate * entry.factor;
+
+    if (entry.updated == 0) {
+        entry.messageTokens = qMax(messages, 1.0);
+        entry.recipientTokens = qMax(recipients, 1.0);
+    } else if (now > entry.updated) {
+        double secs = (now - entry.updated) / 1000.0;
+        entry.messageTokens = qMin(entry.messageTokens + secs * messages,
+                                   qMax(messages, 1.0));
+        entry.recipientTokens = qMin(entry.recipientTokens
+                                     + secs * recipients,
+                                     qMax(recipients, 1.0));
+    }
+
+    entry.updated = now;
+}
+
+/* process wide cache of the authentication mechs which worked for servers */
+struct QsrMailAuthMechCache
+{
+    QMutex mutex;
+    QHash<QString, QsrMailTransport::AuthMech> mechs;
+};
+
+Q_GLOBAL_STATIC(QsrMailAuthMechCache, authMechCache)
+
+/*!
+ * \internal
+ *
+ * Returns the SASL name of the authentication *mech*.
+ */
+static QByteArray authMechName(QsrMailTransport::AuthMech mech)
+{
+    switch (mech) {
+    case QsrMailTransport::CramMd5Mech:
+        return "CRAM-MD5";
+    case QsrMailTransport::LoginMech:
+        return "LOGIN";
+    case QsrMailTransport::PlainMech:
+        return "PLAIN";
+    case QsrMailTransport::AutoSelectMech:
+    case QsrMailTransport::DisabledMech:
+        break;
+    }
+
+    return QByteArray();
+}
+
 /*!
  * \internal
  *
@@ -405,26 +667,101 @@ QT_BEGIN_NAMESPACE
 QsrMailTransportPrivate::QsrMailTransportPrivate(QsrMailTransport *qq) :
     q_ptr(qq),
     timer(0),
+    idleTimer(0),
+    heartbeatTimer(0),
+    raceTimer(0),
+    retryTimer(0),
+    notifyTimer(0),
+    paceTimer(0),
     socket(0),
+    raceIndex(0),
+    sessionResumed(false),
     state(IdleState),
     interrupted(false),
     aborted(false),
     reachedRTS(false),
+    closeRequested(false),
     authenticated(false),
+    pipelined(false),
     crlfState(0),
+    skipResponses(0),
+    readPos(0),
     hasStartTls(false),
     hasAuth(false),
+    hasPipelining(false),
+    hasChunking(false),
+    hasBinaryMime(false),
+    hasEightBitMime(false),
+    hasSmtpUtf8(false),
+    hasSize(false),
+    maxMessageSize(0),
     selectedAuthMech(QsrMailTransport::DisabledMech),
     totalMessages(0),
     processedMessages(0),
+    progressTransaction(0),
+    progressProcessed(0),
+    progressTotal(0),
+    rcptNext(0),
+    rcptIndex(0),
+    acceptedRcpts(0),
+    chunked(false),
+    binaryMime(false),
+    eightBitBody(false),
+    utf8Envelope(false),
+    messageSize(-1),
+    bdatPending(0),
+    bdatLast(false),
     waitingRenderer(0),
+    bufferPool(RINGBUFFER_SIZE, 2),
+    rttStart(0),
+    rtt(0),
+    windowBytes(0),
+    writeWindow(0),
+    corked(false),
+    sendFileTransaction(0),
+    sendFilePos(0),
+    sendFileStuffing(0),
+    sendFileWaiting(false),
+    sessionMessages(0),
+    phaseStart(0),
+    tlsStart(0),
+    authStart(0),
+    transactionStart(0),
+    dataStart(0),
+    traceData(false),
+    spoolWindow(16),
+    spoolRemaining(0),
+    spoolStopped(false),
+    current(0),
     authMech(QsrMailTransport::AutoSelectMech),
     systemIdentifier("localhost"),
     timeout(6000),
+    connectTimeout(0),
+    dataTimeout(0),
     serverProtocol(QAbstractSocket::AnyIPProtocol),
     serverPort(25),
-    tlsLevel(QsrMailTransport::TlsOptional)
+    tlsLevel(QsrMailTransport::TlsOptional),
+    keepAlive(false),
+    idleTimeout(60000),
+    heartbeatInterval(0),
+    maxAttempts(1),
+    retryInterval(60000),
+    maxRetryInterval(3600000),
+    breakerThreshold(0),
+    breakerTimeout(300000),
+    threadedRendering(false),
+    prefetchDepth(0),
+    lowWatermark(0),
+    highWatermark(0),
+    notifyInterval(0),
+    messageRate(0),
+    recipientRate(0),
+    maxServerConnections(0)
 {
+    /* reserved buffers keep their memory when they are cleared */
+    readBuffer.reserve(READ_BUFFER_SIZE);
+    response.text.reserve(READ_BUFFER_SIZE);
+    response.reset();
 }
 
 /*!
@@ -459,12 +796,62 @@ void QsrMailTransportPrivate::_q_socketReadyRead()
 {
     Q_Q(QsrMailTransport);
 
-    while (socket->canReadLine()) {
-        /* read the line and add it to the result object */
-        QByteArray data(socket->readLine());
-        response.append(data);
+    /* append the received data to the read buffer */
+    qint64 available = socket->bytesAvailable();
+    if (available <= 0)
+        return;
+
+    int size = readBuffer.size();
+    readBuffer.resize(size + static_cast<int>(available));
+    qint64 got = socket->read(readBuffer.data() + size, available);
+    readBuffer.resize(size + static_cast<int>(qMax(Q_INT64_C(0), got)));
+
+    /* parse the complete lines in place; the FSM resets the buffer when
+     * the connection changes, which ends the loop
+     */
+    while (readPos < readBuffer.size()) {
+        const char *begin = readBuffer.constData() + readPos;
+        const char *end = static_cast<const char *>(
+                    memchr(begin, '\n', readBuffer.size() - readPos));
+        if (end == 0)
+            break;
+
+        readPos += static_cast<int>(end - begin) + 1;
+        bool parsed = response.append(begin, static_cast<int>(end - begin));
+
+        int lineSize = static_cast<int>(end - begin);
+        if (lineSize > 0 && begin[lineSize-1] == '\r')
+            lineSize--;
+
+        if (!trace.isNull())
+            trace->record(QsrMailTraceRing::ServerDirection, begin, lineSize);
+
+        /* a line which is not a reply leaves the session out of sync */
+        if (!parsed) {
+            protocolError(QByteArray(begin, lineSize));
+            return;
+        }
 
         if (response.isValid) {
+            statistics.addReply(response.code);
+
+            /* the quickest answer to a command is the round trip time */
+            if (rttStart != 0) {
+                qint64 sample = QsrMailTransactionPrivate::now() - rttStart;
+                if (rtt == 0 || sample < rtt)
+                    rtt = qMax(sample, Q_INT64_C(1));
+                rttStart = 0;
+            }
+
+            /* responses to pipelined commands of a failed transaction are
+             * of no interest - drop them without bothering the FSM
+             */
+            if (skipResponses > 0) {
+                skipResponses--;
+                response.reset();
+                continue;
+            }
+
             /* response is complete - run the FSM within the event */
             QMetaObject::invokeMethod(q, "_q_processStates",
                                       Qt::DirectConnection);
@@ -473,6 +860,12 @@ void QsrMailTransportPrivate::_q_socketReadyRead()
             response.reset();
         }
     }
+
+    /* keep a partial line for the next round */
+    if (readPos > 0) {
+        readBuffer.remove(0, readPos);
+        readPos = 0;
+    }
 }
 
 /*!
@@ -480,6 +873,7 @@ void QsrMailTransportPrivate::_q_socketReadyRead()
  *
  * Is connected to the active renderer and called everytime the renderer
  * has data available. The data is consumed if the buffer has space available.
+ * Lines starting with a "." are escaped using the QsrMailDotStuffer.
  * When the buffer is full *waitForBytesWritten* is set to enforce
  * _q_bytesWritten() to call this method when the socket flushed some data and
  * thus there is now space in the buffer. This is not very elegant, but
@@ -510,9 +904,12 @@ void QsrMailTransportPrivate::_q_writeMessageData()
         r = qobject_cast<QsrMailRenderer *>(q->sender());
 
     /* read all available chunks and put them to the device */
+    qint64 rendered = 0;
     forever {
-        /* don't flood the socket buffer */
-        int maxSize = r->bufferSize();
+        /* don't flood the socket buffer; the window covers the
+         * bandwidth-delay product of the connection once it is known
+         */
+        int maxSize = qMax(r->bufferSize(), writeWindow);
 
         if (socket->isEncrypted())
             maxSize -= socket->encryptedBytesToWrite();
@@ -525,35 +922,120 @@ void QsrMailTransportPrivate::_q_writeMessageData()
             break;
         }
 
-        /* check for data */
-        int size = r->bytesAvailable();
-        if (size <= 0)
+        /* check for data; once the ringbuffer of the renderer wrapped
+         * around the data comes in two segments which are written at once
+         */
+        const char *data[2] = { 0, 0 };
+        int sizes[2] = { 0, 0 };
+        int parts = r->dataSegments(data, sizes);
+        if (parts <= 0)
             break;
 
         /* make sure maxSize is not exceeded */
-        if (size > maxSize)
-            size = maxSize;
-
-        /* detect CRLF at end of buffer */
-        const char *data = r->dataPointer();
-        if (size == 1) {
-            if (crlfState == 1 && *data == 10)
-                crlfState = 2;
-            else if (*data == 13)
-                crlfState = 1;
-            else
-                crlfState = 0;
-        } else {
-            if (*(data+size-2) == 13 && *(data+size-1) == 10)
-                crlfState = 2;
-            else if (*(data+size-1) == 13)
-                crlfState = 1;
-            else
-                crlfState = 0;
+        int size = 0;
+        for (int i=0; i<parts; ++i) {
+            sizes[i] = qMin(sizes[i], maxSize - size);
+            size += sizes[i];
         }
+        if (sizes[parts-1] == 0)
+            parts--;
+
+        /* BDAT transfers the chunk as is; without PIPELINING we have to
+         * wait for the response to the previous chunk
+         */
+        if (chunked) {
+            if (bdatPending > 0 && !hasPipelining) {
+                waitingRenderer = r;
+                break;
+            }
+
+            QByteArray command("BDAT " % QByteArray::number(size) % "\r\n");
+            if (!trace.isNull() && !traceData) {
+                /* only the first chunk, the rest would flood the trace */
+                traceData = true;
+                trace->record(QsrMailTraceRing::ClientDirection,
+                              command.constData(), command.size() - 2);
+            }
+            Segment segments[3] = {
+                { command.constData(), command.size() },
+                { data[0], sizes[0] },
+                { data[1], sizes[1] }
+            };
+            writeSegments(segments, parts + 1);
+            bdatPending++;
+
+            r->advanceDataPointer(size);
+            rendered += size;
+            continue;
+        }
+
+        /* write the data with transparency applied; the spans are
+         * taken directly from the renderer buffer and gathered into as
+         * few writes as possible
+         */
+        Segment segments[MAX_WRITE_SEGMENTS];
+        int count = 0;
+
+        /* the trace keeps the beginning of the message data */
+        if (!trace.isNull() && !traceData) {
+            traceData = true;
+            trace->record(QsrMailTraceRing::ClientDirection,
+                          data[0], sizes[0]);
+        }
+
+        for (int i=0; i<parts; ++i) {
+            const char *part = data[i];
+            const int partSize = sizes[i];
+
+            /* detect CRLF at end of buffer */
+            if (partSize == 1) {
+                if (crlfState == 1 && *part == 10)
+                    crlfState = 2;
+                else if (*part == 13)
+                    crlfState = 1;
+                else
+                    crlfState = 0;
+            } else {
+                if (*(part+partSize-2) == 13 && *(part+partSize-1) == 10)
+                    crlfState = 2;
+                else if (*(part+partSize-1) == 13)
+                    crlfState = 1;
+                else
+                    crlfState = 0;
+            }
+
+            for (int pos=0; pos<partSize; ) {
+                bool stuff;
+                int span = dotStuffer.scan(part + pos, partSize - pos,
+                                           &stuff);
+
+                if (count > MAX_WRITE_SEGMENTS - 2) {
+                    writeSegments(segments, count);
+                    count = 0;
+                }
+
+                if (span > 0) {
+                    segments[count].data = part + pos;
+                    segments[count++].size = span;
+                }
+                if (stuff) {
+                    segments[count].data = ".";
+                    segments[count++].size = 1;
+                }
+
+                pos += span;
+            }
+        }
+
+        writeSegments(segments, count);
 
-        socket->write(data, size);
         r->advanceDataPointer(size);
+        rendered += size;
+    }
+
+    if (rendered > 0) {
+        statistics.add(QsrMailStatisticsCounters::BytesRendered, rendered);
+        windowBytes += rendered;
     }
 }
 
@@ -570,13 +1052,14 @@ void QsrMailTransportPrivate::_q_encryptedBytesWritten(qint64 size)
 {
     Q_UNUSED(size)
 
-    /* retrigger the timer to avoid timeouts */
-    if (timer->isActive())
-        timer->start();
+    /* extend the deadline to avoid timeouts */
+    timer->touch();
 
     /* call writeMessageData if we have a renderer waiting to free up space */
     if (waitingRenderer != 0)
         _q_writeMessageData();
+    else if (sendFileWaiting)
+        sendFileData();
 }
 
 /*!
@@ -602,28 +1085,39 @@ void QsrMailTransportPrivate::_q_bytesWritten(qint64 size)
 /*!
  * \internal
  *
- * Is connected to the active renderer and is triggered everytime the renderer
- * processed a chunk of data (that is for example a mime part or headers, etc).
+ * Is connected to the active renderer and is triggered everytime data of
+ * the renderer has been written to the socket. *processed* is the number of
+ * bytes written so far, *total* the size of the message or -1 if unknown.
  *
- * The method triggers first the QsrMailTransaction::progressUpdate() event
- * to reflect the current messages progress and then triggers
- * QsrMailTransport::progressUpdate() to reflect the overall progress of
- * delivery.
+ * The method triggers first the QsrMailTransaction::transferProgress() and
+ * QsrMailTransaction::progressUpdate() events to reflect the current
+ * messages progress and then triggers QsrMailTransport::progressUpdate() to
+ * reflect the overall progress of delivery. The percent signals are only
+ * emitted if the percentage actually changed. With a notification interval
+ * the progress is only recorded and emitted by flushNotifications().
  */
-void QsrMailTransportPrivate::_q_messageProgress(int processed, int total)
+void QsrMailTransportPrivate::_q_messageProgress(qint64 processed,
+                                                 qint64 total)
 {
     Q_Q(QsrMailTransport);
 
-    /* calculate the percentage; make sure it does not exceed 100% */
-    int percent = processed * 100 / total;
-    if (percent > 100)
-        percent = 100;
+    if (notifyInterval > 0) {
+        queue.head()->timing.bytesSent = processed;
+        progressTransaction = queue.head();
+        progressProcessed = processed;
+        progressTotal = total;
+        scheduleNotification();
+        return;
+    }
 
     /* update transaction's progress */
-    queue.head()->setProgress(percent);
+    int percent = queue.head()->progress;
+    if (queue.head()->setProgress(processed, total) == percent)
+        return;
 
     /* update overall progress to reflect the current transaction */
-    percent = (processedMessages * 100 + percent) / totalMessages;
+    percent = (processedMessages * 100 + queue.head()->progress)
+            / totalMessages;
     emit q->progressUpdate(percent > 100 ? 100 : percent);
 }
 
@@ -632,7 +1126,9 @@ void QsrMailTransportPrivate::_q_messageProgress(int processed, int total)
  *
  * Is connected to every transaction and ensures that, when the transaction
  * is finished, the transactionFinished() signal fires, followed by
- * progressUpdate() to reflect the completed message.
+ * progressUpdate() to reflect the completed message. With a notification
+ * interval the transaction is added to the batch of the next
+ * transactionsFinished() signal instead.
  */
 void QsrMailTransportPrivate::_q_transactionFinished()
 {
@@ -640,14 +1136,44 @@ void QsrMailTransportPrivate::_q_transactionFinished()
 
     /* fetch the transaction which trigger the event */
     QsrMailTransaction *t = qobject_cast<QsrMailTransaction *>(q->sender());
-    const QsrMailTransactionPrivate *p = t->d_func();
+    QsrMailTransactionPrivate *p = t->d_func();
 
     /* disconnect signals */
     p->renderer->disconnect(q);
     t->disconnect(q);
 
-    /* abort renderer */
+    /* abort renderer and recycle its buffer */
     p->renderer->abort();
+    p->renderer->releaseBuffer();
+
+    /* the data of a spooled message is not needed anymore */
+    if (p->spoolKey >= 0)
+        returnToSpool(p, true);
+
+    /* keep the trace which led to the failure */
+    if (!trace.isNull() && p->error != QsrMailTransaction::NoError)
+        p->protocolTrace = trace->dump();
+
+    /* count the outcome before anyone gets to see the transaction */
+    statistics.addFailure(p->error);
+    statistics.add(QsrMailStatisticsCounters::QueueDepth, -1);
+    if (p->timing.dataTime > 0)
+        statistics.add(QsrMailStatisticsCounters::RenderTime,
+                       p->timing.dataTime);
+
+    /* collect the transaction for the next batch */
+    if (notifyInterval > 0) {
+        /* the recorded progress of the transaction is its last one */
+        if (progressTransaction == p) {
+            p->setProgress(progressProcessed, progressTotal);
+            progressTransaction = 0;
+        }
+
+        ++processedMessages;
+        finishedBatch.append(t);
+        scheduleNotification();
+        return;
+    }
 
     /* relay the event */
     emit q->transactionFinished(t);
@@ -672,7 +1198,173 @@ void QsrMailTransportPrivate::_q_timeout()
      * UnconnectedState on the socket.
      */
     interrupted = true;
-    socket->disconnectFromHost();
+    if (!stopRace())
+        socket->disconnectFromHost();
+}
+
+/*!
+ * \internal
+ *
+ * The current connection attempts did not succeed in time - start the
+ * attempt with the next address.
+ */
+void QsrMailTransportPrivate::_q_raceTimeout()
+{
+    if (!racers.isEmpty() && raceIndex < serverAddresses.size())
+        startRacer();
+}
+
+/*!
+ * \internal
+ *
+ * The state of one of the racing sockets changed. The first socket which
+ * connects becomes the socket of the transport and all other attempts are
+ * cancelled. Failed attempts are replaced by the attempt with the next
+ * address. If all attempts failed the FSM continues with
+ * DisconnectedState.
+ */
+void QsrMailTransportPrivate::_q_racerStateChanged(
+        QAbstractSocket::SocketState socketState)
+{
+    Q_Q(QsrMailTransport);
+
+    QSslSocket *racer = qobject_cast<QSslSocket *>(q->sender());
+    if (!racers.contains(racer))
+        return;
+
+    if (socketState == QAbstractSocket::ConnectedState) {
+        /* we have a winner */
+        racers.removeOne(racer);
+        cancelRacers();
+
+        racer->disconnect(q);
+        racer->setSslConfiguration(socket->sslConfiguration());
+        setupSocket(racer);
+
+        socket->disconnect(q);
+        socket->deleteLater();
+        socket = racer;
+        serverAddress = socket->peerAddress();
+
+        _q_stateChanged(QAbstractSocket::ConnectedState);
+    } else if (socketState == QAbstractSocket::UnconnectedState) {
+        /* the attempt failed - continue with the next address */
+        connectError = racer->errorString();
+        racers.removeOne(racer);
+        racer->disconnect(q);
+        racer->deleteLater();
+
+        if (raceIndex < serverAddresses.size()) {
+            startRacer();
+        } else if (racers.isEmpty()) {
+            raceTimer->stop();
+            _q_stateChanged(QAbstractSocket::UnconnectedState);
+        }
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Is triggered when the idle timer fires while the session is kept alive.
+ * The session is then closed gracefully.
+ */
+void QsrMailTransportPrivate::_q_idleTimeout()
+{
+    Q_Q(QsrMailTransport);
+    q->closeSession();
+}
+
+/*!
+ * \internal
+ *
+ * Is triggered by the heartbeat timer and sends a NOOP command to the
+ * server so the idle session does not get dropped.
+ */
+void QsrMailTransportPrivate::_q_heartbeat()
+{
+    if (state != KeepAliveState)
+        return;
+
+    timer->start(timeout);
+    write("NOOP");
+    state = NoopState;
+}
+
+/*!
+ * \internal
+ *
+ * Runs the FSM for internal events (queued messages, close requests) of an
+ * idle session. The slot is invoked queued, so the FSM might have left the
+ * KeepAliveState in the meantime; the call is ignored in that case.
+ */
+void QsrMailTransportPrivate::_q_resumeSession()
+{
+    if (state != KeepAliveState)
+        return;
+
+    response.reset();
+    _q_processStates();
+}
+
+/*!
+ * \internal
+ *
+ * Is triggered by the retry timer. Deferred messages which are due are
+ * queued again and delivered by the running session, by the idle
+ * keep-alive session or by a new session.
+ */
+void QsrMailTransportPrivate::_q_retryTimeout()
+{
+    Q_Q(QsrMailTransport);
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    QList<QsrMailTransactionPrivate *>::Iterator it = deferred.begin();
+    while (it != deferred.end()) {
+        if ((*it)->retryTime <= now) {
+            queue.enqueue(*it);
+            it = deferred.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    scheduleRetry();
+
+    if (queue.isEmpty())
+        return;
+
+    if (state == KeepAliveState)
+        QMetaObject::invokeMethod(q, "_q_resumeSession", Qt::QueuedConnection);
+    else if (state == IdleState || state == FinishedState)
+        sendMessagesImpl(serverHostname.isEmpty() ? ConnectingState
+                                                  : ResolvingState);
+}
+
+/*!
+ * \internal
+ *
+ * Is triggered by the notification timer and emits the notifications
+ * collected during the interval.
+ */
+void QsrMailTransportPrivate::_q_notify()
+{
+    flushNotifications();
+}
+
+/*!
+ * \internal
+ *
+ * Is triggered by the pace timer when the rate limits of the server allow
+ * the next message, which resumes the FSM in the ReadyToSendState.
+ */
+void QsrMailTransportPrivate::_q_pace()
+{
+    if (state != ReadyToSendState)
+        return;
+
+    timer->start(timeout);
+    _q_processStates();
 }
 
 /*!
@@ -691,9 +1383,8 @@ void QsrMailTransportPrivate::_q_processStates()
     Q_Q(QsrMailTransport);
     int code = response.code;
 
-    /* Trigger timer so we do not timeout */
-    if (timer->isActive())
-        timer->start();
+    /* Extend the deadline so we do not timeout */
+    timer->touch();
 
     /* The state machine loops until a return statement is executed.
      * The explicit use of return and continue statements is intented
@@ -701,68 +1392,134 @@ void QsrMailTransportPrivate::_q_processStates()
      */
     forever {
         if (state == ResolvingState) {
-            /* Resolve the hostname into a protocol and an address */
-            QDnsLookup::Type type = QDnsLookup::ANY;
-
-            switch (serverProtocol) {
-            case QAbstractSocket::IPv4Protocol:
-                type = QDnsLookup::A;
-                break;
-
-            case QAbstractSocket::IPv6Protocol:
-                type = QDnsLookup::AAAA;
-                break;
+            phaseStart = QsrMailTransactionPrivate::now();
 
-            case QAbstractSocket::AnyIPProtocol:
-            case QAbstractSocket::UnknownNetworkLayerProtocol:
-                break;
+            /* Resolve the hostname - other transports might have done this
+             * already
+             */
+            if (QsrMailResolver::cachedAddresses(serverHostname, serverProtocol,
+                                                 &serverAddresses)) {
+                sessionTiming.resolveTime =
+                        QsrMailTransactionPrivate::now() - phaseStart;
+                serverAddress = serverAddresses.first();
+                state = ConnectingState;
+                continue;
             }
 
-            QDnsLookup *resolver = new QDnsLookup(type, serverHostname, q);
-            q->connect(resolver, SIGNAL(finished()),
-                       q, SLOT(_q_processStates()));
-            q->connect(resolver, SIGNAL(finished()),
-                       resolver, SLOT(deleteLater()));
-
             /*
-             * The resolver finished slot will trigger the fsm again, after
+             * The resolver finished signal will trigger the fsm again, after
              * which the next state will be ResolvedState
              */
+            QsrMailResolver *resolver =
+                    QsrMailResolver::lookup(serverHostname, serverProtocol);
+            q->connect(resolver, SIGNAL(finished()),
+                       q, SLOT(_q_processStates()));
+
             state = ResolvedState;
-            resolver->lookup();
             return;
         } else if (state == ResolvedState) {
             /* Resolver returned a result - cast the event object */
-            QDnsLookup *resolver = qobject_cast<QDnsLookup *>(q->sender());
+            QsrMailResolver *resolver =
+                    qobject_cast<QsrMailResolver *>(q->sender());
             Q_ASSERT(resolver != 0);
 
-            /* On error flush the queue */
-            if (resolver->error() != QDnsLookup::NoError) {
+            resolver->disconnect(q);
+            serverAddresses = resolver->addresses();
+
+            /* On error try the next server or flush the queue */
+            if (serverAddresses.isEmpty()) {
+                if (nextServer()) {
+                    state = ResolvingState;
+                    continue;
+                }
+
                 finalizeQueue(QsrMailTransaction::ResolverError,
                               resolver->errorString());
+                timer->stop();
+                releaseConnection();
                 state = IdleState;
+                flushNotifications();
+                emit q->finished();
                 return;
             }
 
-            /* Select a random address for connection */
-            const QList<QDnsHostAddressRecord> records(resolver->hostAddressRecords());
-            serverAddress = records.at(qrand() % records.size()).value();
+            sessionTiming.resolveTime =
+                    QsrMailTransactionPrivate::now() - phaseStart;
+            serverAddress = serverAddresses.first();
             state = ConnectingState;
             continue;
         } else if (state == ConnectingState) {
+            connectError.clear();
+            phaseStart = QsrMailTransactionPrivate::now();
+
             /* Connect to the server stored in serverAddress */
-            socket->connectToHost(serverAddress, serverPort);
+            if (serverAddresses.size() < 2) {
+                socket->connectToHost(serverAddress, serverPort);
+
+                /* The state variable will be advanced by _q_stateChanged() */
+                return;
+            }
+
+            /* Race the addresses of the server (happy eyeballs, RFC8305):
+             * the next address is tried if the current attempts did not
+             * succeed within CONNECTION_ATTEMPT_DELAY; the first
+             * connection wins.
+             */
+            raceIndex = 0;
+            startRacer();
 
-            /* The state variable will be advanced by _q_stateChanged() */
+            /* The state variable will be advanced by _q_racerStateChanged() */
             return;
         } else if (state == ConnectedState) {
             /* Connection is established; reset states and wait for
              * the banner
              */
             authenticated = false;
+            pipelined = false;
+            skipResponses = 0;
+            rttStart = 0;
+            rtt = 0;
+            windowBytes = 0;
+            writeWindow = 0;
+            corked = false;
+            readBuffer.resize(0);
+            timer->start(timeout);
+            readPos = 0;
+
+            if (!trace.isNull()) {
+                trace->record(QsrMailTraceRing::EventDirection,
+                              "connected to "
+                              % socket->peerAddress().toString().toLatin1()
+                              % " port " % QByteArray::number(serverPort));
+            }
+
+            /* the session phases start over, the lookup is kept */
+            qint64 now = QsrMailTransactionPrivate::now();
+            sessionTiming.connectTime = now - phaseStart;
+            sessionTiming.greetingTime = -1;
+            sessionTiming.tlsTime = -1;
+            sessionTiming.authTime = -1;
+            sessionMessages = 0;
+            phaseStart = now;
+
+            /* With implicit TLS the banner is sent after the handshake */
+            if (tlsLevel == QsrMailTransport::TlsImplicit) {
+                tlsStart = now;
+                offerTlsSession();
+                socket->startClientEncryption();
+            }
 
             state = BannerState;
             return;
+        } else if (state == BannerState && code == 220
+                   && tlsLevel == QsrMailTransport::TlsImplicit) {
+            /* 220: service ready on the encrypted connection; the
+             * extensions are enumerated once and STARTTLS is skipped
+             */
+            tlsEstablished();
+            write("EHLO " % systemIdentifier);
+            state = EncryptedSessionInitState;
+            return;
         } else if (state == BannerState && code == 220) {
             /* 220: service ready */
             write("EHLO " % systemIdentifier);
@@ -775,17 +1532,21 @@ void QsrMailTransportPrivate::_q_processStates()
             return;
         } else if (state == SessionInitState && code == 250) {
             /* Enumerate the extension */
-            enumExtensions(response.lines);
+            enumExtensions(response.text);
+            sessionTiming.greetingTime =
+                    QsrMailTransactionPrivate::now() - phaseStart;
 
             /* Establish TLS, if required */
             if (tlsLevel == QsrMailTransport::TlsOptional && hasStartTls) {
                 /* Server provides TLS and we MAY use it */
+                tlsStart = QsrMailTransactionPrivate::now();
                 write("STARTTLS");
                 state = TlsSetupState;
                 return;
             } else if (tlsLevel == QsrMailTransport::TlsRequired) {
                 if (hasStartTls) {
                     /* Server provides TLS and we MUST use it */
+                    tlsStart = QsrMailTransactionPrivate::now();
                     write("STARTTLS");
                     state = TlsSetupState;
                     return;
@@ -806,9 +1567,18 @@ void QsrMailTransportPrivate::_q_processStates()
             q->connect(socket, SIGNAL(encrypted()),
                        q, SLOT(_q_processStates()));
 
-            /* Server agreed to TLS so try to set it up */
+            /* Server agreed to TLS so try to set it up, offering the
+             * session of an earlier connection to the server
+             */
+            offerTlsSession();
             socket->startClientEncryption();
 
+            /* Anything received before the handshake has not been
+             * protected and must not be taken as a response
+             */
+            readBuffer.resize(0);
+            readPos = 0;
+
             /* Next is encrypted - failure wil raise ssl error */
             state = EncryptedState;
             return;
@@ -830,6 +1600,8 @@ void QsrMailTransportPrivate::_q_processStates()
             q->disconnect(socket, SIGNAL(encrypted()),
                           q, SLOT(_q_processStates()));
 
+            tlsEstablished();
+
             /* RFC2487 section 4.2 requires to resend EHLO and enumerate the
              * response again (public/private EHLO responses).
              */
@@ -840,19 +1612,21 @@ void QsrMailTransportPrivate::_q_processStates()
                    (state == SessionSetupState && code == 250)) {
             /* Enum extensions again as there was an EHLO after STARTTLS */
             if (state == EncryptedSessionInitState)
-                enumExtensions(response.lines);
+                enumExtensions(response.text);
+
+            /* HELO and implicit TLS sessions end the greeting here */
+            if (sessionTiming.greetingTime < 0) {
+                sessionTiming.greetingTime =
+                        QsrMailTransactionPrivate::now() - phaseStart;
+            }
 
             /* Try authentication... */
             if (selectedAuthMech != QsrMailTransport::DisabledMech
                     && (!username.isEmpty() || !password.isEmpty())) {
-                if (selectedAuthMech == QsrMailTransport::CramMd5Mech)
-                    write("AUTH CRAM-MD5");
-                else if (selectedAuthMech == QsrMailTransport::LoginMech)
-                    write("AUTH LOGIN");
-                else if (selectedAuthMech == QsrMailTransport::PlainMech)
-                    write("AUTH PLAIN");
+                write(authCommand());
 
                 /* Enter authentication state */
+                authStart = QsrMailTransactionPrivate::now();
                 state = AuthState;
                 return;
             }
@@ -862,11 +1636,14 @@ void QsrMailTransportPrivate::_q_processStates()
             continue;
         } else if (state == AuthState && code == 334) {
             /* The server sent a challenge - generate the response */
-            write(authResponse(response.line));
+            write(authResponse(response.line()));
             return;
         } else if (state == AuthState && code == 235) {
             /* AUTH successfull - continue with the messages */
             authenticated = true;
+            saveAuthMech(true);
+            sessionTiming.authTime =
+                    QsrMailTransactionPrivate::now() - authStart;
             state = ReadyToSendState;
             continue;
         } else if (state == ReadyToSendState) {
@@ -876,26 +1653,187 @@ void QsrMailTransportPrivate::_q_processStates()
              */
             reachedRTS = true;
 
-            /* Try to setup a transaction */
-            while (!queue.isEmpty()) {
+            /* Stop sending while the server is throttling us */
+            holdQueue();
+
+            /* Top up the queue with the messages of the spool */
+            fillFromSpool();
+
+            /* Wait until the rate limits of the server allow a message */
+            if (!queue.isEmpty() && isPaced()) {
+                qint64 delay = paceDelay();
+                if (delay > 0) {
+                    timer->stop();
+                    paceTimer->start(static_cast<int>(delay));
+                    return;
+                }
+            }
+
+            /* Try to setup a transaction */
+            while (!queue.isEmpty()) {
                 if (setupTransaction()) {
-                    /* Start the SMTP dialog */
-                    write("MAIL FROM:<" % from % ">");
+                    /* the timing of the message starts with MAIL FROM */
+                    QsrMailTransactionPrivate *t = queue.head();
+                    consumeTokens(rcpts.size());
+                    transactionStart = QsrMailTransactionPrivate::now();
+                    t->timing = sessionTiming;
+                    t->timing.sessionReused = sessionMessages++ > 0;
+                    t->timing.queueTime = transactionStart - t->queuedAt;
+
+                    pipelined = hasPipelining;
+                    rcptIndex = 0;
+                    acceptedRcpts = 0;
+                    bdatPending = 0;
+                    bdatLast = false;
+
+                    QByteArray mailFrom("MAIL FROM:<" % from % ">");
+                    if (binaryMime)
+                        mailFrom += " BODY=BINARYMIME";
+                    else if (eightBitBody)
+                        mailFrom += " BODY=8BITMIME";
+                    if (utf8Envelope)
+                        mailFrom += " SMTPUTF8";
+                    if (messageSize >= 0)
+                        mailFrom += " SIZE=" % QByteArray::number(messageSize);
+
+                    if (pipelined) {
+                        /* RFC2920: send the complete envelope in one batch,
+                         * the responses are matched in order
+                         */
+                        QByteArray batch(mailFrom);
+                        /* 13 bytes per RCPT TO line, 6 for the DATA */
+                        batch.reserve(mailFrom.size() + rcpts.dataSize()
+                                      + rcpts.size() * 13 + 6);
+                        for (; rcptNext < rcpts.size(); ++rcptNext) {
+                            batch += "\r\nRCPT TO:<" % rcpts.at(rcptNext)
+                                    % ">";
+                        }
+                        if (!chunked)
+                            batch += "\r\nDATA";
+
+                        write(batch);
+                    } else {
+                        /* Start the SMTP dialog */
+                        write(mailFrom);
+                    }
+
                     state = MailFromState;
                     return;
                 }
             }
 
-            /* No more transactions left */
+            /* No more transactions left - keep the session if requested */
+            if (keepAlive && !closeRequested) {
+                timer->stop();
+                if (idleTimeout > 0)
+                    idleTimer->start(idleTimeout);
+                if (heartbeatInterval > 0)
+                    heartbeatTimer->start(heartbeatInterval);
+
+                state = KeepAliveState;
+                flushNotifications();
+                emit q->idle();
+                return;
+            }
+
             write("QUIT");
             state = ClosingState;
             return;
-        } else if ((state == MailFromState && code == 250) ||
-                   (state == RcptToState && code == 250)) {
-            /* Send all recipients to the server */
-            if (rcpt != rcpts.constEnd()) {
-                write("RCPT TO:<" % *rcpt++ % ">");
-                state = RcptToState;
+        } else if (state == KeepAliveState && !response.isValid) {
+            /* Messages have been queued - start a new delivery cycle */
+            if (!queue.isEmpty()) {
+                idleTimer->stop();
+                heartbeatTimer->stop();
+
+                totalMessages = queue.size();
+                processedMessages = 0;
+                timer->start(timeout);
+
+                state = ReadyToSendState;
+                continue;
+            }
+
+            /* Session should be closed */
+            if (closeRequested) {
+                idleTimer->stop();
+                heartbeatTimer->stop();
+
+                timer->start(timeout);
+                write("QUIT");
+                state = ClosingState;
+                return;
+            }
+
+            /* Nothing to do - wait for the next event */
+            return;
+        } else if (state == NoopState && code == 250) {
+            /* Heartbeat acknowledged; handle events which arrived meanwhile */
+            timer->stop();
+            state = KeepAliveState;
+
+            if (heartbeatInterval > 0)
+                heartbeatTimer->start(heartbeatInterval);
+            if (!queue.isEmpty() || closeRequested)
+                QMetaObject::invokeMethod(q, "_q_resumeSession",
+                                          Qt::QueuedConnection);
+            return;
+        } else if (state == MailFromState && code == 250) {
+            /* Sender accepted - the pipelined RCPT TO responses follow */
+            state = RcptToState;
+            if (pipelined)
+                return;
+
+            /* Send the first recipient to the server */
+            write("RCPT TO:<" % rcpts.at(rcptNext++) % ">");
+            return;
+        } else if (state == RcptToState) {
+            /* Track the response for the recipient; rejected recipients do
+             * not fail the message as long as one recipient is accepted
+             */
+            queue.head()->setRecipientStatus(rcptIndex++, code,
+                                             response.text);
+            if (code == 250 || code == 251)
+                acceptedRcpts++;
+
+            if (pipelined) {
+                /* Wait for the remaining RCPT TO responses. Unless chunking
+                 * DATA has been sent already; the DataState ends it without
+                 * data if no recipient was accepted.
+                 */
+                if (rcptIndex < rcpts.size())
+                    return;
+
+                queue.head()->timing.envelopeTime =
+                        QsrMailTransactionPrivate::now() - transactionStart;
+                if (!chunked) {
+                    state = DataState;
+                    return;
+                }
+            } else if (rcptNext < rcpts.size()) {
+                /* Send the next recipient to the server */
+                write("RCPT TO:<" % rcpts.at(rcptNext++) % ">");
+                return;
+            } else {
+                queue.head()->timing.envelopeTime =
+                        QsrMailTransactionPrivate::now() - transactionStart;
+            }
+
+            /* All recipients rejected - reject the message */
+            if (acceptedRcpts == 0) {
+                rejectRecipients();
+                return;
+            }
+
+            /* RFC3030: send the message in BDAT chunks; the chunks are
+             * only corked if they don't wait for responses in between
+             */
+            if (chunked) {
+                dataStart = QsrMailTransactionPrivate::now();
+                timer->start(effectiveDataTimeout());
+                windowBytes = 0;
+                setCorked(hasPipelining);
+                startRenderer();
+                state = BdatState;
                 return;
             }
 
@@ -903,30 +1841,47 @@ void QsrMailTransportPrivate::_q_processStates()
             write("DATA");
             state = DataState;
             return;
+        } else if (state == DataState && acceptedRcpts == 0) {
+            /* RFC2920: the server accepted the pipelined DATA although no
+             * recipient was accepted - end it without sending the message
+             */
+            if (code == 354) {
+                write(".");
+                state = DataSentState;
+                return;
+            }
+
+            rejectRecipients();
+            return;
+        } else if (state == DataSentState && acceptedRcpts == 0) {
+            /* The response to the empty data is of no interest */
+            rejectRecipients();
+            return;
         } else if (state == DataState && code == 354) {
             /* Init and start renderer stage */
-            waitingRenderer = 0;
-            QsrMailRenderer *r = queue.head()->renderer;
-            q->connect(r, SIGNAL(readChannelFinished()),
-                       q, SLOT(_q_processStates()));
-            q->connect(r, SIGNAL(error()),
-                       q, SLOT(_q_processStates()));
-            q->connect(r, SIGNAL(readyRead()),
-                       q, SLOT(_q_writeMessageData()));
-            q->connect(r, SIGNAL(progressUpdate(int, int)),
-                       q, SLOT(_q_messageProgress(int, int)));
-            r->renderMessage();
-
+            dataStart = QsrMailTransactionPrivate::now();
+            queue.head()->timing.dataResponseTime =
+                    dataStart - transactionStart;
+            timer->start(effectiveDataTimeout());
             state = EndOfMessageState;
+            windowBytes = 0;
+            setCorked(true);
+            if (!startFileTransfer())
+                startRenderer();
             return;
         } else if (state == EndOfMessageState) {
             /* Check for renderer error */
             QsrMailRenderer *r = queue.head()->renderer;
-            if (!r->lastError().isEmpty()) {
+            QString error = sendFileError.isEmpty() ? r->lastError()
+                                                    : sendFileError;
+            sendFile.reset();
+            sendFileTransaction = 0;
+            sendFileError.clear();
+
+            if (!error.isEmpty()) {
                 /* Finalize transaction with error */
                 QsrMailTransactionPrivate *t = queue.dequeue();
-                t->setError(QsrMailTransaction::DataError,
-                            r->lastError());
+                t->setError(QsrMailTransaction::DataError, error);
                 t->finalize();
 
                 /* The message was broken, but we have no possibility
@@ -937,19 +1892,109 @@ void QsrMailTransportPrivate::_q_processStates()
                 return;
             }
 
-            /* Write end-of-message, prepend CRLF if required */
-            if (crlfState != 2)
-                socket->write("\r\n");
-            socket->write(".\r\n");
+            queue.head()->timing.dataTime =
+                    QsrMailTransactionPrivate::now() - dataStart;
+            updateWriteWindow(queue.head()->timing.dataTime);
+
+            /* Write end-of-message, prepend CRLF if required; it leaves
+             * with the tail of the data
+             */
+            const char *end = crlfState != 2 ? "\r\n.\r\n" : ".\r\n";
+            socket->write(end);
+            statistics.add(QsrMailStatisticsCounters::BytesWritten,
+                           qstrlen(end));
+            setCorked(false);
+            timer->start(timeout);
+
+            if (!trace.isNull()) {
+                trace->record(QsrMailTraceRing::ClientDirection, ".");
+                traceData = false;
+            }
 
             state = DataSentState;
             return;
+        } else if (state == BdatState && response.isValid) {
+            /* The server responded to a BDAT chunk */
+            if (code != 250) {
+                rejectTransaction(queue.dequeue(), response.isTransientError);
+
+                /* responses to chunks already sent are of no interest */
+                waitingRenderer = 0;
+                skipResponses = bdatPending - 1;
+
+                write("RSET");
+                state = ReadyToSendState;
+                return;
+            }
+
+            /* The response to BDAT LAST completes the message */
+            if (--bdatPending == 0 && bdatLast) {
+                QsrMailTransactionPrivate *t = queue.dequeue();
+                t->timing.completionTime =
+                        QsrMailTransactionPrivate::now() - transactionStart;
+                t->setError(QsrMailTransaction::NoError);
+                t->setStatus(code, response.text);
+                t->finalize();
+                updateBreaker(false);
+                updateThrottle(false);
+
+                /* Prepare next message */
+                state = ReadyToSendState;
+                continue;
+            }
+
+            /* Without pipelining the next chunk waits for this response */
+            if (bdatLast) {
+                return;
+            } else if (queue.head()->renderer->atEnd()) {
+                queue.head()->timing.dataTime =
+                        QsrMailTransactionPrivate::now() - dataStart;
+                updateWriteWindow(queue.head()->timing.dataTime);
+                write("BDAT 0 LAST");
+                timer->start(timeout);
+                bdatPending++;
+                bdatLast = true;
+            } else if (waitingRenderer != 0) {
+                _q_writeMessageData();
+            }
+            return;
+        } else if (state == BdatState) {
+            /* Renderer finished - check for error */
+            QsrMailRenderer *r = queue.head()->renderer;
+            if (!r->lastError().isEmpty()) {
+                /* Finalize transaction with error */
+                QsrMailTransactionPrivate *t = queue.dequeue();
+                t->setError(QsrMailTransaction::DataError,
+                            r->lastError());
+                t->finalize();
+
+                /* The chunks written so far cannot be taken back */
+                socket->disconnectFromHost();
+                return;
+            }
+
+            /* Complete the message or wait for the pending response */
+            if (bdatLast || (bdatPending > 0 && !hasPipelining))
+                return;
+
+            queue.head()->timing.dataTime =
+                    QsrMailTransactionPrivate::now() - dataStart;
+            updateWriteWindow(queue.head()->timing.dataTime);
+            write("BDAT 0 LAST");
+            timer->start(timeout);
+            bdatPending++;
+            bdatLast = true;
+            return;
         } else if (state == DataSentState && code == 250) {
             /* Finalize transaction */
             QsrMailTransactionPrivate *t = queue.dequeue();
+            t->timing.completionTime =
+                    QsrMailTransactionPrivate::now() - transactionStart;
             t->setError(QsrMailTransaction::NoError);
-            t->setStatus(code, response.lines);
+            t->setStatus(code, response.text);
             t->finalize();
+            updateBreaker(false);
+            updateThrottle(false);
 
             /* Prepare next message */
             state = ReadyToSendState;
@@ -965,14 +2010,62 @@ void QsrMailTransportPrivate::_q_processStates()
              * and if the queue is not empty. If we didn't reach the RTS State
              * the queue will be flushed with a connection error.
              */
+            idleTimer->stop();
+            heartbeatTimer->stop();
+            paceTimer->stop();
+
+            if (!trace.isNull()) {
+                trace->record(QsrMailTraceRing::EventDirection,
+                              "disconnected: "
+                              % socket->errorString().toLatin1());
+            }
+
+            /* The handshake failed while offering a ticket - forget it */
+            if (!offeredTicket.isEmpty()) {
+                dropTlsSession(offeredTicket);
+                offeredTicket.clear();
+            }
+            sessionResumed = false;
+
+            /* Deferred messages are not retried after an abort */
+            if (aborted && !deferred.isEmpty()) {
+                retryTimer->stop();
+                while (!deferred.isEmpty())
+                    queue.enqueue(deferred.takeFirst());
+            }
+
+            /* The message in transfer is sent again if attempts remain */
+            if (reachedRTS && !aborted && !queue.isEmpty()
+                    && queue.head() == current) {
+                QsrMailTransactionPrivate *t = queue.head();
+                if (t->attempts >= maxAttempts || !t->restartRenderer()) {
+                    queue.dequeue();
+                    t->setError(QsrMailTransaction::ConnectionError,
+                                socket->errorString());
+                    t->finalize();
+                }
+            }
+            current = 0;
+
             if (!queue.isEmpty()) {
-                if (reachedRTS) {
-                    /* We saw RTS at least once - so retry the connect */
-                    timer->start();
+                if (reachedRTS && !aborted) {
+                    /* We saw RTS once - so retry the connect. The next
+                     * connection has to reach RTS again to be retried.
+                     */
+                    reachedRTS = false;
+                    statistics.add(QsrMailStatisticsCounters::Reconnects);
+                    timer->start(effectiveConnectTimeout());
                     state = ConnectingState;
                     continue;
                 }
 
+                /* The server is not usable - try the next one */
+                if (!aborted && nextServer()) {
+                    timer->start(effectiveConnectTimeout());
+                    state = ResolvingState;
+                    continue;
+                }
+
                 /* Make sure the timer has stopped and is not messing around */
                 timer->stop();
 
@@ -986,15 +2079,22 @@ void QsrMailTransportPrivate::_q_processStates()
                 } else {
                     /* error due to some socket or ssl problem */
                     finalizeQueue(QsrMailTransaction::ConnectionError,
-                                  socket->errorString());
+                                  connectError.isEmpty()
+                                  ? socket->errorString() : connectError);
                 }
             }
 
             /* This is it - everything comes to an end */
+            releaseConnection();
             state = FinishedState;
             continue;
         } else if (state == FinishedState) {
+            /* Deferred messages are sent by the retry timer later */
+            if (!deferred.isEmpty())
+                return;
+
             /* FSM is complete */
+            flushNotifications();
             emit q->finished();
             return;
         } else {
@@ -1003,16 +2103,24 @@ void QsrMailTransportPrivate::_q_processStates()
              * protocol - then proceed with the next message.
              */
             if (state >= MailFromState && state <= DataSentState) {
-                QsrMailTransactionPrivate *t = queue.dequeue();
-                t->setStatus(code, response.lines);
-                t->setError(QsrMailTransaction::ResponseError);
-                t->finalize();
+                rejectTransaction(queue.dequeue(), response.isTransientError);
+
+                /* If the sender has been rejected in pipelining mode the
+                 * responses to all RCPT TO commands and to DATA are still
+                 * pending - skip them before processing the RSET response.
+                 */
+                if (pipelined && state == MailFromState)
+                    skipResponses = rcpts.size() + (chunked ? 0 : 1);
 
                 write("RSET");
                 state = ReadyToSendState;
                 return;
             }
 
+            /* A remembered mech which failed is selected again next time */
+            if (state == AuthState)
+                saveAuthMech(false);
+
             /* This is an unrecoverable protocol error so cancel all
              * messages left in the queue with the server response and
              * gracefully close the connection.
@@ -1028,39 +2136,83 @@ void QsrMailTransportPrivate::_q_processStates()
 /*!
  * \internal
  *
- * Enumerate the SMTP extensions available in *lines*. The *lines* array
- * is typically directly obtained from the response object of an EHLO
- * reply. Only extensions are enumerated which are actually used within
+ * Enumerate the SMTP extensions available in *text*. The LF separated
+ * lines of *text* are typically directly obtained from the response object
+ * of an EHLO reply. Only extensions are enumerated which are actually used within
  * the FSM. In particular this is:
  *
  * - STARTTLS which sets the *hasStartTls* flag
  * - AUTH which sets the *hasAuth* flag to indicate the server offers
  *   authentication and also selects the auth mech for authentication
  *   based on the servers advertisment.
+ * - PIPELINING which sets the *hasPipelining* flag and enables sending
+ *   the envelope commands in one batch (RFC2920).
+ * - CHUNKING which sets the *hasChunking* flag and sends the messages using
+ *   BDAT instead of DATA (RFC3030).
+ * - BINARYMIME which sets the *hasBinaryMime* flag and allows to send
+ *   messages with binary encoded parts (RFC3030).
+ * - 8BITMIME which sets the *hasEightBitMime* flag and allows to send
+ *   text parts unencoded (RFC6152).
+ * - SMTPUTF8 which sets the *hasSmtpUtf8* flag and allows to send
+ *   envelope addresses with UTF-8 characters (RFC6531).
+ * - SIZE which sets the *hasSize* flag and the *maxMessageSize* announced
+ *   by the server, which is zero if the server does not impose a limit
+ *   (RFC1870).
  */
-void QsrMailTransportPrivate::enumExtensions(const QList<QByteArray> &lines)
+void QsrMailTransportPrivate::enumExtensions(const QByteArray &text)
 {
     /* reset the states */
     hasStartTls = false;
     hasAuth = false;
+    hasPipelining = false;
+    hasChunking = false;
+    hasBinaryMime = false;
+    hasEightBitMime = false;
+    hasSmtpUtf8 = false;
+    hasSize = false;
+    maxMessageSize = 0;
     selectedAuthMech = QsrMailTransport::DisabledMech;
 
     /* enum states from response lines */
-    for (int i=0, size=lines.size(); i<size; i++) {
-        QList<QByteArray> parts(lines[i].split(' '));
+    foreach (const QByteArray &line, text.split('\n')) {
+        QList<QByteArray> parts(line.split(' '));
         if (parts.isEmpty())
             continue;
 
         if (parts[0] == "STARTTLS") {
             /* server has STARTTLS extension */
             hasStartTls = true;
+        } else if (parts[0] == "PIPELINING") {
+            /* server has PIPELINING extension */
+            hasPipelining = true;
+        } else if (parts[0] == "CHUNKING") {
+            /* server has CHUNKING extension */
+            hasChunking = true;
+        } else if (parts[0] == "BINARYMIME") {
+            /* server has BINARYMIME extension */
+            hasBinaryMime = true;
+        } else if (parts[0] == "8BITMIME") {
+            /* server has 8BITMIME extension */
+            hasEightBitMime = true;
+        } else if (parts[0] == "SMTPUTF8") {
+            /* server has SMTPUTF8 extension */
+            hasSmtpUtf8 = true;
+        } else if (parts[0] == "SIZE") {
+            /* server has SIZE extension, optionally with a limit */
+            hasSize = true;
+            if (parts.size() > 1)
+                maxMessageSize = qMax(Q_INT64_C(0), parts[1].toLongLong());
         } else if (parts[0] == "AUTH") {
             hasAuth = true;
 
             /* select authentication mech */
             if (authMech == QsrMailTransport::AutoSelectMech) {
-                /* server supports SMTP-AUTH */
-                if (parts.contains("CRAM-MD5"))
+                /* server supports SMTP-AUTH, prefer what worked before */
+                QsrMailTransport::AuthMech cached = cachedAuthMech();
+                if (cached != QsrMailTransport::DisabledMech
+                        && parts.contains(authMechName(cached)))
+                    selectedAuthMech = cached;
+                else if (parts.contains("CRAM-MD5"))
                     selectedAuthMech = QsrMailTransport::CramMd5Mech;
                 else if (parts.contains("LOGIN"))
                     selectedAuthMech = QsrMailTransport::LoginMech;
@@ -1075,6 +2227,134 @@ void QsrMailTransportPrivate::enumExtensions(const QList<QByteArray> &lines)
     }
 }
 
+/*!
+ * \internal
+ *
+ * Returns the AUTH command for the selected authentication mech. The
+ * first response of PLAIN and LOGIN does not depend on a challenge and is
+ * sent as initial response (RFC4954), which saves a round trip. The
+ * challenges following the command are answered by authResponse().
+ */
+QByteArray QsrMailTransportPrivate::authCommand()
+{
+    QByteArray command("AUTH " % authMechName(selectedAuthMech));
+    QByteArray user(username.toUtf8());
+
+    if (selectedAuthMech == QsrMailTransport::PlainMech) {
+        command += ' ' % plainMech(QByteArray(), user, password.toUtf8());
+    } else if (selectedAuthMech == QsrMailTransport::LoginMech
+               && !user.isEmpty()) {
+        command += ' ' % user.toBase64();
+    }
+
+    return command;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the authentication mech which succeeded for the server before,
+ * or DisabledMech if there is none.
+ */
+QsrMailTransport::AuthMech QsrMailTransportPrivate::cachedAuthMech() const
+{
+    QsrMailAuthMechCache *cache = authMechCache();
+
+    QMutexLocker lock(&cache->mutex);
+    return cache->mechs.value(serverKey(), QsrMailTransport::DisabledMech);
+}
+
+/*!
+ * \internal
+ *
+ * Remember the automatically selected authentication mech for the server
+ * if it *succeeded*, otherwise forget it.
+ */
+void QsrMailTransportPrivate::saveAuthMech(bool succeeded)
+{
+    if (authMech != QsrMailTransport::AutoSelectMech)
+        return;
+
+    QsrMailAuthMechCache *cache = authMechCache();
+
+    QMutexLocker lock(&cache->mutex);
+    if (succeeded)
+        cache->mechs.insert(serverKey(), selectedAuthMech);
+    else
+        cache->mechs.remove(serverKey());
+}
+
+/*!
+ * \internal
+ *
+ * Returns the timeout for establishing the connection, which defaults to
+ * the command timeout.
+ */
+int QsrMailTransportPrivate::effectiveConnectTimeout() const
+{
+    return connectTimeout > 0 ? connectTimeout : timeout;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the timeout for the message transfer, which defaults to the
+ * command timeout.
+ */
+int QsrMailTransportPrivate::effectiveDataTimeout() const
+{
+    return dataTimeout > 0 ? dataTimeout : timeout;
+}
+
+/*!
+ * \internal
+ *
+ * Arm the notification timer unless it is running already. Notifications
+ * which arrive meanwhile are coalesced into the pending ones.
+ */
+void QsrMailTransportPrivate::scheduleNotification()
+{
+    if (!notifyTimer->isActive())
+        notifyTimer->start(notifyInterval);
+}
+
+/*!
+ * \internal
+ *
+ * Emit the notifications collected since the last call: the finished
+ * transactions as one transactionsFinished() signal, followed by the
+ * latest progress. Is called by the notification timer and before
+ * idle() or finished() are emitted, so no notification is held back.
+ */
+void QsrMailTransportPrivate::flushNotifications()
+{
+    Q_Q(QsrMailTransport);
+
+    notifyTimer->stop();
+
+    /* the progress of the current message is applied once per interval */
+    bool changed = !finishedBatch.isEmpty();
+    int progress = 0;
+    if (progressTransaction != 0) {
+        int percent = progressTransaction->progress;
+        progress = progressTransaction->setProgress(progressProcessed,
+                                                    progressTotal);
+        changed = changed || progress != percent;
+        progressTransaction = 0;
+    }
+
+    if (!finishedBatch.isEmpty()) {
+        QVector<QsrMailTransaction *> batch;
+        batch.swap(finishedBatch);
+        emit q->transactionsFinished(batch);
+    }
+
+    if (changed && totalMessages > 0) {
+        int percent = (processedMessages * 100 + progress) / totalMessages;
+        emit q->progressUpdate(percent > 100 ? 100 : percent);
+    }
+}
+
 /*!
  * \internal
  *
@@ -1196,14 +2476,47 @@ QByteArray QsrMailTransportPrivate::plainMech(const QByteArray &challenge,
  *
  * Implementation of QsrMailTransport::queueMessage(). Implementation is
  * separated from frontend due to access restrictions on QsrMailTransaction.
+ *
+ * If *forwardPaths* is not empty the message is delivered to these
+ * recipients instead of the To, Cc and Bcc addresses of the message. This
+ * is used to split a message into deliveries to different servers.
  */
 QsrMailTransaction *
-QsrMailTransportPrivate::queueMessageImpl(const QsrMailMessage &message)
+QsrMailTransportPrivate::queueMessageImpl(
+        const QsrMailMessage &message,
+        const QList<QsrMailAddress> &forwardPaths)
 {
     Q_Q(QsrMailTransport);
 
     QsrMailTransaction *t = QsrMailTransactionPrivate::createInstance(message, q);
+    t->d_func()->forwardPaths = forwardPaths;
+
+    queueTransaction(t);
+    return t;
+}
+
+/*!
+ * \internal
+ *
+ * Queue the transaction *t*, which has been created by
+ * QsrMailTransactionPrivate::createInstance(). A transaction created
+ * without a transport is adopted; it has to live in the thread of the
+ * transport and becomes its child.
+ */
+void QsrMailTransportPrivate::queueTransaction(QsrMailTransaction *t)
+{
+    Q_Q(QsrMailTransport);
+
     QsrMailTransactionPrivate *p = t->d_func();
+    if (p->transport != q) {
+        Q_ASSERT(t->thread() == q->thread());
+        p->transport = q;
+        t->setParent(q);
+    }
+
+    /* the renderer allocates its buffer not before it starts rendering */
+    p->renderer->setBufferPool(&bufferPool);
+    p->renderer->setWatermarks(lowWatermark, highWatermark);
 
     /* connect transaction itself for signal relaying and cleanup */
     QObject::connect(t, SIGNAL(finished()), q, SLOT(_q_transactionFinished()));
@@ -1212,6 +2525,61 @@ QsrMailTransportPrivate::queueMessageImpl(const QsrMailMessage &message)
      * use q_func() to access the interface
      */
     queue.enqueue(p);
+    statistics.add(QsrMailStatisticsCounters::QueueDepth);
+
+    /* an idle session delivers the message right away */
+    if (state == KeepAliveState)
+        QMetaObject::invokeMethod(q, "_q_resumeSession", Qt::QueuedConnection);
+}
+
+/*!
+ * \internal
+ *
+ * Queue the rendered *message*. The transaction carries only the envelope
+ * of the message, its renderer serves the rendered data.
+ */
+QsrMailTransaction *QsrMailTransportPrivate::queueRendered(
+        const QsrMailRenderedMessage &message)
+{
+    QsrMailMessage envelope;
+    envelope.setSender(message.sender());
+
+    QsrMailTransaction *t = queueMessageImpl(envelope, message.recipients());
+    QsrMailTransactionPrivate *p = t->d_func();
+    p->rendered = message;
+
+    if (message.isFileBacked()) {
+        p->renderer->setPrerendered(message.fileName(), message.size(),
+                                    message.requiresBinaryMime());
+    } else if (message.isValid()) {
+        p->renderer->setPrerendered(message.d->data,
+                                    message.requiresBinaryMime());
+    }
+
+    return t;
+}
+
+/*!
+ * \internal
+ *
+ * Queue a copy of the template *message* which is addressed to the
+ * recipients of *envelope*. The renderer of the message shares the *body*
+ * with the other messages of the bulk.
+ */
+QsrMailTransaction *QsrMailTransportPrivate::queueEnvelope(
+        const QsrMailMessage &message, const QsrMailEnvelope &envelope,
+        const QSharedPointer<QsrMailSharedBody> &body)
+{
+    /* the copy shares the body parts with the template */
+    QsrMailMessage msg(message);
+    msg.setTo(envelope.recipients());
+    msg.setCc(QList<QsrMailAddress>());
+    msg.setBcc(QList<QsrMailAddress>());
+    msg.setMessageId(QsrMailRfcTools::createMessageId());
+
+    QsrMailTransaction *t = queueMessageImpl(msg);
+    t->d_func()->renderer->setSharedBody(body, envelope);
+
     return t;
 }
 
@@ -1239,8 +2607,35 @@ void QsrMailTransportPrivate::sendMessagesImpl(State initState)
 {
     Q_Q(QsrMailTransport);
 
+    /* every spooled message is taken at most once per delivery */
+    if (!spool.isNull()) {
+        spoolRemaining = spool->available();
+        spoolStopped = false;
+        fillFromSpool();
+    }
+
     if (queue.isEmpty()) {
-        emit q->finished();
+        flushNotifications();
+        if (deferred.isEmpty())
+            emit q->finished();
+        return;
+    }
+
+    /* The server is throttling us - wait for the circuit breaker */
+    if (holdQueue())
+        return;
+
+    /* All connections the server allows are in use - try again later */
+    if (!acquireConnection()) {
+        qint64 retryTime = QDateTime::currentMSecsSinceEpoch()
+                + CONNECTION_WAIT_DELAY;
+        while (!queue.isEmpty()) {
+            QsrMailTransactionPrivate *t = queue.dequeue();
+            t->retryTime = retryTime;
+            deferred.append(t);
+        }
+
+        scheduleRetry();
         return;
     }
 
@@ -1251,10 +2646,17 @@ void QsrMailTransportPrivate::sendMessagesImpl(State initState)
     interrupted = false;
     aborted = false;
     reachedRTS = false;
+    closeRequested = false;
     authenticated = false;
+    pipelined = false;
     crlfState = 0;
+    skipResponses = 0;
+    current = 0;
+    sendFile.reset();
+    sendFileTransaction = 0;
+    sendFileWaiting = false;
 
-    timer->start(timeout);
+    timer->start(effectiveConnectTimeout());
 
     QMetaObject::invokeMethod(q, "_q_processStates", Qt::QueuedConnection);
 }
@@ -1262,55 +2664,76 @@ void QsrMailTransportPrivate::sendMessagesImpl(State initState)
 /*!
  * \internal
  *
- * Setup the current transaction for sending. This includes setting up the
- * member data for the FSM and checking for mandatory data. The method
- * returns false if the message does not meet the required criterias.
+ * Connect the signals of the socket *s* to the transport.
  */
-bool QsrMailTransportPrivate::setupTransaction()
+void QsrMailTransportPrivate::setupSocket(QSslSocket *s)
 {
-    /* get head transaction */
-    QsrMailTransactionPrivate *t = queue.head();
-    const QsrMailMessage &msg = t->message;
+    Q_Q(QsrMailTransport);
 
-    /* setup transport info data */
-    t->encrypted = socket->isEncrypted();
-    t->sslConfiguration = socket->sslConfiguration();
-    t->authenticated = authenticated;
-    t->authMech = selectedAuthMech;
-    t->username = username;
+    q->connect(s, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
+               q, SLOT(_q_stateChanged(QAbstractSocket::SocketState)));
+    q->connect(s, SIGNAL(readyRead()),
+               q, SLOT(_q_socketReadyRead()));
+    q->connect(s, SIGNAL(encryptedBytesWritten(qint64)),
+               q, SLOT(_q_encryptedBytesWritten(qint64)));
+    q->connect(s, SIGNAL(bytesWritten(qint64)),
+               q, SLOT(_q_bytesWritten(qint64)));
+}
 
-    /* setup sender data */
-    from.clear();
-    if (msg.sender().isValid())
-        from = msg.sender().toByteArray();
-    else if (!msg.from().isEmpty())
-        from = msg.from().first().toByteArray();
+/*!
+ * \internal
+ *
+ * Start the connection attempt to the next address of serverAddresses
+ * using an additional socket.
+ */
+void QsrMailTransportPrivate::startRacer()
+{
+    Q_Q(QsrMailTransport);
 
-    /* setup recipients */
-    QList<QsrMailAddress> recipients;
-    recipients.append(msg.to());
-    recipients.append(msg.cc());
-    recipients.append(msg.bcc());
+    QSslSocket *racer = new QSslSocket(q);
+    q->connect(racer, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
+               q, SLOT(_q_racerStateChanged(QAbstractSocket::SocketState)));
 
-    rcpts.clear();
-    for (int i=0, size=recipients.size(); i<size; ++i)
-        rcpts.insert(recipients.at(i).toByteArray());
-    rcpt = rcpts.constBegin();
+    racers.append(racer);
+    racer->connectToHost(serverAddresses.at(raceIndex++), serverPort);
 
-    /* message preflight check */
-    if (from.isEmpty()) {        
-        queue.dequeue();
-        t->setError(QsrMailTransaction::NoSenderError);
-        t->finalize();
-        return false;
-    }
+    if (raceIndex < serverAddresses.size())
+        raceTimer->start(CONNECTION_ATTEMPT_DELAY);
+}
 
-    if (rcpts.isEmpty()) {
-        queue.dequeue();
-        t->setError(QsrMailTransaction::NoRecipientsError);
-        t->finalize();
-        return false;
+/*!
+ * \internal
+ *
+ * Dispose all racing sockets.
+ */
+void QsrMailTransportPrivate::cancelRacers()
+{
+    Q_Q(QsrMailTransport);
+
+    raceTimer->stop();
+
+    foreach (QSslSocket *racer, racers) {
+        racer->disconnect(q);
+        racer->abort();
+        racer->deleteLater();
     }
+    racers.clear();
+}
+
+/*!
+ * \internal
+ *
+ * Cancel all running connection attempts. Returns false if no attempt was
+ * running. In this case the FSM is not affected, otherwise it continues
+ * with the DisconnectedState.
+ */
+bool QsrMailTransportPrivate::stopRace()
+{
+    if (racers.isEmpty())
+        return false;
+
+    cancelRacers();
+    _q_stateChanged(QAbstractSocket::UnconnectedState);
 
     return true;
 }
@@ -1318,340 +2741,1939 @@ bool QsrMailTransportPrivate::setupTransaction()
 /*!
  * \internal
  *
- * Finalize all messages in the queue. Sets *error* and *errorText* for
- * all the messages in the queue. Also aborts the current renderer if any.
+ * Switch to the next of the fallback servers. Returns false if all servers
+ * have been tried.
  */
-void QsrMailTransportPrivate::finalizeQueue(
+bool QsrMailTransportPrivate::nextServer()
+{
+    if (fallbackHostnames.isEmpty())
+        return false;
+
+    serverHostname = fallbackHostnames.takeFirst();
+    serverAddress = QHostAddress();
+    interrupted = false;
+    response.reset();
+
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Finalize all queued messages with *error* and *errorText* without
+ * connecting any server and emit finished().
+ */
+void QsrMailTransportPrivate::rejectQueue(
         QsrMailTransaction::TransactionError error, const QString &errorText)
 {
-    /* finalize the rest of the queue */
+    Q_Q(QsrMailTransport);
+
+    totalMessages = queue.size();
+    processedMessages = 0;
+    finalizeQueue(error, errorText);
+
+    flushNotifications();
+    emit q->finished();
+}
+
+/*!
+ * \internal
+ *
+ * Reuse an idle keep-alive session for a new sendMessages() call. Returns
+ * true if the session is idle and connected to the server given by
+ * *hostname* or *address* and *port*, which resumes the delivery on the
+ * established session. Returns false if a new session has to be set up.
+ *
+ * An idle session to a different server is closed right away: QUIT is
+ * passed to the kernel and the socket is closed without running the FSM,
+ * so the new session starts from a clean state.
+ */
+bool QsrMailTransportPrivate::resumeSession(const QString &hostname,
+                                            const QHostAddress &address,
+                                            quint16 port)
+{
+    Q_Q(QsrMailTransport);
+
+    if (state != KeepAliveState && state != NoopState)
+        return false;
+
+    if (port != serverPort || (hostname.isEmpty()
+            ? address != serverAddress : hostname != serverHostname)) {
+        idleTimer->stop();
+        heartbeatTimer->stop();
+        timer->stop();
+
+        write("QUIT");
+        socket->flush();
+
+        /* the disconnect must not reach the FSM of the new session */
+        socket->blockSignals(true);
+        socket->abort();
+        socket->blockSignals(false);
+
+        if (!trace.isNull()) {
+            trace->record(QsrMailTraceRing::EventDirection,
+                          "closed idle session to another server");
+        }
+
+        sessionResumed = false;
+        readBuffer.resize(0);
+        readPos = 0;
+        releaseConnection();
+        state = IdleState;
+        return false;
+    }
+
+    if (queue.isEmpty()) {
+        flushNotifications();
+        emit q->idle();
+        return true;
+    }
+
+    if (state == KeepAliveState)
+        QMetaObject::invokeMethod(q, "_q_resumeSession", Qt::QueuedConnection);
+
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the key of the server in the tls session cache.
+ */
+QString QsrMailTransportPrivate::serverKey() const
+{
+    return (serverHostname.isEmpty() ? serverAddress.toString()
+                                     : serverHostname.toLower())
+            % QLatin1Char(':') % QString::number(serverPort);
+}
+
+/*!
+ * \internal
+ *
+ * Prepare the socket for the tls handshake. Session persistence is enabled
+ * so the ticket of the session can be saved after the handshake, and the
+ * ticket of an earlier session with the server is offered for resumption.
+ */
+void QsrMailTransportPrivate::offerTlsSession()
+{
+    QsrMailTlsSessionCache *cache = tlsSessionCache();
+    QByteArray ticket;
+    {
+        QMutexLocker lock(&cache->mutex);
+        ticket = cache->tickets.value(serverKey());
+    }
+
+    QSslConfiguration config = socket->sslConfiguration();
+    config.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    config.setSessionTicket(ticket);
+    socket->setSslConfiguration(config);
+
+    /* The socket is connected by address - verify the certificate
+     * against the name of the server
+     */
+    if (!serverHostname.isEmpty())
+        socket->setPeerVerifyName(serverHostname);
+
+    offeredTicket = ticket;
+    sessionResumed = false;
+}
+
+/*!
+ * \internal
+ *
+ * The tls handshake completed. The server continued the offered session
+ * if it did not replace the ticket; the new ticket is saved.
+ */
+void QsrMailTransportPrivate::tlsEstablished()
+{
+    sessionTiming.tlsTime = QsrMailTransactionPrivate::now() - tlsStart;
+
+    QByteArray ticket = socket->sslConfiguration().sessionTicket();
+
+    sessionResumed = !offeredTicket.isEmpty() && ticket == offeredTicket;
+    offeredTicket.clear();
+    saveTlsSession(ticket);
+
+    statistics.add(QsrMailStatisticsCounters::TlsHandshakes);
+    if (sessionResumed)
+        statistics.add(QsrMailStatisticsCounters::TlsResumed);
+
+    if (!trace.isNull()) {
+        trace->record(QsrMailTraceRing::EventDirection,
+                      sessionResumed ? QByteArray("tls session resumed")
+                                     : QByteArray("tls established"));
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Save the session *ticket* of the connected server in the process wide
+ * tls session cache, shared by all transports.
+ */
+void QsrMailTransportPrivate::saveTlsSession(const QByteArray &ticket)
+{
+    if (ticket.isEmpty())
+        return;
+
+    QsrMailTlsSessionCache *cache = tlsSessionCache();
+    QString key = serverKey();
+
+    QMutexLocker lock(&cache->mutex);
+    if (!cache->tickets.contains(key)
+            && cache->tickets.size() >= MAX_TLS_SESSIONS)
+        cache->tickets.clear();
+    cache->tickets.insert(key, ticket);
+}
+
+/*!
+ * \internal
+ *
+ * Remove the session *ticket* of the connected server from the cache
+ * unless another connection already replaced it.
+ */
+void QsrMailTransportPrivate::dropTlsSession(const QByteArray &ticket)
+{
+    QsrMailTlsSessionCache *cache = tlsSessionCache();
+    QString key = serverKey();
+
+    QMutexLocker lock(&cache->mutex);
+    if (cache->tickets.value(key) == ticket)
+        cache->tickets.remove(key);
+}
+
+/*!
+ * \internal
+ *
+ * Reject the transaction *t* with the current server response. If the
+ * rejection is *transient* the message is deferred for another attempt,
+ * provided it has attempts left.
+ */
+void QsrMailTransportPrivate::rejectTransaction(QsrMailTransactionPrivate *t,
+                                                bool transient)
+{
+    t->setStatus(response.code, response.text);
+
+    if (transient) {
+        updateBreaker(true);
+        updateThrottle(true);
+        if (deferTransaction(t))
+            return;
+    }
+
+    t->setError(QsrMailTransaction::ResponseError);
+    t->finalize();
+}
+
+/*!
+ * \internal
+ *
+ * The server sent *line*, which is not a valid reply. The responses cannot
+ * be matched to the commands anymore, so all queued messages are cancelled
+ * like on any other unrecoverable response and the connection is closed.
+ */
+void QsrMailTransportPrivate::protocolError(const QByteArray &line)
+{
+    timer->stop();
+    response.reset();
+    readBuffer.resize(0);
+    readPos = 0;
+    skipResponses = 0;
+
+    finalizeQueue(QsrMailTransaction::ResponseError,
+                  QsrMailTransport::tr("malformed server response: ")
+                  % QString::fromLatin1(line));
+
+    /* the FSM continues with DisconnectedState */
+    state = ClosingState;
+    socket->disconnectFromHost();
+}
+
+/*!
+ * \internal
+ *
+ * Reject the current transaction, whose recipients have all been rejected,
+ * and reset the protocol for the next message. The message is retried if
+ * all rejections are transient.
+ */
+void QsrMailTransportPrivate::rejectRecipients()
+{
+    QsrMailTransactionPrivate *t = queue.dequeue();
+
+    bool transient = true;
+    foreach (int status, t->recipientStatus)
+        transient = transient && status >= 400 && status < 500;
+
+    rejectTransaction(t, transient);
+
+    write("RSET");
+    state = ReadyToSendState;
+}
+
+/*!
+ * \internal
+ *
+ * Defer the transaction *t* for a retry after retryInterval, which doubles
+ * with each attempt up to maxRetryInterval. Returns false if the message
+ * has no attempts left or cannot be rendered again.
+ */
+bool QsrMailTransportPrivate::deferTransaction(QsrMailTransactionPrivate *t)
+{
+    if (aborted || t->attempts >= maxAttempts)
+        return false;
+
+    if (waitingRenderer == t->renderer)
+        waitingRenderer = 0;
+    if (!t->restartRenderer())
+        return false;
+
+    qint64 delay = qMin(qint64(retryInterval) << qMin(t->attempts - 1, 20),
+                        qint64(maxRetryInterval));
+    t->retryTime = QDateTime::currentMSecsSinceEpoch() + delay;
+
+    deferred.append(t);
+    scheduleRetry();
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Start the retry timer for the deferred message which is due next.
+ */
+void QsrMailTransportPrivate::scheduleRetry()
+{
+    if (deferred.isEmpty()) {
+        retryTimer->stop();
+        return;
+    }
+
+    qint64 next = deferred.first()->retryTime;
+    foreach (const QsrMailTransactionPrivate *t, deferred)
+        next = qMin(next, t->retryTime);
+
+    next -= QDateTime::currentMSecsSinceEpoch();
+    retryTimer->start(static_cast<int>(qBound(Q_INT64_C(0), next,
+            static_cast<qint64>(std::numeric_limits<int>::max()))));
+}
+
+/*!
+ * \internal
+ *
+ * Defer all queued messages while the circuit breaker of the server is
+ * open. Returns true if the messages have been deferred. Held messages do
+ * not lose an attempt.
+ */
+bool QsrMailTransportPrivate::holdQueue()
+{
+    if (breakerThreshold <= 0 || queue.isEmpty())
+        return false;
+
+    QsrMailBreakerCache *cache = breakerCache();
+    qint64 openUntil;
+    {
+        QMutexLocker lock(&cache->mutex);
+        openUntil = cache->entries.value(serverKey()).openUntil;
+    }
+
+    if (openUntil <= QDateTime::currentMSecsSinceEpoch())
+        return false;
+
     while (!queue.isEmpty()) {
         QsrMailTransactionPrivate *t = queue.dequeue();
+        t->retryTime = openUntil;
+        deferred.append(t);
+    }
 
-        if (response.isValid)
-            t->setStatus(response.code, response.lines);
+    scheduleRetry();
+    return true;
+}
 
-        t->setError(error, errorText);
-        t->finalize();
+/*!
+ * \internal
+ *
+ * Update the circuit breaker of the server, which is shared by all
+ * transports. After breakerThreshold transient failures in a row the
+ * breaker opens for breakerTimeout msecs. The next failure after that
+ * opens it again, a delivered message closes it.
+ */
+void QsrMailTransportPrivate::updateBreaker(bool failed)
+{
+    if (breakerThreshold <= 0)
+        return;
+
+    QsrMailBreakerCache *cache = breakerCache();
+    QString key = serverKey();
+
+    QMutexLocker lock(&cache->mutex);
+    if (!failed) {
+        cache->entries.remove(key);
+        return;
     }
+
+    QsrMailBreakerCache::Entry &entry = cache->entries[key];
+    if (++entry.failures >= breakerThreshold)
+        entry.openUntil = QDateTime::currentMSecsSinceEpoch() + breakerTimeout;
 }
 
 /*!
  * \internal
  *
- * \overload
+ * Returns true if messages to the server are paced by a message or
+ * recipient rate.
  */
-void QsrMailTransportPrivate::finalizeQueue(
-        QsrMailTransaction::TransactionError error)
+bool QsrMailTransportPrivate::isPaced() const
 {
-    finalizeQueue(error, QString());
+    return messageRate > 0 || recipientRate > 0;
 }
 
 /*!
  * \internal
  *
- * Write command data to the socket. This is used to write the protocol
- * commands to the server.
+ * Returns the msecs to wait until the rate limits of the server allow the
+ * next message, or 0 if it may be sent right away. The buckets are shared
+ * by all transports delivering to the server. A message needs a whole
+ * token, while the recipients may overdraw the recipient bucket since
+ * their number is not known before the transaction is set up.
+ */
+qint64 QsrMailTransportPrivate::paceDelay()
+{
+    QsrMailThrottleCache *cache = throttleCache();
+
+    QMutexLocker lock(&cache->mutex);
+    QsrMailThrottleCache::Entry &entry = cache->entries[serverKey()];
+    refillBuckets(entry, messageRate, recipientRate,
+                  QDateTime::currentMSecsSinceEpoch());
+
+    double delay = 0;
+    if (messageRate > 0 && entry.messageTokens < 1.0)
+        delay = (1.0 - entry.messageTokens) / (messageRate * entry.factor);
+    if (recipientRate > 0 && entry.recipientTokens < 0) {
+        delay = qMax(delay, -entry.recipientTokens
+                     / (recipientRate * entry.factor));
+    }
+
+    return delay > 0 ? static_cast<qint64>(delay * 1000) + 1 : 0;
+}
+
+/*!
+ * \internal
+ *
+ * Take the tokens for a message with *recipients* from the buckets of the
+ * server.
+ */
+void QsrMailTransportPrivate::consumeTokens(int recipients)
+{
+    if (!isPaced())
+        return;
+
+    QsrMailThrottleCache *cache = throttleCache();
+
+    QMutexLocker lock(&cache->mutex);
+    QsrMailThrottleCache::Entry &entry = cache->entries[serverKey()];
+    refillBuckets(entry, messageRate, recipientRate,
+                  QDateTime::currentMSecsSinceEpoch());
+
+    entry.messageTokens -= 1.0;
+    entry.recipientTokens -= recipients;
+}
+
+/*!
+ * \internal
+ *
+ * Adapt the rates of the server to its responses. A transient rejection
+ * halves the rates, down to MIN_THROTTLE_FACTOR of the configured ones,
+ * and every delivered message raises them by THROTTLE_RECOVERY until the
+ * configured rates are reached again.
+ */
+void QsrMailTransportPrivate::updateThrottle(bool failed)
+{
+    if (!isPaced())
+        return;
+
+    QsrMailThrottleCache *cache = throttleCache();
+
+    QMutexLocker lock(&cache->mutex);
+    QsrMailThrottleCache::Entry &entry = cache->entries[serverKey()];
+
+    /* tokens earned so far are accounted at the old rates */
+    refillBuckets(entry, messageRate, recipientRate,
+                  QDateTime::currentMSecsSinceEpoch());
+
+    if (failed)
+        entry.factor = qMax(entry.factor * 0.5, MIN_THROTTLE_FACTOR);
+    else
+        entry.factor = qMin(entry.factor + THROTTLE_RECOVERY, 1.0);
+}
+
+/*!
+ * \internal
+ *
+ * Take one of the connections the server allows. Returns false if all of
+ * them are in use by the transports of the process. The connection is
+ * held until the session ends, see releaseConnection().
+ */
+bool QsrMailTransportPrivate::acquireConnection()
+{
+    if (maxServerConnections <= 0 || !connectionKey.isEmpty())
+        return true;
+
+    QsrMailThrottleCache *cache = throttleCache();
+    QString key = serverKey();
+
+    QMutexLocker lock(&cache->mutex);
+    QsrMailThrottleCache::Entry &entry = cache->entries[key];
+    if (entry.connections >= maxServerConnections)
+        return false;
+
+    entry.connections++;
+    connectionKey = key;
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Return the connection taken by acquireConnection(), if any.
+ */
+void QsrMailTransportPrivate::releaseConnection()
+{
+    if (connectionKey.isEmpty())
+        return;
+
+    QsrMailThrottleCache *cache = throttleCache();
+
+    QMutexLocker lock(&cache->mutex);
+    cache->entries[connectionKey].connections--;
+    connectionKey.clear();
+}
+
+/*!
+ * \internal
+ *
+ * Setup the current transaction for sending. This includes setting up the
+ * member data for the FSM and checking for mandatory data. The method
+ * returns false if the message does not meet the required criterias.
+ */
+bool QsrMailTransportPrivate::setupTransaction()
+{
+    /* get head transaction */
+    QsrMailTransactionPrivate *t = queue.head();
+    const QsrMailMessage &msg = t->message;
+
+    t->attempts++;
+    current = t;
+
+    /* setup transport info data */
+    t->encrypted = socket->isEncrypted();
+    t->sslConfiguration = socket->sslConfiguration();
+    t->sessionResumed = t->encrypted && sessionResumed;
+
+    /* TLS 1.3 servers issue tickets after the handshake */
+    if (t->encrypted)
+        saveTlsSession(t->sslConfiguration.sessionTicket());
+    t->authenticated = authenticated;
+    t->authMech = selectedAuthMech;
+    t->username = username;
+
+    /* setup sender data */
+    from.clear();
+    if (msg.sender().isValid())
+        from = msg.sender().address().toUtf8();
+    else if (!msg.from().isEmpty() && msg.from().first().isValid())
+        from = msg.from().first().address().toUtf8();
+
+    /* setup recipients */
+    QList<QsrMailAddress> recipients(t->forwardPaths);
+    if (recipients.isEmpty()) {
+        recipients.append(msg.to());
+        recipients.append(msg.cc());
+        recipients.append(msg.bcc());
+    }
+
+    /* the envelope carries the bare addresses in message order, the
+     * display names are only part of the headers
+     */
+    rcpts.clear();
+    rcpts.reserve(recipients.size());
+    rcptNext = 0;
+    utf8Envelope = !isAscii(from);
+    for (int i=0, size=recipients.size(); i<size; ++i) {
+        const QsrMailAddress &address = recipients.at(i);
+        if (address.isValid()) {
+            QByteArray rcpt(address.address().toUtf8());
+            utf8Envelope = utf8Envelope || !isAscii(rcpt);
+            rcpts.insert(rcpt);
+        }
+    }
+
+    /* track the recipient status in the order of the RCPT TO commands */
+    t->recipients.clear();
+    t->recipientStatus.clear();
+    t->recipientStatusText.clear();
+    for (int i=0, size=rcpts.size(); i<size; ++i) {
+        t->recipients.append(QString::fromUtf8(rcpts.at(i)));
+        t->recipientStatus.append(0);
+        t->recipientStatusText.append(QByteArray());
+    }
+
+    /* message preflight check */
+    if (from.isEmpty()) {        
+        queue.dequeue();
+        t->setError(QsrMailTransaction::NoSenderError);
+        t->finalize();
+        return false;
+    }
+
+    if (rcpts.isEmpty()) {
+        queue.dequeue();
+        t->setError(QsrMailTransaction::NoRecipientsError);
+        t->finalize();
+        return false;
+    }
+
+    /* RFC6531: UTF-8 addresses require SMTPUTF8 */
+    if (utf8Envelope && !hasSmtpUtf8) {
+        queue.dequeue();
+        t->setError(QsrMailTransaction::UnsupportedExtensionError,
+                    QsrMailTransport::tr("server does not support SMTPUTF8"));
+        t->finalize();
+        return false;
+    }
+
+    /* RFC6152: text parts are sent unencoded if the server takes 8bit
+     * data; a renderer which started 8bit for another server starts over
+     */
+    if (t->renderer->eightBitMime() && !hasEightBitMime
+            && !t->restartRenderer()) {
+        queue.dequeue();
+        t->setError(QsrMailTransaction::UnsupportedExtensionError,
+                    QsrMailTransport::tr("server does not support 8BITMIME"));
+        t->finalize();
+        return false;
+    }
+    if (!t->renderer->isStarted())
+        t->renderer->setEightBitMime(hasEightBitMime);
+
+    /* RFC6152: announce 8bit data only if the body contains any */
+    eightBitBody = hasEightBitMime && t->renderer->requiresEightBitMime();
+
+    /* binary parts can only be sent using BDAT */
+    binaryMime = t->renderer->requiresBinaryMime();
+    if (binaryMime && !(hasChunking && hasBinaryMime)) {
+        queue.dequeue();
+        t->setError(QsrMailTransaction::UnsupportedExtensionError,
+                    QsrMailTransport::tr("server does not support BINARYMIME"));
+        t->finalize();
+        return false;
+    }
+
+    /* a message which could not be rendered is never sent */
+    if (!t->rendered.errorString().isEmpty()) {
+        queue.dequeue();
+        t->setError(QsrMailTransaction::DataError,
+                    t->rendered.errorString());
+        t->finalize();
+        return false;
+    }
+
+    /* the body of a bulk message might have been lost with another message */
+    if (!t->renderer->isBodyAvailable()) {
+        queue.dequeue();
+        t->setError(QsrMailTransaction::DataError,
+                    QsrMailTransport::tr("body of the bulk delivery " \
+                                         "is not available anymore"));
+        t->finalize();
+        return false;
+    }
+
+    /* RFC1870: declare the size and refuse messages the server would
+     * reject anyway before any data is transferred
+     */
+    messageSize = hasSize ? t->renderer->totalSize() : -1;
+    if (maxMessageSize > 0 && messageSize > maxMessageSize) {
+        queue.dequeue();
+        t->setError(QsrMailTransaction::MessageSizeError);
+        t->finalize();
+        return false;
+    }
+
+    chunked = hasChunking;
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Connect the renderer of the current transaction and start rendering the
+ * message. The renderer output is written by _q_writeMessageData().
+ *
+ * A renderer which has been started by prefetchRenderers() already did
+ * not signal anyone so far; the data it buffered is written right away.
+ * Afterwards the renderers of the following messages are prefetched.
+ */
+void QsrMailTransportPrivate::startRenderer()
+{
+    Q_Q(QsrMailTransport);
+
+    waitingRenderer = 0;
+    dotStuffer.reset();
+
+    QsrMailRenderer *r = queue.head()->renderer;
+    q->connect(r, SIGNAL(readChannelFinished()),
+               q, SLOT(_q_processStates()));
+    q->connect(r, SIGNAL(error()),
+               q, SLOT(_q_processStates()));
+    q->connect(r, SIGNAL(readyRead()),
+               q, SLOT(_q_writeMessageData()));
+    q->connect(r, SIGNAL(progressUpdate(qint64, qint64)),
+               q, SLOT(_q_messageProgress(qint64, qint64)));
+
+    if (!r->isStarted()) {
+        launchRenderer(r);
+    } else if (!r->lastError().isEmpty()) {
+        QMetaObject::invokeMethod(q, "_q_processStates",
+                                  Qt::QueuedConnection);
+    } else if (r->bytesAvailable() > 0) {
+        waitingRenderer = r;
+        _q_writeMessageData();
+    }
+
+    prefetchRenderers();
+}
+
+/*!
+ * \internal
+ *
+ * Start the renderer *r*, on a render thread if threadedRendering is set.
+ */
+void QsrMailTransportPrivate::launchRenderer(QsrMailRenderer *r)
+{
+    if (threadedRendering)
+        r->setRenderThread(QsrMailRenderWorker::nextThread());
+    r->setEightBitMime(hasEightBitMime);
+
+    r->renderMessage();
+}
+
+/*!
+ * \internal
+ *
+ * Start rendering up to prefetchDepth messages queued behind the message
+ * in transfer. Their renderers fill their buffers and wait until they are
+ * connected by startRenderer(), so the data phase of these messages starts
+ * with the encoded data at hand.
+ */
+void QsrMailTransportPrivate::prefetchRenderers()
+{
+    for (int i=1; i<=prefetchDepth && i<queue.size(); i++) {
+        QsrMailRenderer *r = queue.at(i)->renderer;
+        if (!r->isStarted() && r->isPrefetchable())
+            launchRenderer(r);
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Start sending a file backed QsrMailRenderedMessage as data of the DATA
+ * command directly from its file using sendfile(). Returns false if the
+ * message of the current transaction has to go through its renderer: it
+ * is not file backed, the session is encrypted or the platform lacks
+ * sendfile().
+ *
+ * The dots of dot-stuffing are inserted at the offsets recorded when the
+ * message was rendered, the file data itself is never read.
+ */
+bool QsrMailTransportPrivate::startFileTransfer()
+{
+#ifdef Q_OS_LINUX
+    QsrMailTransactionPrivate *t = queue.head();
+    if (!t->rendered.isFileBacked() || t->rendered.requiresBinaryMime()
+            || socket->isEncrypted() || socket->socketDescriptor() == -1)
+        return false;
+
+    sendFile.reset(new QFile(t->rendered.fileName()));
+    if (!sendFile->open(QIODevice::ReadOnly)) {
+        sendFile.reset();
+        return false;
+    }
+
+    sendFileTransaction = t;
+    sendFilePos = 0;
+    sendFileStuffing = 0;
+    sendFileError.clear();
+    waitingRenderer = 0;
+
+    if (!trace.isNull()) {
+        trace->record(QsrMailTraceRing::EventDirection,
+                      "sendfile " % QByteArray::number(t->rendered.size())
+                      % " bytes");
+        traceData = true;
+    }
+
+    _q_messageProgress(0, t->rendered.size());
+    sendFileData();
+    prefetchRenderers();
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*!
+ * \internal
+ *
+ * Pass the data of the file transfer to the kernel until the socket
+ * buffer of the kernel is full. Data is only sent if the socket has no
+ * data of its own buffered, which would be overtaken otherwise.
+ *
+ * The transport is not informed when the kernel buffer drains again. So if
+ * the kernel takes no more data, a small piece of the file is written to
+ * the socket instead; its bytesWritten() signal continues the transfer
+ * once the kernel buffer drained. Once all data is passed the FSM writes
+ * the end of data.
+ */
+void QsrMailTransportPrivate::sendFileData()
+{
+#ifdef Q_OS_LINUX
+    Q_Q(QsrMailTransport);
+
+    sendFileWaiting = false;
+
+    /* the transfer has been interrupted, eg. by a disconnect */
+    if (sendFile.isNull() || state != EndOfMessageState || queue.isEmpty()
+            || queue.head() != sendFileTransaction)
+        return;
+
+    const QsrMailRenderedMessagePrivate *m =
+            sendFileTransaction->rendered.d.constData();
+    const int fd = socket->socketDescriptor();
+    qint64 written = 0;
+
+    while (sendFilePos < m->size) {
+        if (socket->bytesToWrite() > 0) {
+            sendFileWaiting = true;
+            break;
+        }
+
+        qint64 next = m->size;
+        if (sendFileStuffing < m->stuffing.size())
+            next = m->stuffing.at(sendFileStuffing);
+
+        /* the line starts with a dot which has to be doubled */
+        if (sendFilePos == next) {
+            ssize_t n;
+            do {
+                n = ::write(fd, ".", 1);
+            } while (n < 0 && errno == EINTR);
+
+            if (n != 1)
+                socket->write(".", 1);
+
+            sendFileStuffing++;
+            written++;
+            continue;
+        }
+
+        off_t offset = sendFilePos;
+        ssize_t n;
+        do {
+            n = ::sendfile(fd, sendFile->handle(), &offset,
+                           size_t(next - sendFilePos));
+        } while (n < 0 && errno == EINTR);
+
+        if (n > 0) {
+            sendFilePos += n;
+            written += n;
+
+            /* the socket does not signal bytesWritten() for this data */
+            timer->touch();
+            continue;
+        }
+
+        /* the kernel is busy - let the socket write a piece */
+        QByteArray piece;
+        if (sendFile->seek(sendFilePos)) {
+            piece = sendFile->read(qMin(next - sendFilePos,
+                                        qint64(RINGBUFFER_SIZE)));
+        }
+
+        if (piece.isEmpty()) {
+            sendFileError = QsrMailTransport::tr("cannot read message: ")
+                    % sendFile->errorString();
+            socket->disconnectFromHost();
+            return;
+        }
+
+        socket->write(piece);
+        sendFilePos += piece.size();
+        written += piece.size();
+        sendFileWaiting = true;
+        break;
+    }
+
+    if (written > 0) {
+        statistics.add(QsrMailStatisticsCounters::BytesWritten, written);
+        statistics.add(QsrMailStatisticsCounters::BytesRendered, written);
+        _q_messageProgress(sendFilePos, m->size);
+    }
+
+    /* everything passed - the data ends with CRLF */
+    if (sendFilePos >= m->size) {
+        sendFileWaiting = false;
+        crlfState = 2;
+        QMetaObject::invokeMethod(q, "_q_processStates",
+                                  Qt::QueuedConnection);
+    }
+#endif
+}
+
+/*!
+ * \internal
+ *
+ * Queue messages of the spool until the queue and the deferred messages
+ * fill the spool window. The messages are rendered already; their data is
+ * served from the spool and only the envelope is set up as message.
+ */
+void QsrMailTransportPrivate::fillFromSpool()
+{
+    if (spool.isNull() || spoolStopped)
+        return;
+
+    QsrMailSpoolPrivate *s = spool->d_func();
+    while (spoolRemaining > 0
+           && queue.size() + deferred.size() < spoolWindow) {
+        QsrMailSpoolEntry entry;
+        if (!s->checkout(&entry)) {
+            spoolRemaining = 0;
+            break;
+        }
+        spoolRemaining--;
+
+        QsrMailMessage message;
+        message.setSender(QsrMailAddress(QString::fromUtf8(entry.sender)));
+
+        QList<QsrMailAddress> recipients;
+        for (int i=0, size=entry.recipients.size(); i<size; ++i) {
+            recipients.append(QsrMailAddress(
+                                  QString::fromUtf8(entry.recipients.at(i))));
+        }
+
+        QsrMailTransaction *t = queueMessageImpl(message, recipients);
+        QsrMailTransactionPrivate *p = t->d_func();
+        p->renderer->setPrerendered(entry.data, entry.binary);
+        p->spoolKey = entry.key;
+
+        totalMessages++;
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Hand the spooled message of *t* back to the spool. If the transaction
+ * has *finished* and the message has been delivered or rejected for good
+ * it is removed from the spool. Messages which failed with a transient
+ * error, or have not been sent at all, stay for the next delivery. A
+ * transient error also stops taking messages from the spool, they would
+ * most likely fail the same way.
+ */
+void QsrMailTransportPrivate::returnToSpool(QsrMailTransactionPrivate *t,
+                                           bool finished)
+{
+    qint64 key = t->spoolKey;
+    t->spoolKey = -1;
+
+    if (spool.isNull())
+        return;
+
+    bool keep = !finished;
+    if (finished) {
+        switch (t->error) {
+        case QsrMailTransaction::ConnectionError:
+        case QsrMailTransaction::TlsRequiredError:
+        case QsrMailTransaction::ResolverError:
+        case QsrMailTransaction::TimeoutError:
+        case QsrMailTransaction::AbortedError:
+            keep = true;
+            break;
+
+        case QsrMailTransaction::ResponseError:
+            keep = t->status >= 400 && t->status < 500;
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (keep) {
+        spool->d_func()->release(key);
+        spoolStopped = spoolStopped || finished;
+    } else {
+        spool->d_func()->complete(key);
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Finalize all messages in the queue. Sets *error* and *errorText* for
+ * all the messages in the queue. Also aborts the current renderer if any.
+ */
+void QsrMailTransportPrivate::finalizeQueue(
+        QsrMailTransaction::TransactionError error, const QString &errorText)
+{
+    /* finalize the rest of the queue */
+    while (!queue.isEmpty()) {
+        QsrMailTransactionPrivate *t = queue.dequeue();
+
+        if (response.isValid)
+            t->setStatus(response.code, response.text);
+
+        t->setError(error, errorText);
+        t->finalize();
+    }
+}
+
+/*!
+ * \internal
+ *
+ * \overload
+ */
+void QsrMailTransportPrivate::finalizeQueue(
+        QsrMailTransaction::TransactionError error)
+{
+    finalizeQueue(error, QString());
+}
+
+/*!
+ * \internal
+ *
+ * Write command data to the socket. This is used to write the protocol
+ * commands to the server.
+ */
+void QsrMailTransportPrivate::write(const QByteArray &data)
+{
+    /* only commands sent to an idle connection measure the round trip */
+    if (rttStart == 0 && state != BdatState && socket->bytesToWrite() == 0)
+        rttStart = QsrMailTransactionPrivate::now();
+
+    socket->write(data % "\r\n");
+    statistics.add(QsrMailStatisticsCounters::BytesWritten, data.size() + 2);
+
+    /* a command ends the corked data */
+    if (corked)
+        setCorked(false);
+
+    if (!trace.isNull())
+        traceCommand(data);
+}
+
+/*!
+ * \internal
+ *
+ * Record the command *data* in the protocol trace. Credentials are never
+ * traced: the responses to the server's challenges are replaced and the
+ * arguments of AUTH are cut after the mechanism.
+ */
+void QsrMailTransportPrivate::traceCommand(const QByteArray &data)
+{
+    traceData = false;
+
+    if (data.startsWith("AUTH ")) {
+        int pos = data.indexOf(' ', 5);
+        if (pos < 0) {
+            trace->record(QsrMailTraceRing::ClientDirection, data);
+        } else {
+            trace->record(QsrMailTraceRing::ClientDirection,
+                          data.left(pos) % " <redacted>");
+        }
+    } else if (state == AuthState) {
+        trace->record(QsrMailTraceRing::ClientDirection, "<redacted>");
+    } else {
+        trace->recordLines(QsrMailTraceRing::ClientDirection, data);
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Write the *count* *segments* of message data to the socket. On plaintext
+ * sessions the segments are handed to the socket descriptor with a single
+ * writev() as long as the socket has nothing buffered, so the data goes
+ * from the renderer buffer to the kernel without being copied to the
+ * socket's buffer. Whatever the kernel does not take is written to the
+ * socket as usual and flushed by Qt.
+ *
+ * Encrypted sessions always write through the socket, which encrypts the
+ * buffered data in large records.
+ */
+void QsrMailTransportPrivate::writeSegments(const Segment *segments,
+                                           int count)
+{
+    int i = 0;
+    qint64 skip = 0;
+    qint64 total = 0;
+
+    for (int j=0; j<count; j++)
+        total += segments[j].size;
+    statistics.add(QsrMailStatisticsCounters::BytesWritten, total);
+
+#ifdef Q_OS_UNIX
+    qintptr fd = socket->socketDescriptor();
+
+    if (!socket->isEncrypted() && socket->bytesToWrite() == 0 && fd != -1
+            && count > 0) {
+        struct iovec iov[MAX_WRITE_SEGMENTS];
+        int n = qMin(count, MAX_WRITE_SEGMENTS);
+
+        for (int j=0; j<n; j++) {
+            iov[j].iov_base = const_cast<char *>(segments[j].data);
+            iov[j].iov_len = segments[j].size;
+        }
+
+        ssize_t written;
+        do {
+            written = ::writev(fd, iov, n);
+        } while (written < 0 && errno == EINTR);
+
+        /* errors are left to the socket, which sees them on its write */
+        if (written > 0) {
+            skip = written;
+
+            /* the socket does not signal bytesWritten() for this data */
+            timer->touch();
+        }
+    }
+#endif
+
+    /* skip what the kernel took already and write the rest */
+    for (; i<count && skip >= segments[i].size; i++)
+        skip -= segments[i].size;
+
+    for (; i<count; i++) {
+        socket->write(segments[i].data + skip, segments[i].size - skip);
+        skip = 0;
+    }
+}
+
+/*!
+ * \internal
+ *
+ * Cork the connection while the message data is written, if *enabled* is
+ * set. The kernel then sends full segments only, so the small writes of
+ * dot-stuffing and the tail of the data leave together with the end of
+ * data. Uncorking flushes the data buffered by the socket first and sends
+ * what is left. Corking is available on Linux only (TCP_CORK); the kernel
+ * sends a corked partial segment after 200ms anyway.
+ */
+void QsrMailTransportPrivate::setCorked(bool enabled)
+{
+#ifdef TCP_CORK
+    qintptr fd = socket->socketDescriptor();
+    if (corked == enabled || fd == -1)
+        return;
+
+    if (!enabled)
+        socket->flush();
+
+    int value = enabled ? 1 : 0;
+    if (::setsockopt(fd, IPPROTO_TCP, TCP_CORK, &value, sizeof(value)) == 0)
+        corked = enabled;
+#else
+    Q_UNUSED(enabled)
+#endif
+}
+
+/*!
+ * \internal
+ *
+ * Size the write window from the message data written within *elapsed*
+ * nsecs. The window is twice the bandwidth-delay product: the data in
+ * flight while the link is busy, which doubles with every message as long
+ * as the window itself limits the throughput. The round trip time is the
+ * quickest response to a command on this connection.
+ */
+void QsrMailTransportPrivate::updateWriteWindow(qint64 elapsed)
+{
+    qint64 bytes = windowBytes;
+    windowBytes = 0;
+
+    if (rtt == 0 || elapsed <= 0 || bytes == 0)
+        return;
+
+    qreal bdp = qreal(bytes) * qreal(rtt) / qreal(elapsed);
+    writeWindow = int(qMin(2 * bdp, qreal(MAX_WRITE_WINDOW)));
+}
+
+/*!
+ * \internal
+ *
+ * Reset the internal states. Required when the next response is parsed.
+ */
+void QsrMailTransportPrivate::SmtpResponse::reset()
+{
+    /* keep the allocated memory unless it is shared with a transaction */
+    text.resize(0);
+    lineOffset = 0;
+    code = 0;
+    isValid = false;
+    isEmpty = true;
+    isCompleted = false;
+    isIntermediate = false;
+    isTransientError = false;
+    isPermanentError = false;
+    isSuccess = false;
+    isError = false;
+}
+
+/*!
+ * \internal
+ *
+ * Append the response line of *size* bytes at *data* received from the
+ * server to the structure, with or without its line terminator. The line
+ * is parsed in place; only its text is appended to *text*. The response
+ * is considered complete when the isValid flag is set after this call. The
+ * function returns false if the line is not parsable.
+ */
+bool QsrMailTransportPrivate::SmtpResponse::append(const char *data, int size)
+{
+    /* strip the line terminator */
+    while (size > 0 && (data[size-1] == '\n' || data[size-1] == '\r'))
+        size--;
+
+    /* response code and continuation marker; the text is optional */
+    if (size < 3)
+        return false;
+
+    int value = 0;
+    for (int i=0; i<3; i++) {
+        if (data[i] < '0' || data[i] > '9')
+            return false;
+        value = value * 10 + (data[i] - '0');
+    }
+
+    bool cont = size > 3 && data[3] == '-';
+    if (size > 3 && !cont && data[3] != ' ')
+        return false;
+
+    code = value;
+    isCompleted = code >= 200 && code < 300;
+    isIntermediate = code >= 300 && code < 400;
+    isTransientError = code >= 400 && code < 500;
+    isPermanentError = code >= 500 && code < 600;
+    isSuccess = code >= 200 && code < 400;
+    isError = code >= 400 && code < 600;
+
+    /* the lines are separated by LF within the text */
+    if (!isEmpty)
+        text.append('\n');
+    lineOffset = text.size();
+    if (size > 4)
+        text.append(data + 4, size - 4);
+
+    if (!cont)
+        isValid = true;
+
+    isEmpty = false;
+    return true;
+}
+
+/*!
+ * \internal
+ *
+ * Returns the text of the last line of the response.
+ */
+QByteArray QsrMailTransportPrivate::SmtpResponse::line() const
+{
+    return text.mid(lineOffset);
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * Construct a new mail transport. Optionally assign a *parent* to
+ * the object.
+ */
+QsrMailTransport::QsrMailTransport(QObject *parent) :
+    QObject(parent),
+    d_ptr(new QsrMailTransportPrivate(this))
+{
+    Q_D(QsrMailTransport);
+
+    /* setup the socket */
+    d->socket = new QSslSocket(this);
+    d->setupSocket(d->socket);
+
+    /* setup the deadline, served by the timer wheel of the thread */
+    d->timer = new QsrMailDeadline(this, "_q_timeout");
+
+    /* setup the keep-alive timers */
+    d->idleTimer = new QTimer(this);
+    connect(d->idleTimer, SIGNAL(timeout()), this, SLOT(_q_idleTimeout()));
+
+    d->idleTimer->setSingleShot(true);
+
+    d->heartbeatTimer = new QTimer(this);
+    connect(d->heartbeatTimer, SIGNAL(timeout()), this, SLOT(_q_heartbeat()));
+
+    d->heartbeatTimer->setSingleShot(true);
+
+    /* setup the connection racing timer */
+    d->raceTimer = new QTimer(this);
+    connect(d->raceTimer, SIGNAL(timeout()), this, SLOT(_q_raceTimeout()));
+
+    d->raceTimer->setSingleShot(true);
+
+    /* setup the retry timer */
+    d->retryTimer = new QTimer(this);
+    connect(d->retryTimer, SIGNAL(timeout()), this, SLOT(_q_retryTimeout()));
+
+    d->retryTimer->setSingleShot(true);
+
+    /* setup the timer for batched notifications */
+    d->notifyTimer = new QTimer(this);
+    connect(d->notifyTimer, SIGNAL(timeout()), this, SLOT(_q_notify()));
+
+    d->notifyTimer->setSingleShot(true);
+
+    /* setup the timer pacing the messages */
+    d->paceTimer = new QTimer(this);
+    connect(d->paceTimer, SIGNAL(timeout()), this, SLOT(_q_pace()));
+
+    d->paceTimer->setSingleShot(true);
+}
+
+/*!
+ * \internal
+ *
+ * Constructor for derived classes. Constructs an instance from *qq* and
+ * *parent*.
+ */
+QsrMailTransport::QsrMailTransport(QsrMailTransportPrivate &qq,
+                                   QObject *parent) :
+    QObject(parent),
+    d_ptr(&qq)
+{
+}
+
+/*!
+ * Destroys the instance
+ */
+QsrMailTransport::~QsrMailTransport()
+{
+    Q_D(QsrMailTransport);
+
+    /* spooled messages which have not been sent stay in the spool */
+    foreach (QsrMailTransactionPrivate *t, d->queue) {
+        if (t->spoolKey >= 0)
+            d->returnToSpool(t, false);
+    }
+    foreach (QsrMailTransactionPrivate *t, d->deferred) {
+        if (t->spoolKey >= 0)
+            d->returnToSpool(t, false);
+    }
+
+    d->releaseConnection();
+    delete d->timer;
+}
+
+/*!
+ * Set the *username* used for authentication with the SMTP server.
+ */
+void QsrMailTransport::setUser(const QString &username)
+{
+    Q_D(QsrMailTransport);
+    d->username = username;
+}
+
+/*!
+ * Returns the currently set username for authentication.
+ */
+QString QsrMailTransport::user() const
+{
+    Q_D(const QsrMailTransport);
+    return d->username;
+}
+
+/*!
+ * Set the *password* used for authentication with the SMTP server.
+ * Please be aware that the password is stored in **cleartext** within
+ * the object in a not particullary safe storage.
+ */
+void QsrMailTransport::setPassword(const QString &passwd)
+{
+    Q_D(QsrMailTransport);
+    d->password = passwd;
+}
+
+/*!
+ * Returns the currently set password for authentication
+ */
+QString QsrMailTransport::password() const
+{
+    Q_D(const QsrMailTransport);
+    return d->password;
+}
+
+/*!
+ * Set the authentication mechanism. The default is to use autodetection
+ * of the best possible mechanism. The detection checks for CRAM-MD5,
+ * LOGIN and PLAIN in that order and selects the first mechanism the
+ * server supports.
+ *
+ * If an authentication mechanism is explicitly chosen by the developer
+ * and the server does not support the authentication then the
+ * authentication will fail.
+ */
+void QsrMailTransport::setAuthMech(AuthMech mechanism)
+{
+    Q_D(QsrMailTransport);
+    d->authMech = mechanism;
+}
+
+/*!
+ * Returns the current authentication mechanism.
+ */
+QsrMailTransport::AuthMech QsrMailTransport::authMech() const
+{
+    Q_D(const QsrMailTransport);
+    return d->authMech;
+}
+
+/*!
+ * Set the system *identifier* for the SMTP dialog. The system identifier
+ * is presented to the SMTP server during the EHLO/HELO dialog. If not set
+ * the system identifier defaults to *localhost*.
+ */
+void QsrMailTransport::setSystemIdentifier(const QByteArray &value)
+{
+    Q_D(QsrMailTransport);
+    d->systemIdentifier = value;
+}
+
+/*!
+ * Return the currently set system identifier.
+ */
+QByteArray QsrMailTransport::systemIdentifier() const
+{
+    Q_D(const QsrMailTransport);
+    return d->systemIdentifier;
+}
+
+/*!
+ * This is the timeout for the communication with the SMTP server. If the
+ * server does not response within the given timeout (which is specified in
+ * milliseconds) the delivery fails and all messages will yield an error.
+ * Changing the property during mail delivery is not supported and may
+ * lead to unexpected results. If not specified the timeout is set to
+ * 60000 (equals 60 seconds).
+ */
+void QsrMailTransport::setTimeout(int timeout)
+{
+    Q_D(QsrMailTransport);
+    d->timeout = timeout;
+}
+
+/*!
+ * Return the current timeout for server communication.
+ */
+int QsrMailTransport::timeout() const
+{
+    Q_D(const QsrMailTransport);
+    return d->timeout;
+}
+
+/*!
+ * Set the *timeout* in milliseconds for establishing the connection to the
+ * SMTP server. This covers the connection attempts to all addresses of a
+ * server. A *timeout* of 0, the default, uses timeout().
+ */
+void QsrMailTransport::setConnectTimeout(int timeout)
+{
+    Q_D(QsrMailTransport);
+    d->connectTimeout = qMax(timeout, 0);
+}
+
+/*!
+ * Return the current timeout for establishing the connection.
+ */
+int QsrMailTransport::connectTimeout() const
+{
+    Q_D(const QsrMailTransport);
+    return d->connectTimeout;
+}
+
+/*!
+ * Set the *timeout* in milliseconds for the transfer of the message data.
+ * The timeout is extended whenever data is written, so it limits the time
+ * the transfer may stall rather than its duration. A *timeout* of 0, the
+ * default, uses timeout().
+ */
+void QsrMailTransport::setDataTimeout(int timeout)
+{
+    Q_D(QsrMailTransport);
+    d->dataTimeout = qMax(timeout, 0);
+}
+
+/*!
+ * Return the current timeout for the transfer of the message data.
+ */
+int QsrMailTransport::dataTimeout() const
+{
+    Q_D(const QsrMailTransport);
+    return d->dataTimeout;
+}
+
+/*!
+ * Set the required encryption *level* for the connection. The level can be:
+ *
+ * * TlsDisabled - which disables all encryption
+ * * TlsOptional - which makes encryption optional
+ * * TlsRequired - which makes encryption a must
+ * * TlsImplicit - which encrypts the connection before the banner
+ *
+ * Changing the property during mail delivery is not supported and may
+ * lead to unexpected results. If not specified the tls level is set to
+ * TlsOptional which is a reasonable setting.
+ */
+void QsrMailTransport::setTlsLevel(TlsLevel level)
+{
+    Q_D(QsrMailTransport);
+    d->tlsLevel = level;
+}
+
+/*!
+ * Return the currently set encryption level.
+ */
+QsrMailTransport::TlsLevel QsrMailTransport::tlsLevel() const
+{
+    Q_D(const QsrMailTransport);
+    return d->tlsLevel;
+}
+
+/*!
+ * Use this to set the ssl configuration used in the connection. Using
+ * this property the developer decides the encryption parameters and the
+ * level of trust (certificate authentication) for the connection.
+ * Changing the property during mail delivery is not supported and may
+ * lead to unexpected results. If not specified the Qt defaults will be
+ * used.
+ *
+ * \sa QSslConfiguration
+ */
+void QsrMailTransport::setSslConfiguration(const QSslConfiguration &value)
+{
+    Q_D(QsrMailTransport);
+    d->socket->setSslConfiguration(value);
+}
+
+/*!
+ * Return the currently used ssl configuration.
+ */
+QSslConfiguration QsrMailTransport::sslConfiguration() const
+{
+    Q_D(const QsrMailTransport);
+    return d->socket->sslConfiguration();
+}
+
+/*!
+ * Enable or disable the keep-alive mode. In keep-alive mode the session to
+ * the server is not closed when the queue runs empty; instead the idle()
+ * signal is emitted and messages queued afterwards are delivered right away
+ * without reconnecting, negotiating TLS and authenticating again. The
+ * session is closed by closeSession(), when the idleTimeout() expires or
+ * when the server drops the connection, which emits finished().
+ *
+ * The default is to close the session after the queue has been delivered.
+ *
+ * \sa setIdleTimeout(), setHeartbeatInterval()
+ */
+void QsrMailTransport::setKeepAlive(bool enabled)
+{
+    Q_D(QsrMailTransport);
+    d->keepAlive = enabled;
+}
+
+/*!
+ * Returns true if the session is kept open between deliveries.
+ */
+bool QsrMailTransport::keepAlive() const
+{
+    Q_D(const QsrMailTransport);
+    return d->keepAlive;
+}
+
+/*!
+ * Set the time in milliseconds an idle keep-alive session is kept open
+ * before it is closed. A *timeout* of 0 keeps the session open until
+ * closeSession() is called or the server drops the connection. If not
+ * specified the idle timeout is set to 60000 (equals 60 seconds).
+ */
+void QsrMailTransport::setIdleTimeout(int timeout)
+{
+    Q_D(QsrMailTransport);
+    d->idleTimeout = timeout;
+}
+
+/*!
+ * Return the current idle timeout for keep-alive sessions.
+ */
+int QsrMailTransport::idleTimeout() const
+{
+    Q_D(const QsrMailTransport);
+    return d->idleTimeout;
+}
+
+/*!
+ * Set the *interval* in milliseconds at which a NOOP command is sent to the
+ * server while a keep-alive session is idle. Servers usually drop idle
+ * connections after a few minutes; the heartbeat prevents that. An
+ * *interval* of 0 (the default) disables the heartbeat.
+ */
+void QsrMailTransport::setHeartbeatInterval(int interval)
+{
+    Q_D(QsrMailTransport);
+    d->heartbeatInterval = interval;
+}
+
+/*!
+ * Return the current heartbeat interval for keep-alive sessions.
+ */
+int QsrMailTransport::heartbeatInterval() const
+{
+    Q_D(const QsrMailTransport);
+    return d->heartbeatInterval;
+}
+
+/*!
+ * Set the maximum number of delivery *attempts* of a message. A message
+ * which fails with a transient (4xx) error or whose connection drops while
+ * it is sent is retried until it has been tried *attempts* times. The
+ * default of 1 disables retries. Messages with a body read from devices
+ * are retried only as long as the devices have not been read.
+ *
+ * \sa QsrMailTransaction::attempts(), setRetryInterval()
+ */
+void QsrMailTransport::setMaxAttempts(int attempts)
+{
+    Q_D(QsrMailTransport);
+    d->maxAttempts = qMax(attempts, 1);
+}
+
+/*!
+ * Return the maximum number of delivery attempts of a message.
+ */
+int QsrMailTransport::maxAttempts() const
+{
+    Q_D(const QsrMailTransport);
+    return d->maxAttempts;
+}
+
+/*!
+ * Set the *interval* in milliseconds before the first retry of a message
+ * which failed with a transient error. The interval doubles with every
+ * further attempt, up to maxRetryInterval(). Defaults to one minute.
+ * Retries after a dropped connection happen right away.
+ */
+void QsrMailTransport::setRetryInterval(int interval)
+{
+    Q_D(QsrMailTransport);
+    d->retryInterval = qMax(interval, 0);
+}
+
+/*!
+ * Return the interval before the first retry of a message.
+ */
+int QsrMailTransport::retryInterval() const
+{
+    Q_D(const QsrMailTransport);
+    return d->retryInterval;
+}
+
+/*!
+ * Set the maximum *interval* in milliseconds between two attempts of a
+ * message. Defaults to one hour.
+ */
+void QsrMailTransport::setMaxRetryInterval(int interval)
+{
+    Q_D(QsrMailTransport);
+    d->maxRetryInterval = qMax(interval, 0);
+}
+
+/*!
+ * Return the maximum interval between two attempts of a message.
  */
-void QsrMailTransportPrivate::write(const QByteArray &data)
+int QsrMailTransport::maxRetryInterval() const
 {
-    socket->write(data % "\r\n");
+    Q_D(const QsrMailTransport);
+    return d->maxRetryInterval;
 }
 
 /*!
- * \internal
- *
- * Reset the internal states. Required when the next response is parsed.
+ * Set the number of transient *failures* in a row after which no more
+ * messages are sent to a server for circuitBreakerTimeout(). The failures
+ * are counted per server by all transports of the process. Messages held
+ * back by the circuit breaker are sent when it closes and do not lose an
+ * attempt. A value of 0 (the default) disables the circuit breaker.
  */
-void QsrMailTransportPrivate::SmtpResponse::reset()
+void QsrMailTransport::setCircuitBreakerThreshold(int failures)
 {
-    line.clear();
-    lines.clear();
-    code = 0;
-    isValid = false;
-    isEmpty = true;
-    isCompleted = false;
-    isIntermediate = false;
-    isTransientError = false;
-    isPermanentError = false;
-    isSuccess = false;
-    isError = false;
+    Q_D(QsrMailTransport);
+    d->breakerThreshold = qMax(failures, 0);
 }
 
 /*!
- * \internal
- *
- * Append the *data* response from the server to the structure. After the
- * function splitted the data it sets its members accordingly. The response
- * is considered complete when the isValid flag is set after this call. The
- * function returns false if *data* is not parsable.
+ * Return the number of transient failures which open the circuit breaker.
  */
-bool QsrMailTransportPrivate::SmtpResponse::append(const QByteArray &data)
+int QsrMailTransport::circuitBreakerThreshold() const
 {
-    bool cont = false;
-    const char *p = 0;
-    const char *lp = 0;
-    int s = 0;
-    code = 0;
-
-    for (p=data.constData(); *p && *p!='\r' && *p!='\n'; ) {
-        char c = *p++;
-
-        switch (s) {
-        case 0: /* response code */
-        case 1:
-        case 2:
-            if (c < '0' || c > '9')
-                return false;
-            code *= 10;
-            code += c - '0';
-            s++;
-            break;
-
-        case 3: /* continuation */
-            if (c == '-')
-                cont = true;
-            else if (c != ' ')
-                return false;
-            lp = p;
-            s++;
-            break;
-        }
-    }
-
-    if (s != 4)
-        return false;
-
-    isCompleted = code >= 200 && code < 300;
-    isIntermediate = code >= 300 && code < 400;
-    isTransientError = code >= 400 && code < 500;
-    isPermanentError = code >= 500 && code < 600;
-    isSuccess = code >= 200 && code < 400;
-    isError = code >= 400 && code < 600;
-
-    line = QByteArray(lp, static_cast<int>(p-lp));
-    lines.append(line);
-    if (!cont)
-        isValid = true;
-
-    isEmpty = false;
-    return true;
+    Q_D(const QsrMailTransport);
+    return d->breakerThreshold;
 }
 
-/* -------------------------------------------------------------------------- */
-
 /*!
- * Construct a new mail transport. Optionally assign a *parent* to
- * the object.
+ * Set the *timeout* in milliseconds for which the circuit breaker of a
+ * server stays open. Defaults to five minutes.
  */
-QsrMailTransport::QsrMailTransport(QObject *parent) :
-    QObject(parent),
-    d_ptr(new QsrMailTransportPrivate(this))
+void QsrMailTransport::setCircuitBreakerTimeout(int timeout)
 {
     Q_D(QsrMailTransport);
+    d->breakerTimeout = qMax(timeout, 0);
+}
 
-    /* setup the socket */
-    d->socket = new QSslSocket(this);
-    connect(d->socket, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
-            this, SLOT(_q_stateChanged(QAbstractSocket::SocketState)));
-    connect(d->socket, SIGNAL(readyRead()),
-            this, SLOT(_q_socketReadyRead()));
-    connect(d->socket, SIGNAL(encryptedBytesWritten(qint64)),
-            this, SLOT(_q_encryptedBytesWritten(qint64)));
-    connect(d->socket, SIGNAL(bytesWritten(qint64)),
-            this, SLOT(_q_bytesWritten(qint64)));
-
-
-
-    /* setup the timer */
-    d->timer = new QTimer(this);
-    connect(d->timer, SIGNAL(timeout()), this, SLOT(_q_timeout()));
-
-    d->timer->setSingleShot(true);
+/*!
+ * Return the time the circuit breaker of a server stays open.
+ */
+int QsrMailTransport::circuitBreakerTimeout() const
+{
+    Q_D(const QsrMailTransport);
+    return d->breakerTimeout;
 }
 
 /*!
- * \internal
+ * Limit the *messages* per second sent to a server. The limit is shared
+ * by all transports of the process delivering to the server, so a pool
+ * or a router stays below it however many connections it opens. Messages
+ * are paced in the ReadyToSendState until the limit allows the next one.
  *
- * Constructor for derived classes. Constructs an instance from *qq* and
- * *parent*.
+ * Transient rejections by the server halve the rate, which recovers with
+ * every delivered message, so the transports run close to the rate the
+ * server accepts. A value of 0 (the default) disables the limit.
+ *
+ * \sa setRecipientRate(), setMaxServerConnections()
  */
-QsrMailTransport::QsrMailTransport(QsrMailTransportPrivate &qq,
-                                   QObject *parent) :
-    QObject(parent),
-    d_ptr(&qq)
+void QsrMailTransport::setMessageRate(double messages)
 {
+    Q_D(QsrMailTransport);
+    d->messageRate = qMax(messages, 0.0);
 }
 
 /*!
- * Destroys the instance
+ * Return the maximum number of messages per second sent to a server.
  */
-QsrMailTransport::~QsrMailTransport()
+double QsrMailTransport::messageRate() const
 {
+    Q_D(const QsrMailTransport);
+    return d->messageRate;
 }
 
 /*!
- * Set the *username* used for authentication with the SMTP server.
+ * Limit the *recipients* per second sent to a server. The limit is shared
+ * and adapted just like the messageRate(). A value of 0 (the default)
+ * disables the limit.
  */
-void QsrMailTransport::setUser(const QString &username)
+void QsrMailTransport::setRecipientRate(double recipients)
 {
     Q_D(QsrMailTransport);
-    d->username = username;
+    d->recipientRate = qMax(recipients, 0.0);
 }
 
 /*!
- * Returns the currently set username for authentication.
+ * Return the maximum number of recipients per second sent to a server.
  */
-QString QsrMailTransport::user() const
+double QsrMailTransport::recipientRate() const
 {
     Q_D(const QsrMailTransport);
-    return d->username;
+    return d->recipientRate;
 }
 
 /*!
- * Set the *password* used for authentication with the SMTP server.
- * Please be aware that the password is stored in **cleartext** within
- * the object in a not particullary safe storage.
+ * Limit the number of *connections* to a server of all transports of the
+ * process. A transport which finds all of them in use holds its messages
+ * back and tries again after a second; held messages do not lose an
+ * attempt. A value of 0 (the default) disables the limit.
  */
-void QsrMailTransport::setPassword(const QString &passwd)
+void QsrMailTransport::setMaxServerConnections(int connections)
 {
     Q_D(QsrMailTransport);
-    d->password = passwd;
+    d->maxServerConnections = qMax(connections, 0);
 }
 
 /*!
- * Returns the currently set password for authentication
+ * Return the maximum number of connections to a server.
  */
-QString QsrMailTransport::password() const
+int QsrMailTransport::maxServerConnections() const
 {
     Q_D(const QsrMailTransport);
-    return d->password;
+    return d->maxServerConnections;
 }
 
 /*!
- * Set the authentication mechanism. The default is to use autodetection
- * of the best possible mechanism. The detection checks for CRAM-MD5,
- * LOGIN and PLAIN in that order and selects the first mechanism the
- * server supports.
+ * Enable or disable rendering on worker threads. If enabled, messages are
+ * rendered and encoded by one of a process wide pool of render threads
+ * instead of the thread of the transport, so a large attachment does not
+ * delay the other transports of that thread. The encoded data is passed to
+ * the transport through a lock-free buffer; a renderer which gets ahead of
+ * the socket waits until the buffer has been drained.
  *
- * If an authentication mechanism is explicitly chosen by the developer
- * and the server does not support the authentication then the
- * authentication will fail.
+ * Messages with bodies read from sequential devices, which usually depend
+ * on the event loop of their thread, and bulk deliveries are rendered on
+ * the thread of the transport regardless of this setting. Devices of the
+ * other messages must not be accessed while the message is delivered.
+ *
+ * The default is to render on the thread of the transport.
  */
-void QsrMailTransport::setAuthMech(AuthMech mechanism)
+void QsrMailTransport::setThreadedRendering(bool enabled)
 {
     Q_D(QsrMailTransport);
-    d->authMech = mechanism;
+    d->threadedRendering = enabled;
 }
 
 /*!
- * Returns the current authentication mechanism.
+ * Returns true if messages are rendered on worker threads.
  */
-QsrMailTransport::AuthMech QsrMailTransport::authMech() const
+bool QsrMailTransport::threadedRendering() const
 {
     Q_D(const QsrMailTransport);
-    return d->authMech;
+    return d->threadedRendering;
 }
 
 /*!
- * Set the system *identifier* for the SMTP dialog. The system identifier
- * is presented to the SMTP server during the EHLO/HELO dialog. If not set
- * the system identifier defaults to *localhost*.
+ * Set the number of *messages* queued behind the message in transfer which
+ * are rendered in advance. A prefetched message is rendered and encoded
+ * while the previous message is transferred and its envelope is
+ * negotiated, so its data is at hand as soon as the server accepts it.
+ * The prefetching of a message stops when its buffer is full, so each
+ * message prefetched holds one ringbuffer taken from the buffer pool of
+ * the transport. Combine with setThreadedRendering() to render the
+ * prefetched messages on the render threads.
+ *
+ * Only messages which can be rendered again in case of a retry are
+ * prefetched, ie. messages without QIODevice bodies, and no messages of
+ * bulk deliveries. If not specified no messages are prefetched.
  */
-void QsrMailTransport::setSystemIdentifier(const QByteArray &value)
+void QsrMailTransport::setPrefetchDepth(int messages)
 {
     Q_D(QsrMailTransport);
-    d->systemIdentifier = value;
+    d->prefetchDepth = qMax(0, messages);
+    d->bufferPool.setMaxBuffers(d->prefetchDepth + 2);
 }
 
 /*!
- * Return the currently set system identifier.
+ * Returns the number of messages rendered in advance.
  */
-QByteArray QsrMailTransport::systemIdentifier() const
+int QsrMailTransport::prefetchDepth() const
 {
     Q_D(const QsrMailTransport);
-    return d->systemIdentifier;
+    return d->prefetchDepth;
 }
 
 /*!
- * This is the timeout for the communication with the SMTP server. If the
- * server does not response within the given timeout (which is specified in
- * milliseconds) the delivery fails and all messages will yield an error.
- * Changing the property during mail delivery is not supported and may
- * lead to unexpected results. If not specified the timeout is set to
- * 60000 (equals 60 seconds).
+ * Set the fill levels of the render buffer of the messages. The body is
+ * rendered until *high* bytes are buffered, and rendering resumes once
+ * the socket drained the buffer to *low* bytes, so the next data is
+ * encoded while the rest of the buffer is still being sent. A value of 0
+ * selects the default, which is a quarter of the buffer for *low* and the
+ * full buffer for *high*. The levels apply to messages queued afterwards.
  */
-void QsrMailTransport::setTimeout(int timeout)
+void QsrMailTransport::setBufferWatermarks(int low, int high)
 {
     Q_D(QsrMailTransport);
-    d->timeout = timeout;
+    d->lowWatermark = qMax(0, low);
+    d->highWatermark = qMax(0, high);
 }
 
 /*!
- * Return the current timeout for server communication.
+ * Returns the fill level at which rendering resumes or 0 for the default.
  */
-int QsrMailTransport::timeout() const
+int QsrMailTransport::lowBufferWatermark() const
 {
     Q_D(const QsrMailTransport);
-    return d->timeout;
+    return d->lowWatermark;
 }
 
 /*!
- * Set the required encryption *level* for the connection. The level can be:
+ * Returns the fill level up to which messages are rendered or 0 for the
+ * default.
+ */
+int QsrMailTransport::highBufferWatermark() const
+{
+    Q_D(const QsrMailTransport);
+    return d->highWatermark;
+}
+
+/*!
+ * Deliver the messages of *spool* in addition to the queued messages.
+ * Every call of sendMessages() takes the messages waiting in the spool
+ * and delivers them, keeping at most spoolWindow() of them in memory at
+ * a time. Delivered and permanently rejected messages are removed from
+ * the spool; their transactions are reported by transactionFinished()
+ * like any other. After a transient failure the transport stops taking
+ * messages from the spool, the remaining messages are delivered by the
+ * next call of sendMessages().
  *
- * * TlsDisabled - which disables all encryption
- * * TlsOptional - which makes encryption optional
- * * TlsRequired - which makes encryption a must
+ * The message() of the transaction of a spooled message only carries the
+ * envelope. The spool has to be opened, has to live in the thread of the
+ * transport and must not be shared with other transports. Pass null to
+ * stop using the spool.
  *
- * Changing the property during mail delivery is not supported and may
- * lead to unexpected results. If not specified the tls level is set to
- * TlsOptional which is a reasonable setting.
+ * \sa QsrMailSpool
  */
-void QsrMailTransport::setTlsLevel(TlsLevel level)
+void QsrMailTransport::setSpool(QsrMailSpool *spool)
 {
     Q_D(QsrMailTransport);
-    d->tlsLevel = level;
+    d->spool = spool;
 }
 
 /*!
- * Return the currently set encryption level.
+ * Returns the spool delivered by the transport or null if none is set.
  */
-QsrMailTransport::TlsLevel QsrMailTransport::tlsLevel() const
+QsrMailSpool *QsrMailTransport::spool() const
 {
     Q_D(const QsrMailTransport);
-    return d->tlsLevel;
+    return d->spool.data();
 }
 
 /*!
- * Use this to set the ssl configuration used in the connection. Using
- * this property the developer decides the encryption parameters and the
- * level of trust (certificate authentication) for the connection.
- * Changing the property during mail delivery is not supported and may
- * lead to unexpected results. If not specified the Qt defaults will be
- * used.
- *
- * \sa QSslConfiguration
+ * Set the number of spooled *messages* the transport keeps in memory at
+ * a time. The window includes the messages waiting for a retry. The
+ * default is 16 messages; values below 1 are treated as 1.
  */
-void QsrMailTransport::setSslConfiguration(const QSslConfiguration &value)
+void QsrMailTransport::setSpoolWindow(int messages)
 {
     Q_D(QsrMailTransport);
-    d->socket->setSslConfiguration(value);
+    d->spoolWindow = qMax(1, messages);
 }
 
 /*!
- * Return the currently used ssl configuration.
+ * Returns the number of spooled messages kept in memory at a time.
  */
-QSslConfiguration QsrMailTransport::sslConfiguration() const
+int QsrMailTransport::spoolWindow() const
 {
     Q_D(const QsrMailTransport);
-    return d->socket->sslConfiguration();
+    return d->spoolWindow;
 }
 
 /*!
  * Add *message* to the queue of messages which should be delivered to the
  * SMTP server. To deliver the mail queue use sendMessages().
  * Adding messages during mail delivery is not supported and will lead
- * to unexpected results (namely memory corruption).
+ * to unexpected results (namely memory corruption). The exception is an
+ * idle keep-alive session which delivers the message right away.
  *
  * The function returns a QsrMailTransaction object which is used to track
  * the delivery. It is up to the developer to dispose the object once it
@@ -1665,6 +4687,59 @@ QsrMailTransaction * QsrMailTransport::queueMessage(
     return d->queueMessageImpl(message);
 }
 
+/*!
+ * \overload
+ *
+ * Add the rendered *message* to the queue. The message is delivered to
+ * its recipients as rendered, no matter how often it is queued or retried.
+ * File backed messages are sent from their file by sendfile() where
+ * possible.
+ *
+ * \sa QsrMailRenderedMessage
+ */
+QsrMailTransaction *QsrMailTransport::queueMessage(
+        const QsrMailRenderedMessage &message)
+{
+    Q_D(QsrMailTransport);
+    return d->queueRendered(message);
+}
+
+/*!
+ * Queue a bulk delivery of the template *message* to all *envelopes*. For
+ * every envelope a copy of the message is queued which is addressed to the
+ * recipients of the envelope and carries the headers of the envelope. The
+ * To, Cc and Bcc addresses of the template are ignored and every copy gets
+ * its own Message-ID.
+ *
+ * The body of the template is rendered and encoded only once. The first
+ * message records its body, all following messages only render their own
+ * headers and send the recorded body. Bodies larger than 64MB are not
+ * recorded and are rendered for every message; in this case the body must
+ * not contain devices, since they can be read only once. The same applies
+ * if the delivery of the first message fails before its body has been
+ * rendered completely: messages whose body cannot be rendered anymore fail
+ * with QsrMailTransaction::DataError.
+ *
+ * Returns one QsrMailTransaction for each envelope, in the order of the
+ * *envelopes*. The same rules as for queueMessage() apply.
+ *
+ * \sa QsrMailEnvelope
+ */
+QList<QsrMailTransaction *> QsrMailTransport::queueBulk(
+        const QsrMailMessage &message,
+        const QList<QsrMailEnvelope> &envelopes)
+{
+    Q_D(QsrMailTransport);
+
+    QSharedPointer<QsrMailSharedBody> body(new QsrMailSharedBody);
+    QList<QsrMailTransaction *> result;
+
+    foreach (const QsrMailEnvelope &envelope, envelopes)
+        result.append(d->queueEnvelope(message, envelope, body));
+
+    return result;
+}
+
 /*!
  * Start the mail delivery of the messages.
  *
@@ -1677,15 +4752,21 @@ QsrMailTransaction * QsrMailTransport::queueMessage(
  * port 587 is also very popular for mail submission using authentication.
  *
  * Make sure you do **not** call this function when a mail delivery is
- * already running. Keep track of the finished() signal!
+ * already running. Keep track of the finished() signal! If a keep-alive
+ * session to the same server is idle the session is reused.
  */
 void QsrMailTransport::sendMessages(const QString &serverHostname, quint16 port,
                                     QAbstractSocket::NetworkLayerProtocol protocol)
 {
     Q_D(QsrMailTransport);
 
+    /* reuse an idle keep-alive session */
+    if (d->resumeSession(serverHostname, QHostAddress(), port))
+        return;
+
     /* setup input states and start the fsm */
     d->serverHostname = serverHostname;
+    d->fallbackHostnames.clear();
     d->serverProtocol = protocol;
     d->serverAddress = QHostAddress();
     d->serverPort = port;
@@ -1702,12 +4783,156 @@ void QsrMailTransport::sendMessages(const QHostAddress &serverAddress,
 {
     Q_D(QsrMailTransport);
 
+    if (d->resumeSession(QString(), serverAddress, port))
+        return;
+
     d->serverHostname = QString();
+    d->fallbackHostnames.clear();
     d->serverProtocol = serverAddress.protocol();
     d->serverAddress = serverAddress;
+    d->serverAddresses.clear();
+    d->serverPort = port;
+
+    d->sendMessagesImpl(QsrMailTransportPrivate::ConnectingState);
+}
+
+/*!
+ * This is an overloaded version which tries the servers of the list
+ * *serverHostnames* in order. The next server is used if the name cannot be
+ * resolved or if the session fails before the server is ready to accept
+ * messages, e.g. because the connection is refused or times out. Once a
+ * session has been established the remaining servers are not used anymore.
+ *
+ * This is the delivery to the mail exchangers of a domain, see
+ * QsrMailRouter. If the list is empty all queued messages fail with
+ * QsrMailTransaction::ResolverError.
+ */
+void QsrMailTransport::sendMessages(const QStringList &serverHostnames,
+                                    quint16 port,
+                                    QAbstractSocket::NetworkLayerProtocol protocol)
+{
+    Q_D(QsrMailTransport);
+
+    if (serverHostnames.isEmpty()) {
+        d->rejectQueue(QsrMailTransaction::ResolverError,
+                       tr("no server to deliver to"));
+        return;
+    }
+
+    if (d->resumeSession(serverHostnames.first(), QHostAddress(), port))
+        return;
+
+    d->serverHostname = serverHostnames.first();
+    d->fallbackHostnames = serverHostnames.mid(1);
+    d->serverProtocol = protocol;
+    d->serverAddress = QHostAddress();
     d->serverPort = port;
 
-    d->sendMessagesImpl(QsrMailTransportPrivate::ConnectedState);
+    d->sendMessagesImpl(QsrMailTransportPrivate::ResolvingState);
+}
+
+/*!
+ * Enable the protocol trace which keeps the last *entries* lines of the
+ * SMTP dialog, including the connection events, in a ring of fixed size.
+ * A size of 0 disables the trace, which is the default.
+ *
+ * The beginning of each line is recorded together with a timestamp, which
+ * is cheap enough to keep the trace enabled in production. Of the message
+ * data only the first line is recorded, and the credentials sent for AUTH
+ * are replaced by "<redacted>". When a message fails the trace is kept
+ * with its transaction, see QsrMailTransaction::protocolTrace().
+ *
+ * Changing the size discards the recorded trace. It must not be changed
+ * while other threads read protocolTrace().
+ */
+void QsrMailTransport::setTraceSize(int entries)
+{
+    Q_D(QsrMailTransport);
+
+    if (entries <= 0)
+        d->trace.reset();
+    else
+        d->trace.reset(new QsrMailTraceRing(entries));
+}
+
+/*!
+ * Returns the number of lines kept by the protocol trace or 0 if the
+ * trace is disabled.
+ */
+int QsrMailTransport::traceSize() const
+{
+    Q_D(const QsrMailTransport);
+    return d->trace.isNull() ? 0 : d->trace->size();
+}
+
+/*!
+ * Returns the lines of the protocol trace, oldest first. Each line starts
+ * with the time in seconds of a monotonic clock, followed by "C:" for the
+ * commands, "S:" for the responses or "*" for connection events. Long
+ * lines are truncated and end with their size in bytes.
+ *
+ * The trace is read without locking the transport, so this method may be
+ * called from any thread, eg. when a delivery seems to hang.
+ */
+QByteArray QsrMailTransport::protocolTrace() const
+{
+    Q_D(const QsrMailTransport);
+    return d->trace.isNull() ? QByteArray() : d->trace->dump();
+}
+
+/*!
+ * Set the interval in *msecs* at which notifications are delivered for
+ * bulk runs. An interval of 0, the default, emits every notification
+ * right away.
+ *
+ * With an interval the progress signals of the transport and of the
+ * current transaction are emitted at most once per interval, and finished
+ * transactions are delivered in batches by transactionsFinished() instead
+ * of transactionFinished(). This keeps the signal overhead flat however
+ * many messages are sent. Pending notifications are always delivered
+ * before idle() and finished() are emitted.
+ */
+void QsrMailTransport::setNotificationInterval(int msecs)
+{
+    Q_D(QsrMailTransport);
+    d->notifyInterval = qMax(msecs, 0);
+}
+
+/*!
+ * Returns the interval at which notifications are delivered or 0 if they
+ * are emitted right away.
+ */
+int QsrMailTransport::notificationInterval() const
+{
+    Q_D(const QsrMailTransport);
+    return d->notifyInterval;
+}
+
+/*!
+ * Returns a snapshot of the delivery counters of the transport. The
+ * counters are updated without locking, so this method may be called from
+ * any thread while the transport delivers its messages.
+ *
+ * \sa QsrMailStatistics, QsrMailTransportPool::statistics()
+ */
+QsrMailStatistics QsrMailTransport::statistics() const
+{
+    Q_D(const QsrMailTransport);
+    return d->statistics.snapshot();
+}
+
+/*!
+ * Clears the process wide cache of TLS sessions. Subsequent connections
+ * perform a full handshake with the server.
+ *
+ * \sa QsrMailTransaction::isSessionResumed()
+ */
+void QsrMailTransport::clearTlsSessionCache()
+{
+    QsrMailTlsSessionCache *cache = tlsSessionCache();
+
+    QMutexLocker lock(&cache->mutex);
+    cache->tickets.clear();
 }
 
 /*!
@@ -1719,7 +4944,38 @@ void QsrMailTransport::abort()
     Q_D(QsrMailTransport);
 
     d->aborted = true;
-    d->socket->disconnectFromHost();
+    d->spoolStopped = true;
+
+    /* Without a session only deferred messages are left */
+    if (d->state == QsrMailTransportPrivate::IdleState
+            || d->state == QsrMailTransportPrivate::FinishedState) {
+        if (!d->deferred.isEmpty()) {
+            d->state = QsrMailTransportPrivate::DisconnectedState;
+            QMetaObject::invokeMethod(this, "_q_processStates",
+                                      Qt::QueuedConnection);
+        }
+        return;
+    }
+
+    if (!d->stopRace())
+        d->socket->disconnectFromHost();
+}
+
+/*!
+ * Gracefully close a keep-alive session. If messages are still being
+ * delivered the session is closed after the queue has been processed.
+ * The finished() signal is emitted once the connection has been closed.
+ */
+void QsrMailTransport::closeSession()
+{
+    Q_D(QsrMailTransport);
+
+    d->closeRequested = true;
+    d->spoolStopped = true;
+
+    if (d->state == QsrMailTransportPrivate::KeepAliveState)
+        QMetaObject::invokeMethod(this, "_q_resumeSession",
+                                  Qt::QueuedConnection);
 }
 
 QT_END_NAMESPACE
@@ -25,11 +25,18 @@
 #include "qsrmailglobal.h"
 #include <QObject>
 #include <QAbstractSocket>
+#include <QList>
+#include <QVector>
+#include <QStringList>
 
 QT_BEGIN_NAMESPACE
 
 class QsrMailMessage;
+class QsrMailEnvelope;
+class QsrMailRenderedMessage;
 class QsrMailTransaction;
+class QsrMailStatistics;
+class QsrMailSpool;
 class QsrMailTransportPrivate;
 class QHostAddress;
 class QSslConfiguration;
@@ -44,7 +51,8 @@ public:
     enum TlsLevel {
         TlsDisabled,
         TlsOptional,
-        TlsRequired
+        TlsRequired,
+        TlsImplicit
     };
 
     enum AuthMech {
@@ -74,13 +82,72 @@ public:
     void setTimeout(int timeout);
     int timeout() const;
 
+    void setConnectTimeout(int timeout);
+    int connectTimeout() const;
+
+    void setDataTimeout(int timeout);
+    int dataTimeout() const;
+
     void setTlsLevel(QsrMailTransport::TlsLevel level);
     QsrMailTransport::TlsLevel tlsLevel() const;
 
     void setSslConfiguration(const QSslConfiguration &value);
     QSslConfiguration sslConfiguration() const;
 
+    void setKeepAlive(bool enabled);
+    bool keepAlive() const;
+
+    void setIdleTimeout(int timeout);
+    int idleTimeout() const;
+
+    void setHeartbeatInterval(int interval);
+    int heartbeatInterval() const;
+
+    void setMaxAttempts(int attempts);
+    int maxAttempts() const;
+
+    void setRetryInterval(int interval);
+    int retryInterval() const;
+
+    void setMaxRetryInterval(int interval);
+    int maxRetryInterval() const;
+
+    void setCircuitBreakerThreshold(int failures);
+    int circuitBreakerThreshold() const;
+
+    void setCircuitBreakerTimeout(int timeout);
+    int circuitBreakerTimeout() const;
+
+    void setMessageRate(double messages);
+    double messageRate() const;
+
+    void setRecipientRate(double recipients);
+    double recipientRate() const;
+
+    void setMaxServerConnections(int connections);
+    int maxServerConnections() const;
+
+    void setThreadedRendering(bool enabled);
+    bool threadedRendering() const;
+
+    void setPrefetchDepth(int messages);
+    int prefetchDepth() const;
+
+    void setBufferWatermarks(int low, int high);
+    int lowBufferWatermark() const;
+    int highBufferWatermark() const;
+
+    void setSpool(QsrMailSpool *spool);
+    QsrMailSpool *spool() const;
+
+    void setSpoolWindow(int messages);
+    int spoolWindow() const;
+
     QsrMailTransaction *queueMessage(const QsrMailMessage &message);
+    QsrMailTransaction *queueMessage(const QsrMailRenderedMessage &message);
+    QList<QsrMailTransaction *> queueBulk(
+            const QsrMailMessage &message,
+            const QList<QsrMailEnvelope> &envelopes);
 
     void sendMessages(const QString &serverHostname,
                       quint16 serverPort = 25,
@@ -90,12 +157,31 @@ public:
     void sendMessages(const QHostAddress &serverAddress,
                       quint16 serverPort = 25);
 
+    void sendMessages(const QStringList &serverHostnames,
+                      quint16 serverPort = 25,
+                      QAbstractSocket::NetworkLayerProtocol
+                      protocol = QAbstractSocket::AnyIPProtocol);
+
+    void setTraceSize(int entries);
+    int traceSize() const;
+    QByteArray protocolTrace() const;
+
+    void setNotificationInterval(int msecs);
+    int notificationInterval() const;
+
+    QsrMailStatistics statistics() const;
+
+    static void clearTlsSessionCache();
+
 public Q_SLOTS:
     void abort();
+    void closeSession();
 
 Q_SIGNALS:
     void progressUpdate(int percent);
     void transactionFinished(QsrMailTransaction *transaction);
+    void transactionsFinished(const QVector<QsrMailTransaction *> &transactions);
+    void idle();
     void finished();
 
 protected:
@@ -103,6 +189,8 @@ protected:
 
 protected:
     Q_DECLARE_PRIVATE(QsrMailTransport)
+    friend class QsrMailRouterPrivate;
+    friend class QsrMailTransportPoolPrivate;
 
     QScopedPointer<QsrMailTransportPrivate> d_ptr;
 
@@ -111,10 +199,18 @@ protected:
     Q_PRIVATE_SLOT(d_func(), void _q_encryptedBytesWritten(qint64))
     Q_PRIVATE_SLOT(d_func(), void _q_bytesWritten(qint64))
     Q_PRIVATE_SLOT(d_func(), void _q_writeMessageData())
-    Q_PRIVATE_SLOT(d_func(), void _q_messageProgress(int, int))
+    Q_PRIVATE_SLOT(d_func(), void _q_messageProgress(qint64, qint64))
     Q_PRIVATE_SLOT(d_func(), void _q_transactionFinished())
     Q_PRIVATE_SLOT(d_func(), void _q_processStates())
     Q_PRIVATE_SLOT(d_func(), void _q_timeout())
+    Q_PRIVATE_SLOT(d_func(), void _q_raceTimeout())
+    Q_PRIVATE_SLOT(d_func(), void _q_racerStateChanged(QAbstractSocket::SocketState))
+    Q_PRIVATE_SLOT(d_func(), void _q_idleTimeout())
+    Q_PRIVATE_SLOT(d_func(), void _q_heartbeat())
+    Q_PRIVATE_SLOT(d_func(), void _q_resumeSession())
+    Q_PRIVATE_SLOT(d_func(), void _q_retryTimeout())
+    Q_PRIVATE_SLOT(d_func(), void _q_notify())
+    Q_PRIVATE_SLOT(d_func(), void _q_pace())
 };
 
 QT_END_NAMESPACE
@@ -24,17 +24,30 @@
 
 #include "qsrmailtransport.h"
 #include "qsrmailtransaction_p.h"
+#include "qsrmaildotstuffer_p.h"
+#include "qsrmailbufferpool_p.h"
+#include "qsrmailrecipientset_p.h"
+#include "qsrmailstatistics_p.h"
+#include "qsrmailtrace_p.h"
+#include "qsrmailtimerwheel_p.h"
+#include "qsrmailspool.h"
 
 #include <QSslSocket>
+#include <QFile>
 #include <QQueue>
 #include <QHostAddress>
 #include <QTimer>
+#include <QSharedPointer>
+#include <QScopedPointer>
+#include <QPointer>
 
 QT_BEGIN_NAMESPACE
 
 class QsrMailTransport;
 class QsrMailTransportPrivate
 {
+    friend class QsrMailRouterPrivate;
+
 public:
     enum State {
         IdleState,
@@ -54,12 +67,21 @@ public:
         RcptToState,
         DataState,
         EndOfMessageState,
+        BdatState,
         DataSentState,
+        KeepAliveState,
+        NoopState,
         ClosingState,
         DisconnectedState,
         FinishedState
     };
 
+    struct Segment
+    {
+        const char *data;
+        int size;
+    };
+
 public:
     explicit QsrMailTransportPrivate(QsrMailTransport *qq);
 
@@ -68,14 +90,29 @@ public:
     void _q_writeMessageData();
     void _q_encryptedBytesWritten(qint64 size);
     void _q_bytesWritten(qint64 size);
-    void _q_messageProgress(int processed, int total);
+    void _q_messageProgress(qint64 processed, qint64 total);
     void _q_transactionFinished();
     void _q_timeout();
+    void _q_raceTimeout();
+    void _q_racerStateChanged(QAbstractSocket::SocketState socketState);
+    void _q_idleTimeout();
+    void _q_heartbeat();
+    void _q_resumeSession();
+    void _q_retryTimeout();
+    void _q_notify();
+    void _q_pace();
     void _q_processStates();
 
 private:
-    void enumExtensions(const QList<QByteArray> &lines);
+    void enumExtensions(const QByteArray &text);
 
+    QByteArray authCommand();
+    QsrMailTransport::AuthMech cachedAuthMech() const;
+    void saveAuthMech(bool succeeded);
+    int effectiveConnectTimeout() const;
+    int effectiveDataTimeout() const;
+    void scheduleNotification();
+    void flushNotifications();
     QByteArray authResponse(const QString &challenge);
     QByteArray cramMd5Mech(const QByteArray &challenge,
                            const QByteArray &user,
@@ -87,25 +124,73 @@ private:
                          const QByteArray &user,
                          const QByteArray &pass);
 
-    QsrMailTransaction *queueMessageImpl(const QsrMailMessage &message);
+    QsrMailTransaction *queueMessageImpl(
+            const QsrMailMessage &message,
+            const QList<QsrMailAddress> &forwardPaths =
+            QList<QsrMailAddress>());
+    QsrMailTransaction *queueRendered(
+            const QsrMailRenderedMessage &message);
+    void queueTransaction(QsrMailTransaction *t);
+    QsrMailTransaction *queueEnvelope(
+            const QsrMailMessage &message, const QsrMailEnvelope &envelope,
+            const QSharedPointer<QsrMailSharedBody> &body);
     void sendMessagesImpl(State initState);
-    bool setupTransaction();    
+    bool nextServer();
+    void setupSocket(QSslSocket *s);
+    void startRacer();
+    void cancelRacers();
+    bool stopRace();
+    void rejectQueue(QsrMailTransaction::TransactionError error,
+                     const QString &errorText);
+    bool resumeSession(const QString &hostname, const QHostAddress &address,
+                       quint16 port);
+    QString serverKey() const;
+    void offerTlsSession();
+    void tlsEstablished();
+    void saveTlsSession(const QByteArray &ticket);
+    void dropTlsSession(const QByteArray &ticket);
+    void rejectTransaction(QsrMailTransactionPrivate *t, bool transient);
+    void rejectRecipients();
+    void protocolError(const QByteArray &line);
+    bool deferTransaction(QsrMailTransactionPrivate *t);
+    void scheduleRetry();
+    bool holdQueue();
+    void updateBreaker(bool failed);
+    bool isPaced() const;
+    qint64 paceDelay();
+    void consumeTokens(int recipients);
+    void updateThrottle(bool failed);
+    bool acquireConnection();
+    void releaseConnection();
+    bool setupTransaction();
+    void startRenderer();
+    void launchRenderer(QsrMailRenderer *r);
+    void prefetchRenderers();
+    bool startFileTransfer();
+    void sendFileData();
 
     void finalizeQueue(QsrMailTransaction::TransactionError error,
                        const QString &errorText);
     void finalizeQueue(QsrMailTransaction::TransactionError error);
 
     void write(const QByteArray &data);
+    void traceCommand(const QByteArray &data);
+    void fillFromSpool();
+    void returnToSpool(QsrMailTransactionPrivate *t, bool finished);
+    void writeSegments(const Segment *segments, int count);
+    void setCorked(bool enabled);
+    void updateWriteWindow(qint64 elapsed);
 
 public:
     /* Response helper */
     struct SmtpResponse
     {
         void reset();
-        bool append(const QByteArray &data);
+        bool append(const char *data, int size);
+        QByteArray line() const;
 
-        QByteArray line;
-        QList<QByteArray> lines;
+        QByteArray text;
+        int lineOffset;
         int code;
         bool isValid;
         bool isEmpty;
@@ -122,18 +207,43 @@ public:
 
     /* instance data */
     QsrMailTransport *q_ptr;
-    QTimer *timer;
+    QsrMailDeadline *timer;
+    QTimer *idleTimer;
+    QTimer *heartbeatTimer;
+    QTimer *raceTimer;
+    QTimer *retryTimer;
+    QTimer *notifyTimer;
+    QTimer *paceTimer;
     QSslSocket *socket;
+    QList<QSslSocket *> racers;
+    int raceIndex;
+    QString connectError;
+    QByteArray offeredTicket;
+    QString connectionKey;
+    bool sessionResumed;
     State state;
     bool interrupted;
     bool aborted;
-    bool reachedRTS;    
+    bool reachedRTS;
+    bool closeRequested;
     bool authenticated;
+    bool pipelined;
     int crlfState;
+    QsrMailDotStuffer dotStuffer;
+    int skipResponses;
+    QByteArray readBuffer;
+    int readPos;
 
     /* SMTP extensions */
     bool hasStartTls;
     bool hasAuth;
+    bool hasPipelining;
+    bool hasChunking;
+    bool hasBinaryMime;
+    bool hasEightBitMime;
+    bool hasSmtpUtf8;
+    bool hasSize;
+    qint64 maxMessageSize;
     QsrMailTransport::AuthMech selectedAuthMech;
 
     /* transaction related data */
@@ -141,10 +251,67 @@ public:
     QQueue<QsrMailTransactionPrivate *> queue;
     int totalMessages;
     int processedMessages;
+
+    /* batched notification related data */
+    QVector<QsrMailTransaction *> finishedBatch;
+    QsrMailTransactionPrivate *progressTransaction;
+    qint64 progressProcessed;
+    qint64 progressTotal;
     QByteArray from;
-    QSet<QByteArray> rcpts;
-    QSet<QByteArray>::ConstIterator rcpt;
+    QsrMailRecipientSet rcpts;
+    int rcptNext;
+    int rcptIndex;
+    int acceptedRcpts;
+    bool chunked;
+    bool binaryMime;
+    bool eightBitBody;
+    bool utf8Envelope;
+    qint64 messageSize;
+    int bdatPending;
+    bool bdatLast;
     QsrMailRenderer *waitingRenderer;
+    QsrMailBufferPool bufferPool;
+
+    /* adaptive write window, sized from the bandwidth-delay product */
+    qint64 rttStart;
+    qint64 rtt;
+    qint64 windowBytes;
+    int writeWindow;
+    bool corked;
+
+    /* sendfile() transfer of file backed rendered messages */
+    QScopedPointer<QFile> sendFile;
+    QsrMailTransactionPrivate *sendFileTransaction;
+    qint64 sendFilePos;
+    int sendFileStuffing;
+    bool sendFileWaiting;
+    QString sendFileError;
+
+    /* timing related data, see QsrMailTransactionTiming */
+    QsrMailTransactionTiming sessionTiming;
+    int sessionMessages;
+    qint64 phaseStart;
+    qint64 tlsStart;
+    qint64 authStart;
+    qint64 transactionStart;
+    qint64 dataStart;
+
+    /* monitoring counters, read by other threads */
+    QsrMailStatisticsCounters statistics;
+
+    /* protocol trace, null unless enabled */
+    QScopedPointer<QsrMailTraceRing> trace;
+    bool traceData;
+
+    /* spool related data */
+    QPointer<QsrMailSpool> spool;
+    int spoolWindow;
+    int spoolRemaining;
+    bool spoolStopped;
+
+    /* retry related data */
+    QList<QsrMailTransactionPrivate *> deferred;
+    QsrMailTransactionPrivate *current;
 
     /* member data */
     QString username;
@@ -152,11 +319,31 @@ public:
     QsrMailTransport::AuthMech authMech;
     QByteArray systemIdentifier;
     int timeout;
+    int connectTimeout;
+    int dataTimeout;
     QString serverHostname;
+    QStringList fallbackHostnames;
     QAbstractSocket::NetworkLayerProtocol serverProtocol;
     QHostAddress serverAddress;
+    QList<QHostAddress> serverAddresses;
     quint16 serverPort;
     QsrMailTransport::TlsLevel tlsLevel;
+    bool keepAlive;
+    int idleTimeout;
+    int heartbeatInterval;
+    int maxAttempts;
+    int retryInterval;
+    int maxRetryInterval;
+    int breakerThreshold;
+    int breakerTimeout;
+    bool threadedRendering;
+    int prefetchDepth;
+    int lowWatermark;
+    int highWatermark;
+    int notifyInterval;
+    double messageRate;
+    double recipientRate;
+    int maxServerConnections;
 };
 
 QT_END_NAMESPACE
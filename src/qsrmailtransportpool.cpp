@@ -0,0 +1,782 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+/*!
+ * \class QsrMailTransportPool qsrmailtransportpool.h <QsrMailTransportPool>
+ * \brief This class dispatches messages over multiple concurrent SMTP
+ * sessions to the same server.
+ *
+ * A single QsrMailTransport delivers its queue one message after another
+ * over exactly one connection. For large amounts of messages the throughput
+ * is thus limited by the round trip times of a single SMTP session. The
+ * pool keeps up to maxConnections() QsrMailTransport instances, each with
+ * its own connection and FSM, and spreads the queued messages across them.
+ *
+ * The interface is modelled after QsrMailTransport. The settings of the pool
+ * are applied to all transports it manages. The progressUpdate() signal is
+ * normalized over all messages of all transports and finished() is emitted
+ * once every transport has finished its delivery.
+ *
+ * Example:
+ * \code
+ * QsrMailTransportPool *pool = new QsrMailTransportPool();
+ * pool->setMaxConnections(4);
+ *
+ * connect(pool, &QsrMailTransportPool::finished,
+ *         pool, &QsrMailTransportPool::deleteLater);
+ *
+ * foreach (const QsrMailMessage &msg, messages)
+ *     pool->queueMessage(msg);
+ *
+ * pool->sendMessages("mail.server.foo");
+ * \endcode
+ *
+ * \sa QsrMailTransport
+ */
+
+/*!
+ * \fn QsrMailTransportPool::progressUpdate(int percent)
+ *
+ * Track this signal to receive progress updates of the mail delivery. The
+ * percentage is normalized to 100% over all messages in all transports.
+ */
+
+/*!
+ * \fn QsrMailTransportPool::transactionFinished(QsrMailTransaction *transaction)
+ *
+ * This signal is emitted when a particular message delivery has been completed
+ * by any of the transports. It is the developers responsibilty to dispose the
+ * transaction using deleteLater().
+ */
+
+/*!
+ * \fn QsrMailTransportPool::transactionsFinished(const QVector<QsrMailTransaction *> &transactions)
+ *
+ * This signal relays the batches of finished *transactions* of the
+ * transports if a notification interval is set.
+ *
+ * \sa setNotificationInterval()
+ */
+
+/*!
+ * \fn QsrMailTransportPool::finished()
+ *
+ * Is emitted when all transports have processed their messages and closed
+ * the connection to the server.
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailTransportPoolPrivate qsrmailtransportpool_p.h
+ * \brief The implementation and private data class of the
+ * QsrMailTransportPool class.
+ */
+
+/*!
+ * \internal
+ *
+ * \class QsrMailTransportPoolPrivate::Connection qsrmailtransportpool_p.h
+ * \brief Bookkeeping of a single transport within the pool.
+ */
+
+#include "qsrmailtransportpool.h"
+#include "qsrmailtransportpool_p.h"
+
+#include "qsrmailtransaction.h"
+#include "qsrmailtransport_p.h"
+
+#include <QHostAddress>
+
+QT_BEGIN_NAMESPACE
+
+/*!
+ * \internal
+ *
+ * Construct a data class for QsrMailTransportPoolPrivate from *qq*.
+ */
+QsrMailTransportPoolPrivate::QsrMailTransportPoolPrivate(
+        QsrMailTransportPool *qq) :
+    q_ptr(qq),
+    totalMessages(0),
+    runningTransports(0),
+    sslConfigurationSet(false),
+    statistics(new QsrMailStatisticsCounters),
+    maxConnections(4),
+    authMech(QsrMailTransport::AutoSelectMech),
+    systemIdentifier("localhost"),
+    timeout(6000),
+    connectTimeout(0),
+    dataTimeout(0),
+    notifyInterval(0),
+    messageRate(0),
+    recipientRate(0),
+    maxServerConnections(0),
+    lowWatermark(0),
+    highWatermark(0),
+    tlsLevel(QsrMailTransport::TlsOptional)
+{
+}
+
+/*!
+ * \internal
+ *
+ * Updates the progress of the transport which sent the signal and emits
+ * the overall progress normalized over all messages of the pool.
+ */
+void QsrMailTransportPoolPrivate::_q_progressUpdate(int percent)
+{
+    Q_Q(QsrMailTransportPool);
+
+    Connection *c = connection(q->sender());
+    if (c == 0 || totalMessages == 0)
+        return;
+
+    c->percent = percent;
+
+    /* weight the progress of every transport with its share of messages */
+    qint64 weighted = 0;
+    for (int i=0, size=connections.size(); i<size; ++i)
+        weighted += connections.at(i).percent * connections.at(i).total;
+
+    int overall = static_cast<int>(weighted / totalMessages);
+    emit q->progressUpdate(overall > 100 ? 100 : overall);
+}
+
+/*!
+ * \internal
+ *
+ * Relays the transactionFinished() signal of the managed transports.
+ */
+void QsrMailTransportPoolPrivate::_q_transactionFinished(
+        QsrMailTransaction *transaction)
+{
+    Q_Q(QsrMailTransportPool);
+    emit q->transactionFinished(transaction);
+}
+
+/*!
+ * \internal
+ *
+ * Relays the transactionsFinished() signal of the managed transports.
+ */
+void QsrMailTransportPoolPrivate::_q_transactionsFinished(
+        const QVector<QsrMailTransaction *> &transactions)
+{
+    Q_Q(QsrMailTransportPool);
+    emit q->transactionsFinished(transactions);
+}
+
+/*!
+ * \internal
+ *
+ * One of the transports has finished. If it was the last running transport
+ * the finished() signal of the pool is emitted.
+ */
+void QsrMailTransportPoolPrivate::_q_finished()
+{
+    Q_Q(QsrMailTransportPool);
+
+    Connection *c = connection(q->sender());
+    if (c == 0 || !c->running)
+        return;
+
+    c->running = false;
+    if (--runningTransports == 0)
+        emit q->finished();
+}
+
+/*!
+ * \internal
+ *
+ * Returns the connection record for *transport* or null if the transport
+ * is not managed by the pool.
+ */
+QsrMailTransportPoolPrivate::Connection *
+QsrMailTransportPoolPrivate::connection(QObject *transport)
+{
+    for (int i=0, size=connections.size(); i<size; ++i) {
+        if (connections.at(i).transport == transport)
+            return &connections[i];
+    }
+
+    return 0;
+}
+
+/*!
+ * \internal
+ *
+ * Select the connection which receives the next message. Idle connections
+ * are preferred; if there is none a new transport is created as long as the
+ * maxConnections limit is not reached. Otherwise the connection with the
+ * least queued messages is returned.
+ */
+QsrMailTransportPoolPrivate::Connection *
+QsrMailTransportPoolPrivate::selectConnection()
+{
+    Q_Q(QsrMailTransportPool);
+
+    Connection *result = 0;
+    for (int i=0, size=connections.size(); i<size; ++i) {
+        Connection *c = &connections[i];
+        if (result == 0 || c->queued < result->queued)
+            result = c;
+    }
+
+    if (result == 0 || (result->queued > 0
+                        && connections.size() < maxConnections)) {
+        Connection c;
+        c.transport = new QsrMailTransport(q);
+        setupTransport(c.transport);
+
+        connections.append(c);
+        result = &connections.last();
+    }
+
+    return result;
+}
+
+/*!
+ * \internal
+ *
+ * Apply the pool settings to *transport* and connect its signals.
+ */
+void QsrMailTransportPoolPrivate::setupTransport(QsrMailTransport *transport)
+{
+    Q_Q(QsrMailTransportPool);
+
+    transport->setUser(username);
+    transport->setPassword(password);
+    transport->setAuthMech(authMech);
+    transport->setSystemIdentifier(systemIdentifier);
+    transport->setTimeout(timeout);
+    transport->setConnectTimeout(connectTimeout);
+    transport->setDataTimeout(dataTimeout);
+    transport->setNotificationInterval(notifyInterval);
+    transport->setMessageRate(messageRate);
+    transport->setRecipientRate(recipientRate);
+    transport->setMaxServerConnections(maxServerConnections);
+    transport->setBufferWatermarks(lowWatermark, highWatermark);
+    transport->setTlsLevel(tlsLevel);
+
+    if (sslConfigurationSet)
+        transport->setSslConfiguration(sslConfiguration);
+
+    /* the transport adds its counters to the ones of the pool */
+    transport->d_func()->statistics.parent = statistics;
+
+    QObject::connect(transport, SIGNAL(progressUpdate(int)),
+                     q, SLOT(_q_progressUpdate(int)));
+    QObject::connect(transport, SIGNAL(transactionFinished(QsrMailTransaction*)),
+                     q, SLOT(_q_transactionFinished(QsrMailTransaction*)));
+    QObject::connect(transport,
+                     SIGNAL(transactionsFinished(QVector<QsrMailTransaction*>)),
+                     q,
+                     SLOT(_q_transactionsFinished(QVector<QsrMailTransaction*>)));
+    QObject::connect(transport, SIGNAL(finished()),
+                     q, SLOT(_q_finished()));
+}
+
+/*!
+ * \internal
+ *
+ * Prepare the bookkeeping for a delivery run. Every connection with queued
+ * messages is marked as running. Returns false if there is nothing to
+ * deliver.
+ */
+bool QsrMailTransportPoolPrivate::startDelivery()
+{
+    totalMessages = 0;
+    runningTransports = 0;
+
+    for (int i=0, size=connections.size(); i<size; ++i) {
+        Connection &c = connections[i];
+
+        c.total = c.queued;
+        c.queued = 0;
+        c.percent = 0;
+        c.running = c.total > 0;
+
+        totalMessages += c.total;
+        if (c.running)
+            runningTransports++;
+    }
+
+    return runningTransports > 0;
+}
+
+/* -------------------------------------------------------------------------- */
+
+/*!
+ * Construct a new transport pool. Optionally assign a *parent* to the object.
+ */
+QsrMailTransportPool::QsrMailTransportPool(QObject *parent) :
+    QObject(parent),
+    d_ptr(new QsrMailTransportPoolPrivate(this))
+{
+}
+
+/*!
+ * Destroys the instance and all transports of the pool.
+ */
+QsrMailTransportPool::~QsrMailTransportPool()
+{
+}
+
+/*!
+ * Set the maximum number of concurrent *connections* the pool opens to the
+ * server. Since all connections of the pool go to the same server this is
+ * the per host connection limit. The default is 4 connections. Values below
+ * 1 are treated as 1.
+ *
+ * Lowering the value does not close transports which already have been
+ * created; it only affects the creation of new transports.
+ */
+void QsrMailTransportPool::setMaxConnections(int connections)
+{
+    Q_D(QsrMailTransportPool);
+    d->maxConnections = qMax(1, connections);
+}
+
+/*!
+ * Returns the maximum number of concurrent connections.
+ */
+int QsrMailTransportPool::maxConnections() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->maxConnections;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setUser()
+ */
+void QsrMailTransportPool::setUser(const QString &username)
+{
+    Q_D(QsrMailTransportPool);
+    d->username = username;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setUser(username);
+}
+
+/*!
+ * \copydoc QsrMailTransport::user()
+ */
+QString QsrMailTransportPool::user() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->username;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setPassword()
+ */
+void QsrMailTransportPool::setPassword(const QString &passwd)
+{
+    Q_D(QsrMailTransportPool);
+    d->password = passwd;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setPassword(passwd);
+}
+
+/*!
+ * \copydoc QsrMailTransport::password()
+ */
+QString QsrMailTransportPool::password() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->password;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setAuthMech()
+ */
+void QsrMailTransportPool::setAuthMech(QsrMailTransport::AuthMech mechanism)
+{
+    Q_D(QsrMailTransportPool);
+    d->authMech = mechanism;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setAuthMech(mechanism);
+}
+
+/*!
+ * \copydoc QsrMailTransport::authMech()
+ */
+QsrMailTransport::AuthMech QsrMailTransportPool::authMech() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->authMech;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setSystemIdentifier()
+ */
+void QsrMailTransportPool::setSystemIdentifier(const QByteArray &value)
+{
+    Q_D(QsrMailTransportPool);
+    d->systemIdentifier = value;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setSystemIdentifier(value);
+}
+
+/*!
+ * \copydoc QsrMailTransport::systemIdentifier()
+ */
+QByteArray QsrMailTransportPool::systemIdentifier() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->systemIdentifier;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setTimeout()
+ */
+void QsrMailTransportPool::setTimeout(int timeout)
+{
+    Q_D(QsrMailTransportPool);
+    d->timeout = timeout;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setTimeout(timeout);
+}
+
+/*!
+ * \copydoc QsrMailTransport::timeout()
+ */
+int QsrMailTransportPool::timeout() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->timeout;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setConnectTimeout()
+ */
+void QsrMailTransportPool::setConnectTimeout(int timeout)
+{
+    Q_D(QsrMailTransportPool);
+    d->connectTimeout = timeout;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setConnectTimeout(timeout);
+}
+
+/*!
+ * \copydoc QsrMailTransport::connectTimeout()
+ */
+int QsrMailTransportPool::connectTimeout() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->connectTimeout;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setDataTimeout()
+ */
+void QsrMailTransportPool::setDataTimeout(int timeout)
+{
+    Q_D(QsrMailTransportPool);
+    d->dataTimeout = timeout;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setDataTimeout(timeout);
+}
+
+/*!
+ * \copydoc QsrMailTransport::dataTimeout()
+ */
+int QsrMailTransportPool::dataTimeout() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->dataTimeout;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setNotificationInterval()
+ */
+void QsrMailTransportPool::setNotificationInterval(int msecs)
+{
+    Q_D(QsrMailTransportPool);
+    d->notifyInterval = qMax(msecs, 0);
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setNotificationInterval(msecs);
+}
+
+/*!
+ * \copydoc QsrMailTransport::notificationInterval()
+ */
+int QsrMailTransportPool::notificationInterval() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->notifyInterval;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setMessageRate()
+ */
+void QsrMailTransportPool::setMessageRate(double messages)
+{
+    Q_D(QsrMailTransportPool);
+    d->messageRate = qMax(messages, 0.0);
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setMessageRate(messages);
+}
+
+/*!
+ * \copydoc QsrMailTransport::messageRate()
+ */
+double QsrMailTransportPool::messageRate() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->messageRate;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setRecipientRate()
+ */
+void QsrMailTransportPool::setRecipientRate(double recipients)
+{
+    Q_D(QsrMailTransportPool);
+    d->recipientRate = qMax(recipients, 0.0);
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setRecipientRate(recipients);
+}
+
+/*!
+ * \copydoc QsrMailTransport::recipientRate()
+ */
+double QsrMailTransportPool::recipientRate() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->recipientRate;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setMaxServerConnections()
+ */
+void QsrMailTransportPool::setMaxServerConnections(int connections)
+{
+    Q_D(QsrMailTransportPool);
+    d->maxServerConnections = qMax(connections, 0);
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setMaxServerConnections(connections);
+}
+
+/*!
+ * \copydoc QsrMailTransport::maxServerConnections()
+ */
+int QsrMailTransportPool::maxServerConnections() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->maxServerConnections;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setBufferWatermarks()
+ */
+void QsrMailTransportPool::setBufferWatermarks(int low, int high)
+{
+    Q_D(QsrMailTransportPool);
+    d->lowWatermark = qMax(0, low);
+    d->highWatermark = qMax(0, high);
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setBufferWatermarks(low, high);
+}
+
+/*!
+ * \copydoc QsrMailTransport::lowBufferWatermark()
+ */
+int QsrMailTransportPool::lowBufferWatermark() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->lowWatermark;
+}
+
+/*!
+ * \copydoc QsrMailTransport::highBufferWatermark()
+ */
+int QsrMailTransportPool::highBufferWatermark() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->highWatermark;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setTlsLevel()
+ */
+void QsrMailTransportPool::setTlsLevel(QsrMailTransport::TlsLevel level)
+{
+    Q_D(QsrMailTransportPool);
+    d->tlsLevel = level;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setTlsLevel(level);
+}
+
+/*!
+ * \copydoc QsrMailTransport::tlsLevel()
+ */
+QsrMailTransport::TlsLevel QsrMailTransportPool::tlsLevel() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->tlsLevel;
+}
+
+/*!
+ * \copydoc QsrMailTransport::setSslConfiguration()
+ */
+void QsrMailTransportPool::setSslConfiguration(const QSslConfiguration &value)
+{
+    Q_D(QsrMailTransportPool);
+    d->sslConfiguration = value;
+    d->sslConfigurationSet = true;
+
+    foreach (QsrMailTransport *transport, transports())
+        transport->setSslConfiguration(value);
+}
+
+/*!
+ * \copydoc QsrMailTransport::sslConfiguration()
+ */
+QSslConfiguration QsrMailTransportPool::sslConfiguration() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->sslConfiguration;
+}
+
+/*!
+ * Returns the transports currently managed by the pool. Transports are
+ * created on demand while queueing messages, so the list is empty until
+ * the first message has been queued.
+ */
+QList<QsrMailTransport *> QsrMailTransportPool::transports() const
+{
+    Q_D(const QsrMailTransportPool);
+    QList<QsrMailTransport *> result;
+
+    for (int i=0, size=d->connections.size(); i<size; ++i)
+        result.append(d->connections.at(i).transport);
+
+    return result;
+}
+
+/*!
+ * Returns a snapshot of the delivery counters summed up over all transports
+ * of the pool. Like QsrMailTransport::statistics() this may be called from
+ * any thread.
+ */
+QsrMailStatistics QsrMailTransportPool::statistics() const
+{
+    Q_D(const QsrMailTransportPool);
+    return d->statistics->snapshot();
+}
+
+/*!
+ * Add *message* to the queue of one of the pooled transports. The message is
+ * assigned to an idle transport or the transport with the shortest queue.
+ * New transports are created until maxConnections() is reached.
+ *
+ * As with QsrMailTransport::queueMessage() adding messages during mail
+ * delivery is not supported. The returned QsrMailTransaction is owned by
+ * the transport and must be disposed by the developer.
+ */
+QsrMailTransaction *QsrMailTransportPool::queueMessage(
+        const QsrMailMessage &message)
+{
+    Q_D(QsrMailTransportPool);
+
+    QsrMailTransportPoolPrivate::Connection *c = d->selectConnection();
+    c->queued++;
+
+    return c->transport->queueMessage(message);
+}
+
+/*!
+ * Start the mail delivery over all transports which have messages queued.
+ * Every transport opens its own connection to *serverHostname* using
+ * *serverPort* and *protocol*.
+ *
+ * \sa QsrMailTransport::sendMessages()
+ */
+void QsrMailTransportPool::sendMessages(const QString &serverHostname,
+                                        quint16 serverPort,
+                                        QAbstractSocket::NetworkLayerProtocol protocol)
+{
+    Q_D(QsrMailTransportPool);
+
+    if (!d->startDelivery()) {
+        emit finished();
+        return;
+    }
+
+    for (int i=0, size=d->connections.size(); i<size; ++i) {
+        if (d->connections.at(i).running) {
+            d->connections.at(i).transport->sendMessages(serverHostname,
+                                                         serverPort,
+                                                         protocol);
+        }
+    }
+}
+
+/*!
+ * This is an overloaded version providing an interface using QHostAddress
+ * as *serverAddress* instead of a hostname.
+ */
+void QsrMailTransportPool::sendMessages(const QHostAddress &serverAddress,
+                                        quint16 serverPort)
+{
+    Q_D(QsrMailTransportPool);
+
+    if (!d->startDelivery()) {
+        emit finished();
+        return;
+    }
+
+    for (int i=0, size=d->connections.size(); i<size; ++i) {
+        if (d->connections.at(i).running) {
+            d->connections.at(i).transport->sendMessages(serverAddress,
+                                                         serverPort);
+        }
+    }
+}
+
+/*!
+ * Abort the delivery on all transports of the pool.
+ *
+ * \sa QsrMailTransport::abort()
+ */
+void QsrMailTransportPool::abort()
+{
+    foreach (QsrMailTransport *transport, transports())
+        transport->abort();
+}
+
+QT_END_NAMESPACE
+
+#include "moc_qsrmailtransportpool.cpp"
@@ -0,0 +1,121 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILTRANSPORTPOOL_H
+#define QSRMAILTRANSPORTPOOL_H
+
+#include "qsrmailglobal.h"
+#include "qsrmailtransport.h"
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailTransportPoolPrivate;
+class QSRMAILSHARED_EXPORT QsrMailTransportPool : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit QsrMailTransportPool(QObject *parent = 0);
+    ~QsrMailTransportPool();
+
+    void setMaxConnections(int connections);
+    int maxConnections() const;
+
+    void setUser(const QString &username);
+    QString user() const;
+
+    void setPassword(const QString &passwd);
+    QString password() const;
+
+    void setAuthMech(QsrMailTransport::AuthMech mechanism);
+    QsrMailTransport::AuthMech authMech() const;
+
+    void setSystemIdentifier(const QByteArray &value);
+    QByteArray systemIdentifier() const;
+
+    void setTimeout(int timeout);
+    int timeout() const;
+
+    void setConnectTimeout(int timeout);
+    int connectTimeout() const;
+
+    void setDataTimeout(int timeout);
+    int dataTimeout() const;
+
+    void setNotificationInterval(int msecs);
+    int notificationInterval() const;
+
+    void setMessageRate(double messages);
+    double messageRate() const;
+
+    void setRecipientRate(double recipients);
+    double recipientRate() const;
+
+    void setMaxServerConnections(int connections);
+    int maxServerConnections() const;
+
+    void setBufferWatermarks(int low, int high);
+    int lowBufferWatermark() const;
+    int highBufferWatermark() const;
+
+    void setTlsLevel(QsrMailTransport::TlsLevel level);
+    QsrMailTransport::TlsLevel tlsLevel() const;
+
+    void setSslConfiguration(const QSslConfiguration &value);
+    QSslConfiguration sslConfiguration() const;
+
+    QList<QsrMailTransport *> transports() const;
+    QsrMailStatistics statistics() const;
+
+    QsrMailTransaction *queueMessage(const QsrMailMessage &message);
+
+    void sendMessages(const QString &serverHostname,
+                      quint16 serverPort = 25,
+                      QAbstractSocket::NetworkLayerProtocol
+                      protocol = QAbstractSocket::AnyIPProtocol);
+
+    void sendMessages(const QHostAddress &serverAddress,
+                      quint16 serverPort = 25);
+
+public Q_SLOTS:
+    void abort();
+
+Q_SIGNALS:
+    void progressUpdate(int percent);
+    void transactionFinished(QsrMailTransaction *transaction);
+    void transactionsFinished(const QVector<QsrMailTransaction *> &transactions);
+    void finished();
+
+private:
+    Q_DECLARE_PRIVATE(QsrMailTransportPool)
+
+    QScopedPointer<QsrMailTransportPoolPrivate> d_ptr;
+
+    Q_PRIVATE_SLOT(d_func(), void _q_progressUpdate(int))
+    Q_PRIVATE_SLOT(d_func(), void _q_transactionFinished(QsrMailTransaction *))
+    Q_PRIVATE_SLOT(d_func(), void _q_transactionsFinished(
+                       const QVector<QsrMailTransaction *> &))
+    Q_PRIVATE_SLOT(d_func(), void _q_finished())
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILTRANSPORTPOOL_H
@@ -0,0 +1,101 @@
+/*****************************************************************************
+** QsrMail - a SMTP client library for Qt
+**
+** Copyright 2014 Frank Enderle <frank.enderle@anamica.de>
+**
+** This file is part of QsrMail.
+**
+** QsrMail is free software: you can redistribute it and/or modify
+** it under the terms of the GNU Lesser General Public License as
+** published by the Free Software Foundation, either version 3 of
+** the License, or (at your option) any later version.
+**
+** QsrMail is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU Lesser General Public License for more details.
+**
+** You should have received a copy of the GNU Lesser General Public
+** License along with QsrMail. If not, see <http://www.gnu.org/licenses/>.
+*****************************************************************************/
+
+#ifndef QSRMAILTRANSPORTPOOL_P_H
+#define QSRMAILTRANSPORTPOOL_P_H
+
+#include "qsrmailtransportpool.h"
+#include "qsrmailstatistics_p.h"
+
+#include <QList>
+#include <QSharedPointer>
+#include <QSslConfiguration>
+
+QT_BEGIN_NAMESPACE
+
+class QsrMailTransportPool;
+class QsrMailTransportPoolPrivate
+{
+public:
+    explicit QsrMailTransportPoolPrivate(QsrMailTransportPool *qq);
+
+    void _q_progressUpdate(int percent);
+    void _q_transactionFinished(QsrMailTransaction *transaction);
+    void _q_transactionsFinished(
+            const QVector<QsrMailTransaction *> &transactions);
+    void _q_finished();
+
+private:
+    struct Connection
+    {
+        Connection() :
+            transport(0),
+            queued(0),
+            total(0),
+            percent(0),
+            running(false)
+        {}
+
+        QsrMailTransport *transport;
+        int queued;
+        int total;
+        int percent;
+        bool running;
+    };
+
+    Connection *connection(QObject *transport);
+    Connection *selectConnection();
+    void setupTransport(QsrMailTransport *transport);
+    bool startDelivery();
+
+public:
+    Q_DECLARE_PUBLIC(QsrMailTransportPool)
+
+    /* instance data */
+    QsrMailTransportPool *q_ptr;
+    QList<Connection> connections;
+    int totalMessages;
+    int runningTransports;
+    bool sslConfigurationSet;
+    QSharedPointer<QsrMailStatisticsCounters> statistics;
+
+    /* member data */
+    int maxConnections;
+    QString username;
+    QString password;
+    QsrMailTransport::AuthMech authMech;
+    QByteArray systemIdentifier;
+    int timeout;
+    int connectTimeout;
+    int dataTimeout;
+    int notifyInterval;
+    double messageRate;
+    double recipientRate;
+    int maxServerConnections;
+    int lowWatermark;
+    int highWatermark;
+    QsrMailTransport::TlsLevel tlsLevel;
+    QSslConfiguration sslConfiguration;
+};
+
+QT_END_NAMESPACE
+
+#endif // QSRMAILTRANSPORTPOOL_P_H